@@ -0,0 +1,405 @@
+#include "config.h" /* should be included first */
+
+#include <check.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkplus.h"
+#include "pmemarena.h"
+
+#ifndef DIR_DAX
+#define DIR_DAX "/mnt/pmem0/tmp"
+#endif
+#ifndef DIR_NONDAX
+#define DIR_NONDAX "/tmp"
+#endif
+#define FILE_A "foo"
+
+#define NTHREAD 4
+#define NOBJ_PER_THREAD 4096
+
+/* global variables */
+static PMEMarena *p_ = NULL;
+
+/* util functions */
+static PMEMarena *pmemarena_create_default(const char *path)
+{
+	return pmemarena_create(path, PMEMARENA_MIN_POOL, 0600);
+}
+
+static int compare_ptr(const void *a, const void *b)
+{
+	const uintptr_t x = *(const uintptr_t *)a, y = *(const uintptr_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* fixtures */
+static void setup_once_daxfs(void)
+{
+	success(chdir(DIR_DAX));
+}
+
+static void setup_once_nondaxfs(void)
+{
+	success(chdir(DIR_NONDAX));
+}
+
+static void setup(void)
+{
+	unlink(FILE_A); /* DO NOT assert */
+	errno = 0;
+	failure(access(FILE_A, F_OK));
+	error(ENOENT);
+}
+
+static void teardown(void)
+{
+	if (p_) {
+		pmemarena_close(p_);
+		p_ = NULL;
+	}
+}
+
+/* test cases */
+START_TEST(create_OK)
+{
+	p_ = pmemarena_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+
+	struct stat st;
+	success(stat(FILE_A, &st));
+	ck_assert_uint_eq(PMEMARENA_MIN_POOL, st.st_size);
+
+	struct pmemarena_stats s;
+	pmemarena_stats(p_, &s);
+	ck_assert_uint_lt(0, s.nslab);
+	ck_assert_uint_eq(0, s.nslab_used);
+	ck_assert_uint_eq(0, s.nobj);
+
+	/* sizes are rounded up to a size class */
+	char *const a = pmemarena_alloc(p_, 1);
+	ck_assert_ptr_nonnull(a);
+	ck_assert_uint_eq(16, pmemarena_usable_size(p_, a));
+	char *const b = pmemarena_alloc(p_, 100);
+	ck_assert_ptr_nonnull(b);
+	ck_assert_uint_eq(128, pmemarena_usable_size(p_, b));
+	char *const c = pmemarena_alloc(p_, PMEMARENA_MAX_ALLOC);
+	ck_assert_ptr_nonnull(c);
+	ck_assert_uint_eq(PMEMARENA_MAX_ALLOC, pmemarena_usable_size(p_, c));
+
+	/* objects do not overlap */
+	memset(a, 0xAA, 16);
+	memset(b, 0xBB, 128);
+	memset(c, 0xCC, PMEMARENA_MAX_ALLOC);
+	ck_assert_int_eq((char)0xAA, a[15]);
+	ck_assert_int_eq((char)0xBB, b[127]);
+
+	pmemarena_stats(p_, &s);
+	ck_assert_uint_eq(3, s.nslab_used);
+	ck_assert_uint_eq(3, s.nobj);
+	ck_assert_uint_eq(16 + 128 + PMEMARENA_MAX_ALLOC, s.allocated);
+	ck_assert_uint_eq(3 * PMEMARENA_SLAB_SIZE, s.footprint);
+
+	/* a freed object is reused */
+	pmemarena_free(p_, b);
+	pmemarena_stats(p_, &s);
+	ck_assert_uint_eq(2, s.nobj);
+	ck_assert_ptr_eq(b, pmemarena_alloc(p_, 128));
+
+	/* double free and foreign pointers are ignored */
+	pmemarena_free(p_, a);
+	pmemarena_free(p_, a);
+	pmemarena_free(p_, &s);
+	pmemarena_free(p_, NULL);
+	pmemarena_stats(p_, &s);
+	ck_assert_uint_eq(2, s.nobj);
+}
+END_TEST
+
+START_TEST(create_EINVAL_poolsize)
+{
+	errno = 0;
+	ck_assert_ptr_null(pmemarena_create(FILE_A,
+		PMEMARENA_MIN_POOL - 1, 0600));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(create_EEXIST)
+{
+	p_ = pmemarena_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+	pmemarena_close(p_);
+	p_ = NULL;
+
+	errno = 0;
+	ck_assert_ptr_null(pmemarena_create_default(FILE_A));
+	error(EEXIST);
+}
+END_TEST
+
+START_TEST(header_PMEMARN)
+{
+	p_ = pmemarena_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+	pmemarena_close(p_);
+	p_ = NULL;
+
+	FILE *const fp = fopen(FILE_A, "r+b");
+	ck_assert_ptr_nonnull(fp);
+
+	char header[8];
+	ck_assert_uint_eq(8, fread(header, sizeof(char), 8, fp));
+	ck_assert_mem_eq("PMEMARN", header, 8);
+
+	success(fclose(fp));
+}
+END_TEST
+
+START_TEST(alloc_EINVAL)
+{
+	p_ = pmemarena_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+
+	errno = 0;
+	ck_assert_ptr_null(pmemarena_alloc(p_, 0));
+	error(EINVAL);
+	errno = 0;
+	ck_assert_ptr_null(pmemarena_alloc(p_, PMEMARENA_MAX_ALLOC + 1));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(alloc_ENOMEM)
+{
+	p_ = pmemarena_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+
+	struct pmemarena_stats s;
+	pmemarena_stats(p_, &s);
+	const size_t nslab = s.nslab;
+
+	/* fill the pool with the largest class */
+	size_t n = 0;
+	void *last = NULL;
+	for (void *p; (p = pmemarena_alloc(p_, PMEMARENA_MAX_ALLOC)); ++n)
+		last = p;
+	error(ENOMEM);
+	pmemarena_stats(p_, &s);
+	ck_assert_uint_eq(nslab, s.nslab_used);
+	ck_assert_uint_eq(n, s.nobj);
+
+	/* another class cannot get a slab */
+	errno = 0;
+	ck_assert_ptr_null(pmemarena_alloc(p_, 16));
+	error(ENOMEM);
+
+	/* a freed object is available again */
+	pmemarena_free(p_, last);
+	ck_assert_ptr_eq(last, pmemarena_alloc(p_, PMEMARENA_MAX_ALLOC));
+}
+END_TEST
+
+START_TEST(no_tcache_OK)
+{
+	p_ = pmemarena_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+	pmemarena_set_tcache(p_, 0);
+
+	/* more than a slab of objects, of two classes in turn */
+	static void *objs[2 * NOBJ_PER_THREAD];
+	const size_t n = sizeof(objs) / sizeof(objs[0]);
+	for (size_t i = 0; i < n; ++i) {
+		objs[i] = pmemarena_alloc(p_, i % 2 ? 100 : 64);
+		ck_assert_ptr_nonnull(objs[i]);
+		memset(objs[i], (int)i, i % 2 ? 100 : 64);
+	}
+	struct pmemarena_stats s;
+	pmemarena_stats(p_, &s);
+	ck_assert_uint_eq(n, s.nobj);
+	ck_assert_uint_lt(2, s.nslab_used);
+
+	void *sorted[2 * NOBJ_PER_THREAD];
+	memcpy(sorted, objs, sizeof(objs));
+	qsort(sorted, n, sizeof(sorted[0]), compare_ptr);
+	for (size_t i = 1; i < n; ++i)
+		ck_assert_ptr_ne(sorted[i - 1], sorted[i]);
+
+	for (size_t i = 0; i < n; ++i)
+		pmemarena_free(p_, objs[i]);
+	pmemarena_stats(p_, &s);
+	ck_assert_uint_eq(0, s.nobj);
+
+	pmemarena_set_tcache(p_, 1);
+	ck_assert_ptr_nonnull(pmemarena_alloc(p_, 64));
+}
+END_TEST
+
+START_TEST(open_OK)
+{
+	p_ = pmemarena_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+
+	/* link objects from the root; every other one is freed */
+	uint64_t *const root = pmemarena_root(p_);
+	for (int i = 0; i < 64; ++i) {
+		char *const obj = pmemarena_alloc(p_, 256);
+		ck_assert_ptr_nonnull(obj);
+		memset(obj, i, 256);
+		pmemarena_persist(p_, obj, 256);
+		root[i] = pmemarena_off(p_, obj);
+	}
+	for (int i = 0; i < 64; i += 2) {
+		pmemarena_free(p_, pmemarena_ptr(p_, root[i]));
+		root[i] = 0;
+	}
+	pmemarena_persist(p_, root, 64 * sizeof(uint64_t));
+
+	pmemarena_close(p_);
+	p_ = pmemarena_open(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+
+	/* live objects survive */
+	struct pmemarena_stats s;
+	pmemarena_stats(p_, &s);
+	ck_assert_uint_eq(32, s.nobj);
+	const uint64_t *const root2 = pmemarena_root(p_);
+	char expected[256];
+	for (int i = 1; i < 64; i += 2) {
+		memset(expected, i, sizeof(expected));
+		ck_assert_mem_eq(expected,
+			pmemarena_ptr(p_, root2[i]), sizeof(expected));
+	}
+
+	/* freed slots are reused, live ones are not */
+	for (int i = 0; i < 32; ++i) {
+		char *const obj = pmemarena_alloc(p_, 256);
+		ck_assert_ptr_nonnull(obj);
+		const uint64_t off = pmemarena_off(p_, obj);
+		for (int j = 1; j < 64; j += 2)
+			ck_assert_uint_ne(root2[j], off);
+	}
+	pmemarena_stats(p_, &s);
+	ck_assert_uint_eq(64, s.nobj);
+	ck_assert_uint_eq(1, s.nslab_used);
+}
+END_TEST
+
+START_TEST(open_EINVAL)
+{
+	const int fd = open(FILE_A, O_WRONLY|O_CREAT|O_EXCL, 0600);
+	opened(fd);
+	success(ftruncate(fd, (off_t)PMEMARENA_MIN_POOL));
+	success(close(fd));
+
+	errno = 0;
+	ck_assert_ptr_null(pmemarena_open(FILE_A));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(open_ENOENT)
+{
+	errno = 0;
+	ck_assert_ptr_null(pmemarena_open(FILE_A));
+	error(ENOENT);
+}
+END_TEST
+
+static void *alloc_free_thread(void *arg)
+{
+	void **const objs = arg;
+	for (int i = 0; i < NOBJ_PER_THREAD; ++i) {
+		objs[i] = pmemarena_alloc(p_, 64);
+		if (!objs[i])
+			return NULL;
+		memset(objs[i], i, 64);
+	}
+	/* free every other object; the rest stays live */
+	for (int i = 0; i < NOBJ_PER_THREAD; i += 2)
+		pmemarena_free(p_, objs[i]);
+	return arg;
+}
+
+START_TEST(threads_OK)
+{
+	p_ = pmemarena_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+
+	static void *objs[NTHREAD][NOBJ_PER_THREAD];
+	pthread_t th[NTHREAD];
+	for (int t = 0; t < NTHREAD; ++t)
+		success(pthread_create(&th[t], NULL,
+			alloc_free_thread, objs[t]));
+	for (int t = 0; t < NTHREAD; ++t) {
+		void *ret = NULL;
+		success(pthread_join(th[t], &ret));
+		ck_assert_ptr_eq(objs[t], ret);
+	}
+
+	/* no object was handed out twice */
+	static void *live[NTHREAD * NOBJ_PER_THREAD / 2];
+	size_t n = 0;
+	for (int t = 0; t < NTHREAD; ++t)
+		for (int i = 1; i < NOBJ_PER_THREAD; i += 2)
+			live[n++] = objs[t][i];
+	qsort(live, n, sizeof(live[0]), compare_ptr);
+	for (size_t i = 1; i < n; ++i)
+		ck_assert_ptr_ne(live[i - 1], live[i]);
+
+	struct pmemarena_stats s;
+	pmemarena_stats(p_, &s);
+	ck_assert_uint_eq(n, s.nobj);
+}
+END_TEST
+
+int main()
+{
+	TCase *const tcase_dax = tcase_create("DAX");
+	tcase_add_unchecked_fixture(tcase_dax, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax, setup, teardown);
+	tcase_add_test(tcase_dax, create_OK);
+	tcase_add_test(tcase_dax, create_EINVAL_poolsize);
+	tcase_add_test(tcase_dax, create_EEXIST);
+	tcase_add_test(tcase_dax, header_PMEMARN);
+	tcase_add_test(tcase_dax, alloc_EINVAL);
+	tcase_add_test(tcase_dax, alloc_ENOMEM);
+	tcase_add_test(tcase_dax, no_tcache_OK);
+	tcase_add_test(tcase_dax, open_OK);
+	tcase_add_test(tcase_dax, open_EINVAL);
+	tcase_add_test(tcase_dax, open_ENOENT);
+	tcase_add_test(tcase_dax, threads_OK);
+
+	TCase *const tcase_nondax = tcase_create("non-DAX");
+	tcase_add_unchecked_fixture(tcase_nondax, setup_once_nondaxfs, NULL);
+	tcase_add_checked_fixture(tcase_nondax, setup, teardown);
+	tcase_add_test(tcase_nondax, create_OK);
+	tcase_add_test(tcase_nondax, create_EINVAL_poolsize);
+	tcase_add_test(tcase_nondax, create_EEXIST);
+	tcase_add_test(tcase_nondax, header_PMEMARN);
+	tcase_add_test(tcase_nondax, alloc_EINVAL);
+	tcase_add_test(tcase_nondax, alloc_ENOMEM);
+	tcase_add_test(tcase_nondax, no_tcache_OK);
+	tcase_add_test(tcase_nondax, open_OK);
+	tcase_add_test(tcase_nondax, open_EINVAL);
+	tcase_add_test(tcase_nondax, open_ENOENT);
+	tcase_add_test(tcase_nondax, threads_OK);
+
+	Suite *const suite = suite_create("pmemarena");
+	suite_add_tcase(suite, tcase_dax);
+	suite_add_tcase(suite, tcase_nondax);
+
+	SRunner *const srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	const int failed = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+
+	return !!failed;
+}
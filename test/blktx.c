@@ -0,0 +1,379 @@
+#include "config.h" /* should be included first */
+
+#include <check.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libpmemblk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkplus.h"
+#include "pmemblktx.h"
+
+#ifndef DIR_DAX
+#define DIR_DAX "/mnt/pmem0/tmp"
+#endif
+#ifndef DIR_NONDAX
+#define DIR_NONDAX "/tmp"
+#endif
+#define FILE_A "foo"
+#define FILE_B "bar"
+
+#define BSIZE PMEMBLK_MIN_BLK
+#define NTX   3
+
+/* global variables */
+static PMEMblkpool *pbp_ = NULL;
+static PMEMblktx *ptx_ = NULL;
+
+/* util functions */
+static PMEMblktx *pmemblktx_create_default(void)
+{
+	return pmemblktx_create(pbp_, FILE_B, PMEMBLKTX_MIN_LOG, 0600);
+}
+
+static void fill_blocks(int c, long long first, int n)
+{
+	char buf[BSIZE];
+	memset(buf, c, BSIZE);
+	for (long long b = first; b < first + n; ++b)
+		success(pmemblk_write(pbp_, buf, b));
+}
+
+static void assert_blocks(int c, long long first, int n)
+{
+	char buf[BSIZE], out[BSIZE];
+	memset(buf, c, BSIZE);
+	for (long long b = first; b < first + n; ++b) {
+		success(pmemblk_read(pbp_, out, b));
+		ck_assert_mem_eq(buf, out, BSIZE);
+	}
+}
+
+/* commits 'c' to blocks [first, first + NTX) in one transaction */
+static int commit_blocks(int c, long long first, unsigned flags)
+{
+	char buf[BSIZE];
+	memset(buf, c, BSIZE);
+	struct pmemblktx_write w[NTX];
+	for (int i = 0; i < NTX; ++i)
+		w[i] = (struct pmemblktx_write){first + i, buf};
+	return pmemblktx_commit(ptx_, w, NTX, flags);
+}
+
+/* cuts the staged copy of the blocks of c short, as a crash would */
+static void truncate_staged(int c)
+{
+	FILE *const fp = fopen(FILE_B, "r+b");
+	ck_assert_ptr_nonnull(fp);
+
+	char pattern[BSIZE], buf[BSIZE];
+	memset(pattern, c, BSIZE);
+	long off = -1;
+	for (long o = 0; off < 0 && fseek(fp, o, SEEK_SET) == 0; o += 64)
+		if (fread(buf, 1, BSIZE, fp) == BSIZE
+				&& memcmp(buf, pattern, BSIZE) == 0)
+			off = o;
+	ck_assert_int_le(0, off);
+
+	/* the last staged block is gone */
+	off += (NTX - 1) * (long)BSIZE;
+	memset(buf, 0, BSIZE);
+	success(fseek(fp, off, SEEK_SET));
+	ck_assert_uint_eq(BSIZE, fwrite(buf, 1, BSIZE, fp));
+	success(fclose(fp));
+}
+
+/* fixtures */
+static void setup_once_daxfs(void)
+{
+	success(chdir(DIR_DAX));
+}
+
+static void setup_once_nondaxfs(void)
+{
+	success(chdir(DIR_NONDAX));
+}
+
+static void setup(void)
+{
+	unlink(FILE_A); /* DO NOT assert */
+	unlink(FILE_B); /* DO NOT assert */
+	pbp_ = pmemblk_create(FILE_A, BSIZE, PMEMBLK_MIN_POOL, 0600);
+	ck_assert_ptr_nonnull(pbp_);
+}
+
+static void teardown(void)
+{
+	if (ptx_) {
+		pmemblktx_close(ptx_);
+		ptx_ = NULL;
+	}
+	if (pbp_) {
+		pmemblk_close(pbp_);
+		pbp_ = NULL;
+	}
+}
+
+/* test cases */
+START_TEST(create_OK)
+{
+	ptx_ = pmemblktx_create_default();
+	ck_assert_ptr_nonnull(ptx_);
+	ck_assert_int_le(16, pmemblktx_max_write(ptx_));
+
+	struct stat st;
+	success(stat(FILE_B, &st));
+	ck_assert_uint_eq(PMEMBLKTX_MIN_LOG, st.st_size);
+
+	fill_blocks('A', 0, 10);
+	success(commit_blocks('B', 2, 0));
+	assert_blocks('A', 0, 2);
+	assert_blocks('B', 2, NTX);
+	assert_blocks('A', 2 + NTX, 10 - 2 - NTX);
+
+	/* the same block twice; the later write wins */
+	char b[BSIZE], c[BSIZE];
+	memset(b, 'B', BSIZE);
+	memset(c, 'C', BSIZE);
+	const struct pmemblktx_write w[2] = {{0, b}, {0, c}};
+	success(pmemblktx_commit(ptx_, w, 2, 0));
+	assert_blocks('C', 0, 1);
+
+	/* as many as allowed */
+	const int max = pmemblktx_max_write(ptx_);
+	struct pmemblktx_write *const all = calloc((size_t)max, sizeof(*all));
+	ck_assert_ptr_nonnull(all);
+	for (int i = 0; i < max; ++i)
+		all[i] = (struct pmemblktx_write){i, b};
+	success(pmemblktx_commit(ptx_, all, max, 0));
+	free(all);
+	assert_blocks('B', 0, max);
+}
+END_TEST
+
+START_TEST(create_EINVAL_logsize)
+{
+	errno = 0;
+	ck_assert_ptr_null(pmemblktx_create(pbp_, FILE_B,
+		PMEMBLKTX_MIN_LOG - 1, 0600));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(create_EEXIST)
+{
+	ptx_ = pmemblktx_create_default();
+	ck_assert_ptr_nonnull(ptx_);
+	pmemblktx_close(ptx_);
+	ptx_ = NULL;
+
+	errno = 0;
+	ck_assert_ptr_null(pmemblktx_create_default());
+	error(EEXIST);
+}
+END_TEST
+
+START_TEST(header_PMEMBTX)
+{
+	ptx_ = pmemblktx_create_default();
+	ck_assert_ptr_nonnull(ptx_);
+	pmemblktx_close(ptx_);
+	ptx_ = NULL;
+
+	FILE *const fp = fopen(FILE_B, "r+b");
+	ck_assert_ptr_nonnull(fp);
+
+	char header[8];
+	ck_assert_uint_eq(8, fread(header, sizeof(char), 8, fp));
+	ck_assert_mem_eq("PMEMBTX", header, 8);
+
+	success(fclose(fp));
+}
+END_TEST
+
+START_TEST(commit_EINVAL)
+{
+	ptx_ = pmemblktx_create_default();
+	ck_assert_ptr_nonnull(ptx_);
+
+	char buf[BSIZE];
+	memset(buf, 'B', BSIZE);
+	const long long nblock = (long long)pmemblk_nblock(pbp_);
+	struct pmemblktx_write w[2] = {{0, buf}, {nblock, buf}};
+
+	errno = 0;
+	failure(pmemblktx_commit(ptx_, w, 0, 0));
+	error(EINVAL);
+	errno = 0;
+	failure(pmemblktx_commit(ptx_, w, pmemblktx_max_write(ptx_) + 1, 0));
+	error(EINVAL);
+
+	/* nothing is written if any block is out of range */
+	fill_blocks('A', 0, 1);
+	errno = 0;
+	failure(pmemblktx_commit(ptx_, w, 2, 0));
+	error(EINVAL);
+	w[1].blockno = -1;
+	errno = 0;
+	failure(pmemblktx_commit(ptx_, w, 2, 0));
+	error(EINVAL);
+	assert_blocks('A', 0, 1);
+}
+END_TEST
+
+START_TEST(open_redo_OK)
+{
+	ptx_ = pmemblktx_create_default();
+	ck_assert_ptr_nonnull(ptx_);
+	fill_blocks('A', 0, 20);
+
+	/* crash after committing to the log */
+	success(commit_blocks('B', 0, PMEMBLKTX_NOAPPLY));
+	success(commit_blocks('C', 10, PMEMBLKTX_NOAPPLY));
+	assert_blocks('A', 0, 20);
+	pmemblktx_close(ptx_);
+
+	ptx_ = pmemblktx_open(pbp_, FILE_B);
+	ck_assert_ptr_nonnull(ptx_);
+	assert_blocks('B', 0, NTX);
+	assert_blocks('C', 10, NTX);
+	assert_blocks('A', NTX, 10 - NTX);
+
+	/* redo happens once */
+	fill_blocks('D', 0, 20);
+	pmemblktx_close(ptx_);
+	ptx_ = pmemblktx_open(pbp_, FILE_B);
+	ck_assert_ptr_nonnull(ptx_);
+	assert_blocks('D', 0, 20);
+}
+END_TEST
+
+START_TEST(open_truncated_OK)
+{
+	ptx_ = pmemblktx_create_default();
+	ck_assert_ptr_nonnull(ptx_);
+	fill_blocks('A', 0, 20);
+
+	success(commit_blocks('B', 0, PMEMBLKTX_NOAPPLY));
+	success(commit_blocks('C', 10, PMEMBLKTX_NOAPPLY));
+	pmemblktx_close(ptx_);
+	truncate_staged('B');
+
+	/* all or nothing; the other transaction is intact */
+	ptx_ = pmemblktx_open(pbp_, FILE_B);
+	ck_assert_ptr_nonnull(ptx_);
+	assert_blocks('A', 0, 10);
+	assert_blocks('C', 10, NTX);
+
+	/* the torn lane is usable again */
+	for (int i = 0; i < 20; ++i)
+		success(commit_blocks('E', 0, 0));
+	assert_blocks('E', 0, NTX);
+}
+END_TEST
+
+START_TEST(commit_after_noapply_OK)
+{
+	ptx_ = pmemblktx_create_default();
+	ck_assert_ptr_nonnull(ptx_);
+	fill_blocks('A', 0, 20);
+
+	success(commit_blocks('B', 0, PMEMBLKTX_NOAPPLY));
+	success(commit_blocks('C', 10, PMEMBLKTX_NOAPPLY));
+
+	/* the stuck transaction goes first, then the newer one */
+	success(commit_blocks('E', 1, 0));
+	assert_blocks('B', 0, 1);
+	assert_blocks('E', 1, NTX);
+	assert_blocks('A', 10, NTX);
+	pmemblktx_close(ptx_);
+
+	/* the log holds no older data of blocks 0 to NTX */
+	ptx_ = pmemblktx_open(pbp_, FILE_B);
+	ck_assert_ptr_nonnull(ptx_);
+	assert_blocks('B', 0, 1);
+	assert_blocks('E', 1, NTX);
+	assert_blocks('C', 10, NTX);
+}
+END_TEST
+
+START_TEST(open_EINVAL)
+{
+	/* not a log */
+	const int fd = open(FILE_B, O_WRONLY|O_CREAT|O_EXCL, 0600);
+	opened(fd);
+	success(ftruncate(fd, (off_t)PMEMBLKTX_MIN_LOG));
+	success(close(fd));
+	errno = 0;
+	ck_assert_ptr_null(pmemblktx_open(pbp_, FILE_B));
+	error(EINVAL);
+	success(unlink(FILE_B));
+
+	/* a log of another block size */
+	ptx_ = pmemblktx_create_default();
+	ck_assert_ptr_nonnull(ptx_);
+	pmemblktx_close(ptx_);
+	ptx_ = NULL;
+	pmemblk_close(pbp_);
+	success(unlink(FILE_A));
+	pbp_ = pmemblk_create(FILE_A, BSIZE * 2, PMEMBLK_MIN_POOL, 0600);
+	ck_assert_ptr_nonnull(pbp_);
+	errno = 0;
+	ck_assert_ptr_null(pmemblktx_open(pbp_, FILE_B));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(open_ENOENT)
+{
+	errno = 0;
+	ck_assert_ptr_null(pmemblktx_open(pbp_, FILE_B));
+	error(ENOENT);
+}
+END_TEST
+
+int main()
+{
+	TCase *const tcase_dax = tcase_create("DAX");
+	tcase_add_unchecked_fixture(tcase_dax, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax, setup, teardown);
+	tcase_add_test(tcase_dax, create_OK);
+	tcase_add_test(tcase_dax, create_EINVAL_logsize);
+	tcase_add_test(tcase_dax, create_EEXIST);
+	tcase_add_test(tcase_dax, header_PMEMBTX);
+	tcase_add_test(tcase_dax, commit_EINVAL);
+	tcase_add_test(tcase_dax, open_redo_OK);
+	tcase_add_test(tcase_dax, open_truncated_OK);
+	tcase_add_test(tcase_dax, commit_after_noapply_OK);
+	tcase_add_test(tcase_dax, open_EINVAL);
+	tcase_add_test(tcase_dax, open_ENOENT);
+
+	TCase *const tcase_nondax = tcase_create("non-DAX");
+	tcase_add_unchecked_fixture(tcase_nondax, setup_once_nondaxfs, NULL);
+	tcase_add_checked_fixture(tcase_nondax, setup, teardown);
+	tcase_add_test(tcase_nondax, create_OK);
+	tcase_add_test(tcase_nondax, create_EINVAL_logsize);
+	tcase_add_test(tcase_nondax, create_EEXIST);
+	tcase_add_test(tcase_nondax, header_PMEMBTX);
+	tcase_add_test(tcase_nondax, commit_EINVAL);
+	tcase_add_test(tcase_nondax, open_redo_OK);
+	tcase_add_test(tcase_nondax, open_truncated_OK);
+	tcase_add_test(tcase_nondax, commit_after_noapply_OK);
+	tcase_add_test(tcase_nondax, open_EINVAL);
+	tcase_add_test(tcase_nondax, open_ENOENT);
+
+	Suite *const suite = suite_create("pmemblktx");
+	suite_add_tcase(suite, tcase_dax);
+	suite_add_tcase(suite, tcase_nondax);
+
+	SRunner *const srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	const int failed = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+
+	return !!failed;
+}
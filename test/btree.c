@@ -0,0 +1,326 @@
+#include "config.h" /* should be included first */
+
+#include <check.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkplus.h"
+#include "pmembtree.h"
+
+#ifndef DIR_DAX
+#define DIR_DAX "/mnt/pmem0/tmp"
+#endif
+#ifndef DIR_NONDAX
+#define DIR_NONDAX "/tmp"
+#endif
+#define FILE_A "foo"
+
+#define NKEY 2000
+
+/* global variables */
+static PMEMbtree *p_ = NULL;
+
+/* util functions */
+static PMEMbtree *pmembtree_create_default(const char *path)
+{
+	return pmembtree_create(path, PMEMBTREE_MIN_POOL, 0600);
+}
+
+/* a permutation of [0, NKEY) scattered over the key space */
+static uint64_t nth_key(uint64_t i)
+{
+	return ((i * 7919) % NKEY) * 1000;
+}
+
+struct scan_state {
+	uint64_t prev;
+	size_t n;
+	size_t limit;
+};
+
+/* callback function passed to pmembtree_scan */
+static int assert_scan_ordered(uint64_t key, uint64_t value, void *arg)
+{
+	struct scan_state *const st = arg;
+	if (st->n > 0)
+		ck_assert_uint_lt(st->prev, key);
+	ck_assert_uint_eq(key + 1, value);
+	st->prev = key;
+	return ++st->n < st->limit; /* 0 terminates the scan */
+}
+
+/* fixtures */
+static void setup_once_daxfs(void)
+{
+	success(chdir(DIR_DAX));
+}
+
+static void setup_once_nondaxfs(void)
+{
+	success(chdir(DIR_NONDAX));
+}
+
+static void setup(void)
+{
+	unlink(FILE_A); /* DO NOT assert */
+	errno = 0;
+	failure(access(FILE_A, F_OK));
+	error(ENOENT);
+}
+
+static void teardown(void)
+{
+	if (p_) {
+		pmembtree_close(p_);
+		p_ = NULL;
+	}
+}
+
+/* test cases */
+START_TEST(create_OK)
+{
+	p_ = pmembtree_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+
+	struct stat st;
+	success(stat(FILE_A, &st));
+	ck_assert_uint_eq(PMEMBTREE_MIN_POOL, st.st_size);
+	ck_assert_uint_eq(0, pmembtree_count(p_));
+	ck_assert_uint_eq(1, pmembtree_nleaf(p_));
+
+	uint64_t value = 0;
+	errno = 0;
+	failure(pmembtree_lookup(p_, 42, &value));
+	error(ENOENT);
+
+	/* insert, then update */
+	success(pmembtree_insert(p_, 42, 1));
+	success(pmembtree_lookup(p_, 42, &value));
+	ck_assert_uint_eq(1, value);
+	success(pmembtree_insert(p_, 42, 2));
+	success(pmembtree_lookup(p_, 42, &value));
+	ck_assert_uint_eq(2, value);
+	ck_assert_uint_eq(1, pmembtree_count(p_));
+
+	/* keys at both ends of the key space */
+	success(pmembtree_insert(p_, 0, 3));
+	success(pmembtree_insert(p_, UINT64_MAX, 4));
+	success(pmembtree_lookup(p_, 0, &value));
+	ck_assert_uint_eq(3, value);
+	success(pmembtree_lookup(p_, UINT64_MAX, &value));
+	ck_assert_uint_eq(4, value);
+
+	/* remove */
+	success(pmembtree_remove(p_, 42));
+	errno = 0;
+	failure(pmembtree_lookup(p_, 42, &value));
+	error(ENOENT);
+	errno = 0;
+	failure(pmembtree_remove(p_, 42));
+	error(ENOENT);
+	ck_assert_uint_eq(2, pmembtree_count(p_));
+}
+END_TEST
+
+START_TEST(create_EINVAL_poolsize)
+{
+	errno = 0;
+	ck_assert_ptr_null(pmembtree_create(FILE_A,
+		PMEMBTREE_MIN_POOL - 1, 0600));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(create_EEXIST)
+{
+	p_ = pmembtree_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+	pmembtree_close(p_);
+	p_ = NULL;
+
+	errno = 0;
+	ck_assert_ptr_null(pmembtree_create_default(FILE_A));
+	error(EEXIST);
+}
+END_TEST
+
+START_TEST(header_PMEMBTR)
+{
+	p_ = pmembtree_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+	pmembtree_close(p_);
+	p_ = NULL;
+
+	FILE *const fp = fopen(FILE_A, "r+b");
+	ck_assert_ptr_nonnull(fp);
+
+	char header[8];
+	ck_assert_uint_eq(8, fread(header, sizeof(char), 8, fp));
+	ck_assert_mem_eq("PMEMBTR", header, 8);
+
+	success(fclose(fp));
+}
+END_TEST
+
+START_TEST(scan_OK)
+{
+	p_ = pmembtree_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+
+	/* enough keys to split leaves and inner nodes */
+	for (uint64_t i = 0; i < NKEY; ++i)
+		success(pmembtree_insert(p_, nth_key(i), nth_key(i) + 1));
+	ck_assert_uint_eq(NKEY, pmembtree_count(p_));
+	ck_assert_uint_lt(1, pmembtree_nleaf(p_));
+
+	/* whole */
+	struct scan_state st = {0, 0, SIZE_MAX};
+	pmembtree_scan(p_, 0, UINT64_MAX, assert_scan_ordered, &st);
+	ck_assert_uint_eq(NKEY, st.n);
+
+	/* [100000, 200000] has keys 100, ..., 200 times 1000 */
+	memset(&st, 0, sizeof(st));
+	st.limit = SIZE_MAX;
+	pmembtree_scan(p_, 100000, 200000, assert_scan_ordered, &st);
+	ck_assert_uint_eq(101, st.n);
+	ck_assert_uint_eq(200000, st.prev);
+
+	/* bounds need not be keys */
+	memset(&st, 0, sizeof(st));
+	st.limit = SIZE_MAX;
+	pmembtree_scan(p_, 100001, 199999, assert_scan_ordered, &st);
+	ck_assert_uint_eq(99, st.n);
+
+	/* the callback terminates the scan */
+	memset(&st, 0, sizeof(st));
+	st.limit = 10;
+	pmembtree_scan(p_, 0, UINT64_MAX, assert_scan_ordered, &st);
+	ck_assert_uint_eq(10, st.n);
+	ck_assert_uint_eq(9000, st.prev);
+}
+END_TEST
+
+START_TEST(insert_ENOSPC)
+{
+	p_ = pmembtree_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+
+	uint64_t n = 0;
+	while (pmembtree_insert(p_, n, n + 1) == 0)
+		++n;
+	error(ENOSPC);
+	ck_assert_uint_eq(n, pmembtree_count(p_));
+
+	/* every key inserted is still there */
+	struct scan_state st = {0, 0, SIZE_MAX};
+	pmembtree_scan(p_, 0, UINT64_MAX, assert_scan_ordered, &st);
+	ck_assert_uint_eq(n, st.n);
+	ck_assert_uint_eq(n - 1, st.prev);
+}
+END_TEST
+
+START_TEST(open_OK)
+{
+	p_ = pmembtree_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+
+	for (uint64_t i = 0; i < NKEY; ++i)
+		success(pmembtree_insert(p_, nth_key(i), nth_key(i) + 1));
+	for (uint64_t i = 0; i < NKEY; i += 2)
+		success(pmembtree_remove(p_, i * 1000));
+	const size_t nleaf = pmembtree_nleaf(p_);
+
+	/* re-open; inner nodes are rebuilt from the leaves */
+	pmembtree_close(p_);
+	p_ = pmembtree_open(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+	ck_assert_uint_eq(nleaf, pmembtree_nleaf(p_));
+	ck_assert_uint_eq(NKEY / 2, pmembtree_count(p_));
+
+	for (uint64_t i = 0; i < NKEY; ++i) {
+		uint64_t value = 0;
+		if (i % 2 == 0) {
+			failure(pmembtree_lookup(p_, i * 1000, &value));
+		} else {
+			success(pmembtree_lookup(p_, i * 1000, &value));
+			ck_assert_uint_eq(i * 1000 + 1, value);
+		}
+	}
+
+	struct scan_state st = {0, 0, SIZE_MAX};
+	pmembtree_scan(p_, 0, UINT64_MAX, assert_scan_ordered, &st);
+	ck_assert_uint_eq(NKEY / 2, st.n);
+
+	/* the rebuilt tree keeps splitting */
+	for (uint64_t i = 0; i < NKEY; i += 2)
+		success(pmembtree_insert(p_, i * 1000, i * 1000 + 1));
+	ck_assert_uint_eq(NKEY, pmembtree_count(p_));
+}
+END_TEST
+
+START_TEST(open_EINVAL)
+{
+	const int fd = open(FILE_A, O_WRONLY|O_CREAT|O_EXCL, 0600);
+	opened(fd);
+	success(ftruncate(fd, (off_t)PMEMBTREE_MIN_POOL));
+	success(close(fd));
+
+	errno = 0;
+	ck_assert_ptr_null(pmembtree_open(FILE_A));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(open_ENOENT)
+{
+	errno = 0;
+	ck_assert_ptr_null(pmembtree_open(FILE_A));
+	error(ENOENT);
+}
+END_TEST
+
+int main()
+{
+	TCase *const tcase_dax = tcase_create("DAX");
+	tcase_add_unchecked_fixture(tcase_dax, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax, setup, teardown);
+	tcase_add_test(tcase_dax, create_OK);
+	tcase_add_test(tcase_dax, create_EINVAL_poolsize);
+	tcase_add_test(tcase_dax, create_EEXIST);
+	tcase_add_test(tcase_dax, header_PMEMBTR);
+	tcase_add_test(tcase_dax, scan_OK);
+	tcase_add_test(tcase_dax, insert_ENOSPC);
+	tcase_add_test(tcase_dax, open_OK);
+	tcase_add_test(tcase_dax, open_EINVAL);
+	tcase_add_test(tcase_dax, open_ENOENT);
+
+	TCase *const tcase_nondax = tcase_create("non-DAX");
+	tcase_add_unchecked_fixture(tcase_nondax, setup_once_nondaxfs, NULL);
+	tcase_add_checked_fixture(tcase_nondax, setup, teardown);
+	tcase_add_test(tcase_nondax, create_OK);
+	tcase_add_test(tcase_nondax, create_EINVAL_poolsize);
+	tcase_add_test(tcase_nondax, create_EEXIST);
+	tcase_add_test(tcase_nondax, header_PMEMBTR);
+	tcase_add_test(tcase_nondax, scan_OK);
+	tcase_add_test(tcase_nondax, insert_ENOSPC);
+	tcase_add_test(tcase_nondax, open_OK);
+	tcase_add_test(tcase_nondax, open_EINVAL);
+	tcase_add_test(tcase_nondax, open_ENOENT);
+
+	Suite *const suite = suite_create("pmembtree");
+	suite_add_tcase(suite, tcase_dax);
+	suite_add_tcase(suite, tcase_nondax);
+
+	SRunner *const srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	const int failed = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+
+	return !!failed;
+}
@@ -0,0 +1,252 @@
+#define _GNU_SOURCE /* getcpu() */
+#include "config.h" /* should be included first */
+
+#include <check.h>
+#include <errno.h>
+#include <libpmem.h>
+#include <libpmemblk.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkplus.h"
+#include "pmembulk.h"
+
+#ifndef DIR_DAX
+#define DIR_DAX "/mnt/pmem0/tmp"
+#endif
+#ifndef DIR_NONDAX
+#define DIR_NONDAX "/tmp"
+#endif
+#define FILE_A "foo"
+
+#define LEN   (PMEMBULK_MIN_SLICE * 4)
+#define BSIZE ((size_t)512)
+
+#define NODE_DIR "/sys/devices/system/node"
+
+/* global variables */
+static char *addr_ = NULL;
+static size_t mapped_len_ = 0;
+static PMEMblkpool *pbp_ = NULL;
+
+/* util functions */
+static void assert_filled(const char *p, size_t len, int c)
+{
+	for (size_t i = 0; i < len; ++i)
+		if (p[i] != (char)c)
+			ck_abort_msg("byte %zu is %d, not %d", i, p[i], c);
+}
+
+/* fixtures */
+static void setup_once_daxfs(void)
+{
+	success(chdir(DIR_DAX));
+}
+
+static void setup_once_nondaxfs(void)
+{
+	success(chdir(DIR_NONDAX));
+}
+
+static void setup(void)
+{
+	unlink(FILE_A); /* DO NOT assert */
+	errno = 0;
+	failure(access(FILE_A, F_OK));
+	error(ENOENT);
+}
+
+static void setup_map(void)
+{
+	setup();
+	int is_pmem;
+	addr_ = pmem_map_file(FILE_A, LEN, PMEM_FILE_CREATE|PMEM_FILE_EXCL,
+		0600, &mapped_len_, &is_pmem);
+	ck_assert_ptr_nonnull(addr_);
+}
+
+static void setup_blk(void)
+{
+	setup();
+	pbp_ = pmemblk_create(FILE_A, BSIZE, PMEMBLK_MIN_POOL, 0600);
+	ck_assert_ptr_nonnull(pbp_);
+}
+
+static void teardown(void)
+{
+	if (addr_) {
+		success(pmem_unmap(addr_, mapped_len_));
+		addr_ = NULL;
+	}
+	if (pbp_) {
+		pmemblk_close(pbp_);
+		pbp_ = NULL;
+	}
+}
+
+/* test cases */
+START_TEST(memset_OK)
+{
+	/* unaligned both ends; slices still cover all of it */
+	static const int NTHREADS[] = {1, 3, 0};
+	const size_t head = 13, tail = 7, len = LEN - head - tail;
+	memset(addr_, 'Z', LEN);
+	for (int i = 0; i < 3; ++i) {
+		const int c = 'A' + i;
+		success(pmembulk_memset(addr_ + head, c, len, NTHREADS[i]));
+		assert_filled(addr_ + head, len, c);
+		assert_filled(addr_, head, 'Z');
+		assert_filled(addr_ + head + len, tail, 'Z');
+	}
+}
+END_TEST
+
+START_TEST(memset_small_OK)
+{
+	memset(addr_, 'Z', 256);
+	success(pmembulk_memset(addr_, 'A', 0, 8));
+	ck_assert_int_eq('Z', addr_[0]);
+	success(pmembulk_memset(addr_ + 1, 'A', 100, 8));
+	assert_filled(addr_ + 1, 100, 'A');
+	ck_assert_int_eq('Z', addr_[0]);
+	ck_assert_int_eq('Z', addr_[101]);
+}
+END_TEST
+
+START_TEST(memset_EINVAL)
+{
+	errno = 0;
+	failure(pmembulk_memset(addr_, 'A', LEN, -1));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(node_OK)
+{
+	/* a kernel without NUMA has no nodes to tell */
+	if (access(NODE_DIR, F_OK) != 0)
+		return;
+
+	addr_[0] = 'A';
+	const int node = pmembulk_node(addr_);
+	ck_assert_int_le(0, node);
+	char path[64];
+	snprintf(path, sizeof(path), NODE_DIR "/node%d", node);
+	success(access(path, F_OK));
+
+	/* where there is one node, it is the caller's as well */
+	char online[16] = "";
+	FILE *const fp = fopen(NODE_DIR "/online", "r");
+	ck_assert_ptr_nonnull(fp);
+	ck_assert_ptr_nonnull(fgets(online, sizeof(online), fp));
+	success(fclose(fp));
+	if (strcmp(online, "0\n") == 0) {
+		unsigned cpu, caller;
+		success(getcpu(&cpu, &caller));
+		ck_assert_int_eq((int)caller, node);
+	}
+}
+END_TEST
+
+START_TEST(blk_set_zero_OK)
+{
+	/* enough for 3 threads of at least 256 blocks */
+	static const long long FROM = 8, COUNT = 3 * 256 + 40, NBLOCK = 1024;
+	char buf[BSIZE], zero[BSIZE];
+	memset(buf, 'A', sizeof(buf));
+	memset(zero, 0, sizeof(zero));
+	for (long long i = 0; i < NBLOCK; ++i)
+		success(pmemblk_write(pbp_, buf, i));
+
+	success(pmembulk_blk_set_zero(pbp_, FROM, COUNT, 3));
+	for (long long i = 0; i < NBLOCK; ++i) {
+		char out[BSIZE];
+		success(pmemblk_read(pbp_, out, i));
+		const int zeroed = FROM <= i && i < FROM + COUNT;
+		ck_assert_mem_eq(zeroed ? zero : buf, out, BSIZE);
+	}
+
+	/* nothing to do */
+	success(pmembulk_blk_set_zero(pbp_, 0, 0, 0));
+}
+END_TEST
+
+START_TEST(blk_set_zero_EINVAL)
+{
+	const long long nblock = (long long)pmemblk_nblock(pbp_);
+
+	errno = 0;
+	failure(pmembulk_blk_set_zero(pbp_, -1, 1, 1));
+	error(EINVAL);
+
+	errno = 0;
+	failure(pmembulk_blk_set_zero(pbp_, 0, nblock + 1, 1));
+	error(EINVAL);
+
+	/* past the end, and past what a long long holds */
+	errno = 0;
+	failure(pmembulk_blk_set_zero(pbp_, nblock + 1, 0, 1));
+	error(EINVAL);
+
+	errno = 0;
+	failure(pmembulk_blk_set_zero(pbp_, LLONG_MAX, 1, 1));
+	error(EINVAL);
+
+	errno = 0;
+	failure(pmembulk_blk_set_zero(pbp_, 1, LLONG_MAX, 1));
+	error(EINVAL);
+
+	errno = 0;
+	failure(pmembulk_blk_set_zero(pbp_, 0, 1, -1));
+	error(EINVAL);
+}
+END_TEST
+
+int main()
+{
+	TCase *const tcase_dax = tcase_create("DAX");
+	tcase_add_unchecked_fixture(tcase_dax, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax, setup_map, teardown);
+	tcase_add_test(tcase_dax, memset_OK);
+	tcase_add_test(tcase_dax, memset_small_OK);
+	tcase_add_test(tcase_dax, memset_EINVAL);
+	tcase_add_test(tcase_dax, node_OK);
+
+	TCase *const tcase_dax_blk = tcase_create("DAX pmemblk");
+	tcase_add_unchecked_fixture(tcase_dax_blk, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax_blk, setup_blk, teardown);
+	tcase_add_test(tcase_dax_blk, blk_set_zero_OK);
+	tcase_add_test(tcase_dax_blk, blk_set_zero_EINVAL);
+
+	TCase *const tcase_nondax = tcase_create("non-DAX");
+	tcase_add_unchecked_fixture(tcase_nondax, setup_once_nondaxfs, NULL);
+	tcase_add_checked_fixture(tcase_nondax, setup_map, teardown);
+	tcase_add_test(tcase_nondax, memset_OK);
+	tcase_add_test(tcase_nondax, memset_small_OK);
+	tcase_add_test(tcase_nondax, memset_EINVAL);
+	tcase_add_test(tcase_nondax, node_OK);
+
+	TCase *const tcase_nondax_blk = tcase_create("non-DAX pmemblk");
+	tcase_add_unchecked_fixture(tcase_nondax_blk, setup_once_nondaxfs,
+		NULL);
+	tcase_add_checked_fixture(tcase_nondax_blk, setup_blk, teardown);
+	tcase_add_test(tcase_nondax_blk, blk_set_zero_OK);
+	tcase_add_test(tcase_nondax_blk, blk_set_zero_EINVAL);
+
+	Suite *const suite = suite_create("pmembulk");
+	suite_add_tcase(suite, tcase_dax);
+	suite_add_tcase(suite, tcase_dax_blk);
+	suite_add_tcase(suite, tcase_nondax);
+	suite_add_tcase(suite, tcase_nondax_blk);
+
+	SRunner *const srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	const int failed = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+
+	return !!failed;
+}
@@ -0,0 +1,378 @@
+#include "config.h" /* should be included first */
+
+#include <check.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "checkplus.h"
+#include "pmemckpt.h"
+
+#ifndef DIR_DAX
+#define DIR_DAX "/mnt/pmem0/tmp"
+#endif
+#ifndef DIR_NONDAX
+#define DIR_NONDAX "/tmp"
+#endif
+#define FILE_A "foo"
+
+#define PAGE    ((size_t)4096)
+#define NPAGE   2048 /* enough for more than one thread to copy */
+#define LEN     (NPAGE * PAGE)
+#define HDRSIZE 4096
+
+/* global variables */
+static char *region_ = NULL;
+static char *spare_ = NULL; /* to restore to */
+static PMEMckpt *ckp_ = NULL;
+
+/* util functions */
+static char *map_region(void)
+{
+	char *const p = mmap(NULL, LEN, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	ck_assert_ptr_ne(MAP_FAILED, p);
+	return p;
+}
+
+static uint64_t rand_next(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/* the modes this kernel has, ending with PMEMCKPT_TRACK_AUTO */
+static void tracks(enum pmemckpt_track t[4])
+{
+	int n = 0;
+	t[n++] = PMEMCKPT_TRACK_WRPROTECT;
+	t[n++] = PMEMCKPT_TRACK_FULL;
+	ckp_ = pmemckpt_create(FILE_A, region_, LEN,
+		PMEMCKPT_TRACK_AUTO, 0600);
+	ck_assert_ptr_nonnull(ckp_);
+	if (pmemckpt_track(ckp_) == PMEMCKPT_TRACK_SOFTDIRTY)
+		t[n++] = PMEMCKPT_TRACK_SOFTDIRTY;
+	t[n] = PMEMCKPT_TRACK_AUTO;
+	pmemckpt_close(ckp_);
+	ckp_ = NULL;
+	unlink(FILE_A);
+}
+
+static void create(enum pmemckpt_track track)
+{
+	unlink(FILE_A);
+	ckp_ = pmemckpt_create(FILE_A, region_, LEN, track, 0600);
+	ck_assert_ptr_nonnull(ckp_);
+	ck_assert_int_eq(track, pmemckpt_track(ckp_));
+}
+
+/* restores the last checkpoint to spare_ and compares */
+static void check_restored(const char *exp, enum pmemckpt_track track)
+{
+	const uint64_t gen = pmemckpt_generation(ckp_);
+	pmemckpt_close(ckp_);
+	ckp_ = NULL;
+	memset(spare_, 0, LEN);
+	PMEMckpt *const ckp = pmemckpt_open(FILE_A, spare_, LEN, track);
+	ck_assert_ptr_nonnull(ckp);
+	ck_assert_uint_eq(gen, pmemckpt_generation(ckp));
+	ck_assert_mem_eq(exp, spare_, LEN);
+	pmemckpt_close(ckp);
+}
+
+/* fixtures */
+static void setup_once_daxfs(void)
+{
+	success(chdir(DIR_DAX));
+}
+
+static void setup_once_nondaxfs(void)
+{
+	success(chdir(DIR_NONDAX));
+}
+
+static void setup(void)
+{
+	unlink(FILE_A); /* DO NOT assert */
+	errno = 0;
+	failure(access(FILE_A, F_OK));
+	error(ENOENT);
+
+	region_ = map_region();
+	spare_ = map_region();
+}
+
+static void teardown(void)
+{
+	if (ckp_) {
+		pmemckpt_close(ckp_);
+		ckp_ = NULL;
+	}
+	munmap(region_, LEN);
+	munmap(spare_, LEN);
+}
+
+/* test cases */
+START_TEST(create_EINVAL)
+{
+	errno = 0;
+	ck_assert_ptr_null(pmemckpt_create(FILE_A, region_ + 1, PAGE,
+		PMEMCKPT_TRACK_FULL, 0600));
+	error(EINVAL);
+	errno = 0;
+	ck_assert_ptr_null(pmemckpt_create(FILE_A, region_, PAGE + 1,
+		PMEMCKPT_TRACK_FULL, 0600));
+	error(EINVAL);
+	errno = 0;
+	ck_assert_ptr_null(pmemckpt_create(FILE_A, region_, 0,
+		PMEMCKPT_TRACK_FULL, 0600));
+	error(EINVAL);
+	errno = 0;
+	failure(access(FILE_A, F_OK));
+}
+END_TEST
+
+START_TEST(open_EINVAL)
+{
+	create(PMEMCKPT_TRACK_FULL);
+	pmemckpt_close(ckp_);
+	ckp_ = NULL;
+
+	/* of another length */
+	errno = 0;
+	ck_assert_ptr_null(pmemckpt_open(FILE_A, region_, LEN / 2,
+		PMEMCKPT_TRACK_FULL));
+	error(EINVAL);
+
+	/* not a checkpoint file */
+	const char zero[8] = {0};
+	const int fd = open(FILE_A, O_RDWR);
+	opened(fd);
+	ck_assert_int_eq(8, pwrite(fd, zero, 8, 0));
+	success(close(fd));
+	errno = 0;
+	ck_assert_ptr_null(pmemckpt_open(FILE_A, region_, LEN,
+		PMEMCKPT_TRACK_FULL));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(softdirty_OK)
+{
+	/* either the kernel has it, and auto picks it, or neither */
+	create(PMEMCKPT_TRACK_FULL);
+	pmemckpt_close(ckp_);
+	unlink(FILE_A);
+	ckp_ = pmemckpt_create(FILE_A, region_, LEN, PMEMCKPT_TRACK_AUTO,
+		0600);
+	ck_assert_ptr_nonnull(ckp_);
+	const enum pmemckpt_track t = pmemckpt_track(ckp_);
+	pmemckpt_close(ckp_);
+	ckp_ = NULL;
+	unlink(FILE_A);
+
+	errno = 0;
+	ckp_ = pmemckpt_create(FILE_A, region_, LEN,
+		PMEMCKPT_TRACK_SOFTDIRTY, 0600);
+	if (t == PMEMCKPT_TRACK_SOFTDIRTY) {
+		ck_assert_ptr_nonnull(ckp_);
+	} else {
+		ck_assert_int_eq(PMEMCKPT_TRACK_FULL, t);
+		ck_assert_ptr_null(ckp_);
+		error(EOPNOTSUPP);
+	}
+}
+END_TEST
+
+START_TEST(empty_OK)
+{
+	/* nothing to restore */
+	memset(region_, 'x', LEN);
+	create(PMEMCKPT_TRACK_FULL);
+	ck_assert_uint_eq(0, pmemckpt_generation(ckp_));
+	pmemckpt_close(ckp_);
+	ckp_ = pmemckpt_open(FILE_A, region_, LEN, PMEMCKPT_TRACK_FULL);
+	ck_assert_ptr_nonnull(ckp_);
+	ck_assert_uint_eq(0, pmemckpt_generation(ckp_));
+	ck_assert_int_eq('x', region_[LEN - 1]);
+}
+END_TEST
+
+START_TEST(full_OK)
+{
+	create(PMEMCKPT_TRACK_FULL);
+	for (int i = 1; i <= 3; ++i) {
+		success(pmemckpt_checkpoint(ckp_, 1));
+		ck_assert_uint_eq((uint64_t)i, pmemckpt_generation(ckp_));
+		ck_assert_uint_eq(LEN, pmemckpt_last_copied(ckp_));
+	}
+}
+END_TEST
+
+START_TEST(wrprotect_OK)
+{
+	create(PMEMCKPT_TRACK_WRPROTECT);
+	/* neither slot matches the region at first */
+	success(pmemckpt_checkpoint(ckp_, 1));
+	ck_assert_uint_eq(LEN, pmemckpt_last_copied(ckp_));
+	success(pmemckpt_checkpoint(ckp_, 1));
+	ck_assert_uint_eq(LEN, pmemckpt_last_copied(ckp_));
+	success(pmemckpt_checkpoint(ckp_, 1));
+	ck_assert_uint_eq(0, pmemckpt_last_copied(ckp_));
+
+	/* a page written is copied to both slots in turn */
+	region_[3 * PAGE + 5] = 1;
+	region_[10 * PAGE] = 2;
+	region_[10 * PAGE + 1] = 3;
+	success(pmemckpt_checkpoint(ckp_, 1));
+	ck_assert_uint_eq(2 * PAGE, pmemckpt_last_copied(ckp_));
+	region_[11 * PAGE] = 4;
+	success(pmemckpt_checkpoint(ckp_, 1));
+	ck_assert_uint_eq(3 * PAGE, pmemckpt_last_copied(ckp_));
+	success(pmemckpt_checkpoint(ckp_, 1));
+	ck_assert_uint_eq(PAGE, pmemckpt_last_copied(ckp_));
+	success(pmemckpt_checkpoint(ckp_, 1));
+	ck_assert_uint_eq(0, pmemckpt_last_copied(ckp_));
+	ck_assert_uint_eq(7, pmemckpt_generation(ckp_));
+
+	/* the region is writable when closed */
+	pmemckpt_close(ckp_);
+	ckp_ = NULL;
+	region_[12 * PAGE] = 5;
+}
+END_TEST
+
+START_TEST(restore_OK)
+{
+	enum pmemckpt_track t[4];
+	tracks(t);
+	char *const exp = malloc(LEN);
+	ck_assert_ptr_nonnull(exp);
+
+	for (int m = 0; t[m] != PMEMCKPT_TRACK_AUTO; ++m) {
+		memset(region_, 0, LEN);
+		create(t[m]);
+		uint64_t seed = (uint64_t)m + 1;
+		for (int gen = 1; gen <= 6; ++gen) {
+			/* a few pages, a byte or a page at a time */
+			for (int i = 0; i < 40; ++i) {
+				const size_t page = rand_next(&seed) % NPAGE;
+				if (i % 2)
+					region_[page * PAGE + i] = (char)gen;
+				else
+					memset(region_ + page * PAGE, gen, PAGE);
+			}
+			success(pmemckpt_checkpoint(ckp_, gen % 3));
+		}
+		memcpy(exp, region_, LEN);
+		/* not in a checkpoint */
+		memset(region_, 0xFF, PAGE);
+		check_restored(exp, t[m]);
+	}
+	free(exp);
+}
+END_TEST
+
+START_TEST(threads_OK)
+{
+	enum pmemckpt_track t[4];
+	tracks(t);
+	char *const exp = malloc(LEN);
+	ck_assert_ptr_nonnull(exp);
+
+	for (int m = 0; t[m] != PMEMCKPT_TRACK_AUTO; ++m) {
+		create(t[m]);
+		for (int gen = 1; gen <= 3; ++gen) {
+			/* every other page, for many runs */
+			for (size_t p = (size_t)gen % 2; p < NPAGE; p += 2)
+				region_[p * PAGE + (size_t)m] = (char)(gen + m);
+			success(pmemckpt_checkpoint(ckp_, 4));
+		}
+		memcpy(exp, region_, LEN);
+		check_restored(exp, t[m]);
+	}
+	free(exp);
+}
+END_TEST
+
+START_TEST(torn_OK)
+{
+	create(PMEMCKPT_TRACK_WRPROTECT);
+	memset(region_, 'a', LEN);
+	success(pmemckpt_checkpoint(ckp_, 1));
+	memset(region_, 'b', LEN);
+	success(pmemckpt_checkpoint(ckp_, 1));
+	char *const exp = malloc(LEN);
+	ck_assert_ptr_nonnull(exp);
+	memcpy(exp, region_, LEN);
+	ck_assert_uint_eq(2, pmemckpt_generation(ckp_));
+	pmemckpt_close(ckp_);
+	ckp_ = NULL;
+
+	/* the third was being written to slot 1 when the process died */
+	char junk[PAGE];
+	memset(junk, 'c', sizeof(junk));
+	const int fd = open(FILE_A, O_RDWR);
+	opened(fd);
+	ck_assert_int_eq((ssize_t)PAGE, pwrite(fd, junk, PAGE,
+		(off_t)(HDRSIZE + LEN * 1 + PAGE * 7)));
+	success(close(fd));
+
+	ckp_ = pmemckpt_open(FILE_A, region_, LEN, PMEMCKPT_TRACK_WRPROTECT);
+	ck_assert_ptr_nonnull(ckp_);
+	ck_assert_mem_eq(exp, region_, LEN);
+
+	/* the next checkpoint goes to slot 1, all of it */
+	success(pmemckpt_checkpoint(ckp_, 1));
+	ck_assert_uint_eq(LEN, pmemckpt_last_copied(ckp_));
+	check_restored(exp, PMEMCKPT_TRACK_WRPROTECT);
+	free(exp);
+}
+END_TEST
+
+int main()
+{
+	TCase *const tcase_dax = tcase_create("DAX");
+	tcase_add_unchecked_fixture(tcase_dax, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax, setup, teardown);
+	tcase_add_test(tcase_dax, create_EINVAL);
+	tcase_add_test(tcase_dax, open_EINVAL);
+	tcase_add_test(tcase_dax, softdirty_OK);
+	tcase_add_test(tcase_dax, empty_OK);
+	tcase_add_test(tcase_dax, full_OK);
+	tcase_add_test(tcase_dax, wrprotect_OK);
+	tcase_add_test(tcase_dax, restore_OK);
+	tcase_add_test(tcase_dax, threads_OK);
+	tcase_add_test(tcase_dax, torn_OK);
+
+	TCase *const tcase_nondax = tcase_create("non-DAX");
+	tcase_add_unchecked_fixture(tcase_nondax, setup_once_nondaxfs, NULL);
+	tcase_add_checked_fixture(tcase_nondax, setup, teardown);
+	tcase_add_test(tcase_nondax, create_EINVAL);
+	tcase_add_test(tcase_nondax, open_EINVAL);
+	tcase_add_test(tcase_nondax, softdirty_OK);
+	tcase_add_test(tcase_nondax, empty_OK);
+	tcase_add_test(tcase_nondax, full_OK);
+	tcase_add_test(tcase_nondax, wrprotect_OK);
+	tcase_add_test(tcase_nondax, restore_OK);
+	tcase_add_test(tcase_nondax, threads_OK);
+	tcase_add_test(tcase_nondax, torn_OK);
+
+	Suite *const suite = suite_create("pmemckpt");
+	suite_add_tcase(suite, tcase_dax);
+	suite_add_tcase(suite, tcase_nondax);
+
+	SRunner *const srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	const int failed = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+
+	return !!failed;
+}
@@ -0,0 +1,829 @@
+#include "config.h" /* should be included first */
+
+#include <check.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "checkplus.h"
+#include "pmemdax.h"
+
+#ifndef DIR_DAX
+#define DIR_DAX "/mnt/pmem0/tmp"
+#endif
+#ifndef DIR_NONDAX
+#define DIR_NONDAX "/tmp"
+#endif
+#define FILE_A "foo"
+
+/*
+ * Device DAX cannot be assumed to be there, and formatting it would
+ * destroy its contents, so a regular file stands in for it. The file is
+ * treated as pmem only if PMEM_IS_PMEM_FORCE=1; otherwise the engines
+ * write back to it through io_uring.
+ */
+#define POOLSIZE (PMEMDAX_MIN_POOL * 2)
+#define BSIZE    ((size_t)512)
+
+/* global variables */
+static int force_ = -1;
+static PMEMdaxblkpool *pbp_ = NULL;
+static PMEMdaxlogpool *plp_ = NULL;
+static PMEMdaxlogreader *plr_ = NULL;
+
+/* callback function passed to pmemdaxlog_walk */
+static int count_chunk(const void *buf, size_t len, void *arg)
+{
+	(void)buf;
+	size_t *const nchunk = arg;
+	ck_assert_uint_lt(0, len);
+	return ++*nchunk < 3;
+}
+
+/* fixtures */
+static void setup_once_daxfs(void)
+{
+	success(chdir(DIR_DAX));
+}
+
+static void setup_once_nondaxfs(void)
+{
+	success(chdir(DIR_NONDAX));
+}
+
+/* a stand-in for the device; it exists before being formatted */
+static void setup(void)
+{
+	unlink(FILE_A); /* DO NOT assert */
+	const int fd = open(FILE_A, O_WRONLY|O_CREAT|O_EXCL, 0600);
+	opened(fd);
+	success(ftruncate(fd, (off_t)POOLSIZE));
+	success(close(fd));
+}
+
+static void teardown(void)
+{
+	if (pbp_) {
+		pmemdaxblk_close(pbp_);
+		pbp_ = NULL;
+	}
+	if (plp_) {
+		pmemdaxlog_close(plp_);
+		plp_ = NULL;
+	}
+	if (plr_) {
+		pmemdaxlog_reader_close(plr_);
+		plr_ = NULL;
+	}
+}
+
+/* test cases */
+START_TEST(blk_create_OK)
+{
+	pbp_ = pmemdaxblk_create(FILE_A, BSIZE);
+	ck_assert_ptr_nonnull(pbp_);
+	ck_assert_uint_eq(BSIZE, pmemdaxblk_bsize(pbp_));
+
+	/* the map and the lanes cost some space */
+	const size_t nblock = pmemdaxblk_nblock(pbp_);
+	ck_assert_uint_lt(0, nblock);
+	ck_assert_uint_lt(nblock, POOLSIZE / BSIZE);
+
+	/* formatting does not resize the stand-in */
+	struct stat st;
+	success(stat(FILE_A, &st));
+	ck_assert_uint_eq(POOLSIZE, st.st_size);
+}
+END_TEST
+
+START_TEST(blk_create_EINVAL_bsize)
+{
+	errno = 0;
+	ck_assert_ptr_null(pmemdaxblk_create(FILE_A, 0));
+	error(EINVAL);
+
+	/* not even one block fits */
+	errno = 0;
+	ck_assert_ptr_null(pmemdaxblk_create(FILE_A, POOLSIZE));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(blk_header_PMEMDXB)
+{
+	pbp_ = pmemdaxblk_create(FILE_A, BSIZE);
+	ck_assert_ptr_nonnull(pbp_);
+	pmemdaxblk_close(pbp_);
+	pbp_ = NULL;
+
+	FILE *const fp = fopen(FILE_A, "r+b");
+	ck_assert_ptr_nonnull(fp);
+
+	char header[8];
+	ck_assert_uint_eq(8, fread(header, sizeof(char), 8, fp));
+	ck_assert_mem_eq("PMEMDXB", header, 8);
+
+	success(fclose(fp));
+}
+END_TEST
+
+START_TEST(blk_read_write_OK)
+{
+	pbp_ = pmemdaxblk_create(FILE_A, BSIZE);
+	ck_assert_ptr_nonnull(pbp_);
+	const long long last = (long long)pmemdaxblk_nblock(pbp_) - 1;
+
+	char zero[BSIZE], buf[BSIZE], out[BSIZE];
+	memset(zero, 0, BSIZE);
+	memset(buf, 'A', BSIZE);
+
+	/* a block reads as zeroes until it is written */
+	memset(out, 'X', BSIZE);
+	success(pmemdaxblk_read(pbp_, out, last));
+	ck_assert_mem_eq(zero, out, BSIZE);
+
+	success(pmemdaxblk_write(pbp_, buf, 0));
+	success(pmemdaxblk_write(pbp_, buf, last));
+	success(pmemdaxblk_read(pbp_, out, last));
+	ck_assert_mem_eq(buf, out, BSIZE);
+
+	/* rewrite one block more times than there are lanes */
+	for (int i = 0; i < 1000; ++i) {
+		memset(buf, i & 0xFF, BSIZE);
+		success(pmemdaxblk_write(pbp_, buf, 1));
+	}
+	success(pmemdaxblk_read(pbp_, out, 1));
+	ck_assert_mem_eq(buf, out, BSIZE);
+
+	/* blocks written before are intact */
+	memset(buf, 'A', BSIZE);
+	success(pmemdaxblk_read(pbp_, out, 0));
+	ck_assert_mem_eq(buf, out, BSIZE);
+	success(pmemdaxblk_read(pbp_, out, last));
+	ck_assert_mem_eq(buf, out, BSIZE);
+
+	errno = 0;
+	failure(pmemdaxblk_read(pbp_, out, last + 1));
+	error(EINVAL);
+	errno = 0;
+	failure(pmemdaxblk_write(pbp_, buf, -1));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(blk_set_zero_error_OK)
+{
+	pbp_ = pmemdaxblk_create(FILE_A, BSIZE);
+	ck_assert_ptr_nonnull(pbp_);
+
+	char zero[BSIZE], buf[BSIZE], out[BSIZE];
+	memset(zero, 0, BSIZE);
+	memset(buf, 'A', BSIZE);
+
+	success(pmemdaxblk_write(pbp_, buf, 0));
+	success(pmemdaxblk_set_zero(pbp_, 0));
+	success(pmemdaxblk_read(pbp_, out, 0));
+	ck_assert_mem_eq(zero, out, BSIZE);
+
+	success(pmemdaxblk_set_error(pbp_, 0));
+	errno = 0;
+	failure(pmemdaxblk_read(pbp_, out, 0));
+	error(EIO);
+
+	/* a write clears the error */
+	success(pmemdaxblk_write(pbp_, buf, 0));
+	success(pmemdaxblk_read(pbp_, out, 0));
+	ck_assert_mem_eq(buf, out, BSIZE);
+}
+END_TEST
+
+START_TEST(blk_open_OK)
+{
+	pbp_ = pmemdaxblk_create(FILE_A, BSIZE);
+	ck_assert_ptr_nonnull(pbp_);
+	const size_t nblock = pmemdaxblk_nblock(pbp_);
+
+	char buf[BSIZE], out[BSIZE];
+	for (int i = 0; i < 200; ++i) {
+		memset(buf, i, BSIZE);
+		success(pmemdaxblk_write(pbp_, buf, i % 10));
+	}
+	pmemdaxblk_close(pbp_);
+
+	pbp_ = pmemdaxblk_open(FILE_A, BSIZE);
+	ck_assert_ptr_nonnull(pbp_);
+	ck_assert_uint_eq(nblock, pmemdaxblk_nblock(pbp_));
+	for (int i = 190; i < 200; ++i) {
+		memset(buf, i, BSIZE);
+		success(pmemdaxblk_read(pbp_, out, i % 10));
+		ck_assert_mem_eq(buf, out, BSIZE);
+	}
+
+	/* the lanes have found their free blocks again */
+	memset(buf, 'B', BSIZE);
+	for (int i = 0; i < 200; ++i)
+		success(pmemdaxblk_write(pbp_, buf, 10 + i));
+	for (int i = 0; i < 10; ++i) {
+		memset(buf, 190 + i, BSIZE);
+		success(pmemdaxblk_read(pbp_, out, i));
+		ck_assert_mem_eq(buf, out, BSIZE);
+	}
+}
+END_TEST
+
+START_TEST(blk_recover_OK)
+{
+	pbp_ = pmemdaxblk_create(FILE_A, BSIZE);
+	ck_assert_ptr_nonnull(pbp_);
+	pmemdaxblk_close(pbp_);
+	pbp_ = NULL;
+
+	/*
+	 * The stores of a killed process stay in the page cache in order,
+	 * and so do the completed part of its io_uring chain, so killing a
+	 * writer leaves the pool as a crash would.
+	 */
+	const pid_t pid = fork();
+	ck_assert_int_ne(-1, pid);
+	if (pid == 0) {
+		PMEMdaxblkpool *const pbp = pmemdaxblk_open(FILE_A, BSIZE);
+		if (!pbp)
+			_exit(1);
+		char buf[BSIZE];
+		for (unsigned i = 0; ; ++i) {
+			memset(buf, (int)(i & 0xFF), BSIZE);
+			pmemdaxblk_write(pbp, buf, i % 16);
+		}
+	}
+	usleep(50000);
+	success(kill(pid, SIGKILL));
+	int status = 0;
+	ck_assert_int_eq(pid, waitpid(pid, &status, 0));
+	ck_assert(WIFSIGNALED(status));
+
+	/* every block holds either its old or its new contents */
+	pbp_ = pmemdaxblk_open(FILE_A, BSIZE);
+	ck_assert_ptr_nonnull(pbp_);
+	char out[BSIZE];
+	for (int i = 0; i < 16; ++i) {
+		success(pmemdaxblk_read(pbp_, out, i));
+		for (size_t j = 1; j < BSIZE; ++j)
+			ck_assert_int_eq(out[0], out[j]);
+	}
+}
+END_TEST
+
+/* the superblock of a pmemdaxblk pool, as it is on media */
+struct daxblk_layout {
+	char magic[8];
+	uint64_t size;
+	uint64_t bsize;
+	uint64_t stride;
+	uint64_t nblock;
+	uint64_t nlane;
+	uint64_t map_off;
+	uint64_t flog_off;
+	uint64_t data_off;
+};
+
+/* writes the 8-byte word of entry ent of the flog of lane */
+static void flog_poke(int fd, const struct daxblk_layout *l, int lane,
+		int ent, int word, uint32_t lo, uint32_t hi)
+{
+	const uint64_t v = (uint64_t)lo | (uint64_t)hi << 32;
+	const off_t off = (off_t)(l->flog_off + (uint64_t)lane * 64
+		+ (uint64_t)ent * 16 + (uint64_t)word * 8);
+	ck_assert_int_eq(8, pwrite(fd, &v, 8, off));
+}
+
+/* fills internal block b with c */
+static void data_poke(int fd, const struct daxblk_layout *l, uint64_t b,
+		int c)
+{
+	char buf[BSIZE];
+	memset(buf, c, BSIZE);
+	ck_assert_int_eq(BSIZE, pwrite(fd, buf, BSIZE,
+		(off_t)(l->data_off + b * l->stride)));
+}
+
+static void assert_block(long long blockno, int c)
+{
+	char buf[BSIZE], out[BSIZE];
+	memset(buf, c, BSIZE);
+	success(pmemdaxblk_read(pbp_, out, blockno));
+	ck_assert_mem_eq(buf, out, BSIZE);
+}
+
+START_TEST(blk_recover_flog_OK)
+{
+	pbp_ = pmemdaxblk_create(FILE_A, BSIZE);
+	ck_assert_ptr_nonnull(pbp_);
+	pmemdaxblk_close(pbp_);
+	pbp_ = NULL;
+
+	const int fd = open(FILE_A, O_RDWR);
+	opened(fd);
+	struct daxblk_layout l;
+	ck_assert_int_eq(sizeof(l), pread(fd, &l, sizeof(l), 0));
+	ck_assert_uint_eq(BSIZE, l.bsize);
+	const uint32_t nb = (uint32_t)l.nblock;
+
+	/*
+	 * Lane i starts with entry 0 {0, nblock + i, nblock + i, 1}. Lane 0
+	 * wrote block 5 to its free block and logged it in full, but the
+	 * map update was lost: recovery finishes it.
+	 */
+	data_poke(fd, &l, nb + 0, 'N');
+	flog_poke(fd, &l, 0, 1, 0, 5, 5);
+	flog_poke(fd, &l, 0, 1, 1, nb + 0, 2);
+
+	/*
+	 * Lane 1 wrote block 7 to its free block, but only the first half
+	 * of the entry made it, so the entry keeps seq 0 and block 7 its
+	 * old contents.
+	 */
+	data_poke(fd, &l, nb + 1, 'T');
+	flog_poke(fd, &l, 1, 1, 0, 7, 7);
+	success(close(fd));
+
+	pbp_ = pmemdaxblk_open(FILE_A, BSIZE);
+	ck_assert_ptr_nonnull(pbp_);
+	assert_block(5, 'N');
+	assert_block(7, 0);
+
+	/* the lanes found the right free blocks: nothing overwrites these */
+	char buf[BSIZE];
+	memset(buf, 'W', BSIZE);
+	for (int i = 0; i < 4 * 64; ++i)
+		success(pmemdaxblk_write(pbp_, buf, 10 + i % 64));
+	assert_block(5, 'N');
+	assert_block(7, 0);
+
+	pmemdaxblk_close(pbp_);
+	pbp_ = pmemdaxblk_open(FILE_A, BSIZE);
+	ck_assert_ptr_nonnull(pbp_);
+	assert_block(5, 'N');
+	assert_block(7, 0);
+	assert_block(10, 'W');
+}
+END_TEST
+
+START_TEST(blk_open_EINVAL)
+{
+	/* not formatted */
+	errno = 0;
+	ck_assert_ptr_null(pmemdaxblk_open(FILE_A, BSIZE));
+	error(EINVAL);
+
+	/* wrong bsize */
+	pbp_ = pmemdaxblk_create(FILE_A, BSIZE);
+	ck_assert_ptr_nonnull(pbp_);
+	pmemdaxblk_close(pbp_);
+	pbp_ = NULL;
+	errno = 0;
+	ck_assert_ptr_null(pmemdaxblk_open(FILE_A, BSIZE * 2));
+	error(EINVAL);
+
+	/* formatted as the other engine */
+	plp_ = pmemdaxlog_create(FILE_A);
+	ck_assert_ptr_nonnull(plp_);
+	errno = 0;
+	ck_assert_ptr_null(pmemdaxblk_open(FILE_A, 0));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(log_create_OK)
+{
+	plp_ = pmemdaxlog_create(FILE_A);
+	ck_assert_ptr_nonnull(plp_);
+	ck_assert_uint_lt(0, pmemdaxlog_nbyte(plp_));
+	ck_assert_uint_lt(pmemdaxlog_nbyte(plp_), POOLSIZE);
+	ck_assert_int_eq(0, pmemdaxlog_tell(plp_));
+}
+END_TEST
+
+START_TEST(log_header_PMEMDXL)
+{
+	plp_ = pmemdaxlog_create(FILE_A);
+	ck_assert_ptr_nonnull(plp_);
+	pmemdaxlog_close(plp_);
+	plp_ = NULL;
+
+	FILE *const fp = fopen(FILE_A, "r+b");
+	ck_assert_ptr_nonnull(fp);
+
+	char header[8];
+	ck_assert_uint_eq(8, fread(header, sizeof(char), 8, fp));
+	ck_assert_mem_eq("PMEMDXL", header, 8);
+
+	success(fclose(fp));
+}
+END_TEST
+
+START_TEST(log_append_OK)
+{
+	plp_ = pmemdaxlog_create(FILE_A);
+	ck_assert_ptr_nonnull(plp_);
+
+	char buf[1000];
+	memset(buf, 'A', sizeof(buf));
+	for (int i = 0; i < 10; ++i)
+		success(pmemdaxlog_append(plp_, buf, sizeof(buf)));
+	ck_assert_int_eq(10000, pmemdaxlog_tell(plp_));
+
+	/* chunksize 0 is the whole log; otherwise stop after 3 chunks */
+	size_t nchunk = 0;
+	pmemdaxlog_walk(plp_, 0, count_chunk, &nchunk);
+	ck_assert_uint_eq(1, nchunk);
+	nchunk = 0;
+	pmemdaxlog_walk(plp_, 1000, count_chunk, &nchunk);
+	ck_assert_uint_eq(3, nchunk);
+
+	/* the log does not wrap */
+	const size_t rest = pmemdaxlog_nbyte(plp_) - 10000;
+	char *const big = calloc(1, rest + 1);
+	ck_assert_ptr_nonnull(big);
+	errno = 0;
+	failure(pmemdaxlog_append(plp_, big, rest + 1));
+	error(ENOSPC);
+	success(pmemdaxlog_append(plp_, big, rest));
+	free(big);
+
+	pmemdaxlog_rewind(plp_);
+	ck_assert_int_eq(0, pmemdaxlog_tell(plp_));
+}
+END_TEST
+
+START_TEST(log_open_OK)
+{
+	plp_ = pmemdaxlog_create(FILE_A);
+	ck_assert_ptr_nonnull(plp_);
+	success(pmemdaxlog_append(plp_, "foobar", 6));
+	pmemdaxlog_close(plp_);
+
+	plp_ = pmemdaxlog_open(FILE_A);
+	ck_assert_ptr_nonnull(plp_);
+	ck_assert_int_eq(6, pmemdaxlog_tell(plp_));
+
+	/* a blk superblock is not a log one */
+	pmemdaxlog_close(plp_);
+	plp_ = NULL;
+	pbp_ = pmemdaxblk_create(FILE_A, BSIZE);
+	ck_assert_ptr_nonnull(pbp_);
+	errno = 0;
+	ck_assert_ptr_null(pmemdaxlog_open(FILE_A));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(reader_open_EINVAL)
+{
+	/* not formatted */
+	errno = 0;
+	ck_assert_ptr_null(pmemdaxlog_reader_open(FILE_A));
+	error(EINVAL);
+
+	pbp_ = pmemdaxblk_create(FILE_A, BSIZE);
+	ck_assert_ptr_nonnull(pbp_);
+	errno = 0;
+	ck_assert_ptr_null(pmemdaxlog_reader_open(FILE_A));
+	error(EINVAL);
+
+	success(unlink(FILE_A));
+	errno = 0;
+	ck_assert_ptr_null(pmemdaxlog_reader_open(FILE_A));
+	error(ENOENT);
+}
+END_TEST
+
+START_TEST(reader_next_OK)
+{
+	plp_ = pmemdaxlog_create(FILE_A);
+	ck_assert_ptr_nonnull(plp_);
+	success(pmemdaxlog_append(plp_, "foo", 3));
+	plr_ = pmemdaxlog_reader_open(FILE_A);
+	ck_assert_ptr_nonnull(plr_);
+
+	const void *buf = NULL;
+	ck_assert_int_eq(3, pmemdaxlog_reader_next(plr_, &buf, 0));
+	ck_assert_mem_eq("foo", buf, 3);
+	ck_assert_int_eq(0, pmemdaxlog_reader_next(plr_, &buf, 0));
+
+	/* only what was appended since */
+	success(pmemdaxlog_append(plp_, "bar", 3));
+	success(pmemdaxlog_append(plp_, "baz", 3));
+	ck_assert_int_eq(6, pmemdaxlog_reader_next(plr_, &buf, -1));
+	ck_assert_mem_eq("barbaz", buf, 6);
+	ck_assert_int_eq(9, pmemdaxlog_reader_tell(plr_));
+	ck_assert_int_eq(9, pmemdaxlog_reader_end(plr_));
+
+	/* a timeout longer than the spin ends in the futex */
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	ck_assert_int_eq(0, pmemdaxlog_reader_next(plr_, &buf, 10000000));
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ck_assert_int_le(10000000, (t1.tv_sec - t0.tv_sec) * 1000000000L
+		+ (t1.tv_nsec - t0.tv_nsec));
+
+	success(pmemdaxlog_reader_seek(plr_, 3));
+	ck_assert_int_eq(6, pmemdaxlog_reader_next(plr_, &buf, 0));
+	errno = 0;
+	failure(pmemdaxlog_reader_seek(plr_, 10));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(reader_wait_OK)
+{
+	plp_ = pmemdaxlog_create(FILE_A);
+	ck_assert_ptr_nonnull(plp_);
+
+	/* a reader in another process sleeps until the appends */
+	const pid_t pid = fork();
+	ck_assert_int_ne(-1, pid);
+	if (pid == 0) {
+		PMEMdaxlogreader *const plr = pmemdaxlog_reader_open(FILE_A);
+		if (!plr)
+			_exit(1);
+		size_t total = 0;
+		while (total < 3000) {
+			const void *buf;
+			const ssize_t n = pmemdaxlog_reader_next(plr, &buf,
+				2000000000LL);
+			if (n <= 0 || memchr(buf, 0, (size_t)n))
+				_exit(2);
+			total += (size_t)n;
+		}
+		pmemdaxlog_reader_close(plr);
+		_exit(0);
+	}
+	char buf[1000];
+	memset(buf, 'A', sizeof(buf));
+	for (int i = 0; i < 3; ++i) {
+		usleep(20000);
+		success(pmemdaxlog_append(plp_, buf, sizeof(buf)));
+	}
+	int status = 0;
+	ck_assert_int_eq(pid, waitpid(pid, &status, 0));
+	ck_assert(WIFEXITED(status));
+	ck_assert_int_eq(0, WEXITSTATUS(status));
+}
+END_TEST
+
+/*
+ * The count of waiting readers, in the superblock of a pmemdaxlog pool;
+ * the low half of a word whose high half is the generation of the count.
+ */
+#define NWAITER_OFF (2048 + 8)
+
+static uint32_t nwaiter(void)
+{
+	const int fd = open(FILE_A, O_RDONLY);
+	opened(fd);
+	uint32_t n = 0;
+	ck_assert_int_eq(sizeof(n), pread(fd, &n, sizeof(n), NWAITER_OFF));
+	success(close(fd));
+	return n;
+}
+
+/* waits up to 2 seconds for n readers to wait */
+static void await_nwaiter(uint32_t n)
+{
+	for (int i = 0; i < 2000 && nwaiter() != n; ++i)
+		usleep(1000);
+	ck_assert_uint_eq(n, nwaiter());
+}
+
+/*
+ * A reader in another process that waits up to timeout_ns at a time for
+ * count bytes; it exits with 2 if it times out.
+ */
+static pid_t fork_reader(size_t count, long long timeout_ns)
+{
+	const pid_t pid = fork();
+	ck_assert_int_ne(-1, pid);
+	if (pid == 0) {
+		PMEMdaxlogreader *const plr = pmemdaxlog_reader_open(FILE_A);
+		if (!plr)
+			_exit(1);
+		size_t total = 0;
+		while (total < count) {
+			const void *buf;
+			const ssize_t n = pmemdaxlog_reader_next(plr, &buf,
+				timeout_ns);
+			if (n <= 0)
+				_exit(2);
+			total += (size_t)n;
+		}
+		pmemdaxlog_reader_close(plr);
+		_exit(0);
+	}
+	return pid;
+}
+
+START_TEST(reader_killed_OK)
+{
+	plp_ = pmemdaxlog_create(FILE_A);
+	ck_assert_ptr_nonnull(plp_);
+
+	/* a reader killed while waiting stays counted */
+	pid_t pid = fork_reader(1, 2000000000LL);
+	await_nwaiter(1);
+	success(kill(pid, SIGKILL));
+	int status = 0;
+	ck_assert_int_eq(pid, waitpid(pid, &status, 0));
+	ck_assert_uint_eq(1, nwaiter());
+
+	/* until the writer opens the pool; one waiting then is counted */
+	pid = fork_reader(3, 2000000000LL);
+	await_nwaiter(2);
+	pmemdaxlog_close(plp_);
+	plp_ = pmemdaxlog_open(FILE_A);
+	ck_assert_ptr_nonnull(plp_);
+	await_nwaiter(1);
+
+	success(pmemdaxlog_append(plp_, "foo", 3));
+	ck_assert_int_eq(pid, waitpid(pid, &status, 0));
+	ck_assert(WIFEXITED(status));
+	ck_assert_int_eq(0, WEXITSTATUS(status));
+	ck_assert_uint_eq(0, nwaiter());
+}
+END_TEST
+
+START_TEST(reader_reset_OK)
+{
+	plp_ = pmemdaxlog_create(FILE_A);
+	ck_assert_ptr_nonnull(plp_);
+
+	/* a, counted before the writer opens the pool, leaves after it */
+	const pid_t a = fork_reader(1, 200000000LL);
+	await_nwaiter(1);
+	usleep(10000);
+	success(kill(a, SIGSTOP));
+	pmemdaxlog_close(plp_);
+	plp_ = pmemdaxlog_open(FILE_A);
+	ck_assert_ptr_nonnull(plp_);
+	ck_assert_uint_eq(0, nwaiter());
+
+	/* b, counted after, stays counted */
+	const pid_t b = fork_reader(3, 2000000000LL);
+	await_nwaiter(1);
+	usleep(300000);
+	success(kill(a, SIGCONT));
+	int status = 0;
+	ck_assert_int_eq(a, waitpid(a, &status, 0));
+	ck_assert(WIFEXITED(status));
+	ck_assert_int_eq(2, WEXITSTATUS(status));
+	ck_assert_uint_eq(1, nwaiter());
+
+	/* and is woken by the next append */
+	success(pmemdaxlog_append(plp_, "foo", 3));
+	ck_assert_int_eq(b, waitpid(b, &status, 0));
+	ck_assert(WIFEXITED(status));
+	ck_assert_int_eq(0, WEXITSTATUS(status));
+	ck_assert_uint_eq(0, nwaiter());
+}
+END_TEST
+
+START_TEST(reader_rewind_ESTALE)
+{
+	plp_ = pmemdaxlog_create(FILE_A);
+	ck_assert_ptr_nonnull(plp_);
+	success(pmemdaxlog_append(plp_, "foo", 3));
+	plr_ = pmemdaxlog_reader_open(FILE_A);
+	ck_assert_ptr_nonnull(plr_);
+	const void *buf = NULL;
+	ck_assert_int_eq(3, pmemdaxlog_reader_next(plr_, &buf, 0));
+
+	/* even once the log is longer than it was */
+	pmemdaxlog_rewind(plp_);
+	success(pmemdaxlog_append(plp_, "quux", 4));
+	errno = 0;
+	ck_assert_int_eq(-1, pmemdaxlog_reader_next(plr_, &buf, 0));
+	error(ESTALE);
+
+	success(pmemdaxlog_reader_seek(plr_, 0));
+	ck_assert_int_eq(4, pmemdaxlog_reader_next(plr_, &buf, 0));
+	ck_assert_mem_eq("quux", buf, 4);
+}
+END_TEST
+
+START_TEST(open_ENOENT)
+{
+	success(unlink(FILE_A));
+	errno = 0;
+	ck_assert_ptr_null(pmemdaxblk_open(FILE_A, BSIZE));
+	error(ENOENT);
+	errno = 0;
+	ck_assert_ptr_null(pmemdaxlog_create(FILE_A));
+	error(ENOENT);
+}
+END_TEST
+
+START_TEST(nonpmem_written_back)
+{
+	/* O_DSYNC, a chain with fdatasync(2), and no io_uring at all */
+	static const char *const CONF[][2] = {
+		{"64", "0"}, {"1", "1"}, {"0", "0"},
+	};
+
+	char buf[BSIZE], out[BSIZE];
+	for (size_t c = 0; c < sizeof(CONF) / sizeof(CONF[0]); ++c) {
+		success(setenv("PMEMDAX_URING_DEPTH", CONF[c][0], 1));
+		success(setenv("PMEMDAX_URING_FSYNC", CONF[c][1], 1));
+
+		pbp_ = pmemdaxblk_create(FILE_A, BSIZE);
+		ck_assert_ptr_nonnull(pbp_);
+		memset(buf, 'A' + (int)c, BSIZE);
+		for (int i = 0; i < 4; ++i)
+			success(pmemdaxblk_write(pbp_, buf, i));
+		pmemdaxblk_close(pbp_);
+
+		/* what a private mapping reads is what reached the file */
+		pbp_ = pmemdaxblk_open(FILE_A, BSIZE);
+		ck_assert_ptr_nonnull(pbp_);
+		for (int i = 0; i < 4; ++i) {
+			success(pmemdaxblk_read(pbp_, out, i));
+			ck_assert_mem_eq(buf, out, BSIZE);
+		}
+		pmemdaxblk_close(pbp_);
+		pbp_ = NULL;
+
+		plp_ = pmemdaxlog_create(FILE_A);
+		ck_assert_ptr_nonnull(plp_);
+		success(pmemdaxlog_append(plp_, buf, BSIZE));
+		pmemdaxlog_close(plp_);
+		plp_ = pmemdaxlog_open(FILE_A);
+		ck_assert_ptr_nonnull(plp_);
+		ck_assert_int_eq(BSIZE, pmemdaxlog_tell(plp_));
+		pmemdaxlog_close(plp_);
+		plp_ = NULL;
+	}
+	success(unsetenv("PMEMDAX_URING_DEPTH"));
+	success(unsetenv("PMEMDAX_URING_FSYNC"));
+}
+END_TEST
+
+static void add_tests(TCase *tcase)
+{
+	tcase_add_test(tcase, open_ENOENT);
+	tcase_add_test(tcase, blk_create_OK);
+	tcase_add_test(tcase, blk_create_EINVAL_bsize);
+	tcase_add_test(tcase, blk_header_PMEMDXB);
+	tcase_add_test(tcase, blk_read_write_OK);
+	tcase_add_test(tcase, blk_set_zero_error_OK);
+	tcase_add_test(tcase, blk_open_OK);
+	tcase_add_test(tcase, blk_recover_OK);
+	tcase_add_test(tcase, blk_recover_flog_OK);
+	tcase_add_test(tcase, blk_open_EINVAL);
+	tcase_add_test(tcase, log_create_OK);
+	tcase_add_test(tcase, log_header_PMEMDXL);
+	tcase_add_test(tcase, log_append_OK);
+	tcase_add_test(tcase, log_open_OK);
+	tcase_add_test(tcase, reader_open_EINVAL);
+	tcase_add_test(tcase, reader_next_OK);
+	tcase_add_test(tcase, reader_wait_OK);
+	tcase_add_test(tcase, reader_killed_OK);
+	tcase_add_test(tcase, reader_reset_OK);
+	tcase_add_test(tcase, reader_rewind_ESTALE);
+}
+
+int main()
+{
+	/* Checks environment variable(s). */
+	const char *const p = getenv("PMEM_IS_PMEM_FORCE");
+	if (p && (strcmp(p, "0") == 0 || strcmp(p, "1") == 0))
+		force_ = atoi(p);
+
+	TCase *const tcase_dax = tcase_create("DAX");
+	tcase_add_unchecked_fixture(tcase_dax, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax, setup, teardown);
+	add_tests(tcase_dax);
+
+	TCase *const tcase_nondax = tcase_create("non-DAX");
+	tcase_add_unchecked_fixture(tcase_nondax, setup_once_nondaxfs, NULL);
+	tcase_add_checked_fixture(tcase_nondax, setup, teardown);
+	add_tests(tcase_nondax);
+	if (force_ != 1)
+		tcase_add_test(tcase_nondax, nonpmem_written_back);
+
+	Suite *const suite = suite_create("pmemdax");
+	suite_add_tcase(suite, tcase_dax);
+	suite_add_tcase(suite, tcase_nondax);
+
+	SRunner *const srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	const int failed = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+
+	return !!failed;
+}
@@ -0,0 +1,216 @@
+#include "config.h" /* should be included first */
+
+#include <check.h>
+#include <errno.h>
+#include <libpmem.h>
+#include <libpmemblk.h>
+#include <libpmemlog.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "checkplus.h"
+
+/*
+ * Run with libpmememu.so preloaded and the latencies and bandwidths
+ * below; see test_emu.
+ */
+
+#ifndef DIR_DAX
+#define DIR_DAX "/mnt/pmem0/tmp"
+#endif
+#ifndef DIR_NONDAX
+#define DIR_NONDAX "/tmp"
+#endif
+#define FILE_A "foo"
+#define FILE_B "bar"
+
+#define POOLSIZE ((size_t)(8 << 20))
+#define LATENCY_MS 10    /* PMEMEMU_{WRITE,READ}_LATENCY_NS */
+#define BW_MBS     1000  /* PMEMEMU_{WRITE,READ}_BW_MBS */
+
+/* global variables */
+static char *addr_ = NULL;
+static size_t mapped_len_ = 0;
+static int is_pmem_ = 0;
+
+/* util functions */
+static long long clock_ms(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (long long)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+static int count_chunk(const void *buf, size_t len, void *arg)
+{
+	(void)buf;
+	*(size_t *)arg += len;
+	return 1;
+}
+
+/* fixtures */
+static void setup_once_daxfs(void)
+{
+	success(chdir(DIR_DAX));
+}
+
+static void setup_once_nondaxfs(void)
+{
+	success(chdir(DIR_NONDAX));
+}
+
+static void setup(void)
+{
+	unlink(FILE_A); /* DO NOT assert */
+	unlink(FILE_B); /* DO NOT assert */
+	errno = 0;
+	failure(access(FILE_A, F_OK));
+	error(ENOENT);
+
+	addr_ = pmem_map_file(FILE_A, POOLSIZE,
+		PMEM_FILE_CREATE|PMEM_FILE_EXCL, 0600, &mapped_len_, &is_pmem_);
+	ck_assert_ptr_nonnull(addr_);
+}
+
+static void teardown(void)
+{
+	success(pmem_unmap(addr_, mapped_len_));
+	addr_ = NULL;
+	unlink(FILE_B); /* DO NOT assert */
+}
+
+/* test cases */
+START_TEST(map_file_is_pmem)
+{
+	/* whatever PMEM_IS_PMEM_FORCE says */
+	ck_assert_int_eq(1, is_pmem_);
+	ck_assert_int_ne(0, pmem_is_pmem(addr_, mapped_len_));
+}
+END_TEST
+
+START_TEST(persist_waits_write_latency)
+{
+	long long t = clock_ms();
+	addr_[0] = 'A';
+	pmem_persist(addr_, 1);
+	ck_assert_int_le(LATENCY_MS, clock_ms() - t);
+
+	/* what is flushed is paid for at the drain */
+	addr_[64] = 'B';
+	pmem_flush(addr_ + 64, 1);
+	t = clock_ms();
+	pmem_drain();
+	ck_assert_int_le(LATENCY_MS, clock_ms() - t);
+}
+END_TEST
+
+START_TEST(persist_waits_write_bandwidth)
+{
+	const size_t len = POOLSIZE / 2;
+	const long long t = clock_ms();
+	pmem_memset_persist(addr_, 'A', len);
+	ck_assert_int_le(LATENCY_MS + (long long)(len / 1000 / BW_MBS),
+		clock_ms() - t);
+	ck_assert_int_eq('A', addr_[len - 1]);
+}
+END_TEST
+
+START_TEST(memcpy_nodrain_waits_at_drain)
+{
+	static char buf[4096];
+	memset(buf, 'A', sizeof(buf));
+	memset(addr_, 0, sizeof(buf)); /* not to time a page fault */
+
+	pmem_memcpy(addr_, buf, sizeof(buf), PMEM_F_MEM_NODRAIN);
+	const long long t = clock_ms();
+	pmem_drain();
+	ck_assert_int_le(LATENCY_MS, clock_ms() - t);
+	ck_assert_mem_eq(buf, addr_, sizeof(buf));
+}
+END_TEST
+
+START_TEST(memcpy_from_pmem_waits_read_latency)
+{
+	static char buf[4096];
+	memset(addr_, 'A', sizeof(buf));
+
+	const long long t = clock_ms();
+	pmem_memcpy_nodrain(buf, addr_, sizeof(buf));
+	ck_assert_int_le(LATENCY_MS, clock_ms() - t);
+	ck_assert_mem_eq(addr_, buf, sizeof(buf));
+}
+END_TEST
+
+START_TEST(blk_read_waits_read_latency)
+{
+	PMEMblkpool *const pbp = pmemblk_create(FILE_B, PMEMBLK_MIN_BLK,
+		PMEMBLK_MIN_POOL, 0600);
+	ck_assert_ptr_nonnull(pbp);
+	char buf[PMEMBLK_MIN_BLK], out[PMEMBLK_MIN_BLK];
+	memset(buf, 'A', sizeof(buf));
+	success(pmemblk_write(pbp, buf, 0));
+
+	const long long t = clock_ms();
+	success(pmemblk_read(pbp, out, 0));
+	ck_assert_int_le(LATENCY_MS, clock_ms() - t);
+	ck_assert_mem_eq(buf, out, sizeof(buf));
+	pmemblk_close(pbp);
+}
+END_TEST
+
+START_TEST(log_walk_waits_read_latency)
+{
+	PMEMlogpool *const plp = pmemlog_create(FILE_B, PMEMLOG_MIN_POOL,
+		0600);
+	ck_assert_ptr_nonnull(plp);
+	static char buf[4096];
+	memset(buf, 'A', sizeof(buf));
+	success(pmemlog_append(plp, buf, sizeof(buf)));
+
+	size_t len = 0;
+	const long long t = clock_ms();
+	pmemlog_walk(plp, 0, count_chunk, &len);
+	ck_assert_int_le(LATENCY_MS, clock_ms() - t);
+	ck_assert_uint_eq(sizeof(buf), len);
+	pmemlog_close(plp);
+}
+END_TEST
+
+int main()
+{
+	TCase *const tcase_dax = tcase_create("DAX");
+	tcase_add_unchecked_fixture(tcase_dax, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax, setup, teardown);
+	tcase_add_test(tcase_dax, map_file_is_pmem);
+	tcase_add_test(tcase_dax, persist_waits_write_latency);
+	tcase_add_test(tcase_dax, persist_waits_write_bandwidth);
+	tcase_add_test(tcase_dax, memcpy_nodrain_waits_at_drain);
+	tcase_add_test(tcase_dax, memcpy_from_pmem_waits_read_latency);
+	tcase_add_test(tcase_dax, blk_read_waits_read_latency);
+	tcase_add_test(tcase_dax, log_walk_waits_read_latency);
+
+	TCase *const tcase_nondax = tcase_create("non-DAX");
+	tcase_add_unchecked_fixture(tcase_nondax, setup_once_nondaxfs, NULL);
+	tcase_add_checked_fixture(tcase_nondax, setup, teardown);
+	tcase_add_test(tcase_nondax, map_file_is_pmem);
+	tcase_add_test(tcase_nondax, persist_waits_write_latency);
+	tcase_add_test(tcase_nondax, persist_waits_write_bandwidth);
+	tcase_add_test(tcase_nondax, memcpy_nodrain_waits_at_drain);
+	tcase_add_test(tcase_nondax, memcpy_from_pmem_waits_read_latency);
+	tcase_add_test(tcase_nondax, blk_read_waits_read_latency);
+	tcase_add_test(tcase_nondax, log_walk_waits_read_latency);
+
+	Suite *const suite = suite_create("pmememu");
+	suite_add_tcase(suite, tcase_dax);
+	suite_add_tcase(suite, tcase_nondax);
+
+	SRunner *const srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	const int failed = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+
+	return !!failed;
+}
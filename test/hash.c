@@ -0,0 +1,278 @@
+#include "config.h" /* should be included first */
+
+#include <check.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkplus.h"
+#include "pmemhash.h"
+
+#ifndef DIR_DAX
+#define DIR_DAX "/mnt/pmem0/tmp"
+#endif
+#ifndef DIR_NONDAX
+#define DIR_NONDAX "/tmp"
+#endif
+#define FILE_A "foo"
+
+/* global variables */
+static PMEMhashpool *p_ = NULL;
+
+/* util functions */
+static PMEMhashpool *pmemhash_create_default(const char *path)
+{
+	return pmemhash_create(path, PMEMHASH_MIN_POOL, 0600);
+}
+
+/* fixtures */
+static void setup_once_daxfs(void)
+{
+	success(chdir(DIR_DAX));
+}
+
+static void setup_once_nondaxfs(void)
+{
+	success(chdir(DIR_NONDAX));
+}
+
+static void setup(void)
+{
+	unlink(FILE_A); /* DO NOT assert */
+	errno = 0;
+	failure(access(FILE_A, F_OK));
+	error(ENOENT);
+}
+
+static void teardown(void)
+{
+	if (p_) {
+		pmemhash_close(p_);
+		p_ = NULL;
+	}
+}
+
+/* test cases */
+START_TEST(create_OK)
+{
+	p_ = pmemhash_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+
+	struct stat st;
+	success(stat(FILE_A, &st));
+	ck_assert_uint_eq(PMEMHASH_MIN_POOL, st.st_size);
+
+	/* a power of two of 4-slot buckets fits in the pool */
+	const size_t nslot = pmemhash_nslot(p_);
+	ck_assert_uint_eq(0, nslot & (nslot - 1));
+	ck_assert_uint_ge(PMEMHASH_MIN_POOL, nslot * 16);
+	ck_assert_uint_eq(0, pmemhash_count(p_));
+
+	long long blockno = -1;
+	errno = 0;
+	failure(pmemhash_lookup(p_, 42, &blockno));
+	error(ENOENT);
+
+	/* insert, then update in place */
+	success(pmemhash_insert(p_, 42, 7LL));
+	success(pmemhash_lookup(p_, 42, &blockno));
+	ck_assert_int_eq(7LL, blockno);
+	success(pmemhash_insert(p_, 42, PMEMHASH_MAX_BLOCKNO));
+	success(pmemhash_lookup(p_, 42, &blockno));
+	ck_assert_int_eq(PMEMHASH_MAX_BLOCKNO, blockno);
+	ck_assert_uint_eq(1, pmemhash_count(p_));
+
+	/* key 0 is an ordinary key */
+	success(pmemhash_insert(p_, 0, 0LL));
+	success(pmemhash_lookup(p_, 0, &blockno));
+	ck_assert_int_eq(0LL, blockno);
+	ck_assert_uint_eq(2, pmemhash_count(p_));
+
+	/* remove */
+	success(pmemhash_remove(p_, 42));
+	errno = 0;
+	failure(pmemhash_lookup(p_, 42, &blockno));
+	error(ENOENT);
+	errno = 0;
+	failure(pmemhash_remove(p_, 42));
+	error(ENOENT);
+	ck_assert_uint_eq(1, pmemhash_count(p_));
+}
+END_TEST
+
+START_TEST(create_EINVAL_poolsize)
+{
+	errno = 0;
+	ck_assert_ptr_null(pmemhash_create(FILE_A,
+		PMEMHASH_MIN_POOL - 1, 0600));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(create_EEXIST)
+{
+	p_ = pmemhash_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+	pmemhash_close(p_);
+	p_ = NULL;
+
+	errno = 0;
+	ck_assert_ptr_null(pmemhash_create_default(FILE_A));
+	error(EEXIST);
+}
+END_TEST
+
+START_TEST(header_PMEMHSH)
+{
+	p_ = pmemhash_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+	pmemhash_close(p_);
+	p_ = NULL;
+
+	FILE *const fp = fopen(FILE_A, "r+b");
+	ck_assert_ptr_nonnull(fp);
+
+	char header[8];
+	ck_assert_uint_eq(8, fread(header, sizeof(char), 8, fp));
+	ck_assert_mem_eq("PMEMHSH", header, 8);
+
+	success(fclose(fp));
+}
+END_TEST
+
+START_TEST(insert_EINVAL)
+{
+	p_ = pmemhash_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+
+	errno = 0;
+	failure(pmemhash_insert(p_, 1, -1LL));
+	error(EINVAL);
+	errno = 0;
+	failure(pmemhash_insert(p_, 1, PMEMHASH_MAX_BLOCKNO + 1));
+	error(EINVAL);
+	ck_assert_uint_eq(0, pmemhash_count(p_));
+}
+END_TEST
+
+START_TEST(insert_ENOSPC)
+{
+	p_ = pmemhash_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+
+	const size_t nslot = pmemhash_nslot(p_);
+	for (size_t i = 0; i < nslot; ++i)
+		success(pmemhash_insert(p_, i, (long long)i));
+	ck_assert_uint_eq(nslot, pmemhash_count(p_));
+
+	errno = 0;
+	failure(pmemhash_insert(p_, nslot, 0LL));
+	error(ENOSPC);
+
+	/* updates still work in a full table */
+	success(pmemhash_insert(p_, 0, 1LL));
+
+	/* a removed slot is reused */
+	success(pmemhash_remove(p_, 1));
+	success(pmemhash_insert(p_, nslot, 2LL));
+	long long blockno = -1;
+	success(pmemhash_lookup(p_, nslot, &blockno));
+	ck_assert_int_eq(2LL, blockno);
+}
+END_TEST
+
+START_TEST(open_OK)
+{
+	p_ = pmemhash_create_default(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+
+	/* long probe sequences at 90% load; then remove every third */
+	const size_t n = pmemhash_nslot(p_) / 10 * 9;
+	for (size_t i = 0; i < n; ++i)
+		success(pmemhash_insert(p_, i * 0x10001, (long long)i));
+	for (size_t i = 0; i < n; i += 3)
+		success(pmemhash_remove(p_, i * 0x10001));
+
+	/* re-open; no rebuild */
+	pmemhash_close(p_);
+	p_ = pmemhash_open(FILE_A);
+	ck_assert_ptr_nonnull(p_);
+
+	ck_assert_uint_eq(n - (n + 2) / 3, pmemhash_count(p_));
+	for (size_t i = 0; i < n; ++i) {
+		long long blockno = -1;
+		if (i % 3 == 0) {
+			failure(pmemhash_lookup(p_, i * 0x10001, &blockno));
+		} else {
+			success(pmemhash_lookup(p_, i * 0x10001, &blockno));
+			ck_assert_int_eq((long long)i, blockno);
+		}
+	}
+}
+END_TEST
+
+START_TEST(open_EINVAL)
+{
+	const int fd = open(FILE_A, O_WRONLY|O_CREAT|O_EXCL, 0600);
+	opened(fd);
+	success(ftruncate(fd, (off_t)PMEMHASH_MIN_POOL));
+	success(close(fd));
+
+	errno = 0;
+	ck_assert_ptr_null(pmemhash_open(FILE_A));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(open_ENOENT)
+{
+	errno = 0;
+	ck_assert_ptr_null(pmemhash_open(FILE_A));
+	error(ENOENT);
+}
+END_TEST
+
+int main()
+{
+	TCase *const tcase_dax = tcase_create("DAX");
+	tcase_add_unchecked_fixture(tcase_dax, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax, setup, teardown);
+	tcase_add_test(tcase_dax, create_OK);
+	tcase_add_test(tcase_dax, create_EINVAL_poolsize);
+	tcase_add_test(tcase_dax, create_EEXIST);
+	tcase_add_test(tcase_dax, header_PMEMHSH);
+	tcase_add_test(tcase_dax, insert_EINVAL);
+	tcase_add_test(tcase_dax, insert_ENOSPC);
+	tcase_add_test(tcase_dax, open_OK);
+	tcase_add_test(tcase_dax, open_EINVAL);
+	tcase_add_test(tcase_dax, open_ENOENT);
+
+	TCase *const tcase_nondax = tcase_create("non-DAX");
+	tcase_add_unchecked_fixture(tcase_nondax, setup_once_nondaxfs, NULL);
+	tcase_add_checked_fixture(tcase_nondax, setup, teardown);
+	tcase_add_test(tcase_nondax, create_OK);
+	tcase_add_test(tcase_nondax, create_EINVAL_poolsize);
+	tcase_add_test(tcase_nondax, create_EEXIST);
+	tcase_add_test(tcase_nondax, header_PMEMHSH);
+	tcase_add_test(tcase_nondax, insert_EINVAL);
+	tcase_add_test(tcase_nondax, insert_ENOSPC);
+	tcase_add_test(tcase_nondax, open_OK);
+	tcase_add_test(tcase_nondax, open_EINVAL);
+	tcase_add_test(tcase_nondax, open_ENOENT);
+
+	Suite *const suite = suite_create("pmemhash");
+	suite_add_tcase(suite, tcase_dax);
+	suite_add_tcase(suite, tcase_nondax);
+
+	SRunner *const srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	const int failed = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+
+	return !!failed;
+}
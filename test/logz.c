@@ -0,0 +1,400 @@
+#include "config.h" /* should be included first */
+
+#include <check.h>
+#include <errno.h>
+#include <libpmemlog.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkplus.h"
+#include "pmemlogz.h"
+
+#ifndef DIR_DAX
+#define DIR_DAX "/mnt/pmem0/tmp"
+#endif
+#ifndef DIR_NONDAX
+#define DIR_NONDAX "/tmp"
+#endif
+#define FILE_A "foo"
+
+#define POOLSIZE ((size_t)(16 << 20))
+#define RSIZE    64 /* of the records of threads_OK */
+#define NTHREAD  4
+
+/* global variables */
+static PMEMlogpool *plp_ = NULL;
+static PMEMlogz *plz_ = NULL;
+
+/* what a walk returned */
+struct walked {
+	char *buf;
+	size_t len;
+	int ncall;
+	int stop_after; /* calls; 0 for never */
+};
+static struct walked w_;
+
+/* util functions */
+static uint64_t rand_next(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static void fill_random(char *buf, size_t len, uint64_t seed)
+{
+	for (size_t i = 0; i < len; ++i)
+		buf[i] = (char)rand_next(&seed);
+}
+
+/* text that compresses well, but not into a single run */
+static void fill_text(char *buf, size_t len, uint64_t seed)
+{
+	static const char *const WORDS[] = {
+		"INFO ", "WARN ", "request ", "served ", "in ", "ms ",
+		"user=", "path=/api/v1/", "status=200 ", "\n",
+	};
+	size_t i = 0;
+	while (i < len) {
+		const char *const w = WORDS[rand_next(&seed) % 10];
+		for (size_t j = 0; w[j] && i < len; ++j)
+			buf[i++] = w[j];
+		if (i < len && rand_next(&seed) % 4 == 0)
+			buf[i++] = (char)('0' + rand_next(&seed) % 10);
+	}
+}
+
+/* callback function passed to pmemlogz_walk() */
+static int collect(const void *buf, size_t len, void *arg)
+{
+	struct walked *const w = arg;
+	w->buf = realloc(w->buf, w->len + len);
+	ck_assert_ptr_nonnull(w->buf);
+	memcpy(w->buf + w->len, buf, len);
+	w->len += len;
+	++w->ncall;
+	return w->stop_after == 0 || w->ncall < w->stop_after;
+}
+
+static void walk(void)
+{
+	free(w_.buf);
+	memset(&w_, 0, sizeof(w_));
+	success(pmemlogz_walk(plp_, collect, &w_));
+}
+
+/* appends buf as one record, and checks that it walks back */
+static void round_trip(const char *buf, size_t len)
+{
+	pmemlog_rewind(plp_);
+	success(pmemlogz_append(plz_, buf, len));
+	success(pmemlogz_flush(plz_));
+	walk();
+	ck_assert_uint_eq(len, w_.len);
+	ck_assert_mem_eq(buf, w_.buf, len);
+}
+
+/* fixtures */
+static void setup_once_daxfs(void)
+{
+	success(chdir(DIR_DAX));
+}
+
+static void setup_once_nondaxfs(void)
+{
+	success(chdir(DIR_NONDAX));
+}
+
+static void setup(void)
+{
+	unlink(FILE_A); /* DO NOT assert */
+	errno = 0;
+	failure(access(FILE_A, F_OK));
+	error(ENOENT);
+
+	plp_ = pmemlog_create(FILE_A, POOLSIZE, 0600);
+	ck_assert_ptr_nonnull(plp_);
+	plz_ = pmemlogz_open(plp_, 0);
+	ck_assert_ptr_nonnull(plz_);
+	memset(&w_, 0, sizeof(w_));
+}
+
+static void teardown(void)
+{
+	if (plz_) {
+		pmemlogz_close(plz_);
+		plz_ = NULL;
+	}
+	if (plp_) {
+		pmemlog_close(plp_);
+		plp_ = NULL;
+	}
+	free(w_.buf);
+	w_.buf = NULL;
+}
+
+/* test cases */
+START_TEST(empty_OK)
+{
+	success(pmemlogz_flush(plz_));
+	ck_assert_int_eq(0, pmemlog_tell(plp_));
+	walk();
+	ck_assert_int_eq(0, w_.ncall);
+}
+END_TEST
+
+START_TEST(append_walk_OK)
+{
+	char *const text = malloc(PMEMLOGZ_FRAME * 3);
+	ck_assert_ptr_nonnull(text);
+	fill_text(text, PMEMLOGZ_FRAME * 3, 1);
+
+	/* records of every length up to 1000 bytes */
+	size_t off = 0;
+	for (size_t n = 1; off + n <= PMEMLOGZ_FRAME * 3; n = n % 1000 + 1) {
+		success(pmemlogz_append(plz_, text + off, n));
+		off += n;
+	}
+	/* nothing is in the pool until the last frame is flushed */
+	ck_assert_uint_lt((size_t)pmemlog_tell(plp_), off);
+	success(pmemlogz_flush(plz_));
+
+	walk();
+	ck_assert_uint_eq(off, w_.len);
+	ck_assert_mem_eq(text, w_.buf, off);
+	ck_assert_int_lt(1, w_.ncall);
+	/* and it did compress */
+	ck_assert_uint_lt((size_t)pmemlog_tell(plp_), off / 2);
+	free(text);
+}
+END_TEST
+
+START_TEST(codec_OK)
+{
+	char *const buf = malloc(PMEMLOGZ_FRAME);
+	ck_assert_ptr_nonnull(buf);
+	static const size_t LEN[] = {
+		1, 4, 5, 12, 13, 16, 17, 100, 270, 271, 4096, PMEMLOGZ_FRAME,
+	};
+	for (size_t i = 0; i < sizeof(LEN) / sizeof(LEN[0]); ++i) {
+		/* a run; matches overlap what they write */
+		memset(buf, 'z', LEN[i]);
+		round_trip(buf, LEN[i]);
+		/* a short period, with lengths over 15 and 270 */
+		for (size_t j = 0; j < LEN[i]; ++j)
+			buf[j] = (char)('a' + j % 7);
+		round_trip(buf, LEN[i]);
+		fill_text(buf, LEN[i], i + 1);
+		round_trip(buf, LEN[i]);
+		fill_random(buf, LEN[i], i + 1);
+		round_trip(buf, LEN[i]);
+	}
+	free(buf);
+}
+END_TEST
+
+START_TEST(incompressible_OK)
+{
+	char *const buf = malloc(PMEMLOGZ_FRAME);
+	ck_assert_ptr_nonnull(buf);
+	fill_random(buf, PMEMLOGZ_FRAME, 1);
+	round_trip(buf, PMEMLOGZ_FRAME);
+	/* stored as it is, behind an 8-byte frame header */
+	ck_assert_int_eq(PMEMLOGZ_FRAME + 8, pmemlog_tell(plp_));
+	free(buf);
+}
+END_TEST
+
+START_TEST(raw_OK)
+{
+	pmemlogz_close(plz_);
+	plz_ = pmemlogz_open(plp_, PMEMLOGZ_RAW);
+	ck_assert_ptr_nonnull(plz_);
+
+	char buf[4096];
+	memset(buf, 'z', sizeof(buf));
+	round_trip(buf, sizeof(buf));
+	ck_assert_int_eq(sizeof(buf) + 8, pmemlog_tell(plp_));
+}
+END_TEST
+
+START_TEST(large_record_OK)
+{
+	/* a record larger than a frame spans several */
+	const size_t len = PMEMLOGZ_FRAME * 3 + 17;
+	char *const buf = malloc(len);
+	ck_assert_ptr_nonnull(buf);
+	fill_text(buf, len, 1);
+	/* and is not put in a frame of its own */
+	success(pmemlogz_append(plz_, "x", 1));
+	success(pmemlogz_append(plz_, buf, len));
+	success(pmemlogz_flush(plz_));
+	walk();
+	ck_assert_uint_eq(len + 1, w_.len);
+	ck_assert_int_eq('x', w_.buf[0]);
+	ck_assert_mem_eq(buf, w_.buf + 1, len);
+	ck_assert_int_eq(4, w_.ncall);
+	free(buf);
+}
+END_TEST
+
+START_TEST(walk_stop_OK)
+{
+	char buf[PMEMLOGZ_FRAME / 2];
+	fill_text(buf, sizeof(buf), 1);
+	for (int i = 0; i < 4; ++i)
+		success(pmemlogz_append(plz_, buf, sizeof(buf)));
+	success(pmemlogz_flush(plz_));
+
+	w_.stop_after = 1;
+	success(pmemlogz_walk(plp_, collect, &w_));
+	ck_assert_int_eq(1, w_.ncall);
+	ck_assert_uint_eq(PMEMLOGZ_FRAME, w_.len);
+}
+END_TEST
+
+static void *thread_append(void *arg)
+{
+	const int t = (int)(intptr_t)arg;
+	char rec[RSIZE];
+	for (int i = 0; i < 5000; ++i) {
+		memset(rec, ' ', sizeof(rec));
+		snprintf(rec, sizeof(rec), "thread %d record %d", t, i);
+		if (pmemlogz_append(plz_, rec, sizeof(rec)) != 0)
+			return (void *)1;
+	}
+	/* the rest is appended when the thread exits */
+	return NULL;
+}
+
+START_TEST(threads_OK)
+{
+	pthread_t th[NTHREAD];
+	for (int t = 0; t < NTHREAD; ++t)
+		success(pthread_create(&th[t], NULL, thread_append,
+			(void *)(intptr_t)t));
+	for (int t = 0; t < NTHREAD; ++t) {
+		void *ret;
+		success(pthread_join(th[t], &ret));
+		ck_assert_ptr_null(ret);
+	}
+
+	walk();
+	ck_assert_uint_eq((size_t)NTHREAD * 5000 * RSIZE, w_.len);
+	int next[NTHREAD] = {0};
+	for (size_t off = 0; off < w_.len; off += RSIZE) {
+		int t, i;
+		ck_assert_int_eq(2, sscanf(w_.buf + off,
+			"thread %d record %d", &t, &i));
+		ck_assert_int_lt(t, NTHREAD);
+		/* the records of a thread are in order */
+		ck_assert_int_eq(next[t], i);
+		++next[t];
+	}
+}
+END_TEST
+
+START_TEST(close_OK)
+{
+	success(pmemlogz_append(plz_, "abc", 3));
+	ck_assert_int_eq(0, pmemlog_tell(plp_));
+	pmemlogz_close(plz_);
+	plz_ = NULL;
+	walk();
+	ck_assert_uint_eq(3, w_.len);
+	ck_assert_mem_eq("abc", w_.buf, 3);
+}
+END_TEST
+
+START_TEST(walk_EILSEQ)
+{
+	/* the frame claims more than it has */
+	const uint32_t f[2] = {100, 90};
+	success(pmemlog_append(plp_, f, sizeof(f)));
+	errno = 0;
+	failure(pmemlogz_walk(plp_, collect, &w_));
+	error(EILSEQ);
+
+	/* a compressed frame that decodes to less than it claims */
+	pmemlog_rewind(plp_);
+	char frame[8 + 11];
+	const uint32_t g[2] = {100, 11};
+	memcpy(frame, g, sizeof(g));
+	frame[8] = (char)0xA0; /* 10 literals, the last sequence */
+	memset(frame + 9, 'x', 10);
+	success(pmemlog_append(plp_, frame, sizeof(frame)));
+	errno = 0;
+	failure(pmemlogz_walk(plp_, collect, &w_));
+	error(EILSEQ);
+}
+END_TEST
+
+START_TEST(append_ENOSPC)
+{
+	char *const buf = malloc(PMEMLOGZ_FRAME);
+	ck_assert_ptr_nonnull(buf);
+	size_t n = 0;
+	int r;
+	do {
+		fill_random(buf, PMEMLOGZ_FRAME, ++n);
+		r = pmemlogz_append(plz_, buf, PMEMLOGZ_FRAME);
+	} while (r == 0 && n < POOLSIZE / PMEMLOGZ_FRAME + 1);
+	failure(r);
+	error(ENOSPC);
+	free(buf);
+
+	/* the frames that fit are intact */
+	walk();
+	ck_assert_uint_eq((n - 1) * PMEMLOGZ_FRAME, w_.len);
+}
+END_TEST
+
+int main()
+{
+	TCase *const tcase_dax = tcase_create("DAX");
+	tcase_add_unchecked_fixture(tcase_dax, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax, setup, teardown);
+	tcase_add_test(tcase_dax, empty_OK);
+	tcase_add_test(tcase_dax, append_walk_OK);
+	tcase_add_test(tcase_dax, codec_OK);
+	tcase_add_test(tcase_dax, incompressible_OK);
+	tcase_add_test(tcase_dax, raw_OK);
+	tcase_add_test(tcase_dax, large_record_OK);
+	tcase_add_test(tcase_dax, walk_stop_OK);
+	tcase_add_test(tcase_dax, threads_OK);
+	tcase_add_test(tcase_dax, close_OK);
+	tcase_add_test(tcase_dax, walk_EILSEQ);
+	tcase_add_test(tcase_dax, append_ENOSPC);
+
+	TCase *const tcase_nondax = tcase_create("non-DAX");
+	tcase_add_unchecked_fixture(tcase_nondax, setup_once_nondaxfs, NULL);
+	tcase_add_checked_fixture(tcase_nondax, setup, teardown);
+	tcase_add_test(tcase_nondax, empty_OK);
+	tcase_add_test(tcase_nondax, append_walk_OK);
+	tcase_add_test(tcase_nondax, codec_OK);
+	tcase_add_test(tcase_nondax, incompressible_OK);
+	tcase_add_test(tcase_nondax, raw_OK);
+	tcase_add_test(tcase_nondax, large_record_OK);
+	tcase_add_test(tcase_nondax, walk_stop_OK);
+	tcase_add_test(tcase_nondax, threads_OK);
+	tcase_add_test(tcase_nondax, close_OK);
+	tcase_add_test(tcase_nondax, walk_EILSEQ);
+	tcase_add_test(tcase_nondax, append_ENOSPC);
+
+	Suite *const suite = suite_create("pmemlogz");
+	suite_add_tcase(suite, tcase_dax);
+	suite_add_tcase(suite, tcase_nondax);
+
+	SRunner *const srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	const int failed = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+
+	return !!failed;
+}
@@ -0,0 +1,214 @@
+#include "config.h" /* should be included first */
+
+#include <check.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkplus.h"
+#include "pmemmap.h"
+
+#ifndef DIR_DAX
+#define DIR_DAX "/mnt/pmem0/tmp"
+#endif
+#ifndef DIR_NONDAX
+#define DIR_NONDAX "/tmp"
+#endif
+#define FILE_A "foo"
+
+#define LEN (PMEMMAP_HUGE_SIZE * 2)
+
+/* global variables */
+static void *addr_ = NULL;
+
+/* util functions */
+static void assert_huge_aligned(const void *addr)
+{
+	ck_assert_uint_eq(0, (uintptr_t)addr & (PMEMMAP_HUGE_SIZE - 1));
+}
+
+/* fixtures */
+static void setup_once_daxfs(void)
+{
+	success(chdir(DIR_DAX));
+}
+
+static void setup_once_nondaxfs(void)
+{
+	success(chdir(DIR_NONDAX));
+}
+
+static void setup(void)
+{
+	unlink(FILE_A); /* DO NOT assert */
+	errno = 0;
+	failure(access(FILE_A, F_OK));
+	error(ENOENT);
+}
+
+static void teardown(void)
+{
+	if (addr_) {
+		success(pmemmap_unmap(addr_, LEN));
+		addr_ = NULL;
+	}
+}
+
+/* test cases */
+START_TEST(mode_parse_OK)
+{
+	for (int m = PMEMMAP_PMEM; m <= PMEMMAP_HUGETLB; ++m)
+		ck_assert_int_eq(m, pmemmap_mode_parse(pmemmap_mode_name(m)));
+	ck_assert_int_eq(-1, pmemmap_mode_parse("4k"));
+	ck_assert_ptr_null(pmemmap_mode_name(-1));
+}
+END_TEST
+
+START_TEST(create_pmem_OK)
+{
+	size_t mapped_len = 0;
+	int is_pmem = -1;
+	addr_ = pmemmap_create(FILE_A, LEN, 0600, PMEMMAP_PMEM,
+		&mapped_len, &is_pmem);
+	ck_assert_ptr_nonnull(addr_);
+	ck_assert_uint_eq(LEN, mapped_len);
+	ck_assert_int_ne(-1, is_pmem);
+	memset(addr_, 'A', LEN);
+}
+END_TEST
+
+START_TEST(create_aligned_OK)
+{
+	size_t mapped_len = 0;
+	int is_pmem = -1;
+	addr_ = pmemmap_create(FILE_A, LEN, 0600, PMEMMAP_ALIGNED,
+		&mapped_len, &is_pmem);
+	ck_assert_ptr_nonnull(addr_);
+	assert_huge_aligned(addr_);
+	ck_assert_uint_eq(LEN, mapped_len);
+	ck_assert_int_ne(-1, is_pmem);
+
+	/* fully allocated */
+	struct stat st;
+	success(stat(FILE_A, &st));
+	ck_assert_uint_eq(LEN, st.st_size);
+	ck_assert_uint_le(LEN, (size_t)st.st_blocks * 512);
+
+	/* the mapping is the file */
+	memset(addr_, 'A', LEN);
+	success(msync(addr_, LEN, MS_SYNC));
+	const int fd = open(FILE_A, O_RDONLY);
+	opened(fd);
+	char buf[4096];
+	ck_assert_int_eq(sizeof(buf), pread(fd, buf, sizeof(buf),
+		(off_t)(LEN - sizeof(buf))));
+	ck_assert_mem_eq((char *)addr_ + LEN - sizeof(buf), buf, sizeof(buf));
+	success(close(fd));
+
+	const long long huge = pmemmap_huge_bytes(addr_, LEN);
+	ck_assert_int_le(0, huge);
+	ck_assert_int_le(huge, LEN);
+}
+END_TEST
+
+START_TEST(create_aligned_EEXIST)
+{
+	addr_ = pmemmap_create(FILE_A, LEN, 0600, PMEMMAP_ALIGNED, NULL, NULL);
+	ck_assert_ptr_nonnull(addr_);
+
+	errno = 0;
+	ck_assert_ptr_null(pmemmap_create(FILE_A, LEN, 0600,
+		PMEMMAP_ALIGNED, NULL, NULL));
+	error(EEXIST);
+}
+END_TEST
+
+START_TEST(create_thp_OK)
+{
+	addr_ = pmemmap_create(NULL, LEN, 0600, PMEMMAP_THP, NULL, NULL);
+	ck_assert_ptr_nonnull(addr_);
+	assert_huge_aligned(addr_);
+	memset(addr_, 'A', LEN);
+
+	/* THP may be disabled or out of memory; do not require it */
+	const long long huge = pmemmap_huge_bytes(addr_, LEN);
+	ck_assert_int_le(0, huge);
+	ck_assert_int_le(huge, LEN);
+
+	/* no file is made */
+	errno = 0;
+	failure(access(FILE_A, F_OK));
+	error(ENOENT);
+}
+END_TEST
+
+START_TEST(create_hugetlb_OK_or_ENOMEM)
+{
+	errno = 0;
+	addr_ = pmemmap_create(NULL, LEN, 0600, PMEMMAP_HUGETLB, NULL, NULL);
+	if (!addr_) {
+		/* vm.nr_hugepages is too small */
+		error(ENOMEM);
+		return;
+	}
+	assert_huge_aligned(addr_);
+	memset(addr_, 'A', LEN);
+	ck_assert_int_eq(LEN, pmemmap_huge_bytes(addr_, LEN));
+}
+END_TEST
+
+START_TEST(create_EINVAL)
+{
+	/* huge-page modes need whole huge pages */
+	errno = 0;
+	ck_assert_ptr_null(pmemmap_create(FILE_A, LEN - 4096, 0600,
+		PMEMMAP_ALIGNED, NULL, NULL));
+	error(EINVAL);
+
+	errno = 0;
+	ck_assert_ptr_null(pmemmap_create(FILE_A, LEN, 0600, -1, NULL, NULL));
+	error(EINVAL);
+}
+END_TEST
+
+int main()
+{
+	TCase *const tcase_dax = tcase_create("DAX");
+	tcase_add_unchecked_fixture(tcase_dax, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax, setup, teardown);
+	tcase_add_test(tcase_dax, mode_parse_OK);
+	tcase_add_test(tcase_dax, create_pmem_OK);
+	tcase_add_test(tcase_dax, create_aligned_OK);
+	tcase_add_test(tcase_dax, create_aligned_EEXIST);
+	tcase_add_test(tcase_dax, create_thp_OK);
+	tcase_add_test(tcase_dax, create_hugetlb_OK_or_ENOMEM);
+	tcase_add_test(tcase_dax, create_EINVAL);
+
+	TCase *const tcase_nondax = tcase_create("non-DAX");
+	tcase_add_unchecked_fixture(tcase_nondax, setup_once_nondaxfs, NULL);
+	tcase_add_checked_fixture(tcase_nondax, setup, teardown);
+	tcase_add_test(tcase_nondax, mode_parse_OK);
+	tcase_add_test(tcase_nondax, create_pmem_OK);
+	tcase_add_test(tcase_nondax, create_aligned_OK);
+	tcase_add_test(tcase_nondax, create_aligned_EEXIST);
+	tcase_add_test(tcase_nondax, create_thp_OK);
+	tcase_add_test(tcase_nondax, create_hugetlb_OK_or_ENOMEM);
+	tcase_add_test(tcase_nondax, create_EINVAL);
+
+	Suite *const suite = suite_create("pmemmap");
+	suite_add_tcase(suite, tcase_dax);
+	suite_add_tcase(suite, tcase_nondax);
+
+	SRunner *const srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	const int failed = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+
+	return !!failed;
+}
@@ -1,3 +1,5 @@
+#include "config.h" /* should be included first */
+
 #include <assert.h>
 #include <immintrin.h> /* AVX */
 #include <xmmintrin.h> /* SSE2 (SFENCE) */
@@ -9,6 +11,20 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "perfplus.h"
+#include "pmemmap.h"
+
+/*
+ * Usage: perf [-m pmem|aligned|thp|hugetlb] [libc|libpmem|avx]
+ *
+ * Copies 1 GiB from DRAM to a mapping made by pmemmap_create() in the
+ * given mode (pmem by default), and prints the time of each step in usec
+ * followed by the dTLB and LLC misses of the whole copy (-1 if
+ * perf_event_open(2) is not allowed):
+ *
+ *   total  memcopy  flush  drain  dTLB-misses  LLC-misses
+ */
+
 static void *memcopy_avx(void *dst, const void *src, size_t len)
 {
 	__m256i ymm0, ymm1, ymm2, ymm3, ymm4, ymm5, ymm6, ymm7,
@@ -73,18 +89,24 @@ static void drain_sfence(void)
 	_mm_sfence();
 }
 
-static long elapsed_us(const struct timespec *s, const struct timespec *e)
+static void usage(const char *argv0)
 {
-	return (long)(e->tv_sec - s->tv_sec) * 1000000L
-		+ (e->tv_nsec - s->tv_nsec) / 1000L;
+	fprintf(stderr, "usage: %s [-m pmem|aligned|thp|hugetlb] "
+		"[libc|libpmem|avx]\n", argv0);
+	exit(1);
 }
 
 int main(int argc, char **argv)
 {
-	static const char *const TMPFILE = "/mnt/pmem0/tmp/perftest";
 	static const size_t NB1G = 1 << 30;
 
 	int r = 0;
+	int mode = PMEMMAP_PMEM;
+	int opt;
+	while ((opt = getopt(argc, argv, "m:")) != -1) {
+		if (opt != 'm' || (mode = pmemmap_mode_parse(optarg)) < 0)
+			usage(argv[0]);
+	}
 
 	/* this is how memmove_nodrain_normal() does */
 	void *(*fun_memcopy)(void *, const void *, size_t) = memmove;
@@ -92,13 +114,13 @@ int main(int argc, char **argv)
 	void (*fun_drain)(void) = pmem_drain;
 	size_t alignment = sizeof(void *);
 
-	if (argc > 1) {
-		if (strcmp(argv[1], "libpmem") == 0) {
+	if (optind < argc) {
+		if (strcmp(argv[optind], "libpmem") == 0) {
 			fun_memcopy = pmem_memmove_nodrain;
 			fun_flush = flush_nop;
 			fun_drain = pmem_drain;
 			alignment = 16;
-		} else if (strcmp(argv[1], "avx") == 0) {
+		} else if (strcmp(argv[optind], "avx") == 0) {
 			fun_memcopy = memcopy_avx;
 			fun_flush = flush_nop;
 			fun_drain = drain_sfence;
@@ -106,13 +128,13 @@ int main(int argc, char **argv)
 		}
 	}
 
-	unlink(TMPFILE);
+	const char *const tmpfile = perf_tmpfile();
+	unlink(tmpfile);
 
 	size_t mapped_len = 0;
 	int is_pmem = 0;
-	char *const dst = pmem_map_file(
-		TMPFILE, NB1G,
-		PMEM_FILE_CREATE|PMEM_FILE_EXCL, 0600,
+	char *const dst = pmemmap_create(
+		tmpfile, NB1G, 0600, mode,
 		&mapped_len, &is_pmem);
 	assert(dst != NULL);
 	assert(((uintptr_t)dst & (alignment - 1)) == 0);
@@ -123,7 +145,11 @@ int main(int argc, char **argv)
 	assert(src != NULL);
 	memset(src, ~0, NB1G);
 
+	struct perf_misses misses;
+	perf_misses_open(&misses);
+
 	struct timespec t[4] = {{0},{0},{0},{0}};
+	perf_misses_start(&misses);
 	r = clock_gettime(CLOCK_MONOTONIC, &t[0]);
 	assert(r == 0);
 
@@ -138,6 +164,12 @@ int main(int argc, char **argv)
 	fun_drain();
 	r = clock_gettime(CLOCK_MONOTONIC, &t[3]);
 	assert(r == 0);
+	perf_misses_stop(&misses);
+	perf_misses_close(&misses);
+
+	/* the kernel is free to fall back to 4 KiB pages */
+	if (mode != PMEMMAP_PMEM && pmemmap_huge_bytes(dst, NB1G) <= 0)
+		fprintf(stderr, "%s: no huge pages\n", pmemmap_mode_name(mode));
 
 	assert(memcmp(dst, src, NB1G) == 0);
 
@@ -145,8 +177,14 @@ int main(int argc, char **argv)
 	const long flush_us   = elapsed_us(&t[1], &t[2]);
 	const long drain_us   = elapsed_us(&t[2], &t[3]);
 	const long total_us   = memcopy_us + flush_us + drain_us;
-	printf("%ld\t%ld\t%ld\t%ld\n",
-		total_us, memcopy_us, flush_us, drain_us);
+	printf("%ld\t%ld\t%ld\t%ld\t%lld\t%lld\n",
+		total_us, memcopy_us, flush_us, drain_us,
+		misses.dtlb, misses.llc);
+
+	free(src);
+	pmemmap_unmap(dst, mapped_len);
+	if (mode == PMEMMAP_PMEM || mode == PMEMMAP_ALIGNED)
+		unlink(tmpfile);
 
 #ifdef NDEBUG
 	(void)r;
@@ -0,0 +1,193 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+#include "pmemarena.h"
+
+/*
+ * Usage: perf_arena [arena|locked|malloc] [nthreads]
+ *
+ * Each thread keeps WINDOW slots and, for OPS times, frees a random
+ * slot if it is live or fills it with a new object of random size.
+ * Prints mode, threads, operations/sec and fragmentation, that is,
+ * 1 - (live bytes requested) / (bytes taken from the pool or the OS).
+ *
+ * "locked" is pmemarena without its thread caches, behind a single
+ * global lock; the baseline for what the thread caches buy.
+ */
+
+#define WINDOW 4096
+#define OPS    (1 << 21)
+
+enum mode { ARENA, LOCKED, MALLOC };
+
+static enum mode mode_ = ARENA;
+static PMEMarena *pap_ = NULL;
+static pthread_mutex_t lock_ = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t barrier_;
+
+struct worker {
+	pthread_t th;
+	uint64_t seed;
+	size_t live; /* bytes requested and not freed */
+	void *slot[WINDOW];
+	size_t size[WINDOW];
+};
+
+static void *do_alloc(size_t size)
+{
+	void *p = NULL;
+	switch (mode_) {
+	case ARENA:
+		p = pmemarena_alloc(pap_, size);
+		break;
+	case LOCKED:
+		pthread_mutex_lock(&lock_);
+		p = pmemarena_alloc(pap_, size);
+		pthread_mutex_unlock(&lock_);
+		break;
+	case MALLOC:
+		p = malloc(size);
+		break;
+	}
+	return p;
+}
+
+static void do_free(void *p)
+{
+	switch (mode_) {
+	case ARENA:
+		pmemarena_free(pap_, p);
+		break;
+	case LOCKED:
+		pthread_mutex_lock(&lock_);
+		pmemarena_free(pap_, p);
+		pthread_mutex_unlock(&lock_);
+		break;
+	case MALLOC:
+		free(p);
+		break;
+	}
+}
+
+static void *worker(void *arg)
+{
+	struct worker *const w = arg;
+
+	pthread_barrier_wait(&barrier_);
+	for (int i = 0; i < OPS; ++i) {
+		const uint64_t r = perf_rand(&w->seed);
+		const size_t k = (size_t)(r % WINDOW);
+		if (w->slot[k]) {
+			do_free(w->slot[k]);
+			w->slot[k] = NULL;
+			w->live -= w->size[k];
+		} else {
+			/* log-uniform from 16 bytes to 4 KiB */
+			const size_t max = (size_t)16 << ((r >> 32) % 9);
+			const size_t size = (size_t)((r >> 16) % max) + 1;
+			w->slot[k] = do_alloc(size);
+			assert(w->slot[k] != NULL);
+			/* touch it as an application would */
+			memset(w->slot[k], 0, size);
+			w->size[k] = size;
+			w->live += size;
+		}
+	}
+	pthread_barrier_wait(&barrier_);
+	return NULL;
+}
+
+static size_t rss_bytes(void)
+{
+	long pages = 0, rss = 0;
+	FILE *const fp = fopen("/proc/self/statm", "r");
+	assert(fp != NULL);
+	const int n = fscanf(fp, "%ld %ld", &pages, &rss);
+	assert(n == 2);
+	fclose(fp);
+	(void)n;
+	return (size_t)rss * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t NB1G = 1 << 30;
+
+	const char *mode_name = "arena";
+	if (argc > 1) {
+		mode_name = argv[1];
+		if (strcmp(mode_name, "locked") == 0)
+			mode_ = LOCKED;
+		else if (strcmp(mode_name, "malloc") == 0)
+			mode_ = MALLOC;
+	}
+	const int nthreads = argc > 2 ? atoi(argv[2]) : 1;
+	assert(nthreads > 0);
+
+	const char *const path = perf_tmpfile();
+	if (mode_ != MALLOC) {
+		unlink(path);
+		pap_ = pmemarena_create(path, NB1G, 0600);
+		assert(pap_ != NULL);
+		if (mode_ == LOCKED)
+			pmemarena_set_tcache(pap_, 0);
+	}
+
+	struct worker *const w = calloc((size_t)nthreads, sizeof(*w));
+	assert(w != NULL);
+	int r = pthread_barrier_init(&barrier_, NULL, (unsigned)nthreads + 1);
+	assert(r == 0);
+	for (int i = 0; i < nthreads; ++i) {
+		w[i].seed = 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1);
+		r = pthread_create(&w[i].th, NULL, worker, &w[i]);
+		assert(r == 0);
+	}
+
+	const size_t rss0 = rss_bytes();
+	struct timespec t[2] = {{0},{0}};
+	pthread_barrier_wait(&barrier_);
+	r = clock_gettime(CLOCK_MONOTONIC, &t[0]);
+	assert(r == 0);
+	pthread_barrier_wait(&barrier_);
+	r = clock_gettime(CLOCK_MONOTONIC, &t[1]);
+	assert(r == 0);
+
+	size_t live = 0;
+	for (int i = 0; i < nthreads; ++i) {
+		r = pthread_join(w[i].th, NULL);
+		assert(r == 0);
+		live += w[i].live;
+	}
+
+	size_t footprint = 0;
+	if (mode_ == MALLOC) {
+		footprint = rss_bytes() - rss0;
+	} else {
+		struct pmemarena_stats st;
+		pmemarena_stats(pap_, &st);
+		footprint = st.footprint;
+	}
+
+	const double sec = (double)elapsed_us(&t[0], &t[1]) / 1e6;
+	const double ops = (double)OPS * nthreads / sec;
+	const double frag = footprint ? 1.0 - (double)live / footprint : 0.0;
+	printf("%s\t%d\t%.0f\t%.3f\n", mode_name, nthreads, ops, frag);
+
+	if (pap_) {
+		pmemarena_close(pap_);
+		unlink(path);
+	}
+	free(w);
+#ifdef NDEBUG
+	(void)r;
+#endif
+	return 0;
+}
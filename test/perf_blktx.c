@@ -0,0 +1,172 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <libpmemblk.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+#include "pmemblktx.h"
+
+/*
+ * Usage: perf_blktx [tx|journal|block] [blocks-per-tx] [nthreads]
+ *
+ * Each thread updates blocks-per-tx random blocks at a time until it has
+ * written NBLOCKS blocks, and the total rate is printed:
+ *
+ *   mode  blocks-per-tx  nthreads  blocks/sec
+ *
+ * tx       pmemblktx_commit().
+ * journal  what an application does without pmemblktx: write the blocks
+ *          to a journal area of the pool, write a journal header, write
+ *          the blocks in place, then clear the header.
+ * block    pmemblk_write() of each block; not atomic, for reference.
+ */
+
+#define POOLSIZE ((size_t)1 << 30)
+#define LOGSIZE  ((size_t)1 << 26)
+#define BSIZE    ((size_t)4096)
+#define NBLOCKS  (1 << 16)
+
+enum mode { MODE_TX, MODE_JOURNAL, MODE_BLOCK };
+
+static PMEMblkpool *pbp_ = NULL;
+static PMEMblktx *ptx_ = NULL;
+static enum mode mode_ = MODE_TX;
+static int k_ = 1;
+static long long ndata_ = 0; /* blocks before the journal areas */
+
+/* journal header of an application */
+struct journal {
+	uint64_t seq;
+	uint64_t n;
+	long long blockno[(BSIZE - 16) / sizeof(long long)];
+};
+
+static void *worker(void *arg)
+{
+	const int id = (int)(intptr_t)arg;
+	uint64_t seed = (uint64_t)id + 1;
+	char *const buf = malloc(BSIZE * (size_t)k_);
+	struct pmemblktx_write *const w = calloc((size_t)k_, sizeof(*w));
+	struct journal *const j = calloc(1, sizeof(*j));
+	assert(buf && w && j);
+	memset(buf, id, BSIZE * (size_t)k_);
+
+	/* a header block and k_ blocks per thread */
+	const long long jarea = ndata_ + (long long)id * (k_ + 1);
+	int r = 0;
+	for (int n = 0; n < NBLOCKS; n += k_) {
+		for (int i = 0; i < k_; ++i) {
+			w[i].blockno = (long long)(perf_rand(&seed)
+				% (uint64_t)ndata_);
+			w[i].buf = buf + (size_t)i * BSIZE;
+		}
+		switch (mode_) {
+		case MODE_TX:
+			r = pmemblktx_commit(ptx_, w, k_, 0);
+			assert(r == 0);
+			break;
+		case MODE_JOURNAL:
+			for (int i = 0; i < k_; ++i) {
+				r = pmemblk_write(pbp_, w[i].buf, jarea + 1 + i);
+				assert(r == 0);
+				j->blockno[i] = w[i].blockno;
+			}
+			j->seq++;
+			j->n = (uint64_t)k_;
+			r = pmemblk_write(pbp_, j, jarea);
+			assert(r == 0);
+			for (int i = 0; i < k_; ++i) {
+				r = pmemblk_write(pbp_, w[i].buf, w[i].blockno);
+				assert(r == 0);
+			}
+			j->n = 0;
+			r = pmemblk_write(pbp_, j, jarea);
+			assert(r == 0);
+			break;
+		case MODE_BLOCK:
+			for (int i = 0; i < k_; ++i) {
+				r = pmemblk_write(pbp_, w[i].buf, w[i].blockno);
+				assert(r == 0);
+			}
+			break;
+		}
+	}
+	(void)r;
+	free(j);
+	free(w);
+	free(buf);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *const NAME[] = {"tx", "journal", "block"};
+
+	if (argc > 1) {
+		if (strcmp(argv[1], "journal") == 0)
+			mode_ = MODE_JOURNAL;
+		else if (strcmp(argv[1], "block") == 0)
+			mode_ = MODE_BLOCK;
+		else if (strcmp(argv[1], "tx") != 0)
+			return 1;
+	}
+	k_ = argc > 2 ? atoi(argv[2]) : 1;
+	const int nthreads = argc > 3 ? atoi(argv[3]) : 1;
+	assert(k_ > 0 && k_ <= (int)(sizeof(((struct journal *)0)->blockno)
+		/ sizeof(long long)));
+	assert(nthreads > 0);
+
+	int r = 0;
+	char logpath[4096];
+	snprintf(logpath, sizeof(logpath), "%s.txlog", perf_tmpfile());
+	const char *const path = perf_tmpfile();
+	unlink(path);
+	unlink(logpath);
+
+	pbp_ = pmemblk_create(path, BSIZE, POOLSIZE, 0600);
+	assert(pbp_ != NULL);
+	ndata_ = (long long)pmemblk_nblock(pbp_) - (long long)nthreads * (k_ + 1);
+	assert(ndata_ > 0);
+	if (mode_ == MODE_TX) {
+		ptx_ = pmemblktx_create(pbp_, logpath, LOGSIZE, 0600);
+		assert(ptx_ != NULL);
+		assert(k_ <= pmemblktx_max_write(ptx_));
+	}
+
+	pthread_t *const th = calloc((size_t)nthreads, sizeof(*th));
+	assert(th != NULL);
+	struct timespec t[2] = {{0},{0}};
+	r = clock_gettime(CLOCK_MONOTONIC, &t[0]);
+	assert(r == 0);
+	for (int i = 0; i < nthreads; ++i) {
+		r = pthread_create(&th[i], NULL, worker, (void *)(intptr_t)i);
+		assert(r == 0);
+	}
+	for (int i = 0; i < nthreads; ++i) {
+		r = pthread_join(th[i], NULL);
+		assert(r == 0);
+	}
+	r = clock_gettime(CLOCK_MONOTONIC, &t[1]);
+	assert(r == 0);
+
+	const long nblocks = (long)((NBLOCKS + k_ - 1) / k_ * k_) * nthreads;
+	printf("%s\t%d\t%d\t%.0f\n", NAME[mode_], k_, nthreads,
+		(double)nblocks * 1e6 / (double)elapsed_us(&t[0], &t[1]));
+
+	free(th);
+	if (ptx_)
+		pmemblktx_close(ptx_);
+	pmemblk_close(pbp_);
+	unlink(logpath);
+	unlink(path);
+#ifdef NDEBUG
+	(void)r;
+#endif
+	return 0;
+}
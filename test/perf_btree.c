@@ -0,0 +1,222 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <search.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+#include "pmembtree.h"
+
+/*
+ * Usage: perf_btree [nkey]
+ *
+ * Inserts nkey random keys into pmembtree and into a DRAM-only
+ * baseline, then prints one line per operation:
+ *
+ *   insert   pmembtree|dram  inserts/sec
+ *   lookup   pmembtree|dram  lookups/sec
+ *   scan     pmembtree|dram  keys/sec in scans of SCANLEN keys
+ *   recover  pmembtree       usec to pmembtree_open()
+ *   recover  dram            usec to rebuild the tree from the keys
+ *
+ * The baseline is what a C program has for std::map: a tsearch(3)
+ * red-black tree. tsearch has no range query, so the baseline scan
+ * runs over a sorted array with bsearch(3) instead, which is an upper
+ * bound for any DRAM tree.
+ */
+
+#define NLOOKUP (1 << 20)
+#define NSCAN   (1 << 14)
+#define SCANLEN 100
+
+static uint64_t *keys_ = NULL;
+static size_t nkey_ = 0;
+
+static int key_compare(const void *a, const void *b)
+{
+	const uint64_t ka = *(const uint64_t *)a;
+	const uint64_t kb = *(const uint64_t *)b;
+	return (ka > kb) - (ka < kb);
+}
+
+/* callback function passed to pmembtree_scan */
+static int count_entry(uint64_t key, uint64_t value, void *arg)
+{
+	size_t *const n = arg;
+	(void)key;
+	(void)value;
+	return ++*n < SCANLEN;
+}
+
+static void *dram_build(void)
+{
+	void *root = NULL;
+	for (size_t i = 0; i < nkey_; ++i) {
+		void *const r = tsearch(&keys_[i], &root, key_compare);
+		assert(r != NULL);
+		(void)r;
+	}
+	return root;
+}
+
+/* tdestroy(3) is a GNU extension */
+static void dram_destroy(void *root)
+{
+	for (size_t i = 0; i < nkey_; ++i)
+		tdelete(&keys_[i], &root, key_compare);
+}
+
+static void print_rate(const char *op, const char *impl, size_t n,
+		const struct timespec *t)
+{
+	printf("%s\t%s\t%.0f\n", op, impl,
+		(double)n * 1e6 / (double)elapsed_us(&t[0], &t[1]));
+}
+
+int main(int argc, char **argv)
+{
+	nkey_ = argc > 1 ? (size_t)atol(argv[1]) : (size_t)1 << 22;
+	assert(nkey_ > 0);
+
+	int r = 0;
+	const char *const path = perf_tmpfile();
+	unlink(path);
+
+	keys_ = malloc(nkey_ * sizeof(*keys_));
+	assert(keys_ != NULL);
+	uint64_t seed = 1;
+	for (size_t i = 0; i < nkey_; ++i)
+		keys_[i] = perf_rand(&seed);
+
+	/* leaves are at least half full; leave room for the inner levels */
+	PMEMbtree *pbt = pmembtree_create(path,
+		PMEMBTREE_MIN_POOL + nkey_ * 64, 0600);
+	assert(pbt != NULL);
+
+	struct timespec t[2] = {{0},{0}};
+
+	/* insert */
+	r = clock_gettime(CLOCK_MONOTONIC, &t[0]);
+	assert(r == 0);
+	for (size_t i = 0; i < nkey_; ++i) {
+		r = pmembtree_insert(pbt, keys_[i], i);
+		assert(r == 0);
+	}
+	r = clock_gettime(CLOCK_MONOTONIC, &t[1]);
+	assert(r == 0);
+	print_rate("insert", "pmembtree", nkey_, t);
+
+	r = clock_gettime(CLOCK_MONOTONIC, &t[0]);
+	assert(r == 0);
+	void *dram = dram_build();
+	r = clock_gettime(CLOCK_MONOTONIC, &t[1]);
+	assert(r == 0);
+	print_rate("insert", "dram", nkey_, t);
+
+	/* point lookup */
+	uint64_t sum = 0, value = 0;
+	seed = 2;
+	r = clock_gettime(CLOCK_MONOTONIC, &t[0]);
+	assert(r == 0);
+	for (int i = 0; i < NLOOKUP; ++i) {
+		r = pmembtree_lookup(pbt, keys_[perf_rand(&seed) % nkey_],
+			&value);
+		assert(r == 0);
+		sum += value;
+	}
+	r = clock_gettime(CLOCK_MONOTONIC, &t[1]);
+	assert(r == 0);
+	print_rate("lookup", "pmembtree", NLOOKUP, t);
+
+	seed = 2;
+	r = clock_gettime(CLOCK_MONOTONIC, &t[0]);
+	assert(r == 0);
+	for (int i = 0; i < NLOOKUP; ++i) {
+		void *const p = tfind(&keys_[perf_rand(&seed) % nkey_],
+			&dram, key_compare);
+		assert(p != NULL);
+		sum += **(uint64_t **)p;
+	}
+	r = clock_gettime(CLOCK_MONOTONIC, &t[1]);
+	assert(r == 0);
+	print_rate("lookup", "dram", NLOOKUP, t);
+
+	/* scan */
+	size_t nscanned = 0;
+	seed = 3;
+	r = clock_gettime(CLOCK_MONOTONIC, &t[0]);
+	assert(r == 0);
+	for (int i = 0; i < NSCAN; ++i) {
+		size_t n = 0;
+		pmembtree_scan(pbt, perf_rand(&seed), UINT64_MAX,
+			count_entry, &n);
+		nscanned += n;
+	}
+	r = clock_gettime(CLOCK_MONOTONIC, &t[1]);
+	assert(r == 0);
+	print_rate("scan", "pmembtree", nscanned, t);
+
+	uint64_t *const sorted = malloc(nkey_ * sizeof(*sorted));
+	assert(sorted != NULL);
+	memcpy(sorted, keys_, nkey_ * sizeof(*sorted));
+	qsort(sorted, nkey_, sizeof(*sorted), key_compare);
+	nscanned = 0;
+	seed = 3;
+	r = clock_gettime(CLOCK_MONOTONIC, &t[0]);
+	assert(r == 0);
+	for (int i = 0; i < NSCAN; ++i) {
+		const uint64_t lo = perf_rand(&seed);
+		size_t l = 0, h = nkey_;
+		while (l < h) {
+			const size_t m = l + (h - l) / 2;
+			if (sorted[m] < lo)
+				l = m + 1;
+			else
+				h = m;
+		}
+		for (size_t n = 0; n < SCANLEN && l < nkey_; ++n, ++l) {
+			sum += sorted[l];
+			++nscanned;
+		}
+	}
+	r = clock_gettime(CLOCK_MONOTONIC, &t[1]);
+	assert(r == 0);
+	print_rate("scan", "dram", nscanned, t);
+
+	/* recovery */
+	pmembtree_close(pbt);
+	r = clock_gettime(CLOCK_MONOTONIC, &t[0]);
+	assert(r == 0);
+	pbt = pmembtree_open(path);
+	assert(pbt != NULL);
+	r = clock_gettime(CLOCK_MONOTONIC, &t[1]);
+	assert(r == 0);
+	assert(pmembtree_count(pbt) == nkey_);
+	printf("recover\tpmembtree\t%ld\n", elapsed_us(&t[0], &t[1]));
+
+	dram_destroy(dram);
+	r = clock_gettime(CLOCK_MONOTONIC, &t[0]);
+	assert(r == 0);
+	dram = dram_build();
+	r = clock_gettime(CLOCK_MONOTONIC, &t[1]);
+	assert(r == 0);
+	printf("recover\tdram\t%ld\n", elapsed_us(&t[0], &t[1]));
+
+	/* keep the loops above from being optimized away */
+	if (sum == 0)
+		fprintf(stderr, "sum %lu\n", (unsigned long)sum);
+
+	dram_destroy(dram);
+	free(sorted);
+	free(keys_);
+	pmembtree_close(pbt);
+	unlink(path);
+#ifdef NDEBUG
+	(void)r;
+#endif
+	return 0;
+}
@@ -0,0 +1,100 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <libpmem.h>
+#include <libpmemblk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+#include "pmembulk.h"
+
+/*
+ * Usage: perf_bulk [memset|blk] [nthreads]
+ *
+ * memset creates a POOLSIZE file with pmem_map_file() and fills it twice
+ * with pmembulk_memset(); the first pass also faults the pages in, as
+ * when provisioning a new pool. blk creates a pmemblk pool on it and
+ * zeroes every block with pmembulk_blk_set_zero(). Prints:
+ *
+ *   memset  nthreads  first-GiB/s  again-GiB/s
+ *   blk     nthreads  blocks/sec   GiB/s
+ *
+ * nthreads 1 is the single-threaded baseline.
+ */
+
+#define POOLSIZE ((size_t)1 << 30)
+#define BSIZE    ((size_t)4096)
+
+static double gib_per_sec(size_t len, const struct timespec *t0,
+		const struct timespec *t1)
+{
+	return (double)len / (double)(1 << 30) * 1e6
+		/ (double)elapsed_us(t0, t1);
+}
+
+static void run_memset(const char *path, int nthreads)
+{
+	size_t mapped_len;
+	int is_pmem;
+	unlink(path);
+	void *const addr = pmem_map_file(path, POOLSIZE,
+		PMEM_FILE_CREATE|PMEM_FILE_EXCL, 0600, &mapped_len, &is_pmem);
+	assert(addr != NULL);
+
+	struct timespec t0, t1, t2;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	int r = pmembulk_memset(addr, 0, mapped_len, nthreads);
+	assert(r == 0);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	r = pmembulk_memset(addr, 0xA5, mapped_len, nthreads);
+	assert(r == 0);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	(void)r;
+
+	printf("memset\t%d\t%.2f\t%.2f\n", nthreads,
+		gib_per_sec(mapped_len, &t0, &t1),
+		gib_per_sec(mapped_len, &t1, &t2));
+	pmem_unmap(addr, mapped_len);
+	unlink(path);
+}
+
+static void run_blk(const char *path, int nthreads)
+{
+	unlink(path);
+	PMEMblkpool *const pbp = pmemblk_create(path, BSIZE, POOLSIZE, 0600);
+	assert(pbp != NULL);
+	const long long nblock = (long long)pmemblk_nblock(pbp);
+
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	const int r = pmembulk_blk_set_zero(pbp, 0, nblock, nthreads);
+	assert(r == 0);
+	(void)r;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	printf("blk\t%d\t%.0f\t%.2f\n", nthreads,
+		(double)nblock * 1e6 / (double)elapsed_us(&t0, &t1),
+		gib_per_sec((size_t)nblock * BSIZE, &t0, &t1));
+	pmemblk_close(pbp);
+	unlink(path);
+}
+
+int main(int argc, char **argv)
+{
+	const char *const mode = argc > 1 ? argv[1] : "memset";
+	const int nthreads = argc > 2 ? atoi(argv[2]) : 1;
+	assert(nthreads > 0);
+
+	if (strcmp(mode, "memset") == 0) {
+		run_memset(perf_tmpfile(), nthreads);
+	} else if (strcmp(mode, "blk") == 0) {
+		run_blk(perf_tmpfile(), nthreads);
+	} else {
+		fprintf(stderr, "usage: %s [memset|blk] [nthreads]\n", argv[0]);
+		return 1;
+	}
+	return 0;
+}
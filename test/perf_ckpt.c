@@ -0,0 +1,109 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+#include "pmemckpt.h"
+
+/*
+ * Usage: perf_ckpt [nthreads]
+ *
+ * Checkpoints a region of REGION bytes of DRAM to PERF_TMPFILE after a
+ * given fraction of its pages has been written, with every kind of
+ * tracking the kernel has, and prints one line per run:
+ *
+ *   track  dirty%  nthreads  write-ms  ckpt-ms  MiB-copied  GB/s
+ *
+ * write-ms is the time to write the pages, which includes the faults
+ * of write-protect tracking; ckpt-ms is of pmemckpt_checkpoint(). Each
+ * line is of the second of two checkpoints at the same fraction, so
+ * that the pages copied are those of both, as in a steady state.
+ */
+
+#define REGION ((size_t)1 << 28)
+#define PAGE   ((size_t)4096)
+#define NPAGE  (REGION / PAGE)
+
+static char *region_ = NULL;
+static uint64_t seed_ = 1;
+
+/* writes a word to each page with probability fraction */
+static long dirty(double fraction, int gen)
+{
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	const uint64_t limit = (uint64_t)(fraction * 1e6);
+	for (size_t p = 0; p < NPAGE; ++p)
+		if (perf_rand(&seed_) % 1000000 < limit)
+			*(volatile uint64_t *)(region_ + p * PAGE) =
+				(uint64_t)gen;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return elapsed_us(&t0, &t1);
+}
+
+static void run(enum pmemckpt_track track, const char *name, int nthreads)
+{
+	static const double FRACTION[] = {0.001, 0.01, 0.05, 0.2, 0.5, 1.0};
+
+	const char *const path = perf_tmpfile();
+	unlink(path);
+	PMEMckpt *const ckp = pmemckpt_create(path, region_, REGION, track,
+		0600);
+	if (!ckp) {
+		perror(name);
+		return;
+	}
+	/* neither slot matches the region at first */
+	int r = pmemckpt_checkpoint(ckp, nthreads);
+	assert(r == 0);
+	r = pmemckpt_checkpoint(ckp, nthreads);
+	assert(r == 0);
+
+	int gen = 0;
+	for (size_t f = 0; f < sizeof(FRACTION) / sizeof(FRACTION[0]); ++f) {
+		long write_us = 0, ckpt_us = 0;
+		for (int i = 0; i < 2; ++i) {
+			write_us = dirty(FRACTION[f], ++gen);
+			struct timespec t0, t1;
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			r = pmemckpt_checkpoint(ckp, nthreads);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			assert(r == 0);
+			ckpt_us = elapsed_us(&t0, &t1);
+		}
+		const size_t copied = pmemckpt_last_copied(ckp);
+		printf("%s\t%.1f\t%d\t%.3f\t%.3f\t%.1f\t%.2f\n", name,
+			FRACTION[f] * 100, nthreads,
+			(double)write_us / 1e3, (double)ckpt_us / 1e3,
+			(double)copied / (1 << 20),
+			ckpt_us > 0 ? (double)copied / (double)ckpt_us / 1e3
+				: 0.0);
+	}
+	(void)r;
+	pmemckpt_close(ckp);
+	unlink(path);
+}
+
+int main(int argc, char **argv)
+{
+	const int nthreads = argc > 1 ? atoi(argv[1]) : 1;
+	assert(nthreads >= 0);
+
+	region_ = mmap(NULL, REGION, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	assert(region_ != MAP_FAILED);
+	memset(region_, 0xA5, REGION);
+
+	run(PMEMCKPT_TRACK_FULL, "full", nthreads);
+	run(PMEMCKPT_TRACK_WRPROTECT, "wrprotect", nthreads);
+	run(PMEMCKPT_TRACK_SOFTDIRTY, "softdirty", nthreads);
+
+	munmap(region_, REGION);
+	return 0;
+}
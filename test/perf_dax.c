@@ -0,0 +1,277 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <libpmemblk.h>
+#include <libpmemlog.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+#include "pmemdax.h"
+
+/*
+ * Usage: perf_dax [blk|log]
+ *
+ * Runs the same workload with libpmemblk/libpmemlog on a file on DAX
+ * FS, with pmemdax on a file on DAX FS, and with pmemdax on Device DAX,
+ * and prints one line per run:
+ *
+ *   engine  where  op  ops/sec  dTLB-misses/op  LLC-misses/op
+ *
+ * blk does random BSIZE writes, then random reads, over the blocks
+ * that every pool has; log appends BSIZE records, then walks them.
+ * The misses are -1 if perf_event_open(2) is not allowed.
+ *
+ * $PERFTEST_DEVICE overrides PATH_DEVICE_DAX; with
+ * PMEM_IS_PMEM_FORCE=1 it may be a large regular file.
+ */
+
+#ifndef PATH_DEVICE_DAX
+#define PATH_DEVICE_DAX "/dev/dax1.0"
+#endif
+
+#define POOLSIZE ((size_t)1 << 30)
+#define BSIZE    ((size_t)4096)
+#define NOPS     (1 << 18)
+
+struct engine {
+	const char *name;
+	const char *where;
+	void *pool;
+	int (*read)(void *pool, void *buf, long long blockno);
+	int (*write)(void *pool, const void *buf, long long blockno);
+	int (*append)(void *pool, const void *buf, size_t count);
+	void (*walk)(void *pool, size_t chunksize,
+		int (*process_chunk)(const void *, size_t, void *), void *arg);
+};
+
+static char buf_[BSIZE];
+static struct perf_misses misses_;
+
+/* adapters */
+static int blk_read(void *p, void *buf, long long n)
+{
+	return pmemblk_read(p, buf, n);
+}
+
+static int blk_write(void *p, const void *buf, long long n)
+{
+	return pmemblk_write(p, buf, n);
+}
+
+static int daxblk_read(void *p, void *buf, long long n)
+{
+	return pmemdaxblk_read(p, buf, n);
+}
+
+static int daxblk_write(void *p, const void *buf, long long n)
+{
+	return pmemdaxblk_write(p, buf, n);
+}
+
+static int log_append(void *p, const void *buf, size_t count)
+{
+	return pmemlog_append(p, buf, count);
+}
+
+static void log_walk(void *p, size_t chunksize,
+		int (*process_chunk)(const void *, size_t, void *), void *arg)
+{
+	pmemlog_walk(p, chunksize, process_chunk, arg);
+}
+
+static int daxlog_append(void *p, const void *buf, size_t count)
+{
+	return pmemdaxlog_append(p, buf, count);
+}
+
+static void daxlog_walk(void *p, size_t chunksize,
+		int (*process_chunk)(const void *, size_t, void *), void *arg)
+{
+	pmemdaxlog_walk(p, chunksize, process_chunk, arg);
+}
+
+/* callback function passed to walk; reads a word per cache line */
+static int touch_chunk(const void *buf, size_t len, void *arg)
+{
+	uint64_t *const sum = arg;
+	const uint64_t *const w = buf;
+	for (size_t i = 0; i < len / sizeof(*w); i += 64 / sizeof(*w))
+		*sum += w[i];
+	return 1;
+}
+
+static const char *device_path(void)
+{
+	const char *const p = getenv("PERFTEST_DEVICE");
+	return p ? p : PATH_DEVICE_DAX;
+}
+
+/* pmemdax formats an existing file in place */
+static void make_standin(const char *path)
+{
+	unlink(path);
+	const int fd = open(path, O_WRONLY|O_CREAT|O_EXCL, 0600);
+	assert(fd != -1);
+	const int r = ftruncate(fd, (off_t)POOLSIZE);
+	assert(r == 0);
+	(void)r;
+	close(fd);
+}
+
+static void measure_start(struct timespec *t)
+{
+	perf_misses_start(&misses_);
+	clock_gettime(CLOCK_MONOTONIC, t);
+}
+
+static void measure_stop(const struct engine *e, const char *op,
+		long nops, const struct timespec *t0)
+{
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	perf_misses_stop(&misses_);
+	const double dtlb = misses_.dtlb < 0
+		? -1.0 : (double)misses_.dtlb / (double)nops;
+	const double llc = misses_.llc < 0
+		? -1.0 : (double)misses_.llc / (double)nops;
+	printf("%s\t%s\t%s\t%.0f\t%.3f\t%.3f\n", e->name, e->where, op,
+		(double)nops * 1e6 / (double)elapsed_us(t0, &t1), dtlb, llc);
+}
+
+static void run_blk(const struct engine *e, size_t nblock)
+{
+	struct timespec t;
+	uint64_t seed = 1;
+	int r = 0;
+
+	measure_start(&t);
+	for (int i = 0; i < NOPS; ++i) {
+		const long long n = (long long)(perf_rand(&seed) % nblock);
+		r = e->write(e->pool, buf_, n);
+		assert(r == 0);
+	}
+	measure_stop(e, "write", NOPS, &t);
+
+	measure_start(&t);
+	for (int i = 0; i < NOPS; ++i) {
+		const long long n = (long long)(perf_rand(&seed) % nblock);
+		r = e->read(e->pool, buf_, n);
+		assert(r == 0);
+	}
+	measure_stop(e, "read", NOPS, &t);
+	(void)r;
+}
+
+static void run_log(const struct engine *e)
+{
+	struct timespec t;
+	long n = 0;
+
+	measure_start(&t);
+	while (n < NOPS && e->append(e->pool, buf_, BSIZE) == 0)
+		++n;
+	measure_stop(e, "append", n, &t);
+
+	uint64_t sum = 0;
+	measure_start(&t);
+	e->walk(e->pool, BSIZE, touch_chunk, &sum);
+	measure_stop(e, "walk", n, &t);
+
+	/* keep the walk from being optimized away */
+	if (sum == 1)
+		fprintf(stderr, "sum %lu\n", (unsigned long)sum);
+}
+
+int main(int argc, char **argv)
+{
+	const char *const mode = argc > 1 ? argv[1] : "blk";
+	const char *const path = perf_tmpfile();
+	const char *const dev = device_path();
+
+	perf_misses_open(&misses_);
+	memset(buf_, 0xA5, sizeof(buf_));
+
+	if (strcmp(mode, "blk") == 0) {
+		struct engine e[3] = {
+			{"pmemblk", "daxfs", NULL, blk_read, blk_write,
+				NULL, NULL},
+			{"pmemdax", "daxfs", NULL, daxblk_read, daxblk_write,
+				NULL, NULL},
+			{"pmemdax", "devdax", NULL, daxblk_read, daxblk_write,
+				NULL, NULL},
+		};
+		e[2].pool = pmemdaxblk_create(dev, BSIZE);
+		assert(e[2].pool != NULL);
+		size_t nblock = pmemdaxblk_nblock(e[2].pool);
+
+		unlink(path);
+		e[0].pool = pmemblk_create(path, BSIZE, POOLSIZE, 0600);
+		assert(e[0].pool != NULL);
+		if (pmemblk_nblock(e[0].pool) < nblock)
+			nblock = pmemblk_nblock(e[0].pool);
+		pmemblk_close(e[0].pool);
+		unlink(path);
+
+		make_standin(path);
+		e[1].pool = pmemdaxblk_create(path, BSIZE);
+		assert(e[1].pool != NULL);
+		if (pmemdaxblk_nblock(e[1].pool) < nblock)
+			nblock = pmemdaxblk_nblock(e[1].pool);
+		pmemdaxblk_close(e[1].pool);
+		unlink(path);
+
+		e[0].pool = pmemblk_create(path, BSIZE, POOLSIZE, 0600);
+		assert(e[0].pool != NULL);
+		run_blk(&e[0], nblock);
+		pmemblk_close(e[0].pool);
+		unlink(path);
+
+		make_standin(path);
+		e[1].pool = pmemdaxblk_create(path, BSIZE);
+		assert(e[1].pool != NULL);
+		run_blk(&e[1], nblock);
+		pmemdaxblk_close(e[1].pool);
+		unlink(path);
+
+		run_blk(&e[2], nblock);
+		pmemdaxblk_close(e[2].pool);
+	} else if (strcmp(mode, "log") == 0) {
+		struct engine e[3] = {
+			{"pmemlog", "daxfs", NULL, NULL, NULL,
+				log_append, log_walk},
+			{"pmemdax", "daxfs", NULL, NULL, NULL,
+				daxlog_append, daxlog_walk},
+			{"pmemdax", "devdax", NULL, NULL, NULL,
+				daxlog_append, daxlog_walk},
+		};
+		unlink(path);
+		e[0].pool = pmemlog_create(path, POOLSIZE, 0600);
+		assert(e[0].pool != NULL);
+		run_log(&e[0]);
+		pmemlog_close(e[0].pool);
+		unlink(path);
+
+		make_standin(path);
+		e[1].pool = pmemdaxlog_create(path);
+		assert(e[1].pool != NULL);
+		run_log(&e[1]);
+		pmemdaxlog_close(e[1].pool);
+		unlink(path);
+
+		e[2].pool = pmemdaxlog_create(dev);
+		assert(e[2].pool != NULL);
+		run_log(&e[2]);
+		pmemdaxlog_close(e[2].pool);
+	} else {
+		fprintf(stderr, "usage: %s [blk|log]\n", argv[0]);
+		return 1;
+	}
+
+	perf_misses_close(&misses_);
+	return 0;
+}
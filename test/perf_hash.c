@@ -0,0 +1,183 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <libpmemblk.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+#include "pmemhash.h"
+
+/*
+ * Usage: perf_hash [nthreads]
+ *
+ * Fills a pmemblk pool whose blocks carry their key in the first
+ * 8 bytes, indexes every block in pmemhash, then prints:
+ *
+ *   insert   1         inserts/sec
+ *   lookup   nthreads  lookups/sec
+ *   restart  pmemhash  usec to pmemhash_open() and look up a key
+ *   restart  rebuild   usec to read every block into a DRAM index
+ */
+
+#define NLOOKUP (1 << 22)
+
+static PMEMhashpool *php_ = NULL;
+static uint64_t *keys_ = NULL;
+static size_t nkey_ = 0;
+
+/* the DRAM index an application rebuilds at startup today */
+struct dram_entry {
+	uint64_t key;
+	long long blockno;
+};
+
+static void dram_insert(struct dram_entry *t, size_t mask,
+		uint64_t key, long long blockno)
+{
+	for (size_t i = key * 0x9E3779B97F4A7C15ULL; ; ++i) {
+		struct dram_entry *const e = &t[i & mask];
+		if (e->blockno < 0) {
+			e->key = key;
+			e->blockno = blockno;
+			return;
+		}
+	}
+}
+
+static void *lookup_worker(void *arg)
+{
+	uint64_t seed = (uint64_t)(uintptr_t)arg;
+	long long sum = 0, blockno = 0;
+	for (int i = 0; i < NLOOKUP; ++i) {
+		const uint64_t key = keys_[perf_rand(&seed) % nkey_];
+		const int r = pmemhash_lookup(php_, key, &blockno);
+		assert(r == 0);
+		(void)r;
+		sum += blockno;
+	}
+	return (void *)(intptr_t)sum;
+}
+
+static size_t next_pow2(size_t n)
+{
+	size_t p = 1;
+	while (p < n)
+		p *= 2;
+	return p;
+}
+
+int main(int argc, char **argv)
+{
+	static const size_t NB1G = 1 << 30;
+
+	const int nthreads = argc > 1 ? atoi(argv[1]) : 1;
+	assert(nthreads > 0);
+
+	int r = 0;
+	char blkpath[4096];
+	snprintf(blkpath, sizeof(blkpath), "%s.blk", perf_tmpfile());
+	const char *const path = perf_tmpfile();
+	unlink(blkpath);
+	unlink(path);
+
+	/* the value store */
+	PMEMblkpool *const pbp = pmemblk_create(blkpath,
+		PMEMBLK_MIN_BLK, NB1G, 0600);
+	assert(pbp != NULL);
+	nkey_ = pmemblk_nblock(pbp);
+	keys_ = malloc(nkey_ * sizeof(*keys_));
+	assert(keys_ != NULL);
+	char buf[PMEMBLK_MIN_BLK];
+	memset(buf, 0, sizeof(buf));
+	uint64_t seed = 1;
+	for (size_t i = 0; i < nkey_; ++i) {
+		keys_[i] = perf_rand(&seed);
+		memcpy(buf, &keys_[i], sizeof(keys_[i]));
+		r = pmemblk_write(pbp, buf, (long long)i);
+		assert(r == 0);
+	}
+
+	/* at most 50% load */
+	const size_t nslot = next_pow2(nkey_) * 2;
+	php_ = pmemhash_create(path, 4096 + nslot * 16, 0600);
+	assert(php_ != NULL);
+
+	struct timespec t[2] = {{0},{0}};
+	r = clock_gettime(CLOCK_MONOTONIC, &t[0]);
+	assert(r == 0);
+	for (size_t i = 0; i < nkey_; ++i) {
+		r = pmemhash_insert(php_, keys_[i], (long long)i);
+		assert(r == 0);
+	}
+	r = clock_gettime(CLOCK_MONOTONIC, &t[1]);
+	assert(r == 0);
+	printf("insert\t1\t%.0f\n",
+		(double)nkey_ * 1e6 / (double)elapsed_us(&t[0], &t[1]));
+
+	pthread_t *const th = calloc((size_t)nthreads, sizeof(*th));
+	assert(th != NULL);
+	r = clock_gettime(CLOCK_MONOTONIC, &t[0]);
+	assert(r == 0);
+	for (int i = 0; i < nthreads; ++i) {
+		r = pthread_create(&th[i], NULL, lookup_worker,
+			(void *)(uintptr_t)(i + 1));
+		assert(r == 0);
+	}
+	for (int i = 0; i < nthreads; ++i) {
+		r = pthread_join(th[i], NULL);
+		assert(r == 0);
+	}
+	r = clock_gettime(CLOCK_MONOTONIC, &t[1]);
+	assert(r == 0);
+	printf("lookup\t%d\t%.0f\n", nthreads, (double)NLOOKUP * nthreads
+		* 1e6 / (double)elapsed_us(&t[0], &t[1]));
+
+	/* restart with the persistent index */
+	pmemhash_close(php_);
+	long long blockno = -1;
+	r = clock_gettime(CLOCK_MONOTONIC, &t[0]);
+	assert(r == 0);
+	php_ = pmemhash_open(path);
+	assert(php_ != NULL);
+	r = pmemhash_lookup(php_, keys_[nkey_ - 1], &blockno);
+	assert(r == 0);
+	r = clock_gettime(CLOCK_MONOTONIC, &t[1]);
+	assert(r == 0);
+	assert(blockno == (long long)nkey_ - 1);
+	printf("restart\tpmemhash\t%ld\n", elapsed_us(&t[0], &t[1]));
+
+	/* restart with a DRAM index rebuilt from the blocks */
+	r = clock_gettime(CLOCK_MONOTONIC, &t[0]);
+	assert(r == 0);
+	const size_t mask = nslot - 1;
+	struct dram_entry *const dram = malloc(nslot * sizeof(*dram));
+	assert(dram != NULL);
+	memset(dram, 0xFF, nslot * sizeof(*dram));
+	for (size_t i = 0; i < nkey_; ++i) {
+		uint64_t key;
+		r = pmemblk_read(pbp, buf, (long long)i);
+		assert(r == 0);
+		memcpy(&key, buf, sizeof(key));
+		dram_insert(dram, mask, key, (long long)i);
+	}
+	r = clock_gettime(CLOCK_MONOTONIC, &t[1]);
+	assert(r == 0);
+	printf("restart\trebuild\t%ld\n", elapsed_us(&t[0], &t[1]));
+
+	free(dram);
+	free(th);
+	free(keys_);
+	pmemhash_close(php_);
+	pmemblk_close(pbp);
+	unlink(path);
+	unlink(blkpath);
+#ifdef NDEBUG
+	(void)r;
+#endif
+	return 0;
+}
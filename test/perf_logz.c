@@ -0,0 +1,156 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <libpmemlog.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+#include "pmemlogz.h"
+
+/*
+ * Usage: perf_logz [nthreads]
+ *
+ * Appends NREC log lines of RSIZE bytes with nthreads threads, each a
+ * line of text with a given fraction of its bytes made random, with
+ * pmemlog_append() (plain), with pmemlogz without compression (raw) and
+ * with it (lz), and prints one line per run:
+ *
+ *   mode  random%  nthreads  ratio  MB/s  cpu-sec/GiB
+ *
+ * ratio is logical bytes per byte written to the pool; MB/s is of the
+ * logical bytes; cpu-sec/GiB is CPU time of the process per logical GiB.
+ * raw against plain is the gain of batching the records into frames; lz
+ * against raw is what compression buys for what it costs.
+ */
+
+#define POOLSIZE  ((size_t)1 << 30)
+#define RSIZE     256
+#define NREC      (1 << 19)
+#define NDISTINCT 4096 /* records are drawn from this many */
+
+enum mode { PLAIN, RAW, LZ };
+
+static PMEMlogpool *plp_ = NULL;
+static PMEMlogz *plz_ = NULL;
+static enum mode mode_;
+static int nthreads_ = 1;
+static char *recs_ = NULL;
+
+/* log lines, of which a fraction of the bytes is random */
+static void make_records(double random_fraction)
+{
+	static const char *const LINE =
+		"2024-01-01T00:00:00.000Z INFO  [http-nio-8080-exec-7] "
+		"o.a.c.c.C.[Tomcat].[localhost] request served: "
+		"method=GET path=/api/v1/users/12345/orders status=200 "
+		"bytes=5120 duration_ms=12 user_agent=Mozilla/5.0 (X11; Linux "
+		"x86_64) trace=0000000000000000 span=0000000000000000 ok\n";
+	uint64_t seed = 1;
+	for (size_t r = 0; r < NDISTINCT; ++r) {
+		char *const rec = recs_ + r * RSIZE;
+		for (size_t i = 0; i < RSIZE; ++i)
+			rec[i] = LINE[i % strlen(LINE)];
+		/* in fields of 8 bytes, as of ids and timestamps */
+		for (size_t i = 0; i < RSIZE; i += 8) {
+			const uint64_t v = perf_rand(&seed);
+			if ((double)(v % 1000) < random_fraction * 1000)
+				memcpy(rec + i, &v, 8);
+		}
+	}
+}
+
+static void *worker(void *arg)
+{
+	const intptr_t t = (intptr_t)arg;
+	int r = 0;
+	for (long i = t; i < NREC; i += nthreads_) {
+		const char *const rec =
+			recs_ + (size_t)(i % NDISTINCT) * RSIZE;
+		if (mode_ == PLAIN)
+			r = pmemlog_append(plp_, rec, RSIZE);
+		else
+			r = pmemlogz_append(plz_, rec, RSIZE);
+		assert(r == 0);
+	}
+	if (mode_ != PLAIN)
+		r = pmemlogz_flush(plz_);
+	assert(r == 0);
+	(void)r;
+	return NULL;
+}
+
+static void run(enum mode mode, const char *name, double random_fraction)
+{
+	mode_ = mode;
+	pmemlog_rewind(plp_);
+	if (mode != PLAIN) {
+		plz_ = pmemlogz_open(plp_, mode == RAW ? PMEMLOGZ_RAW : 0);
+		assert(plz_ != NULL);
+	}
+
+	pthread_t *const th = calloc((size_t)nthreads_, sizeof(*th));
+	assert(th != NULL);
+	struct timespec t0, t1, c0, c1;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &c0);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int i = 0; i < nthreads_; ++i) {
+		const int r = pthread_create(&th[i], NULL, worker,
+			(void *)(intptr_t)i);
+		assert(r == 0);
+		(void)r;
+	}
+	for (int i = 0; i < nthreads_; ++i)
+		pthread_join(th[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &c1);
+	free(th);
+
+	if (plz_) {
+		pmemlogz_close(plz_);
+		plz_ = NULL;
+	}
+	if (!name)
+		return;
+	const double logical = (double)NREC * RSIZE;
+	printf("%s\t%.0f\t%d\t%.2f\t%.1f\t%.3f\n", name,
+		random_fraction * 100, nthreads_,
+		logical / (double)pmemlog_tell(plp_),
+		logical / (double)elapsed_us(&t0, &t1),
+		(double)elapsed_us(&c0, &c1) / 1e6
+			/ (logical / (double)(1 << 30)));
+}
+
+int main(int argc, char **argv)
+{
+	static const double FRACTION[] = {1.0, 0.5, 0.2, 0.05, 0.0};
+
+	nthreads_ = argc > 1 ? atoi(argv[1]) : 1;
+	assert(nthreads_ > 0);
+	recs_ = malloc((size_t)NDISTINCT * RSIZE);
+	assert(recs_ != NULL);
+
+	const char *const path = perf_tmpfile();
+	unlink(path);
+	plp_ = pmemlog_create(path, POOLSIZE, 0600);
+	assert(plp_ != NULL);
+	assert(pmemlog_nbyte(plp_) >= (size_t)NREC * RSIZE * 2);
+
+	make_records(1.0);
+	run(PLAIN, NULL, 1.0); /* fault the pool in */
+	for (size_t f = 0; f < sizeof(FRACTION) / sizeof(FRACTION[0]); ++f) {
+		make_records(FRACTION[f]);
+		run(PLAIN, "plain", FRACTION[f]);
+		run(RAW, "raw", FRACTION[f]);
+		run(LZ, "lz", FRACTION[f]);
+	}
+
+	pmemlog_close(plp_);
+	unlink(path);
+	free(recs_);
+	return 0;
+}
@@ -0,0 +1,313 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <cpuid.h>
+#include <libpmem.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+
+/*
+ * Usage: perf_mem [nthreads]
+ *
+ * Calls each of the copy and set functions of libpmem, and pmem_memcpy()
+ * and pmem_memset() with each of the PMEM_F_MEM_* flags, on records of
+ * each size in SIZES, with nthreads threads each writing TOTAL/nthreads
+ * bytes to its own part of a pool at PERF_TMPFILE, and prints one line
+ * per run:
+ *
+ *   function  flags  size  nthreads  path  GB/s  Mops/s
+ *
+ * Lines beginning with # before them tell the CPU features and the
+ * environment variables that libpmem picks its code from, and what it
+ * is expected to pick; path is what that means for the run: movnt for
+ * non-temporal stores, mov+flush for stores and a flush of each line,
+ * and mov for stores alone. libpmem does not tell what it picked, but
+ * logs it at PMEM_LOG_LEVEL=3 in its debug build. The expectation
+ * follows libpmem 1.x, in which AVX-512F is used only when
+ * PMEM_AVX512F=1, and AVX unless PMEM_AVX=0.
+ */
+
+#define REGION ((size_t)1 << 28)
+#define TOTAL  ((size_t)1 << 26) /* written by each run */
+#define MAX_THREADS 64
+
+static const size_t SIZES[] = {
+	64, 256, 1 << 10, 4 << 10, 64 << 10, 1 << 20, 16 << 20,
+};
+
+enum func {
+	MEMCPY_PERSIST, MEMMOVE_PERSIST, MEMSET_PERSIST,
+	MEMCPY_NODRAIN, MEMMOVE_NODRAIN, MEMSET_NODRAIN,
+	MEMCPY, MEMSET,
+};
+
+static const char *const FUNC[] = {
+	"memcpy_persist", "memmove_persist", "memset_persist",
+	"memcpy_nodrain", "memmove_nodrain", "memset_nodrain",
+	"memcpy", "memset",
+};
+
+/* of pmem_memcpy() and pmem_memset() */
+static const struct {
+	const char *name;
+	unsigned flags;
+} FLAGS[] = {
+#ifdef PMEM_F_MEM_NODRAIN
+	{"0", 0},
+	{"NODRAIN", PMEM_F_MEM_NODRAIN},
+	{"NONTEMPORAL", PMEM_F_MEM_NONTEMPORAL},
+	{"NONTEMPORAL|NODRAIN", PMEM_F_MEM_NONTEMPORAL|PMEM_F_MEM_NODRAIN},
+	{"TEMPORAL", PMEM_F_MEM_TEMPORAL},
+	{"WC", PMEM_F_MEM_WC},
+	{"WB", PMEM_F_MEM_WB},
+	{"NOFLUSH", PMEM_F_MEM_NOFLUSH},
+#endif
+	{NULL, 0},
+};
+
+/* what libpmem has to pick from */
+static struct {
+	int sse2, avx, avx512f, clflushopt, clwb;
+	int no_movnt;
+	size_t movnt_threshold;
+	const char *width; /* of the stores */
+	const char *flush;
+} cpu_;
+
+struct job {
+	pthread_t th;
+	enum func func;
+	unsigned flags;
+	size_t size;
+	char *dst;
+	size_t area; /* of dst */
+	size_t len;  /* to write */
+};
+
+static char *src_ = NULL;
+static pthread_barrier_t barrier_;
+
+/* util functions */
+static int env_is(const char *name, const char *value)
+{
+	const char *const p = getenv(name);
+	return p && strcmp(p, value) == 0;
+}
+
+static void cpu_init(void)
+{
+	unsigned a, b, c, d;
+	__builtin_cpu_init();
+	cpu_.sse2 = __builtin_cpu_supports("sse2");
+	cpu_.avx = __builtin_cpu_supports("avx");
+	cpu_.avx512f = __builtin_cpu_supports("avx512f");
+	if (__get_cpuid_count(7, 0, &a, &b, &c, &d)) {
+		cpu_.clflushopt = !!(b & (1U << 23));
+		cpu_.clwb = !!(b & (1U << 24));
+	}
+
+	cpu_.no_movnt = env_is("PMEM_NO_MOVNT", "1");
+	const char *const t = getenv("PMEM_MOVNT_THRESHOLD");
+	cpu_.movnt_threshold = t && *t ? strtoul(t, NULL, 0) : 256;
+
+	if (cpu_.avx512f && env_is("PMEM_AVX512F", "1"))
+		cpu_.width = "avx512f";
+	else if (cpu_.avx && !env_is("PMEM_AVX", "0"))
+		cpu_.width = "avx";
+	else
+		cpu_.width = "sse2";
+
+	if (env_is("PMEM_NO_FLUSH", "1"))
+		cpu_.flush = "none";
+	else if (cpu_.clwb && !env_is("PMEM_NO_CLWB", "1"))
+		cpu_.flush = "clwb";
+	else if (cpu_.clflushopt && !env_is("PMEM_NO_CLFLUSHOPT", "1"))
+		cpu_.flush = "clflushopt";
+	else
+		cpu_.flush = "clflush";
+}
+
+static void print_env(const char *name)
+{
+	const char *const p = getenv(name);
+	printf(" %s=%s", name, p ? p : "");
+}
+
+static void print_dispatch(void)
+{
+	printf("# cpu:%s%s%s%s%s\n",
+		cpu_.sse2 ? " sse2" : "", cpu_.avx ? " avx" : "",
+		cpu_.avx512f ? " avx512f" : "",
+		cpu_.clflushopt ? " clflushopt" : "", cpu_.clwb ? " clwb" : "");
+	printf("# env:");
+	print_env("PMEM_AVX512F");
+	print_env("PMEM_AVX");
+	print_env("PMEM_NO_MOVNT");
+	print_env("PMEM_MOVNT_THRESHOLD");
+	print_env("PMEM_NO_CLWB");
+	print_env("PMEM_NO_CLFLUSHOPT");
+	print_env("PMEM_NO_FLUSH");
+	print_env("PMEM_IS_PMEM_FORCE");
+	printf("\n");
+	printf("# expected: %s stores, %s flush, ", cpu_.width, cpu_.flush);
+	if (cpu_.no_movnt)
+		printf("no movnt\n");
+	else
+		printf("movnt from %zu bytes\n", cpu_.movnt_threshold);
+}
+
+/* what libpmem is expected to do for a call */
+static const char *path_of(unsigned flags, size_t size)
+{
+#ifdef PMEM_F_MEM_NODRAIN
+	if (flags & PMEM_F_MEM_NOFLUSH)
+		return "mov";
+	if (flags & (PMEM_F_MEM_NONTEMPORAL|PMEM_F_MEM_WC))
+		return "movnt";
+	if (flags & (PMEM_F_MEM_TEMPORAL|PMEM_F_MEM_WB))
+		return "mov+flush";
+#else
+	(void)flags;
+#endif
+	return !cpu_.no_movnt && size >= cpu_.movnt_threshold
+		? "movnt" : "mov+flush";
+}
+
+static void call(enum func func, unsigned flags, char *dst, size_t size)
+{
+	switch (func) {
+	case MEMCPY_PERSIST:
+		pmem_memcpy_persist(dst, src_, size);
+		break;
+	case MEMMOVE_PERSIST:
+		pmem_memmove_persist(dst, src_, size);
+		break;
+	case MEMSET_PERSIST:
+		pmem_memset_persist(dst, 0x5A, size);
+		break;
+	/* the drains are of each call, as a caller would need them */
+	case MEMCPY_NODRAIN:
+		pmem_memcpy_nodrain(dst, src_, size);
+		pmem_drain();
+		break;
+	case MEMMOVE_NODRAIN:
+		pmem_memmove_nodrain(dst, src_, size);
+		pmem_drain();
+		break;
+	case MEMSET_NODRAIN:
+		pmem_memset_nodrain(dst, 0x5A, size);
+		pmem_drain();
+		break;
+#ifdef PMEM_F_MEM_NODRAIN
+	case MEMCPY:
+		pmem_memcpy(dst, src_, size, flags);
+		break;
+	case MEMSET:
+		pmem_memset(dst, 0x5A, size, flags);
+		break;
+#endif
+	default:
+		(void)flags;
+		assert(0);
+	}
+}
+
+static void *worker(void *arg)
+{
+	struct job *const j = arg;
+	pthread_barrier_wait(&barrier_);
+	size_t off = 0;
+	for (size_t done = 0; done < j->len; done += j->size) {
+		call(j->func, j->flags, j->dst + off, j->size);
+		off += j->size;
+		if (off + j->size > j->area)
+			off = 0;
+	}
+	return NULL;
+}
+
+static void run(char *pool, enum func func, const char *flags_name,
+		unsigned flags, size_t size, int nthreads)
+{
+	/* each thread writes over its own part of the pool */
+	const size_t area = REGION / (size_t)nthreads;
+	if (size > area)
+		return;
+	size_t len = TOTAL / (size_t)nthreads;
+	len = (len + size - 1) / size * size;
+
+	struct job jobs[MAX_THREADS];
+	int r = pthread_barrier_init(&barrier_, NULL, (unsigned)nthreads + 1);
+	assert(r == 0);
+	for (int t = 0; t < nthreads; ++t) {
+		struct job *const j = &jobs[t];
+		j->func = func;
+		j->flags = flags;
+		j->size = size;
+		j->dst = pool + (size_t)t * area;
+		j->area = area;
+		j->len = len;
+		r = pthread_create(&j->th, NULL, worker, j);
+		assert(r == 0);
+	}
+	pthread_barrier_wait(&barrier_);
+	const uint64_t t0 = now_ns();
+	for (int t = 0; t < nthreads; ++t)
+		pthread_join(jobs[t].th, NULL);
+	const uint64_t ns = now_ns() - t0;
+	pthread_barrier_destroy(&barrier_);
+	(void)r;
+
+	const double bytes = (double)len * nthreads;
+	printf("%s\t%s\t%zu\t%d\t%s\t%.2f\t%.3f\n", FUNC[func],
+		flags_name, size, nthreads, path_of(flags, size),
+		bytes / (double)ns, bytes / (double)size * 1e3 / (double)ns);
+}
+
+int main(int argc, char **argv)
+{
+	const int nthreads = argc > 1 ? atoi(argv[1]) : 1;
+	assert(nthreads > 0 && nthreads <= MAX_THREADS);
+
+	cpu_init();
+	print_dispatch();
+
+	const char *const path = perf_tmpfile();
+	unlink(path);
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	char *const pool = pmem_map_file(path, REGION,
+		PMEM_FILE_CREATE|PMEM_FILE_EXCL, 0600, &mapped_len, &is_pmem);
+	assert(pool != NULL);
+	assert(is_pmem);
+	/* fault the pool in */
+	memset(pool, 0, REGION);
+	pmem_persist(pool, REGION);
+
+	const size_t maxsize = SIZES[sizeof(SIZES) / sizeof(SIZES[0]) - 1];
+	src_ = malloc(maxsize);
+	assert(src_ != NULL);
+	memset(src_, 0xA5, maxsize);
+
+	for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); ++s) {
+		for (int f = MEMCPY_PERSIST; f < MEMCPY; ++f)
+			run(pool, (enum func)f, "-", 0, SIZES[s], nthreads);
+		for (int i = 0; FLAGS[i].name; ++i) {
+			run(pool, MEMCPY, FLAGS[i].name, FLAGS[i].flags,
+				SIZES[s], nthreads);
+			run(pool, MEMSET, FLAGS[i].name, FLAGS[i].flags,
+				SIZES[s], nthreads);
+		}
+	}
+
+	free(src_);
+	pmem_unmap(pool, mapped_len);
+	unlink(path);
+	return 0;
+}
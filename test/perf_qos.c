@@ -0,0 +1,134 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <libpmem.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+#include "pmemqos.h"
+
+/*
+ * Usage: perf_qos [bg-MB/s] [interval_us]
+ *
+ * A foreground thread writes and drains FSIZE bytes at a random offset
+ * every interval_us, NFG times, while a background thread copies BSIZE
+ * bytes at a time over the rest of the pool until the foreground is
+ * done. It runs with no background (alone), with it unthrottled
+ * (noqos), and with it limited to bg-MB/s while the foreground writes
+ * (qos), and prints one line per run:
+ *
+ *   mode  p50  p99  p99.9  max  (us)  fg-MB/s  bg-MB/s
+ *
+ * The latencies are of the foreground writes, taken from when each was
+ * due, so that one held up delays those behind it.
+ */
+
+#define POOLSIZE ((size_t)1 << 30)
+#define FREGION  ((size_t)1 << 26) /* of the foreground */
+#define FSIZE    4096
+#define BSIZE    ((size_t)1 << 26)
+#define NFG      20000
+
+static PMEMqos *qos_ = NULL;
+static char *pmem_ = NULL;
+static char *src_ = NULL;
+static long interval_us_ = 50;
+static int stop_ = 0;
+static uint64_t lat_[NFG];
+
+static void *background(void *arg)
+{
+	(void)arg;
+	char *const dst = pmem_ + FREGION;
+	const size_t nslice = (POOLSIZE - FREGION) / BSIZE;
+	for (size_t i = 0; !__atomic_load_n(&stop_, __ATOMIC_RELAXED); ++i) {
+		pmemqos_memmove_nodrain(qos_, PMEMQOS_BG,
+			dst + (i % nslice) * BSIZE, src_, BSIZE);
+		pmemqos_drain(qos_, PMEMQOS_BG);
+	}
+	return NULL;
+}
+
+static void foreground(void)
+{
+	uint64_t seed = 1;
+	uint64_t due = now_ns();
+	for (int i = 0; i < NFG; ++i) {
+		due += (uint64_t)interval_us_ * 1000;
+		if (now_ns() < due)
+			sleep_until(due);
+		const size_t off = perf_rand(&seed) % (FREGION / FSIZE) * FSIZE;
+		pmemqos_memmove_nodrain(qos_, PMEMQOS_FG, pmem_ + off, src_,
+			FSIZE);
+		pmemqos_drain(qos_, PMEMQOS_FG);
+		lat_[i] = now_ns() - due;
+	}
+}
+
+static void run(const char *mode, int bg, uint64_t bg_rate)
+{
+	int r = pmemqos_set_limit(qos_, PMEMQOS_BG, bg_rate, 4 * PMEMQOS_CHUNK);
+	assert(r == 0);
+	pmemqos_reset_stats(qos_);
+	__atomic_store_n(&stop_, 0, __ATOMIC_RELAXED);
+	pthread_t th;
+	if (bg) {
+		r = pthread_create(&th, NULL, background, NULL);
+		assert(r == 0);
+	}
+	foreground();
+	__atomic_store_n(&stop_, 1, __ATOMIC_RELAXED);
+	if (bg)
+		pthread_join(th, NULL);
+	(void)r;
+
+	struct pmemqos_stats fg, bgst;
+	pmemqos_stats(qos_, PMEMQOS_FG, &fg);
+	pmemqos_stats(qos_, PMEMQOS_BG, &bgst);
+	qsort(lat_, NFG, sizeof(lat_[0]), cmp_u64);
+	printf("%s\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\n", mode,
+		(double)lat_[NFG / 2] / 1e3,
+		(double)lat_[NFG * 99 / 100] / 1e3,
+		(double)lat_[NFG * 999 / 1000] / 1e3,
+		(double)lat_[NFG - 1] / 1e3,
+		(double)fg.bytes * 1e3 / (double)fg.elapsed_ns,
+		(double)bgst.bytes * 1e3 / (double)bgst.elapsed_ns);
+}
+
+int main(int argc, char **argv)
+{
+	const uint64_t bg_rate = (argc > 1 ? strtoull(argv[1], NULL, 0) : 500)
+		* 1000000;
+	interval_us_ = argc > 2 ? atol(argv[2]) : 50;
+	assert(bg_rate > 0 && interval_us_ > 0);
+
+	const char *const path = perf_tmpfile();
+	unlink(path);
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	pmem_ = pmem_map_file(path, POOLSIZE, PMEM_FILE_CREATE|PMEM_FILE_EXCL,
+		0600, &mapped_len, &is_pmem);
+	assert(pmem_ != NULL);
+	src_ = malloc(BSIZE);
+	assert(src_ != NULL);
+	memset(src_, 0xA5, BSIZE);
+	/* fault the pool in */
+	memset(pmem_, 0, POOLSIZE);
+	qos_ = pmemqos_new();
+	assert(qos_ != NULL);
+
+	run("alone", 0, 0);
+	run("noqos", 1, 0);
+	run("qos", 1, bg_rate);
+
+	pmemqos_delete(qos_);
+	free(src_);
+	pmem_unmap(pmem_, mapped_len);
+	unlink(path);
+	return 0;
+}
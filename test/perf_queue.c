@@ -0,0 +1,163 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+#include "pmemqueue.h"
+
+/*
+ * Usage: perf_queue [nproducers] [nconsumers] [batch]
+ *
+ * Moves NITEM items of ISIZE bytes through a pmemqueue from nproducers
+ * threads, which enqueue batch items a call, to nconsumers threads, and
+ * prints:
+ *
+ *   nproducers  nconsumers  batch  Mitems/s  enq-p50  enq-p99
+ *   deq-p50  deq-p99  (ns)
+ *
+ * on one line. The latencies are of the calls that succeeded; a thread
+ * that finds the queue full or empty yields and tries again.
+ */
+
+#define POOLSIZE ((size_t)1 << 26)
+#define ISIZE    64
+#define NITEM    (1 << 20)
+
+static PMEMqueue *pqp_ = NULL;
+static int nproducers_ = 1;
+static int nconsumers_ = 1;
+static int batch_ = 1;
+static long ndequeued_ = 0;
+
+/* latencies of the calls of one thread */
+struct lat {
+	uint64_t *ns;
+	size_t n;
+};
+
+static void *producer(void *arg)
+{
+	struct lat *const l = arg;
+	const long nitem = NITEM / nproducers_;
+	char buf[ISIZE];
+	memset(buf, 0xA5, sizeof(buf));
+	struct iovec iov[batch_];
+	for (int i = 0; i < batch_; ++i) {
+		iov[i].iov_base = buf;
+		iov[i].iov_len = sizeof(buf);
+	}
+
+	for (long done = 0; done < nitem; ) {
+		const long left = nitem - done;
+		const int n = left < batch_ ? (int)left : batch_;
+		const uint64_t t0 = now_ns();
+		const int r = pmemqueue_enqueue_batch(pqp_, iov, n);
+		if (r == -1) {
+			assert(errno == EAGAIN);
+			sched_yield();
+			continue;
+		}
+		l->ns[l->n++] = now_ns() - t0;
+		done += r;
+	}
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	struct lat *const l = arg;
+	const long total = NITEM / nproducers_ * nproducers_;
+	char buf[ISIZE];
+	while (__atomic_load_n(&ndequeued_, __ATOMIC_RELAXED) < total) {
+		const uint64_t t0 = now_ns();
+		const ssize_t r = pmemqueue_dequeue(pqp_, buf);
+		if (r == -1) {
+			assert(errno == EAGAIN);
+			sched_yield();
+			continue;
+		}
+		l->ns[l->n++] = now_ns() - t0;
+		__atomic_add_fetch(&ndequeued_, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/* merges the latencies of n threads, sorted */
+static uint64_t *merge(struct lat *l, int n, size_t *total)
+{
+	*total = 0;
+	for (int i = 0; i < n; ++i)
+		*total += l[i].n;
+	uint64_t *const all = malloc(*total * sizeof(uint64_t) + 1);
+	assert(all != NULL);
+	size_t k = 0;
+	for (int i = 0; i < n; ++i) {
+		memcpy(all + k, l[i].ns, l[i].n * sizeof(uint64_t));
+		k += l[i].n;
+	}
+	qsort(all, *total, sizeof(uint64_t), cmp_u64);
+	return all;
+}
+
+int main(int argc, char **argv)
+{
+	nproducers_ = argc > 1 ? atoi(argv[1]) : 1;
+	nconsumers_ = argc > 2 ? atoi(argv[2]) : 1;
+	batch_ = argc > 3 ? atoi(argv[3]) : 1;
+	assert(nproducers_ > 0 && nconsumers_ > 0 && batch_ > 0);
+
+	const char *const path = perf_tmpfile();
+	unlink(path);
+	pqp_ = pmemqueue_create(path, POOLSIZE, ISIZE, 0600);
+	assert(pqp_ != NULL);
+
+	const int nthreads = nproducers_ + nconsumers_;
+	struct lat *const l = calloc((size_t)nthreads, sizeof(*l));
+	pthread_t *const th = calloc((size_t)nthreads, sizeof(*th));
+	assert(l != NULL && th != NULL);
+	for (int i = 0; i < nthreads; ++i) {
+		l[i].ns = malloc((size_t)NITEM * sizeof(uint64_t));
+		assert(l[i].ns != NULL);
+	}
+
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int i = 0; i < nthreads; ++i) {
+		const int r = pthread_create(&th[i], NULL,
+			i < nproducers_ ? producer : consumer, &l[i]);
+		assert(r == 0);
+		(void)r;
+	}
+	for (int i = 0; i < nthreads; ++i)
+		pthread_join(th[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	size_t nenq, ndeq;
+	uint64_t *const enq = merge(l, nproducers_, &nenq);
+	uint64_t *const deq = merge(l + nproducers_, nconsumers_, &ndeq);
+	printf("%d\t%d\t%d\t%.2f\t%lu\t%lu\t%lu\t%lu\n",
+		nproducers_, nconsumers_, batch_,
+		(double)ndequeued_ / (double)elapsed_us(&t0, &t1),
+		(unsigned long)enq[nenq / 2],
+		(unsigned long)enq[nenq * 99 / 100],
+		(unsigned long)deq[ndeq / 2],
+		(unsigned long)deq[ndeq * 99 / 100]);
+
+	free(enq);
+	free(deq);
+	for (int i = 0; i < nthreads; ++i)
+		free(l[i].ns);
+	free(l);
+	free(th);
+	pmemqueue_close(pqp_);
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,138 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <libpmemlog.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+#include "pmemlogrepl.h"
+
+/*
+ * Usage: perf_repl [rsize]
+ *
+ * Appends TOTAL bytes in records of rsize bytes (256 by default) to a
+ * pmemlog pool at PERF_TMPFILE, mirrored to $PERFTEST_MIRROR, or to
+ * PERF_TMPFILE.mirror, with no mirror (plain), by appending to both in
+ * turn (sync), and with pmemlogrepl (async), and prints one line per
+ * run:
+ *
+ *   mode  rsize  MB/s  p50  p99  p99.9  (us)  lag-avg  lag-max  (us)
+ *   drain-ms  stalls
+ *
+ * The percentiles are of the appends as the caller sees them. lag is
+ * from an append to the primary to its append to the mirror, and
+ * drain-ms how long the mirror took to catch up after the last append;
+ * stalls counts appends that found the ring full.
+ */
+
+#define TOTAL ((size_t)1 << 28)
+
+enum mode { PLAIN, SYNC, ASYNC };
+
+static const char *const MODE[] = {"plain", "sync", "async"};
+
+static size_t rsize_ = 256;
+static uint64_t *lat_ = NULL;
+
+static PMEMlogpool *create(const char *path)
+{
+	unlink(path);
+	PMEMlogpool *const plp = pmemlog_create(path, TOTAL + (16 << 20),
+		0600);
+	assert(plp != NULL);
+	return plp;
+}
+
+static void run(enum mode mode, const char *path, const char *mpath)
+{
+	PMEMlogpool *const primary = create(path);
+	PMEMlogpool *const mirror = mode == PLAIN ? NULL : create(mpath);
+	PMEMlogrepl *const prl = mode == ASYNC
+		? pmemlogrepl_open(primary, mirror) : NULL;
+	assert(mode != ASYNC || prl != NULL);
+
+	char *const rec = malloc(rsize_);
+	assert(rec != NULL);
+	uint64_t seed = 1;
+	for (size_t i = 0; i < rsize_; ++i)
+		rec[i] = (char)perf_rand(&seed);
+
+	const size_t nrec = TOTAL / rsize_;
+	int r = 0;
+	const uint64_t t0 = now_ns();
+	for (size_t i = 0; i < nrec; ++i) {
+		const uint64_t s = now_ns();
+		switch (mode) {
+		case PLAIN:
+			r = pmemlog_append(primary, rec, rsize_);
+			break;
+		case SYNC:
+			r = pmemlog_append(primary, rec, rsize_);
+			r |= pmemlog_append(mirror, rec, rsize_);
+			break;
+		case ASYNC:
+			r = pmemlogrepl_append(prl, rec, rsize_);
+			break;
+		}
+		assert(r == 0);
+		lat_[i] = now_ns() - s;
+	}
+	const uint64_t t1 = now_ns();
+	struct pmemlogrepl_stats st;
+	memset(&st, 0, sizeof(st));
+	if (prl) {
+		r = pmemlogrepl_sync(prl);
+		assert(r == 0);
+		pmemlogrepl_stats(prl, &st);
+	}
+	const uint64_t t2 = now_ns();
+	(void)r;
+
+	qsort(lat_, nrec, sizeof(lat_[0]), cmp_u64);
+	printf("%s\t%zu\t%.1f\t%.2f\t%.2f\t%.2f\t%.1f\t%.1f\t%.3f\t%llu\n",
+		MODE[mode], rsize_, (double)TOTAL * 1e3 / (double)(t1 - t0),
+		(double)lat_[nrec / 2] / 1e3,
+		(double)lat_[nrec * 99 / 100] / 1e3,
+		(double)lat_[nrec * 999 / 1000] / 1e3,
+		st.nrec ? (double)st.lag_ns_sum / (double)st.nrec / 1e3 : 0.0,
+		(double)st.lag_ns_max / 1e3, (double)(t2 - t1) / 1e6,
+		(unsigned long long)st.nstall);
+
+	free(rec);
+	if (prl)
+		pmemlogrepl_close(prl);
+	if (mirror)
+		pmemlog_close(mirror);
+	pmemlog_close(primary);
+	unlink(path);
+	if (mirror)
+		unlink(mpath);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		rsize_ = strtoul(argv[1], NULL, 0);
+	assert(rsize_ >= 64 && rsize_ <= TOTAL);
+
+	const char *const path = perf_tmpfile();
+	const char *mpath = getenv("PERFTEST_MIRROR");
+	char buf[4096];
+	if (!mpath) {
+		snprintf(buf, sizeof(buf), "%s.mirror", path);
+		mpath = buf;
+	}
+	lat_ = malloc(TOTAL / rsize_ * sizeof(lat_[0]));
+	assert(lat_ != NULL);
+
+	run(PLAIN, path, mpath);
+	run(SYNC, path, mpath);
+	run(ASYNC, path, mpath);
+
+	free(lat_);
+	return 0;
+}
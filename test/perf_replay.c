@@ -0,0 +1,274 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <errno.h>
+#include <libpmemblk.h>
+#include <libpmemlog.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+#include "pmemtrace.h"
+
+/*
+ * Usage: perf_replay trace [speed]
+ *
+ * Replays a trace written by tracegen against a pmemblk pool at
+ * PERF_TMPFILE and a pmemlog pool next to it, with one thread per
+ * thread of the trace, and prints one line per op and one for all:
+ *
+ *   trace  speed  op  nops  ops/sec  p50  p99  p99.9  max  (us)
+ *
+ * The replay is open-loop: each op is issued at its timestamp divided
+ * by speed, and its latency is taken from then, so an op that waits for
+ * one before it to finish is charged the wait, as it would be under the
+ * recorded load. With speed 0 the ops are issued back to back, and
+ * latency is that of the call.
+ *
+ * Every block of the trace is written once before the clock starts, so
+ * that reads find data. An append that finds the log full rewinds it;
+ * the trace is refused if one could not fit the log at all.
+ */
+
+static struct pmemtrace tr_;
+static PMEMblkpool *pbp_ = NULL;
+static PMEMlogpool *plp_ = NULL;
+static double speed_ = 1.0;
+static uint64_t start_;
+static size_t maxappend_ = 0;
+static long nrewind_ = 0;
+
+/* the records of one thread of the trace */
+struct worker {
+	pthread_t th;
+	uint64_t *idx;
+	uint64_t *lat; /* ns, by idx */
+	size_t n;
+	volatile uint64_t sink; /* of the walks, not to optimize them away */
+};
+
+/* callback function passed to pmemlog_walk(); reads a word per line */
+static int touch_chunk(const void *buf, size_t len, void *arg)
+{
+	uint64_t *const sum = arg;
+	const uint64_t *const w = buf;
+	for (size_t i = 0; i < len / sizeof(*w); i += 64 / sizeof(*w))
+		*sum += w[i];
+	return 1;
+}
+
+static void issue(const struct pmemtrace_rec *rec, char *buf, uint64_t *sum)
+{
+	int r = 0;
+	switch (rec->op) {
+	case PMEMTRACE_BLK_READ:
+		r = pmemblk_read(pbp_, buf, (long long)rec->offset);
+		break;
+	case PMEMTRACE_BLK_WRITE:
+		r = pmemblk_write(pbp_, buf, (long long)rec->offset);
+		break;
+	case PMEMTRACE_BLK_ZERO:
+		r = pmemblk_set_zero(pbp_, (long long)rec->offset);
+		break;
+	case PMEMTRACE_LOG_APPEND:
+		/* it fits an empty log; see main() */
+		r = pmemlog_append(plp_, buf, rec->size);
+		if (r == -1 && errno == ENOSPC) {
+			pmemlog_rewind(plp_);
+			__atomic_add_fetch(&nrewind_, 1, __ATOMIC_RELAXED);
+			r = pmemlog_append(plp_, buf, rec->size);
+		}
+		break;
+	case PMEMTRACE_LOG_WALK:
+		pmemlog_walk(plp_, rec->size, touch_chunk, sum);
+		break;
+	}
+	assert(r == 0);
+	(void)r;
+}
+
+static void *worker(void *arg)
+{
+	struct worker *const w = arg;
+	const size_t len = maxappend_ > tr_.hdr->bsize
+		? maxappend_ : tr_.hdr->bsize;
+	char *const buf = malloc(len);
+	assert(buf != NULL);
+	memset(buf, 0xA5, len);
+	uint64_t sum = 0;
+
+	for (size_t i = 0; i < w->n; ++i) {
+		const struct pmemtrace_rec *const rec = &tr_.rec[w->idx[i]];
+		uint64_t t0;
+		if (speed_ > 0.0) {
+			t0 = start_ + (uint64_t)((double)rec->ts / speed_);
+			if (now_ns() < t0)
+				sleep_until(t0);
+		} else {
+			t0 = now_ns();
+		}
+		/* reads fill buf; a write after them writes whatever it has */
+		issue(rec, buf, &sum);
+		w->lat[i] = now_ns() - t0;
+	}
+
+	w->sink = sum;
+	free(buf);
+	return NULL;
+}
+
+/* the latencies of op, or of all ops if op is PMEMTRACE_NOP, sorted */
+static size_t gather(const struct worker *w, unsigned nw, unsigned op,
+		uint64_t *out)
+{
+	size_t n = 0;
+	for (unsigned t = 0; t < nw; ++t)
+		for (size_t i = 0; i < w[t].n; ++i)
+			if (op == PMEMTRACE_NOP
+					|| tr_.rec[w[t].idx[i]].op == op)
+				out[n++] = w[t].lat[i];
+	qsort(out, n, sizeof(*out), cmp_u64);
+	return n;
+}
+
+static void report(const char *op, const uint64_t *lat, size_t n,
+		long elapsed)
+{
+	if (n == 0)
+		return;
+	printf("%s\t%.2f\t%s\t%zu\t%.0f\t%.1f\t%.1f\t%.1f\t%.1f\n",
+		tr_.hdr->name, speed_, op, n,
+		(double)n * 1e6 / (double)elapsed,
+		(double)lat[n / 2] / 1e3,
+		(double)lat[n * 99 / 100] / 1e3,
+		(double)lat[n * 999 / 1000] / 1e3,
+		(double)lat[n - 1] / 1e3);
+}
+
+/* write every block of the trace once */
+static void prefill(void)
+{
+	const size_t nblock = tr_.hdr->nblock;
+	unsigned char *const touched = calloc((nblock + 7) / 8, 1);
+	char *const buf = malloc(tr_.hdr->bsize);
+	assert(touched != NULL && buf != NULL);
+	memset(buf, 0x5A, tr_.hdr->bsize);
+	for (uint64_t i = 0; i < tr_.hdr->nrec; ++i) {
+		const struct pmemtrace_rec *const rec = &tr_.rec[i];
+		if (rec->op > PMEMTRACE_BLK_ZERO)
+			continue;
+		const uint64_t b = rec->offset;
+		if (touched[b / 8] & (1U << (b % 8)))
+			continue;
+		touched[b / 8] |= (unsigned char)(1U << (b % 8));
+		const int r = pmemblk_write(pbp_, buf, (long long)b);
+		assert(r == 0);
+		(void)r;
+	}
+	free(buf);
+	free(touched);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s trace [speed]\n", argv[0]);
+		return 2;
+	}
+	if (pmemtrace_load(argv[1], &tr_) == -1) {
+		perror(argv[1]);
+		return 1;
+	}
+	speed_ = argc > 2 ? atof(argv[2]) : 1.0;
+	assert(speed_ >= 0.0);
+	const struct pmemtrace_hdr *const hdr = tr_.hdr;
+
+	/* the pools, with room for the metadata of libpmemblk */
+	const char *const path = perf_tmpfile();
+	char *const logpath = malloc(strlen(path) + 5);
+	assert(logpath != NULL);
+	sprintf(logpath, "%s.log", path);
+	unlink(path);
+	unlink(logpath);
+	size_t blksize = hdr->nblock * (hdr->bsize + 4) + ((size_t)16 << 20);
+	if (blksize < PMEMBLK_MIN_POOL)
+		blksize = PMEMBLK_MIN_POOL;
+	pbp_ = pmemblk_create(path, hdr->bsize, blksize, 0600);
+	assert(pbp_ != NULL);
+	assert(pmemblk_nblock(pbp_) >= hdr->nblock);
+	const size_t logsize = hdr->logsize < PMEMLOG_MIN_POOL
+		? PMEMLOG_MIN_POOL : hdr->logsize;
+	plp_ = pmemlog_create(logpath, logsize, 0600);
+	assert(plp_ != NULL);
+	prefill();
+
+	/* split the records by thread */
+	struct worker *const w = calloc(hdr->nthread, sizeof(*w));
+	assert(w != NULL);
+	for (uint64_t i = 0; i < hdr->nrec; ++i) {
+		++w[tr_.rec[i].thread].n;
+		if (tr_.rec[i].op == PMEMTRACE_LOG_APPEND
+				&& tr_.rec[i].size > maxappend_)
+			maxappend_ = tr_.rec[i].size;
+	}
+	if (maxappend_ > pmemlog_nbyte(plp_)) {
+		fprintf(stderr, "%s: an append of %zu bytes does not fit "
+			"a log of %zu\n", argv[1], maxappend_,
+			pmemlog_nbyte(plp_));
+		return 1;
+	}
+	for (unsigned t = 0; t < hdr->nthread; ++t) {
+		w[t].idx = malloc(w[t].n * sizeof(uint64_t) + 1);
+		w[t].lat = malloc(w[t].n * sizeof(uint64_t) + 1);
+		assert(w[t].idx != NULL && w[t].lat != NULL);
+		w[t].n = 0;
+	}
+	for (uint64_t i = 0; i < hdr->nrec; ++i) {
+		struct worker *const wt = &w[tr_.rec[i].thread];
+		wt->idx[wt->n++] = i;
+	}
+
+	/* wake up on time, not up to 50 us late */
+	prctl(PR_SET_TIMERSLACK, 1UL);
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	start_ = now_ns() + 1000000; /* leave the threads time to start */
+	for (unsigned t = 0; t < hdr->nthread; ++t) {
+		const int r = pthread_create(&w[t].th, NULL, worker, &w[t]);
+		assert(r == 0);
+		(void)r;
+	}
+	for (unsigned t = 0; t < hdr->nthread; ++t)
+		pthread_join(w[t].th, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	const long elapsed = elapsed_us(&t0, &t1);
+
+	uint64_t *const lat = malloc(hdr->nrec * sizeof(uint64_t) + 1);
+	assert(lat != NULL);
+	for (unsigned op = 0; op < PMEMTRACE_NOP; ++op)
+		report(pmemtrace_op_name(op), lat,
+			gather(w, hdr->nthread, op, lat), elapsed);
+	report("all", lat, gather(w, hdr->nthread, PMEMTRACE_NOP, lat),
+		elapsed);
+	if (nrewind_ > 0)
+		fprintf(stderr, "log rewound %ld times\n", nrewind_);
+
+	free(lat);
+	for (unsigned t = 0; t < hdr->nthread; ++t) {
+		free(w[t].idx);
+		free(w[t].lat);
+	}
+	free(w);
+	pmemlog_close(plp_);
+	pmemblk_close(pbp_);
+	unlink(logpath);
+	unlink(path);
+	free(logpath);
+	pmemtrace_unload(&tr_);
+	return 0;
+}
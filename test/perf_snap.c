@@ -0,0 +1,118 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <libpmemblk.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+#include "pmemsnap.h"
+
+/*
+ * Usage: perf_snap [nthreads]
+ *
+ * Writes NWRITE distinct blocks of a pmemblk pool with nthreads threads
+ * through pmemsnap, once to fault them in and three times measured, then
+ * exports the snapshot, and prints:
+ *
+ *   write   none    nthreads  writes/sec  (no snapshot)
+ *   write   first   nthreads  writes/sec  (each saves its block)
+ *   write   again   nthreads  writes/sec  (the blocks are saved)
+ *   export  -       nthreads  GiB/s
+ *
+ * first against none is the cost of copy-on-write; again against none
+ * is what an active snapshot costs once the working set is saved.
+ */
+
+#define POOLSIZE ((size_t)1 << 30)
+#define BSIZE    ((size_t)4096)
+#define NWRITE   (1 << 16)
+
+static PMEMsnap *psp_ = NULL;
+static int nthreads_ = 1;
+
+static void *write_worker(void *arg)
+{
+	char buf[BSIZE];
+	memset(buf, 0xA5, sizeof(buf));
+	for (long long i = (intptr_t)arg; i < NWRITE; i += nthreads_) {
+		const int r = pmemsnap_write(psp_, buf, i);
+		assert(r == 0);
+		(void)r;
+	}
+	return NULL;
+}
+
+static void run_write(const char *name)
+{
+	pthread_t *const th = calloc((size_t)nthreads_, sizeof(*th));
+	assert(th != NULL);
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int i = 0; i < nthreads_; ++i) {
+		const int r = pthread_create(&th[i], NULL, write_worker,
+			(void *)(intptr_t)i);
+		assert(r == 0);
+		(void)r;
+	}
+	for (int i = 0; i < nthreads_; ++i)
+		pthread_join(th[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	free(th);
+
+	if (name)
+		printf("write\t%s\t%d\t%.0f\n", name, nthreads_,
+			(double)NWRITE * 1e6 / (double)elapsed_us(&t0, &t1));
+}
+
+int main(int argc, char **argv)
+{
+	nthreads_ = argc > 1 ? atoi(argv[1]) : 1;
+	assert(nthreads_ > 0);
+
+	const char *const path = perf_tmpfile();
+	char snap[4096], img[4096];
+	snprintf(snap, sizeof(snap), "%s.snap", path);
+	snprintf(img, sizeof(img), "%s.img", path);
+	unlink(path);
+	unlink(snap);
+	unlink(img);
+
+	PMEMblkpool *const pbp = pmemblk_create(path, BSIZE, POOLSIZE, 0600);
+	assert(pbp != NULL);
+	assert(pmemblk_nblock(pbp) >= NWRITE);
+	psp_ = pmemsnap_create(pbp, snap, pmemsnap_size(pbp), 0600);
+	assert(psp_ != NULL);
+
+	run_write(NULL); /* fault the pool in */
+	run_write("none");
+	int r = pmemsnap_begin(psp_);
+	assert(r == 0);
+	run_write("first");
+	run_write("again");
+
+	const int fd = open(img, O_RDWR|O_CREAT|O_EXCL, 0600);
+	assert(fd != -1);
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	r = pmemsnap_export(psp_, fd, nthreads_);
+	assert(r == 0);
+	(void)r;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	close(fd);
+	printf("export\t-\t%d\t%.2f\n", nthreads_,
+		(double)(pmemblk_nblock(pbp) * BSIZE) / (double)(1 << 30)
+		* 1e6 / (double)elapsed_us(&t0, &t1));
+
+	pmemsnap_close(psp_);
+	pmemblk_close(pbp);
+	unlink(img);
+	unlink(snap);
+	unlink(path);
+	return 0;
+}
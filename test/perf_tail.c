@@ -0,0 +1,133 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+#include "pmemdax.h"
+
+/*
+ * Usage: perf_tail [nreaders] [interval_us]
+ *
+ * Forks nreaders processes that tail a pmemdaxlog pool with
+ * pmemdaxlog_reader_next(), then appends NREC records of RSIZE bytes,
+ * one every interval_us, each stamped with the time it was appended.
+ * Every reader takes the time at which it sees each record, and the
+ * latencies of all of them are printed as:
+ *
+ *   nreaders  interval_us  p50  p99  p99.9  max  (ns)
+ *
+ * An interval longer than PMEMDAX_SPIN_NS has readers asleep on the
+ * futex when a record comes; a shorter one keeps them spinning.
+ */
+
+#define POOLSIZE ((size_t)1 << 28)
+#define RSIZE    64
+#define NREC     20000
+
+/* shared with the readers */
+struct shared {
+	int ready;
+	uint64_t lat[]; /* nreaders * NREC */
+};
+
+static int reader(const char *path, struct shared *sh, uint64_t *lat)
+{
+	PMEMdaxlogreader *const plr = pmemdaxlog_reader_open(path);
+	if (!plr)
+		return 1;
+	__atomic_add_fetch(&sh->ready, 1, __ATOMIC_SEQ_CST);
+
+	int n = 0;
+	while (n < NREC) {
+		const void *buf;
+		const ssize_t len = pmemdaxlog_reader_next(plr, &buf, -1);
+		if (len <= 0 || len % RSIZE != 0)
+			return 1;
+		const uint64_t seen = now_ns();
+		for (const char *p = buf; p < (const char *)buf + len;
+				p += RSIZE) {
+			uint64_t stamp;
+			memcpy(&stamp, p, sizeof(stamp));
+			lat[n++] = seen - stamp;
+		}
+	}
+	pmemdaxlog_reader_close(plr);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const int nreaders = argc > 1 ? atoi(argv[1]) : 1;
+	const long interval_us = argc > 2 ? atol(argv[2]) : 100;
+	assert(nreaders > 0);
+
+	const char *const path = perf_tmpfile();
+	unlink(path);
+	const int fd = open(path, O_WRONLY|O_CREAT|O_EXCL, 0600);
+	assert(fd != -1);
+	int r = ftruncate(fd, (off_t)POOLSIZE);
+	assert(r == 0);
+	close(fd);
+	PMEMdaxlogpool *const plp = pmemdaxlog_create(path);
+	assert(plp != NULL);
+
+	const size_t nlat = (size_t)nreaders * NREC;
+	const size_t shlen = sizeof(struct shared) + nlat * sizeof(uint64_t);
+	struct shared *const sh = mmap(NULL, shlen, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	assert(sh != MAP_FAILED);
+
+	pid_t *const pid = calloc((size_t)nreaders, sizeof(*pid));
+	assert(pid != NULL);
+	for (int i = 0; i < nreaders; ++i) {
+		pid[i] = fork();
+		assert(pid[i] != -1);
+		if (pid[i] == 0)
+			_exit(reader(path, sh, sh->lat + (size_t)i * NREC));
+	}
+	while (__atomic_load_n(&sh->ready, __ATOMIC_SEQ_CST) < nreaders)
+		usleep(1000);
+
+	char rec[RSIZE];
+	memset(rec, 0xA5, sizeof(rec));
+	/* sleep, not spin, so that the writer leaves the readers a CPU */
+	uint64_t next = now_ns();
+	for (int i = 0; i < NREC; ++i) {
+		next += (uint64_t)interval_us * 1000;
+		const struct timespec ts = {
+			(time_t)(next / 1000000000ULL),
+			(long)(next % 1000000000ULL)};
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		const uint64_t stamp = now_ns();
+		memcpy(rec, &stamp, sizeof(stamp));
+		r = pmemdaxlog_append(plp, rec, sizeof(rec));
+		assert(r == 0);
+	}
+	for (int i = 0; i < nreaders; ++i) {
+		int status = 0;
+		waitpid(pid[i], &status, 0);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	(void)r;
+
+	qsort(sh->lat, nlat, sizeof(uint64_t), cmp_u64);
+	printf("%d\t%ld\t%lu\t%lu\t%lu\t%lu\n", nreaders, interval_us,
+		(unsigned long)sh->lat[nlat / 2],
+		(unsigned long)sh->lat[nlat * 99 / 100],
+		(unsigned long)sh->lat[nlat * 999 / 1000],
+		(unsigned long)sh->lat[nlat - 1]);
+
+	free(pid);
+	munmap(sh, shlen);
+	pmemdaxlog_close(plp);
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,177 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <libpmemblk.h>
+#include <libpmemlog.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PERF_TMPFILE "/tmp/perftest" /* should be on non-DAX FS */
+#include "perfplus.h"
+#include "pmemdax.h"
+
+/*
+ * Usage: perf_uring [blk|log] [depth]
+ *
+ * Runs the same workload on a file on non-DAX FS with libpmemblk/
+ * libpmemlog, whose every persist is an msync(2), and with pmemdax
+ * writing back through io_uring with O_DSYNC, through io_uring with
+ * fdatasync(2), and through pwrite(2), and prints one line per run:
+ *
+ *   engine  mode  op  ops/sec
+ *
+ * blk does random BSIZE writes over the blocks that every pool has;
+ * log appends BSIZE records. depth is PMEMDAX_URING_DEPTH of the
+ * io_uring runs. Do not set PMEM_IS_PMEM_FORCE=1.
+ */
+
+#define POOLSIZE ((size_t)1 << 28)
+#define BSIZE    ((size_t)4096)
+#define NOPS     (1 << 14)
+
+static char buf_[BSIZE];
+
+/* pmemdax formats an existing file in place */
+static void make_standin(const char *path)
+{
+	unlink(path);
+	const int fd = open(path, O_WRONLY|O_CREAT|O_EXCL, 0600);
+	assert(fd != -1);
+	const int r = ftruncate(fd, (off_t)POOLSIZE);
+	assert(r == 0);
+	(void)r;
+	close(fd);
+}
+
+static void print(const char *engine, const char *mode, const char *op,
+		long nops, const struct timespec *t0)
+{
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	printf("%s\t%s\t%s\t%.0f\n", engine, mode, op,
+		(double)nops * 1e6 / (double)elapsed_us(t0, &t1));
+}
+
+static void run_pmemblk(const char *path, size_t nblock)
+{
+	unlink(path);
+	PMEMblkpool *const pbp = pmemblk_create(path, BSIZE, POOLSIZE, 0600);
+	assert(pbp != NULL);
+	struct timespec t;
+	uint64_t seed = 1;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	for (int i = 0; i < NOPS; ++i) {
+		const int r = pmemblk_write(pbp, buf_,
+			(long long)(perf_rand(&seed) % nblock));
+		assert(r == 0);
+		(void)r;
+	}
+	print("pmemblk", "msync", "write", NOPS, &t);
+	pmemblk_close(pbp);
+	unlink(path);
+}
+
+static void run_daxblk(const char *path, const char *mode, size_t nblock)
+{
+	make_standin(path);
+	PMEMdaxblkpool *const pbp = pmemdaxblk_create(path, BSIZE);
+	assert(pbp != NULL);
+	struct timespec t;
+	uint64_t seed = 1;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	for (int i = 0; i < NOPS; ++i) {
+		const int r = pmemdaxblk_write(pbp, buf_,
+			(long long)(perf_rand(&seed) % nblock));
+		assert(r == 0);
+		(void)r;
+	}
+	print("pmemdax", mode, "write", NOPS, &t);
+	pmemdaxblk_close(pbp);
+	unlink(path);
+}
+
+static void run_pmemlog(const char *path)
+{
+	unlink(path);
+	PMEMlogpool *const plp = pmemlog_create(path, POOLSIZE, 0600);
+	assert(plp != NULL);
+	struct timespec t;
+	long n = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	while (n < NOPS && pmemlog_append(plp, buf_, BSIZE) == 0)
+		++n;
+	print("pmemlog", "msync", "append", n, &t);
+	pmemlog_close(plp);
+	unlink(path);
+}
+
+static void run_daxlog(const char *path, const char *mode)
+{
+	make_standin(path);
+	PMEMdaxlogpool *const plp = pmemdaxlog_create(path);
+	assert(plp != NULL);
+	struct timespec t;
+	long n = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	while (n < NOPS && pmemdaxlog_append(plp, buf_, BSIZE) == 0)
+		++n;
+	print("pmemdax", mode, "append", n, &t);
+	pmemdaxlog_close(plp);
+	unlink(path);
+}
+
+/* the environment that pmemdax reads when it maps a non-pmem file */
+static void set_mode(const char *depth, const char *fsync)
+{
+	int r = setenv("PMEMDAX_URING_DEPTH", depth, 1);
+	r |= setenv("PMEMDAX_URING_FSYNC", fsync, 1);
+	assert(r == 0);
+	(void)r;
+}
+
+int main(int argc, char **argv)
+{
+	const char *const op = argc > 1 ? argv[1] : "blk";
+	const char *const depth = argc > 2 ? argv[2] : "64";
+	const char *const path = perf_tmpfile();
+	memset(buf_, 0xA5, sizeof(buf_));
+
+	if (strcmp(op, "blk") == 0) {
+		unlink(path);
+		PMEMblkpool *const pbp =
+			pmemblk_create(path, BSIZE, POOLSIZE, 0600);
+		assert(pbp != NULL);
+		size_t nblock = pmemblk_nblock(pbp);
+		pmemblk_close(pbp);
+		make_standin(path);
+		PMEMdaxblkpool *const pdp = pmemdaxblk_create(path, BSIZE);
+		assert(pdp != NULL);
+		if (pmemdaxblk_nblock(pdp) < nblock)
+			nblock = pmemdaxblk_nblock(pdp);
+		pmemdaxblk_close(pdp);
+
+		run_pmemblk(path, nblock);
+		set_mode(depth, "0");
+		run_daxblk(path, "dsync", nblock);
+		set_mode(depth, "1");
+		run_daxblk(path, "fsync", nblock);
+		set_mode("0", "0");
+		run_daxblk(path, "pwrite", nblock);
+	} else if (strcmp(op, "log") == 0) {
+		run_pmemlog(path);
+		set_mode(depth, "0");
+		run_daxlog(path, "dsync");
+		set_mode(depth, "1");
+		run_daxlog(path, "fsync");
+		set_mode("0", "0");
+		run_daxlog(path, "pwrite");
+	} else {
+		fprintf(stderr, "usage: %s [blk|log] [depth]\n", argv[0]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,138 @@
+#ifndef PERFPLUS_H
+#define PERFPLUS_H
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pmemplus.h" /* now_ns(), sleep_until() */
+
+#ifndef PERF_TMPFILE
+#define PERF_TMPFILE "/mnt/pmem0/tmp/perftest"
+#endif
+
+/* $PERFTEST_FILE overrides PERF_TMPFILE, e.g. to a file on tmpfs */
+static inline const char *perf_tmpfile(void)
+{
+	const char *const p = getenv("PERFTEST_FILE");
+	return p ? p : PERF_TMPFILE;
+}
+
+static inline long elapsed_us(const struct timespec *s, const struct timespec *e)
+{
+	return (long)(e->tv_sec - s->tv_sec) * 1000000L
+		+ (e->tv_nsec - s->tv_nsec) / 1000L;
+}
+
+/* for qsort() of latencies */
+static inline int cmp_u64(const void *a, const void *b)
+{
+	const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* xorshift64*; good enough for workload generation */
+static inline uint64_t perf_rand(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 2685821657736338717ULL;
+}
+
+/* hardware cache events for perf_counter_open() */
+#define PERF_CACHE_EVENT(cache, op, result) \
+	((uint64_t)(cache) | (uint64_t)(op) << 8 | (uint64_t)(result) << 16)
+#define PERF_DTLB_LOAD_MISSES PERF_CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB, \
+	PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)
+#define PERF_DTLB_STORE_MISSES PERF_CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB, \
+	PERF_COUNT_HW_CACHE_OP_WRITE, PERF_COUNT_HW_CACHE_RESULT_MISS)
+#define PERF_LLC_LOAD_MISSES PERF_CACHE_EVENT(PERF_COUNT_HW_CACHE_LL, \
+	PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)
+#define PERF_LLC_STORE_MISSES PERF_CACHE_EVENT(PERF_COUNT_HW_CACHE_LL, \
+	PERF_COUNT_HW_CACHE_OP_WRITE, PERF_COUNT_HW_CACHE_RESULT_MISS)
+
+/*
+ * Opens a disabled counter of the calling thread, or returns -1 if the
+ * CPU or perf_event_paranoid does not allow it.
+ */
+static inline int perf_counter_open(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static inline void perf_counter_start(int fd)
+{
+	if (fd < 0)
+		return;
+	ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+	ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+/* stops the counter and returns its value, or -1 if it is not open */
+static inline long long perf_counter_stop(int fd)
+{
+	uint64_t n = 0;
+	if (fd < 0)
+		return -1;
+	ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(fd, &n, sizeof(n)) != (ssize_t)sizeof(n))
+		return -1;
+	return (long long)n;
+}
+
+/* dTLB and LLC misses of the calling thread, loads and stores summed */
+struct perf_misses {
+	int fd[4];
+	long long dtlb; /* -1 if not counted */
+	long long llc;  /* -1 if not counted */
+};
+
+static inline void perf_misses_open(struct perf_misses *m)
+{
+	static const uint64_t config[4] = {
+		PERF_DTLB_LOAD_MISSES, PERF_DTLB_STORE_MISSES,
+		PERF_LLC_LOAD_MISSES, PERF_LLC_STORE_MISSES,
+	};
+	for (int i = 0; i < 4; ++i)
+		m->fd[i] = perf_counter_open(PERF_TYPE_HW_CACHE, config[i]);
+	m->dtlb = m->llc = -1;
+}
+
+static inline void perf_misses_start(struct perf_misses *m)
+{
+	for (int i = 0; i < 4; ++i)
+		perf_counter_start(m->fd[i]);
+}
+
+static inline void perf_misses_stop(struct perf_misses *m)
+{
+	long long n[4];
+	for (int i = 0; i < 4; ++i)
+		n[i] = perf_counter_stop(m->fd[i]);
+	m->dtlb = n[0] < 0 || n[1] < 0 ? -1 : n[0] + n[1];
+	m->llc = n[2] < 0 || n[3] < 0 ? -1 : n[2] + n[3];
+}
+
+static inline void perf_misses_close(struct perf_misses *m)
+{
+	for (int i = 0; i < 4; ++i)
+		if (m->fd[i] >= 0)
+			close(m->fd[i]);
+}
+
+#endif /* PERFPLUS_H */
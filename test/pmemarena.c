@@ -0,0 +1,565 @@
+#include "config.h" /* should be included first */
+
+#include <errno.h>
+#include <libpmem.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pmemarena.h"
+#include "pmemplus.h"
+
+#define ARENA_MAGIC    "PMEMARN"
+#define ARENA_HDR_SIZE ((size_t)4096)
+
+#define SLAB_SIZE     PMEMARENA_SLAB_SIZE
+#define SLAB_NWORD    (SLAB_SIZE / 16 / 64) /* one bit per 16 bytes */
+#define SLAB_HDR_SIZE (64 + SLAB_NWORD * sizeof(uint64_t))
+
+#define NONE UINT32_MAX
+
+static const uint32_t class_size[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024,
+	1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384, 32768, 65536,
+};
+#define NCLASS (sizeof(class_size) / sizeof(class_size[0]))
+
+/* on-media layout */
+struct arena_hdr {
+	char magic[8];
+	uint64_t poolsize;
+	uint64_t nslab;
+	uint64_t reserved[5];
+	unsigned char root[PMEMARENA_ROOT_SIZE];
+};
+
+struct slab_hdr {
+	uint32_t cls; /* size class + 1, or 0 if not assigned yet */
+	uint32_t reserved[15];
+	uint64_t bitmap[SLAB_NWORD]; /* set bit = allocated object */
+};
+
+/* volatile per-slab state, rebuilt by pmemarena_open() */
+struct slab_rt {
+	uint32_t nfree;  /* atomic */
+	uint32_t owned;  /* owned by a thread cache; under lock */
+	uint32_t queued; /* on the partial list; under lock */
+	uint32_t next;   /* next on the partial list */
+	uint32_t hint;   /* bitmap word to start searching from */
+};
+
+struct tcache {
+	struct tcache *prev, *next;
+	PMEMarena *pap;
+	uint32_t slab[NCLASS];
+};
+
+struct pmemarena {
+	char *base;
+	size_t mapped_len;
+	int is_pmem;
+	struct arena_hdr *hdr;
+	size_t nslab;
+	struct slab_rt *rt;
+
+	pthread_mutex_t lock;    /* guards everything below */
+	uint32_t partial[NCLASS];
+	uint32_t fresh;          /* slabs from here on were never assigned */
+	pthread_key_t key;
+	struct tcache *tcaches;
+	int no_tcache;           /* every allocation takes the lock */
+};
+
+/* util functions */
+static int size_class(size_t size)
+{
+	if (size == 0 || size > PMEMARENA_MAX_ALLOC)
+		return -1;
+	for (int c = 0; c < (int)NCLASS; ++c)
+		if (size <= class_size[c])
+			return c;
+	return -1;
+}
+
+static uint32_t class_nobj(int c)
+{
+	return (uint32_t)((SLAB_SIZE - SLAB_HDR_SIZE) / class_size[c]);
+}
+
+static struct slab_hdr *slab_hdr(PMEMarena *pap, uint32_t s)
+{
+	return (struct slab_hdr *)(pap->base + ARENA_HDR_SIZE + s * SLAB_SIZE);
+}
+
+/* bits of the w-th bitmap word which map to existing objects */
+static uint64_t word_mask(uint32_t nobj, uint32_t w)
+{
+	const uint32_t rem = nobj - w * 64;
+	return rem >= 64 ? ~0ULL : (1ULL << rem) - 1;
+}
+
+void pmemarena_persist(PMEMarena *pap, const void *addr, size_t len)
+{
+	if (pap->is_pmem)
+		pmem_persist(addr, len);
+	else
+		pmem_msync(addr, len);
+}
+
+/* slab ownership; the caller holds pap->lock */
+static void partial_push(PMEMarena *pap, uint32_t s, int c)
+{
+	struct slab_rt *const rt = &pap->rt[s];
+	if (rt->owned || rt->queued)
+		return;
+	rt->queued = 1;
+	rt->next = pap->partial[c];
+	pap->partial[c] = s;
+}
+
+static void partial_remove(PMEMarena *pap, uint32_t s, int c)
+{
+	uint32_t *p = &pap->partial[c];
+	while (*p != NONE && *p != s)
+		p = &pap->rt[*p].next;
+	if (*p == s) {
+		*p = pap->rt[s].next;
+		pap->rt[s].queued = 0;
+	}
+}
+
+static void slab_release_locked(PMEMarena *pap, uint32_t s, int c)
+{
+	pap->rt[s].owned = 0;
+	if (__atomic_load_n(&pap->rt[s].nfree, __ATOMIC_ACQUIRE) > 0)
+		partial_push(pap, s, c);
+}
+
+static void slab_assign(PMEMarena *pap, uint32_t s, int c)
+{
+	/*
+	 * The bitmap of a slab being (re)assigned is all zero,
+	 * so the class can be switched by a single 4-byte store.
+	 */
+	struct slab_hdr *const sh = slab_hdr(pap, s);
+	__atomic_store_n(&sh->cls, (uint32_t)c + 1, __ATOMIC_RELEASE);
+	pmemarena_persist(pap, &sh->cls, sizeof(sh->cls));
+	pap->rt[s].nfree = class_nobj(c);
+	pap->rt[s].hint = 0;
+}
+
+static uint32_t slab_acquire_locked(PMEMarena *pap, int c)
+{
+	uint32_t s = NONE;
+
+	/* 1. a partially used slab of the same class */
+	while (pap->partial[c] != NONE) {
+		const uint32_t t = pap->partial[c];
+		struct slab_rt *const rt = &pap->rt[t];
+		pap->partial[c] = rt->next;
+		rt->queued = 0;
+		if (!rt->owned && rt->nfree > 0
+				&& slab_hdr(pap, t)->cls == (uint32_t)c + 1) {
+			s = t;
+			break;
+		}
+	}
+
+	/* 2. a slab never assigned */
+	if (s == NONE && pap->fresh < pap->nslab) {
+		s = pap->fresh++;
+		slab_assign(pap, s, c);
+	}
+
+	/* 3. an empty slab of any class; only when the pool is full */
+	for (uint32_t t = 0; s == NONE && t < pap->nslab; ++t) {
+		struct slab_rt *const rt = &pap->rt[t];
+		const uint32_t cls = slab_hdr(pap, t)->cls;
+		if (rt->owned)
+			continue;
+		if (cls != 0 && __atomic_load_n(&rt->nfree, __ATOMIC_ACQUIRE)
+				!= class_nobj((int)cls - 1))
+			continue;
+		if (rt->queued)
+			partial_remove(pap, t, (int)cls - 1);
+		s = t;
+		slab_assign(pap, s, c);
+	}
+
+	if (s != NONE)
+		pap->rt[s].owned = 1;
+	return s;
+}
+
+static uint32_t slab_acquire(PMEMarena *pap, int c)
+{
+	pthread_mutex_lock(&pap->lock);
+	const uint32_t s = slab_acquire_locked(pap, c);
+	pthread_mutex_unlock(&pap->lock);
+	return s;
+}
+
+static void *slab_alloc(PMEMarena *pap, uint32_t s, int c)
+{
+	struct slab_hdr *const sh = slab_hdr(pap, s);
+	struct slab_rt *const rt = &pap->rt[s];
+
+	if (__atomic_load_n(&rt->nfree, __ATOMIC_ACQUIRE) == 0)
+		return NULL;
+
+	const uint32_t nobj = class_nobj(c);
+	const uint32_t nword = (nobj + 63) / 64;
+	for (uint32_t i = 0; i < nword; ++i) {
+		const uint32_t w = (rt->hint + i) % nword;
+		const uint64_t v = __atomic_load_n(&sh->bitmap[w], __ATOMIC_RELAXED);
+		const uint64_t avail = ~v & word_mask(nobj, w);
+		if (!avail)
+			continue;
+
+		/*
+		 * Only the owner sets bits but any thread may clear them,
+		 * hence the atomic OR. The object is handed out only after
+		 * its bit is persistent.
+		 */
+		const uint64_t bit = avail & (~avail + 1);
+		__atomic_fetch_or(&sh->bitmap[w], bit, __ATOMIC_ACQ_REL);
+		pmemarena_persist(pap, &sh->bitmap[w], sizeof(uint64_t));
+		__atomic_fetch_sub(&rt->nfree, 1, __ATOMIC_ACQ_REL);
+		rt->hint = w;
+
+		const size_t idx = (size_t)w * 64 + (size_t)__builtin_ctzll(bit);
+		return (char *)sh + SLAB_HDR_SIZE + idx * class_size[c];
+	}
+	return NULL;
+}
+
+/* thread caches */
+static void tcache_destroy(void *arg)
+{
+	struct tcache *const tc = arg;
+	PMEMarena *const pap = tc->pap;
+
+	pthread_mutex_lock(&pap->lock);
+	for (int c = 0; c < (int)NCLASS; ++c)
+		if (tc->slab[c] != NONE)
+			slab_release_locked(pap, tc->slab[c], c);
+	if (tc->prev)
+		tc->prev->next = tc->next;
+	else
+		pap->tcaches = tc->next;
+	if (tc->next)
+		tc->next->prev = tc->prev;
+	pthread_mutex_unlock(&pap->lock);
+
+	free(tc);
+}
+
+static struct tcache *tcache_get(PMEMarena *pap)
+{
+	struct tcache *tc = pthread_getspecific(pap->key);
+	if (tc)
+		return tc;
+
+	tc = malloc(sizeof(*tc));
+	if (!tc)
+		return NULL;
+	tc->pap = pap;
+	for (int c = 0; c < (int)NCLASS; ++c)
+		tc->slab[c] = NONE;
+
+	pthread_mutex_lock(&pap->lock);
+	tc->prev = NULL;
+	tc->next = pap->tcaches;
+	if (tc->next)
+		tc->next->prev = tc;
+	pap->tcaches = tc;
+	pthread_mutex_unlock(&pap->lock);
+
+	if (pthread_setspecific(pap->key, tc) != 0) {
+		tcache_destroy(tc);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return tc;
+}
+
+/* pool management */
+static PMEMarena *arena_init(char *base, size_t mapped_len, int is_pmem)
+{
+	PMEMarena *const pap = calloc(1, sizeof(*pap));
+	if (!pap)
+		return NULL;
+
+	pap->base = base;
+	pap->mapped_len = mapped_len;
+	pap->is_pmem = is_pmem;
+	pap->hdr = (struct arena_hdr *)base;
+	pap->nslab = pap->hdr->nslab;
+	for (int c = 0; c < (int)NCLASS; ++c)
+		pap->partial[c] = NONE;
+
+	pap->rt = calloc(pap->nslab, sizeof(*pap->rt));
+	if (!pap->rt) {
+		free(pap);
+		return NULL;
+	}
+
+	/* recovery: the bitmaps are the only allocation state */
+	for (uint32_t s = 0; s < pap->nslab; ++s) {
+		const struct slab_hdr *const sh = slab_hdr(pap, s);
+		if (sh->cls == 0)
+			continue;
+		const int c = (int)sh->cls - 1;
+		const uint32_t nobj = class_nobj(c);
+		uint32_t used = 0;
+		for (uint32_t w = 0; w < (nobj + 63) / 64; ++w)
+			used += (uint32_t)__builtin_popcountll(
+				sh->bitmap[w] & word_mask(nobj, w));
+		pap->rt[s].nfree = nobj - used;
+		pap->fresh = s + 1;
+		partial_push(pap, s, c);
+	}
+
+	if (pthread_key_create(&pap->key, tcache_destroy) != 0) {
+		free(pap->rt);
+		free(pap);
+		errno = EAGAIN;
+		return NULL;
+	}
+	pthread_mutex_init(&pap->lock, NULL);
+	return pap;
+}
+
+PMEMarena *pmemarena_create(const char *path, size_t poolsize, mode_t mode)
+{
+	if (poolsize < PMEMARENA_MIN_POOL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	char *const base = pmem_map_file(path, poolsize,
+		PMEM_FILE_CREATE|PMEM_FILE_EXCL, mode, &mapped_len, &is_pmem);
+	if (!base)
+		return NULL;
+
+	/* a new file reads as zeroes; i.e. every slab is unassigned */
+	struct arena_hdr *const hdr = (struct arena_hdr *)base;
+	hdr->poolsize = mapped_len;
+	hdr->nslab = (mapped_len - ARENA_HDR_SIZE) / SLAB_SIZE;
+	pmem_msync(hdr, sizeof(*hdr));
+
+	magic_persist(hdr->magic, ARENA_MAGIC);
+
+	PMEMarena *const pap = arena_init(base, mapped_len, is_pmem);
+	if (!pap) {
+		const int oerrno = errno;
+		pmem_unmap(base, mapped_len);
+		unlink(path);
+		errno = oerrno;
+	}
+	return pap;
+}
+
+PMEMarena *pmemarena_open(const char *path)
+{
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	char *const base = pmem_map_file(path, 0, 0, 0,
+		&mapped_len, &is_pmem);
+	if (!base)
+		return NULL;
+
+	const struct arena_hdr *const hdr = (struct arena_hdr *)base;
+	int valid = mapped_len >= PMEMARENA_MIN_POOL
+		&& memcmp(hdr->magic, ARENA_MAGIC, sizeof(hdr->magic)) == 0
+		&& hdr->poolsize == mapped_len
+		&& hdr->nslab == (mapped_len - ARENA_HDR_SIZE) / SLAB_SIZE;
+	for (uint64_t s = 0; valid && s < hdr->nslab; ++s) {
+		const struct slab_hdr *const sh = (struct slab_hdr *)
+			(base + ARENA_HDR_SIZE + s * SLAB_SIZE);
+		valid = sh->cls <= NCLASS;
+	}
+	if (!valid) {
+		pmem_unmap(base, mapped_len);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	PMEMarena *const pap = arena_init(base, mapped_len, is_pmem);
+	if (!pap) {
+		const int oerrno = errno;
+		pmem_unmap(base, mapped_len);
+		errno = oerrno;
+	}
+	return pap;
+}
+
+void pmemarena_close(PMEMarena *pap)
+{
+	/* thread caches of threads still alive are simply dropped */
+	pthread_key_delete(pap->key);
+	for (struct tcache *tc = pap->tcaches, *next; tc; tc = next) {
+		next = tc->next;
+		free(tc);
+	}
+	pthread_mutex_destroy(&pap->lock);
+	pmem_unmap(pap->base, pap->mapped_len);
+	free(pap->rt);
+	free(pap);
+}
+
+/* allocation */
+
+/* takes a slab, an object from it and gives the slab back, all locked */
+static void *alloc_uncached(PMEMarena *pap, int c)
+{
+	void *ptr = NULL;
+	pthread_mutex_lock(&pap->lock);
+	while (!ptr) {
+		const uint32_t s = slab_acquire_locked(pap, c);
+		if (s == NONE) {
+			errno = ENOMEM;
+			break;
+		}
+		ptr = slab_alloc(pap, s, c);
+		slab_release_locked(pap, s, c);
+	}
+	pthread_mutex_unlock(&pap->lock);
+	return ptr;
+}
+
+void pmemarena_set_tcache(PMEMarena *pap, int enabled)
+{
+	__atomic_store_n(&pap->no_tcache, !enabled, __ATOMIC_RELAXED);
+}
+
+void *pmemarena_alloc(PMEMarena *pap, size_t size)
+{
+	const int c = size_class(size);
+	if (c < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (__atomic_load_n(&pap->no_tcache, __ATOMIC_RELAXED))
+		return alloc_uncached(pap, c);
+
+	struct tcache *const tc = tcache_get(pap);
+	if (!tc)
+		return NULL;
+
+	for (;;) {
+		if (tc->slab[c] == NONE) {
+			tc->slab[c] = slab_acquire(pap, c);
+			if (tc->slab[c] == NONE) {
+				errno = ENOMEM;
+				return NULL;
+			}
+		}
+
+		void *const ptr = slab_alloc(pap, tc->slab[c], c);
+		if (ptr)
+			return ptr;
+
+		/* the slab is full; give it back so that frees refill it */
+		pthread_mutex_lock(&pap->lock);
+		slab_release_locked(pap, tc->slab[c], c);
+		pthread_mutex_unlock(&pap->lock);
+		tc->slab[c] = NONE;
+	}
+}
+
+/* returns the slab index of ptr, or NONE if ptr is not an object */
+static uint32_t slab_of(PMEMarena *pap, const void *ptr, size_t *idx)
+{
+	const char *const p = ptr;
+	const char *const slabs = pap->base + ARENA_HDR_SIZE;
+	if (p < slabs || p >= slabs + pap->nslab * SLAB_SIZE)
+		return NONE;
+
+	const size_t off = (size_t)(p - slabs);
+	const uint32_t s = (uint32_t)(off / SLAB_SIZE);
+	const uint32_t cls = slab_hdr(pap, s)->cls;
+	const size_t in_slab = off % SLAB_SIZE;
+	if (cls == 0 || in_slab < SLAB_HDR_SIZE)
+		return NONE;
+
+	const size_t size = class_size[cls - 1];
+	if ((in_slab - SLAB_HDR_SIZE) % size != 0)
+		return NONE;
+	*idx = (in_slab - SLAB_HDR_SIZE) / size;
+	if (*idx >= class_nobj((int)cls - 1))
+		return NONE;
+	return s;
+}
+
+void pmemarena_free(PMEMarena *pap, void *ptr)
+{
+	size_t idx = 0;
+	if (!ptr)
+		return;
+	const uint32_t s = slab_of(pap, ptr, &idx);
+	if (s == NONE)
+		return;
+
+	struct slab_hdr *const sh = slab_hdr(pap, s);
+	const uint64_t bit = 1ULL << (idx % 64);
+	uint64_t *const word = &sh->bitmap[idx / 64];
+	const uint64_t old = __atomic_fetch_and(word, ~bit, __ATOMIC_ACQ_REL);
+	if (!(old & bit))
+		return; /* double free */
+	pmemarena_persist(pap, word, sizeof(*word));
+
+	/* a full slab has no owner; put it back on the partial list */
+	if (__atomic_fetch_add(&pap->rt[s].nfree, 1, __ATOMIC_ACQ_REL) == 0) {
+		pthread_mutex_lock(&pap->lock);
+		partial_push(pap, s, (int)sh->cls - 1);
+		pthread_mutex_unlock(&pap->lock);
+	}
+}
+
+size_t pmemarena_usable_size(PMEMarena *pap, const void *ptr)
+{
+	size_t idx = 0;
+	const uint32_t s = slab_of(pap, ptr, &idx);
+	return s == NONE ? 0 : class_size[slab_hdr(pap, s)->cls - 1];
+}
+
+void *pmemarena_root(PMEMarena *pap)
+{
+	return pap->hdr->root;
+}
+
+uint64_t pmemarena_off(PMEMarena *pap, const void *ptr)
+{
+	return (uint64_t)((const char *)ptr - pap->base);
+}
+
+void *pmemarena_ptr(PMEMarena *pap, uint64_t off)
+{
+	return off < pap->mapped_len ? pap->base + off : NULL;
+}
+
+void pmemarena_stats(PMEMarena *pap, struct pmemarena_stats *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->nslab = pap->nslab;
+	for (uint32_t s = 0; s < pap->nslab; ++s) {
+		const uint32_t cls = slab_hdr(pap, s)->cls;
+		if (cls == 0)
+			continue;
+		const uint32_t nobj = class_nobj((int)cls - 1);
+		const uint32_t used = nobj
+			- __atomic_load_n(&pap->rt[s].nfree, __ATOMIC_ACQUIRE);
+		if (used == 0)
+			continue;
+		st->nslab_used++;
+		st->nobj += used;
+		st->allocated += (size_t)used * class_size[cls - 1];
+		st->footprint += SLAB_SIZE;
+	}
+}
@@ -0,0 +1,67 @@
+#ifndef PMEMARENA_H
+#define PMEMARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * pmemarena: a crash-safe slab allocator over a pmem_map_file() region.
+ *
+ * The pool is split into 256 KiB slabs. Each slab serves a single size
+ * class and keeps its allocation state in a persistent bitmap, so that
+ * pmemarena_open() can recover every live object without a log.
+ * Allocating threads own a slab per size class and do not take the
+ * global lock except to refill.
+ *
+ * Crash safety covers the allocator's own state only. An object is
+ * allocated once its bit is persistent, so one that was allocated but
+ * not yet linked from the root or another object when the process died
+ * stays allocated after pmemarena_open() and leaks: the bitmaps cannot
+ * tell it from a live one. Callers that cannot afford that must record
+ * the object in their own persistent state before relying on it, and
+ * free what that record does not reach after a crash.
+ */
+
+#define PMEMARENA_MIN_POOL  ((size_t)(1 << 20) * 4)
+#define PMEMARENA_MAX_ALLOC ((size_t)(1 << 16))
+#define PMEMARENA_SLAB_SIZE ((size_t)(1 << 18))
+#define PMEMARENA_ROOT_SIZE ((size_t)512)
+
+typedef struct pmemarena PMEMarena;
+
+struct pmemarena_stats {
+	size_t nslab;      /* slabs in the pool */
+	size_t nslab_used; /* slabs holding at least one object */
+	size_t nobj;       /* allocated objects */
+	size_t allocated;  /* bytes of allocated objects (class-rounded) */
+	size_t footprint;  /* bytes of slabs holding at least one object */
+};
+
+PMEMarena *pmemarena_create(const char *path, size_t poolsize, mode_t mode);
+PMEMarena *pmemarena_open(const char *path);
+void pmemarena_close(PMEMarena *pap);
+
+void *pmemarena_alloc(PMEMarena *pap, size_t size);
+void pmemarena_free(PMEMarena *pap, void *ptr);
+size_t pmemarena_usable_size(PMEMarena *pap, const void *ptr);
+
+/*
+ * With enabled == 0, allocations no longer use the thread caches but
+ * take the global lock for each object; for benchmarks. On by default.
+ */
+void pmemarena_set_tcache(PMEMarena *pap, int enabled);
+
+/* PMEMARENA_ROOT_SIZE bytes of persistent user data in the pool header */
+void *pmemarena_root(PMEMarena *pap);
+
+/* Offsets stay valid across pmemarena_close()/pmemarena_open(). */
+uint64_t pmemarena_off(PMEMarena *pap, const void *ptr);
+void *pmemarena_ptr(PMEMarena *pap, uint64_t off);
+
+/* pmem_persist() or pmem_msync() depending on the pool's media */
+void pmemarena_persist(PMEMarena *pap, const void *addr, size_t len);
+
+void pmemarena_stats(PMEMarena *pap, struct pmemarena_stats *st);
+
+#endif /* PMEMARENA_H */
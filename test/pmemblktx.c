@@ -0,0 +1,535 @@
+#include "config.h" /* should be included first */
+
+#include <errno.h>
+#include <libpmem.h>
+#include <libpmemblk.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pmemblktx.h"
+#include "pmemplus.h"
+
+#define BLKTX_MAGIC   "PMEMBTX"
+#define BLKTX_HDR_SIZE ((size_t)4096)
+
+#define NLANE         8
+#define NSTRIPE       1024
+#define MAX_THREADS   8
+
+/* on-media layout */
+struct blktx_hdr {
+	char magic[8];
+	uint64_t logsize;
+	uint64_t bsize;
+	uint64_t nlane;
+	uint64_t lanesize;
+	uint64_t nmax; /* records per lane */
+};
+
+/*
+ * A lane is a commit record, nmax block numbers and nmax blocks. The
+ * record is valid if nrec is not 0 and checksum matches the seq, nrec,
+ * block numbers and blocks.
+ */
+struct commit {
+	uint64_t seq;
+	uint64_t nrec;
+	uint64_t checksum;
+} __attribute__((aligned(64)));
+
+struct lane {
+	pthread_mutex_t lock;
+	int stuck; /* left committed, by PMEMBLKTX_NOAPPLY or an error */
+};
+
+struct pmemblktx {
+	PMEMblkpool *pbp;
+	char *base;
+	size_t mapped_len;
+	int is_pmem;
+	size_t bsize;
+	size_t nblock;
+	size_t lanesize;
+	size_t nmax;
+	size_t data_off; /* of blocks in a lane */
+	uint64_t seq;
+	unsigned next_lane;
+	struct lane lane[NLANE];
+	pthread_mutex_t stripe[NSTRIPE];
+	int fence[NSTRIPE]; /* 1 + the stuck lane holding the stripe, or 0 */
+};
+
+/* a committed write found in the log on open */
+struct redo {
+	uint64_t blockno;
+	uint64_t seq;
+	const char *data;
+};
+
+/* util functions */
+static void persist(PMEMblktx *ptx, const void *addr, size_t len)
+{
+	if (ptx->is_pmem)
+		pmem_persist(addr, len);
+	else
+		pmem_msync(addr, len);
+}
+
+static uint64_t checksum_final(const uint64_t sum[2], uint64_t seq,
+		uint64_t nrec)
+{
+	uint64_t s[2] = {sum[0], sum[1]};
+	const uint64_t tail[2] = {seq, nrec};
+	fletcher64_update(s, tail, sizeof(tail));
+	return fletcher64_final(s);
+}
+
+static struct commit *lane_commit(PMEMblktx *ptx, int i)
+{
+	return (struct commit *)(ptx->base + BLKTX_HDR_SIZE
+		+ (size_t)i * ptx->lanesize);
+}
+
+static uint64_t *lane_blockno(PMEMblktx *ptx, int i)
+{
+	return (uint64_t *)((char *)lane_commit(ptx, i) + sizeof(struct commit));
+}
+
+static char *lane_data(PMEMblktx *ptx, int i)
+{
+	return (char *)lane_commit(ptx, i) + ptx->data_off;
+}
+
+static size_t data_offset(size_t nmax)
+{
+	const size_t off = sizeof(struct commit) + nmax * sizeof(uint64_t);
+	return (off + 63) & ~(size_t)63;
+}
+
+/* the records of lane i if they are committed, otherwise 0 */
+static size_t lane_valid(PMEMblktx *ptx, int i)
+{
+	const struct commit *const c = lane_commit(ptx, i);
+	if (c->nrec == 0 || c->nrec > ptx->nmax)
+		return 0;
+
+	const uint64_t *const blockno = lane_blockno(ptx, i);
+	uint64_t sum[2] = {0, 0};
+	fletcher64_update(sum, blockno, c->nrec * sizeof(*blockno));
+	for (size_t r = 0; r < c->nrec; ++r) {
+		if (blockno[r] >= ptx->nblock)
+			return 0;
+		fletcher64_update(sum, lane_data(ptx, i) + r * ptx->bsize,
+			ptx->bsize);
+	}
+	if (checksum_final(sum, c->seq, c->nrec) != c->checksum)
+		return 0;
+	return c->nrec;
+}
+
+static void lane_invalidate(PMEMblktx *ptx, int i)
+{
+	struct commit *const c = lane_commit(ptx, i);
+	c->nrec = 0;
+	persist(ptx, &c->nrec, sizeof(c->nrec));
+}
+
+static struct lane *lane_acquire(PMEMblktx *ptx)
+{
+	const unsigned start =
+		__atomic_fetch_add(&ptx->next_lane, 1, __ATOMIC_RELAXED);
+	for (int pass = 0; pass < 2; ++pass) {
+		for (unsigned i = 0; i < NLANE; ++i) {
+			struct lane *const l = &ptx->lane[(start + i) % NLANE];
+			if (pass == 0 && pthread_mutex_trylock(&l->lock) != 0)
+				continue;
+			if (pass == 1)
+				pthread_mutex_lock(&l->lock);
+			if (!l->stuck)
+				return l;
+			pthread_mutex_unlock(&l->lock);
+		}
+	}
+	return NULL;
+}
+
+/* locks the stripes of w in ascending order, to avoid deadlocks */
+static void stripes_lock(PMEMblktx *ptx, const struct pmemblktx_write *w,
+		int nwrite, uint64_t *set)
+{
+	memset(set, 0, NSTRIPE / 8);
+	for (int i = 0; i < nwrite; ++i) {
+		const size_t s = (size_t)w[i].blockno % NSTRIPE;
+		set[s / 64] |= (uint64_t)1 << (s % 64);
+	}
+	for (size_t s = 0; s < NSTRIPE; ++s)
+		if (set[s / 64] & ((uint64_t)1 << (s % 64)))
+			pthread_mutex_lock(&ptx->stripe[s]);
+}
+
+static void stripes_unlock(PMEMblktx *ptx, const uint64_t *set)
+{
+	for (size_t s = 0; s < NSTRIPE; ++s)
+		if (set[s / 64] & ((uint64_t)1 << (s % 64)))
+			pthread_mutex_unlock(&ptx->stripe[s]);
+}
+
+/*
+ * Writes the blocks of stuck lane i to the pool and frees the lane. Its
+ * stripes have been fenced since it committed, so none of its blocks
+ * has been written since; the caller holds one of them.
+ */
+static int lane_redo(PMEMblktx *ptx, int i)
+{
+	struct lane *const l = &ptx->lane[i];
+	pthread_mutex_lock(&l->lock);
+	if (!l->stuck) {
+		/* redone by another transaction meanwhile */
+		pthread_mutex_unlock(&l->lock);
+		return 0;
+	}
+	const size_t nrec = lane_commit(ptx, i)->nrec;
+	const uint64_t *const blockno = lane_blockno(ptx, i);
+	/* in order, so that a later write in the same transaction wins */
+	for (size_t r = 0; r < nrec; ++r) {
+		if (pmemblk_write(ptx->pbp, lane_data(ptx, i) + r * ptx->bsize,
+				(long long)blockno[r]) != 0) {
+			pthread_mutex_unlock(&l->lock);
+			return -1;
+		}
+	}
+	lane_invalidate(ptx, i);
+	for (size_t r = 0; r < nrec; ++r)
+		__atomic_store_n(&ptx->fence[blockno[r] % NSTRIPE], 0,
+			__ATOMIC_RELEASE);
+	l->stuck = 0;
+	pthread_mutex_unlock(&l->lock);
+	return 0;
+}
+
+/*
+ * Redoes the stuck lanes fencing the stripes in set, which are locked;
+ * otherwise a transaction writing their blocks would be overwritten by
+ * the older one when the log is redone on open.
+ */
+static int stripes_unfence(PMEMblktx *ptx, const uint64_t *set)
+{
+	for (size_t s = 0; s < NSTRIPE; ++s) {
+		if (!(set[s / 64] & ((uint64_t)1 << (s % 64))))
+			continue;
+		const int f = __atomic_load_n(&ptx->fence[s], __ATOMIC_ACQUIRE);
+		if (f != 0 && lane_redo(ptx, f - 1) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void stripes_fence(PMEMblktx *ptx, const uint64_t *set, int lane)
+{
+	for (size_t s = 0; s < NSTRIPE; ++s)
+		if (set[s / 64] & ((uint64_t)1 << (s % 64)))
+			__atomic_store_n(&ptx->fence[s], lane + 1,
+				__ATOMIC_RELEASE);
+}
+
+/* redo */
+struct redo_arg {
+	PMEMblktx *ptx;
+	const struct redo *redo;
+	size_t n;
+};
+
+static void *redo_worker(void *arg)
+{
+	struct redo_arg *const a = arg;
+	for (size_t i = 0; i < a->n; ++i)
+		if (pmemblk_write(a->ptx->pbp, a->redo[i].data,
+				(long long)a->redo[i].blockno) != 0)
+			return worker_failed();
+	return NULL;
+}
+
+static int redo_compare(const void *a, const void *b)
+{
+	const struct redo *const ra = a, *const rb = b;
+	if (ra->blockno != rb->blockno)
+		return ra->blockno < rb->blockno ? -1 : 1;
+	if (ra->seq != rb->seq)
+		return ra->seq < rb->seq ? -1 : 1;
+	/* a later write in the same transaction wins */
+	return ra->data < rb->data ? -1 : ra->data > rb->data;
+}
+
+/*
+ * Writes the latest committed data of each block in the log, several
+ * blocks at a time, then invalidates the log.
+ */
+static int blktx_redo(PMEMblktx *ptx)
+{
+	size_t n = 0;
+	for (int i = 0; i < NLANE; ++i) {
+		const size_t nrec = lane_valid(ptx, i);
+		n += nrec;
+		if (lane_commit(ptx, i)->seq > ptx->seq)
+			ptx->seq = lane_commit(ptx, i)->seq;
+	}
+	if (n == 0)
+		return 0;
+
+	struct redo *const redo = malloc(n * sizeof(*redo));
+	if (!redo)
+		return -1;
+	size_t k = 0;
+	for (int i = 0; i < NLANE; ++i) {
+		const size_t nrec = lane_valid(ptx, i);
+		for (size_t r = 0; r < nrec; ++r) {
+			redo[k].blockno = lane_blockno(ptx, i)[r];
+			redo[k].seq = lane_commit(ptx, i)->seq;
+			redo[k].data = lane_data(ptx, i) + r * ptx->bsize;
+			++k;
+		}
+	}
+	qsort(redo, n, sizeof(*redo), redo_compare);
+
+	/* keep the last write of each block */
+	size_t m = 0;
+	for (size_t i = 0; i < n; ++i) {
+		if (m > 0 && redo[m - 1].blockno == redo[i].blockno)
+			--m;
+		redo[m++] = redo[i];
+	}
+
+	int nthreads = MAX_THREADS;
+	if ((size_t)nthreads > m)
+		nthreads = (int)m;
+	struct redo_arg arg[MAX_THREADS];
+	for (int t = 0; t < nthreads; ++t) {
+		const size_t lo = m * (size_t)t / (size_t)nthreads;
+		const size_t hi = m * (size_t)(t + 1) / (size_t)nthreads;
+		arg[t] = (struct redo_arg){ptx, redo + lo, hi - lo};
+	}
+	const int ret = run_workers(redo_worker, arg, sizeof(arg[0]),
+		nthreads);
+	const int oerrno = errno;
+	free(redo);
+	if (ret != 0) {
+		errno = oerrno;
+		return -1;
+	}
+
+	for (int i = 0; i < NLANE; ++i)
+		if (lane_commit(ptx, i)->nrec != 0)
+			lane_invalidate(ptx, i);
+	return 0;
+}
+
+/* log management */
+static PMEMblktx *blktx_init(PMEMblkpool *pbp, char *base,
+		size_t mapped_len, int is_pmem)
+{
+	PMEMblktx *const ptx = calloc(1, sizeof(*ptx));
+	if (!ptx)
+		return NULL;
+	const struct blktx_hdr *const hdr = (struct blktx_hdr *)base;
+	ptx->pbp = pbp;
+	ptx->base = base;
+	ptx->mapped_len = mapped_len;
+	ptx->is_pmem = is_pmem;
+	ptx->bsize = hdr->bsize;
+	ptx->nblock = pmemblk_nblock(pbp);
+	ptx->lanesize = hdr->lanesize;
+	ptx->nmax = hdr->nmax;
+	ptx->data_off = data_offset(ptx->nmax);
+	for (int i = 0; i < NLANE; ++i)
+		pthread_mutex_init(&ptx->lane[i].lock, NULL);
+	for (int i = 0; i < NSTRIPE; ++i)
+		pthread_mutex_init(&ptx->stripe[i], NULL);
+	return ptx;
+}
+
+PMEMblktx *pmemblktx_create(PMEMblkpool *pbp, const char *logpath,
+	size_t logsize, mode_t mode)
+{
+	if (logsize < PMEMBLKTX_MIN_LOG) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	const size_t bsize = pmemblk_bsize(pbp);
+	const size_t lanesize = (logsize - BLKTX_HDR_SIZE) / NLANE / 4096 * 4096;
+	size_t nmax = (lanesize - sizeof(struct commit))
+		/ (sizeof(uint64_t) + bsize);
+	while (nmax > 0 && data_offset(nmax) + nmax * bsize > lanesize)
+		--nmax;
+	if (nmax == 0 || nmax > INT32_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	char *const base = pmem_map_file(logpath, logsize,
+		PMEM_FILE_CREATE|PMEM_FILE_EXCL, mode, &mapped_len, &is_pmem);
+	if (!base)
+		return NULL;
+
+	/* a new file reads as zeroes; i.e. every lane is invalid */
+	struct blktx_hdr *const hdr = (struct blktx_hdr *)base;
+	hdr->logsize = mapped_len;
+	hdr->bsize = bsize;
+	hdr->nlane = NLANE;
+	hdr->lanesize = lanesize;
+	hdr->nmax = nmax;
+	pmem_msync(hdr, sizeof(*hdr));
+
+	magic_persist(hdr->magic, BLKTX_MAGIC);
+
+	PMEMblktx *const ptx = blktx_init(pbp, base, mapped_len, is_pmem);
+	if (!ptx) {
+		pmem_unmap(base, mapped_len);
+		unlink(logpath);
+		errno = ENOMEM;
+	}
+	return ptx;
+}
+
+PMEMblktx *pmemblktx_open(PMEMblkpool *pbp, const char *logpath)
+{
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	char *const base = pmem_map_file(logpath, 0, 0, 0,
+		&mapped_len, &is_pmem);
+	if (!base)
+		return NULL;
+
+	const struct blktx_hdr *const hdr = (struct blktx_hdr *)base;
+	if (mapped_len < PMEMBLKTX_MIN_LOG
+			|| memcmp(hdr->magic, BLKTX_MAGIC, sizeof(hdr->magic)) != 0
+			|| hdr->logsize != mapped_len
+			|| hdr->bsize != pmemblk_bsize(pbp)
+			|| hdr->nlane != NLANE
+			|| hdr->nmax == 0
+			|| BLKTX_HDR_SIZE + NLANE * hdr->lanesize > mapped_len
+			|| data_offset(hdr->nmax) + hdr->nmax * hdr->bsize
+				> hdr->lanesize) {
+		pmem_unmap(base, mapped_len);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	PMEMblktx *const ptx = blktx_init(pbp, base, mapped_len, is_pmem);
+	if (!ptx) {
+		pmem_unmap(base, mapped_len);
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (blktx_redo(ptx) != 0) {
+		const int err = errno;
+		pmemblktx_close(ptx);
+		errno = err;
+		return NULL;
+	}
+	return ptx;
+}
+
+void pmemblktx_close(PMEMblktx *ptx)
+{
+	for (int i = 0; i < NLANE; ++i)
+		pthread_mutex_destroy(&ptx->lane[i].lock);
+	for (int i = 0; i < NSTRIPE; ++i)
+		pthread_mutex_destroy(&ptx->stripe[i]);
+	pmem_unmap(ptx->base, ptx->mapped_len);
+	free(ptx);
+}
+
+int pmemblktx_max_write(PMEMblktx *ptx)
+{
+	return (int)ptx->nmax;
+}
+
+int pmemblktx_commit(PMEMblktx *ptx, const struct pmemblktx_write *w,
+	int nwrite, unsigned flags)
+{
+	if (nwrite <= 0 || (size_t)nwrite > ptx->nmax) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (int i = 0; i < nwrite; ++i) {
+		if (w[i].blockno < 0
+				|| (size_t)w[i].blockno >= ptx->nblock) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	uint64_t set[NSTRIPE / 64];
+	stripes_lock(ptx, w, nwrite, set);
+	if (stripes_unfence(ptx, set) != 0) {
+		const int err = errno;
+		stripes_unlock(ptx, set);
+		errno = err;
+		return -1;
+	}
+	struct lane *const l = lane_acquire(ptx);
+	if (!l) {
+		stripes_unlock(ptx, set);
+		errno = EBUSY;
+		return -1;
+	}
+	const int lane = (int)(l - ptx->lane);
+	struct commit *const c = lane_commit(ptx, lane);
+	uint64_t *const blockno = lane_blockno(ptx, lane);
+	char *const data = lane_data(ptx, lane);
+
+	/* stage everything, commit record included, then drain once */
+	uint64_t sum[2] = {0, 0};
+	for (int i = 0; i < nwrite; ++i)
+		blockno[i] = (uint64_t)w[i].blockno;
+	fletcher64_update(sum, blockno, (size_t)nwrite * sizeof(*blockno));
+	for (int i = 0; i < nwrite; ++i) {
+		char *const dst = data + (size_t)i * ptx->bsize;
+		if (ptx->is_pmem)
+			pmem_memcpy_nodrain(dst, w[i].buf, ptx->bsize);
+		else
+			memcpy(dst, w[i].buf, ptx->bsize);
+		fletcher64_update(sum, w[i].buf, ptx->bsize);
+	}
+	c->seq = __atomic_add_fetch(&ptx->seq, 1, __ATOMIC_RELAXED);
+	c->nrec = (uint64_t)nwrite;
+	c->checksum = checksum_final(sum, c->seq, c->nrec);
+	if (ptx->is_pmem) {
+		pmem_flush(c, sizeof(*c)
+			+ (size_t)nwrite * sizeof(*blockno));
+		pmem_drain();
+	} else {
+		pmem_msync(c, ptx->data_off + (size_t)nwrite * ptx->bsize);
+	}
+
+	int ret = 0;
+	if (flags & PMEMBLKTX_NOAPPLY) {
+		l->stuck = 1;
+		stripes_fence(ptx, set, lane);
+		goto out;
+	}
+	for (int i = 0; i < nwrite; ++i) {
+		if (pmemblk_write(ptx->pbp, w[i].buf, w[i].blockno) != 0) {
+			/*
+			 * committed; the next transaction on its blocks, or
+			 * else pmemblktx_open(), will redo it
+			 */
+			l->stuck = 1;
+			stripes_fence(ptx, set, lane);
+			ret = -1;
+			goto out;
+		}
+	}
+	lane_invalidate(ptx, lane);
+
+out:
+	pthread_mutex_unlock(&l->lock);
+	stripes_unlock(ptx, set);
+	return ret;
+}
@@ -0,0 +1,47 @@
+#ifndef PMEMBLKTX_H
+#define PMEMBLKTX_H
+
+#include <libpmemblk.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * pmemblktx: atomic multi-block writes to a pmemblk pool.
+ *
+ * pmemblk_write() is atomic per block only. A transaction stages all of
+ * its blocks into one lane of a redo log kept in a separate file, with a
+ * checksummed commit record, and makes them durable with a single drain;
+ * only then are the blocks written to the pool. A commit record whose
+ * checksum does not match, e.g. one torn by a crash, is ignored.
+ * pmemblktx_open() redoes every committed transaction in parallel.
+ *
+ * Transactions writing disjoint blocks run concurrently, up to one per
+ * lane; ones sharing a block are serialized. A transaction left in the
+ * log, by PMEMBLKTX_NOAPPLY or a failed pmemblk_write(), is redone by the
+ * next one sharing a block with it, before that one is committed.
+ */
+
+#define PMEMBLKTX_MIN_LOG ((size_t)(1 << 20))
+
+/* commit to the log and return; for tests of the redo on open */
+#define PMEMBLKTX_NOAPPLY (1U << 0)
+
+typedef struct pmemblktx PMEMblktx;
+
+struct pmemblktx_write {
+	long long blockno;
+	const void *buf; /* pmemblk_bsize() bytes */
+};
+
+PMEMblktx *pmemblktx_create(PMEMblkpool *pbp, const char *logpath,
+	size_t logsize, mode_t mode);
+PMEMblktx *pmemblktx_open(PMEMblkpool *pbp, const char *logpath);
+void pmemblktx_close(PMEMblktx *ptx);
+
+/* the most blocks a transaction may write */
+int pmemblktx_max_write(PMEMblktx *ptx);
+
+int pmemblktx_commit(PMEMblktx *ptx, const struct pmemblktx_write *w,
+	int nwrite, unsigned flags);
+
+#endif /* PMEMBLKTX_H */
@@ -0,0 +1,738 @@
+#include "config.h" /* should be included first */
+
+#include <errno.h>
+#include <libpmem.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h> /* SSE2 */
+#endif
+
+#include "pmembtree.h"
+#include "pmemplus.h"
+
+#define BTREE_MAGIC    "PMEMBTR"
+#define BTREE_HDR_SIZE ((size_t)4096)
+
+#define LEAF_NSLOT 32
+#define LEAF_FULL  ((uint64_t)UINT32_MAX)
+#define NONE       UINT32_MAX
+
+#define FANOUT      64
+#define MAX_HEIGHT  16
+#define MAX_THREADS 16
+
+/* on-media layout */
+struct split_log {
+	uint64_t valid;
+	uint32_t leaf;    /* the leaf being split */
+	uint32_t newleaf; /* receives the keys >= splitkey */
+	uint64_t splitkey;
+} __attribute__((aligned(64)));
+
+struct btree_hdr {
+	char magic[8];
+	uint64_t poolsize;
+	uint64_t nleaf;
+	struct split_log log;
+};
+
+struct entry {
+	uint64_t key;
+	uint64_t value;
+};
+
+struct leaf {
+	uint64_t bitmap; /* valid entries; the commit word */
+	uint64_t lowkey; /* every key in this leaf is >= lowkey */
+	uint32_t next;   /* the next leaf in key order */
+	uint32_t used;   /* linked into the tree */
+	uint8_t fp[LEAF_NSLOT]; /* fingerprints; rebuilt on open */
+	uint64_t reserved;
+	struct entry ent[LEAF_NSLOT];
+} __attribute__((aligned(64)));
+
+/* DRAM inner nodes */
+struct inode {
+	int n;     /* number of children */
+	int level; /* 0 if children are leaves */
+	uint64_t key[FANOUT]; /* key[i] is the lowest key of child i > 0 */
+	union {
+		struct inode *node;
+		uint32_t leaf;
+	} child[FANOUT];
+};
+
+struct pmembtree {
+	char *base;
+	size_t mapped_len;
+	int is_pmem;
+	struct btree_hdr *hdr;
+	struct leaf *leaf;
+	uint32_t nleaf;
+
+	pthread_rwlock_t lock;
+	struct inode *root;
+	uint32_t *freelist; /* unused leaves */
+	uint32_t nfree;
+	struct inode *spare[MAX_HEIGHT + 1];
+	int nspare;
+};
+
+/* util functions */
+static uint8_t fingerprint(uint64_t key)
+{
+	key *= 0x9E3779B97F4A7C15ULL;
+	return (uint8_t)(key >> 56);
+}
+
+static void persist(PMEMbtree *pbt, const void *addr, size_t len)
+{
+	if (pbt->is_pmem)
+		pmem_persist(addr, len);
+	else
+		pmem_msync(addr, len);
+}
+
+/* returns a bitmask of the valid slots whose fingerprint equals to fp */
+static uint32_t leaf_match(const struct leaf *l, uint8_t fp)
+{
+	const uint32_t valid = (uint32_t)__atomic_load_n(&l->bitmap,
+		__ATOMIC_ACQUIRE);
+#ifdef __SSE2__
+	const __m128i f = _mm_set1_epi8((char)fp);
+	const __m128i lo = _mm_loadu_si128((const __m128i *)&l->fp[0]);
+	const __m128i hi = _mm_loadu_si128((const __m128i *)&l->fp[16]);
+	const uint32_t m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, f))
+		| (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(hi, f)) << 16;
+	return m & valid;
+#else
+	uint32_t m = 0;
+	for (int s = 0; s < LEAF_NSLOT; ++s)
+		if (l->fp[s] == fp)
+			m |= 1U << s;
+	return m & valid;
+#endif
+}
+
+static int leaf_find(const struct leaf *l, uint64_t key)
+{
+	uint32_t m = leaf_match(l, fingerprint(key));
+	while (m) {
+		const int s = __builtin_ctz(m);
+		m &= m - 1;
+		if (l->ent[s].key == key)
+			return s;
+	}
+	return -1;
+}
+
+/* inner nodes */
+static struct inode *inode_new(int level)
+{
+	struct inode *const in = calloc(1, sizeof(*in));
+	if (in)
+		in->level = level;
+	return in;
+}
+
+static void inode_free(struct inode *in)
+{
+	if (!in)
+		return;
+	if (in->level > 0)
+		for (int i = 0; i < in->n; ++i)
+			inode_free(in->child[i].node);
+	free(in);
+}
+
+static int inode_pos(const struct inode *in, uint64_t key)
+{
+	/* the last child whose lowest key is <= key */
+	int lo = 1, hi = in->n;
+	while (lo < hi) {
+		const int mid = (lo + hi) / 2;
+		if (in->key[mid] <= key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+static uint32_t find_leaf(PMEMbtree *pbt, uint64_t key)
+{
+	const struct inode *in = pbt->root;
+	while (in->level > 0)
+		in = in->child[inode_pos(in, key)].node;
+	return in->child[inode_pos(in, key)].leaf;
+}
+
+static struct inode *inode_take(PMEMbtree *pbt, int level)
+{
+	struct inode *const in = pbt->spare[--pbt->nspare];
+	memset(in, 0, sizeof(*in));
+	in->level = level;
+	return in;
+}
+
+/*
+ * Inserts (key, child) right after position pos of in. If in is full,
+ * it is split and the new right sibling is returned.
+ */
+static struct inode *inode_insert(PMEMbtree *pbt, struct inode *in, int pos,
+		uint64_t key, struct inode *node, uint32_t leaf)
+{
+	struct inode *right = NULL;
+	if (in->n == FANOUT) {
+		const int half = FANOUT / 2;
+		right = inode_take(pbt, in->level);
+		right->n = FANOUT - half;
+		memcpy(right->key, &in->key[half], sizeof(in->key[0]) * right->n);
+		memcpy(right->child, &in->child[half],
+			sizeof(in->child[0]) * right->n);
+		in->n = half;
+		if (pos >= half) {
+			in = right;
+			pos -= half;
+		}
+	}
+
+	memmove(&in->key[pos + 2], &in->key[pos + 1],
+		sizeof(in->key[0]) * (size_t)(in->n - pos - 1));
+	memmove(&in->child[pos + 2], &in->child[pos + 1],
+		sizeof(in->child[0]) * (size_t)(in->n - pos - 1));
+	in->key[pos + 1] = key;
+	if (in->level > 0)
+		in->child[pos + 1].node = node;
+	else
+		in->child[pos + 1].leaf = leaf;
+	in->n++;
+	return right;
+}
+
+/* makes sure inner_add() cannot fail */
+static int inner_reserve(PMEMbtree *pbt)
+{
+	/* a split may propagate up to and including a new root */
+	while (pbt->nspare < pbt->root->level + 2) {
+		struct inode *const in = malloc(sizeof(*in));
+		if (!in)
+			return -1;
+		pbt->spare[pbt->nspare++] = in;
+	}
+	return 0;
+}
+
+static void inner_add(PMEMbtree *pbt, uint64_t key, uint32_t leaf)
+{
+	struct inode *path[MAX_HEIGHT];
+	int pos[MAX_HEIGHT], depth = 0;
+
+	for (struct inode *in = pbt->root; ; ) {
+		path[depth] = in;
+		pos[depth] = inode_pos(in, key);
+		if (in->level == 0)
+			break;
+		in = in->child[pos[depth++]].node;
+	}
+
+	struct inode *up = NULL;
+	for (;;) {
+		struct inode *const right = inode_insert(pbt, path[depth],
+			pos[depth], key, up, leaf);
+		if (!right)
+			return;
+
+		key = right->key[0];
+		up = right;
+		if (depth == 0) {
+			struct inode *const root =
+				inode_take(pbt, pbt->root->level + 1);
+			root->n = 2;
+			root->key[0] = pbt->root->key[0];
+			root->child[0].node = pbt->root;
+			root->key[1] = key;
+			root->child[1].node = right;
+			pbt->root = root;
+			return;
+		}
+		--depth;
+	}
+}
+
+struct sep {
+	uint64_t key;
+	uint32_t leaf;
+};
+
+/* bulk-loads the inner nodes from separators sorted by key */
+static struct inode *inner_build(const struct sep *sep, size_t n)
+{
+	/* leave room for later splits */
+	const size_t fill = FANOUT * 3 / 4;
+	size_t nnode = (n + fill - 1) / fill;
+	struct inode **const level = calloc(nnode, sizeof(*level));
+	if (!level)
+		return NULL;
+
+	for (size_t i = 0; i < nnode; ++i) {
+		struct inode *const in = level[i] = inode_new(0);
+		if (!in)
+			goto err;
+		for (size_t j = i * fill; j < n && j < (i + 1) * fill; ++j) {
+			in->key[in->n] = sep[j].key;
+			in->child[in->n++].leaf = sep[j].leaf;
+		}
+	}
+
+	/* level[] is reused in place; parent i adopts children from i * fill */
+	for (int lv = 1; nnode > 1; ++lv) {
+		const size_t nup = (nnode + fill - 1) / fill;
+		for (size_t i = 0; i < nup; ++i) {
+			struct inode *const in = inode_new(lv);
+			if (!in) {
+				for (size_t j = i * fill; j < nnode; ++j)
+					inode_free(level[j]);
+				nnode = i;
+				goto err;
+			}
+			for (size_t j = i * fill; j < nnode && j < (i + 1) * fill; ++j) {
+				in->key[in->n] = level[j]->key[0];
+				in->child[in->n++].node = level[j];
+			}
+			level[i] = in;
+		}
+		nnode = nup;
+	}
+
+	struct inode *const root = level[0];
+	free(level);
+	return root;
+
+err:
+	for (size_t i = 0; i < nnode; ++i)
+		inode_free(level[i]);
+	free(level);
+	return NULL;
+}
+
+/* recovery */
+static void split_redo(PMEMbtree *pbt)
+{
+	struct split_log *const log = &pbt->hdr->log;
+	struct leaf *const l = &pbt->leaf[log->leaf];
+	struct leaf *const n = &pbt->leaf[log->newleaf];
+
+	n->used = 1;
+	persist(pbt, n, 64);
+	l->next = log->newleaf;
+	persist(pbt, l, 64);
+
+	uint64_t bitmap = l->bitmap;
+	for (int s = 0; s < LEAF_NSLOT; ++s)
+		if (l->ent[s].key >= log->splitkey)
+			bitmap &= ~(1ULL << s);
+	__atomic_store_n(&l->bitmap, bitmap, __ATOMIC_RELEASE);
+	persist(pbt, l, 64);
+
+	log->valid = 0;
+	persist(pbt, &log->valid, sizeof(log->valid));
+}
+
+struct scan_arg {
+	PMEMbtree *pbt;
+	uint32_t begin, end;
+	struct sep *sep; /* sorted by key on return */
+	size_t nsep;
+};
+
+static int key_compare(const void *a, const void *b)
+{
+	const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int sep_compare(const void *a, const void *b)
+{
+	const uint64_t x = ((const struct sep *)a)->key;
+	const uint64_t y = ((const struct sep *)b)->key;
+	return (x > y) - (x < y);
+}
+
+static void *scan_leaves(void *arg)
+{
+	struct scan_arg *const sa = arg;
+	struct leaf *const leaves = sa->pbt->leaf;
+
+	for (uint32_t i = sa->begin; i < sa->end; ++i) {
+		struct leaf *const l = &leaves[i];
+		if (!l->used)
+			continue;
+		for (int s = 0; s < LEAF_NSLOT; ++s) {
+			const uint8_t fp = fingerprint(l->ent[s].key);
+			if (l->fp[s] != fp)
+				l->fp[s] = fp;
+		}
+		sa->sep[sa->nsep].key = l->lowkey;
+		sa->sep[sa->nsep++].leaf = i;
+	}
+	qsort(sa->sep, sa->nsep, sizeof(*sa->sep), sep_compare);
+	return NULL;
+}
+
+static int btree_init(PMEMbtree *pbt)
+{
+	if (pbt->hdr->log.valid)
+		split_redo(pbt);
+
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int nthreads = ncpu < 1 ? 1 : ncpu > MAX_THREADS ? MAX_THREADS : (int)ncpu;
+	if ((uint32_t)nthreads > pbt->nleaf)
+		nthreads = 1;
+
+	struct sep *const sep = malloc(sizeof(*sep) * pbt->nleaf * 2);
+	pbt->freelist = malloc(sizeof(*pbt->freelist) * pbt->nleaf);
+	if (!sep || !pbt->freelist)
+		goto err;
+
+	/* every thread sorts its share of the leaves... */
+	struct scan_arg sa[MAX_THREADS];
+	pthread_t th[MAX_THREADS];
+	int started[MAX_THREADS] = {0};
+	const uint32_t per = (pbt->nleaf + (uint32_t)nthreads - 1) / (uint32_t)nthreads;
+	for (int t = 0; t < nthreads; ++t) {
+		sa[t].pbt = pbt;
+		sa[t].begin = per * (uint32_t)t;
+		sa[t].end = sa[t].begin + per > pbt->nleaf ?
+			pbt->nleaf : sa[t].begin + per;
+		sa[t].sep = sep + sa[t].begin;
+		sa[t].nsep = 0;
+		if (t > 0)
+			started[t] = !pthread_create(&th[t], NULL,
+				scan_leaves, &sa[t]);
+	}
+	for (int t = 0; t < nthreads; ++t) {
+		if (started[t])
+			pthread_join(th[t], NULL);
+		else
+			scan_leaves(&sa[t]);
+	}
+
+	/* ...and then the shares are merged */
+	struct sep *const merged = sep + pbt->nleaf;
+	size_t nsep = 0, head[MAX_THREADS] = {0};
+	for (;;) {
+		int min = -1;
+		for (int t = 0; t < nthreads; ++t)
+			if (head[t] < sa[t].nsep && (min < 0 || sa[t].sep[head[t]].key
+					< sa[min].sep[head[min]].key))
+				min = t;
+		if (min < 0)
+			break;
+		merged[nsep++] = sa[min].sep[head[min]++];
+	}
+
+	pbt->nfree = 0;
+	for (uint32_t i = pbt->nleaf; i-- > 0; )
+		if (!pbt->leaf[i].used)
+			pbt->freelist[pbt->nfree++] = i;
+
+	pbt->root = inner_build(merged, nsep);
+	if (!pbt->root)
+		goto err;
+	free(sep);
+	return 0;
+
+err:
+	free(sep);
+	free(pbt->freelist);
+	errno = ENOMEM;
+	return -1;
+}
+
+/* pool management */
+static PMEMbtree *btree_new(char *base, size_t mapped_len, int is_pmem)
+{
+	PMEMbtree *const pbt = calloc(1, sizeof(*pbt));
+	if (!pbt) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	pbt->base = base;
+	pbt->mapped_len = mapped_len;
+	pbt->is_pmem = is_pmem;
+	pbt->hdr = (struct btree_hdr *)base;
+	pbt->leaf = (struct leaf *)(base + BTREE_HDR_SIZE);
+	pbt->nleaf = (uint32_t)pbt->hdr->nleaf;
+
+	if (btree_init(pbt) != 0) {
+		free(pbt);
+		return NULL;
+	}
+	pthread_rwlock_init(&pbt->lock, NULL);
+	return pbt;
+}
+
+PMEMbtree *pmembtree_create(const char *path, size_t poolsize, mode_t mode)
+{
+	if (poolsize < PMEMBTREE_MIN_POOL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	char *const base = pmem_map_file(path, poolsize,
+		PMEM_FILE_CREATE|PMEM_FILE_EXCL, mode, &mapped_len, &is_pmem);
+	if (!base)
+		return NULL;
+
+	struct btree_hdr *const hdr = (struct btree_hdr *)base;
+	uint64_t nleaf = (mapped_len - BTREE_HDR_SIZE) / sizeof(struct leaf);
+	if (nleaf > NONE - 1)
+		nleaf = NONE - 1;
+	hdr->poolsize = mapped_len;
+	hdr->nleaf = nleaf;
+
+	/* the first leaf covers every key */
+	struct leaf *const first = (struct leaf *)(base + BTREE_HDR_SIZE);
+	first->next = NONE;
+	first->used = 1;
+	pmem_msync(base, BTREE_HDR_SIZE + sizeof(*first));
+
+	magic_persist(hdr->magic, BTREE_MAGIC);
+
+	PMEMbtree *const pbt = btree_new(base, mapped_len, is_pmem);
+	if (!pbt) {
+		pmem_unmap(base, mapped_len);
+		unlink(path);
+		errno = ENOMEM;
+	}
+	return pbt;
+}
+
+PMEMbtree *pmembtree_open(const char *path)
+{
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	char *const base = pmem_map_file(path, 0, 0, 0,
+		&mapped_len, &is_pmem);
+	if (!base)
+		return NULL;
+
+	const struct btree_hdr *const hdr = (struct btree_hdr *)base;
+	const int valid = mapped_len >= PMEMBTREE_MIN_POOL
+		&& memcmp(hdr->magic, BTREE_MAGIC, sizeof(hdr->magic)) == 0
+		&& hdr->poolsize == mapped_len
+		&& hdr->nleaf > 0
+		&& BTREE_HDR_SIZE + hdr->nleaf * sizeof(struct leaf) <= mapped_len
+		&& (!hdr->log.valid || (hdr->log.leaf < hdr->nleaf
+			&& hdr->log.newleaf < hdr->nleaf));
+	if (!valid) {
+		pmem_unmap(base, mapped_len);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	PMEMbtree *const pbt = btree_new(base, mapped_len, is_pmem);
+	if (!pbt) {
+		const int oerrno = errno;
+		pmem_unmap(base, mapped_len);
+		errno = oerrno;
+	}
+	return pbt;
+}
+
+void pmembtree_close(PMEMbtree *pbt)
+{
+	pthread_rwlock_destroy(&pbt->lock);
+	inode_free(pbt->root);
+	while (pbt->nspare > 0)
+		free(pbt->spare[--pbt->nspare]);
+	free(pbt->freelist);
+	pmem_unmap(pbt->base, pbt->mapped_len);
+	free(pbt);
+}
+
+/* operations */
+static int leaf_split(PMEMbtree *pbt, uint32_t li)
+{
+	if (pbt->nfree == 0) {
+		errno = ENOSPC;
+		return -1;
+	}
+	if (inner_reserve(pbt) != 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	struct leaf *const l = &pbt->leaf[li];
+	uint64_t keys[LEAF_NSLOT];
+	for (int s = 0; s < LEAF_NSLOT; ++s)
+		keys[s] = l->ent[s].key;
+	qsort(keys, LEAF_NSLOT, sizeof(keys[0]), key_compare);
+	const uint64_t splitkey = keys[LEAF_NSLOT / 2];
+
+	/* prepare the new leaf; it is unreachable until the redo */
+	const uint32_t ni = pbt->freelist[pbt->nfree - 1];
+	struct leaf *const n = &pbt->leaf[ni];
+	memset(n, 0, sizeof(*n));
+	for (int s = 0, d = 0; s < LEAF_NSLOT; ++s) {
+		if (l->ent[s].key < splitkey)
+			continue;
+		n->ent[d] = l->ent[s];
+		n->fp[d] = l->fp[s];
+		n->bitmap |= 1ULL << d++;
+	}
+	n->lowkey = splitkey;
+	n->next = l->next;
+	persist(pbt, n, sizeof(*n));
+
+	pbt->nfree--;
+	inner_add(pbt, splitkey, ni);
+
+	struct split_log *const log = &pbt->hdr->log;
+	log->leaf = li;
+	log->newleaf = ni;
+	log->splitkey = splitkey;
+	persist(pbt, log, sizeof(*log));
+	log->valid = 1;
+	persist(pbt, &log->valid, sizeof(log->valid));
+
+	split_redo(pbt);
+	return 0;
+}
+
+int pmembtree_insert(PMEMbtree *pbt, uint64_t key, uint64_t value)
+{
+	int ret = 0;
+	pthread_rwlock_wrlock(&pbt->lock);
+
+	for (;;) {
+		const uint32_t li = find_leaf(pbt, key);
+		struct leaf *const l = &pbt->leaf[li];
+		const uint64_t bitmap = l->bitmap;
+
+		if (bitmap == LEAF_FULL) {
+			if ((ret = leaf_split(pbt, li)) != 0)
+				break;
+			continue;
+		}
+
+		/* write out of place into a free slot, then commit */
+		const int s = __builtin_ctzll(~bitmap);
+		l->ent[s].key = key;
+		l->ent[s].value = value;
+		l->fp[s] = fingerprint(key);
+		persist(pbt, &l->ent[s], sizeof(l->ent[s]));
+
+		const int old = leaf_find(l, key);
+		uint64_t newbitmap = bitmap | (1ULL << s);
+		if (old >= 0)
+			newbitmap &= ~(1ULL << old);
+		__atomic_store_n(&l->bitmap, newbitmap, __ATOMIC_RELEASE);
+		persist(pbt, &l->bitmap, sizeof(l->bitmap));
+		break;
+	}
+
+	pthread_rwlock_unlock(&pbt->lock);
+	return ret;
+}
+
+int pmembtree_lookup(PMEMbtree *pbt, uint64_t key, uint64_t *value)
+{
+	pthread_rwlock_rdlock(&pbt->lock);
+	const struct leaf *const l = &pbt->leaf[find_leaf(pbt, key)];
+	const int s = leaf_find(l, key);
+	if (s >= 0)
+		*value = l->ent[s].value;
+	pthread_rwlock_unlock(&pbt->lock);
+
+	if (s < 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	return 0;
+}
+
+int pmembtree_remove(PMEMbtree *pbt, uint64_t key)
+{
+	pthread_rwlock_wrlock(&pbt->lock);
+	struct leaf *const l = &pbt->leaf[find_leaf(pbt, key)];
+	const int s = leaf_find(l, key);
+	if (s >= 0) {
+		__atomic_store_n(&l->bitmap, l->bitmap & ~(1ULL << s),
+			__ATOMIC_RELEASE);
+		persist(pbt, &l->bitmap, sizeof(l->bitmap));
+	}
+	pthread_rwlock_unlock(&pbt->lock);
+
+	if (s < 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	return 0;
+}
+
+static int entry_compare(const void *a, const void *b)
+{
+	const uint64_t x = ((const struct entry *)a)->key;
+	const uint64_t y = ((const struct entry *)b)->key;
+	return (x > y) - (x < y);
+}
+
+static void prefetch_leaf(const struct leaf *l)
+{
+	for (size_t off = 0; off < sizeof(*l); off += 64)
+		__builtin_prefetch((const char *)l + off, 0, 3);
+}
+
+void pmembtree_scan(PMEMbtree *pbt, uint64_t lo, uint64_t hi,
+	int (*process_entry)(uint64_t key, uint64_t value, void *arg),
+	void *arg)
+{
+	pthread_rwlock_rdlock(&pbt->lock);
+
+	for (uint32_t li = find_leaf(pbt, lo); li != NONE; ) {
+		const struct leaf *const l = &pbt->leaf[li];
+		if (l->lowkey > hi)
+			break;
+		li = l->next;
+		if (li != NONE)
+			prefetch_leaf(&pbt->leaf[li]);
+
+		struct entry ent[LEAF_NSLOT];
+		int n = 0;
+		for (uint64_t m = l->bitmap; m; m &= m - 1) {
+			const int s = __builtin_ctzll(m);
+			if (l->ent[s].key >= lo && l->ent[s].key <= hi)
+				ent[n++] = l->ent[s];
+		}
+		qsort(ent, (size_t)n, sizeof(ent[0]), entry_compare);
+		for (int i = 0; i < n; ++i)
+			if (!process_entry(ent[i].key, ent[i].value, arg))
+				goto out;
+	}
+
+out:
+	pthread_rwlock_unlock(&pbt->lock);
+}
+
+size_t pmembtree_count(PMEMbtree *pbt)
+{
+	size_t n = 0;
+	pthread_rwlock_rdlock(&pbt->lock);
+	for (uint32_t li = 0; li != NONE; li = pbt->leaf[li].next)
+		n += (size_t)__builtin_popcountll(pbt->leaf[li].bitmap);
+	pthread_rwlock_unlock(&pbt->lock);
+	return n;
+}
+
+size_t pmembtree_nleaf(PMEMbtree *pbt)
+{
+	return pbt->nleaf - pbt->nfree;
+}
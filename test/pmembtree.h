@@ -0,0 +1,44 @@
+#ifndef PMEMBTREE_H
+#define PMEMBTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * pmembtree: an ordered index from 64-bit keys to 64-bit values.
+ *
+ * Leaves live in a pmem_map_file() region and keep their entries
+ * unsorted behind a validity bitmap and 1-byte fingerprints, so that an
+ * insert persists one entry and then commits it by an 8-byte bitmap
+ * store. Leaf splits are made atomic by a one-entry redo log. Inner
+ * nodes live in DRAM only and are rebuilt from the leaves by
+ * pmembtree_open() using several threads.
+ *
+ * Lookups and scans may run concurrently; modifications are exclusive.
+ */
+
+#define PMEMBTREE_MIN_POOL ((size_t)(1 << 18))
+
+typedef struct pmembtree PMEMbtree;
+
+PMEMbtree *pmembtree_create(const char *path, size_t poolsize, mode_t mode);
+PMEMbtree *pmembtree_open(const char *path);
+void pmembtree_close(PMEMbtree *pbt);
+
+int pmembtree_insert(PMEMbtree *pbt, uint64_t key, uint64_t value);
+int pmembtree_lookup(PMEMbtree *pbt, uint64_t key, uint64_t *value);
+int pmembtree_remove(PMEMbtree *pbt, uint64_t key);
+
+/*
+ * Calls process_entry for each key in [lo, hi] in ascending order
+ * until it returns 0, as pmemlog_walk() does with its chunks.
+ */
+void pmembtree_scan(PMEMbtree *pbt, uint64_t lo, uint64_t hi,
+	int (*process_entry)(uint64_t key, uint64_t value, void *arg),
+	void *arg);
+
+size_t pmembtree_count(PMEMbtree *pbt);
+size_t pmembtree_nleaf(PMEMbtree *pbt);
+
+#endif /* PMEMBTREE_H */
@@ -0,0 +1,202 @@
+#define _GNU_SOURCE /* cpu_set_t */
+#include "config.h" /* should be included first */
+
+#include <errno.h>
+#include <libpmem.h>
+#include <libpmemblk.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "pmembulk.h"
+#include "pmemplus.h"
+
+#define MAX_THREADS RUN_MAX_THREADS
+#define SLICE_ALIGN ((uintptr_t)4096)
+
+struct worker {
+	const cpu_set_t *cpus; /* NULL not to pin */
+	/* pmembulk_memset() */
+	char *addr;
+	size_t len;
+	int c;
+	int is_pmem;
+	/* pmembulk_blk_set_zero() */
+	PMEMblkpool *pbp;
+	long long blockno;
+	long long count;
+};
+
+/* util functions */
+
+/* parses a sysfs cpulist such as "0-3,8,10-11" */
+static int read_cpulist(int node, cpu_set_t *cpus)
+{
+	char path[64], list[1024];
+	snprintf(path, sizeof(path),
+		"/sys/devices/system/node/node%d/cpulist", node);
+	FILE *const fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	const int ok = fgets(list, sizeof(list), fp) != NULL;
+	fclose(fp);
+	if (!ok)
+		return -1;
+
+	CPU_ZERO(cpus);
+	for (const char *p = list; *p && *p != '\n'; ) {
+		int lo, hi, n;
+		if (sscanf(p, "%d-%d%n", &lo, &hi, &n) == 2) {
+			p += n;
+		} else if (sscanf(p, "%d%n", &lo, &n) == 1) {
+			hi = lo;
+			p += n;
+		} else {
+			return -1;
+		}
+		for (int c = lo; c <= hi && c < CPU_SETSIZE; ++c)
+			CPU_SET(c, cpus);
+		if (*p == ',')
+			++p;
+	}
+	return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+static int node_of_caller(void)
+{
+	unsigned cpu, node;
+	return syscall(SYS_getcpu, &cpu, &node, NULL) == 0 ? (int)node : -1;
+}
+
+/* clamps nthreads so that no slice is smaller than min */
+static int choose_nthreads(int nthreads, const cpu_set_t *cpus,
+	size_t total, size_t min)
+{
+	if (nthreads == 0)
+		nthreads = cpus ? CPU_COUNT(cpus)
+			: (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > MAX_THREADS)
+		nthreads = MAX_THREADS;
+	if ((size_t)nthreads > total / min)
+		nthreads = (int)(total / min);
+	return nthreads > 0 ? nthreads : 1;
+}
+
+static void *memset_worker(void *arg)
+{
+	struct worker *const w = arg;
+	if (w->cpus)
+		sched_setaffinity(0, sizeof(*w->cpus), w->cpus); /* DO NOT care */
+
+	if (w->is_pmem) {
+#ifdef PMEM_F_MEM_NODRAIN
+		pmem_memset(w->addr, w->c, w->len,
+			PMEM_F_MEM_NONTEMPORAL|PMEM_F_MEM_NODRAIN);
+#else
+		pmem_memset_nodrain(w->addr, w->c, w->len);
+#endif
+		pmem_drain();
+	} else {
+		memset(w->addr, w->c, w->len);
+		if (pmem_msync(w->addr, w->len) != 0)
+			return worker_failed();
+	}
+	return NULL;
+}
+
+static void *set_zero_worker(void *arg)
+{
+	struct worker *const w = arg;
+	if (w->cpus)
+		sched_setaffinity(0, sizeof(*w->cpus), w->cpus); /* DO NOT care */
+
+	for (long long i = 0; i < w->count; ++i)
+		if (pmemblk_set_zero(w->pbp, w->blockno + i) != 0)
+			return worker_failed();
+	return NULL;
+}
+
+int pmembulk_node(const void *addr)
+{
+	/* move_pages(2) with no nodes reports where each page is */
+	void *page = (void *)((uintptr_t)addr & ~(SLICE_ALIGN - 1));
+	int status = -1;
+	if (syscall(SYS_move_pages, 0, 1UL, &page, NULL, &status, 0) != 0)
+		return -1;
+	return status >= 0 ? status : -1;
+}
+
+int pmembulk_memset(void *addr, int c, size_t len, int nthreads)
+{
+	if (nthreads < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (len == 0)
+		return 0;
+
+	/* a page not yet touched has no node */
+	*(volatile char *)addr;
+	cpu_set_t set;
+	const int node = pmembulk_node(addr);
+	const cpu_set_t *const cpus =
+		node >= 0 && read_cpulist(node, &set) == 0 ? &set : NULL;
+
+	nthreads = choose_nthreads(nthreads, cpus, len, PMEMBULK_MIN_SLICE);
+	const int is_pmem = pmem_is_pmem(addr, len);
+
+	/* slices begin at page boundaries so that none share a line */
+	struct worker w[MAX_THREADS];
+	const uintptr_t lo = (uintptr_t)addr, hi = lo + len;
+	uintptr_t begin = lo;
+	for (int t = 0; t < nthreads; ++t) {
+		uintptr_t end = hi;
+		if (t + 1 < nthreads) {
+			end = (lo + len / (size_t)nthreads * (size_t)(t + 1))
+				& ~(SLICE_ALIGN - 1);
+			if (end < begin)
+				end = begin;
+		}
+		w[t] = (struct worker){.cpus = cpus, .addr = (char *)begin,
+			.len = (size_t)(end - begin), .c = c,
+			.is_pmem = is_pmem};
+		begin = end;
+	}
+	return run_workers(memset_worker, w, sizeof(w[0]), nthreads);
+}
+
+int pmembulk_blk_set_zero(PMEMblkpool *pbp, long long blockno,
+	long long count, int nthreads)
+{
+	const size_t nblock = pmemblk_nblock(pbp);
+	if (nthreads < 0 || blockno < 0 || count < 0
+			|| (size_t)blockno > nblock
+			|| (size_t)count > nblock - (size_t)blockno) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (count == 0)
+		return 0;
+
+	/* the pool does not tell where it is; stay near the caller */
+	cpu_set_t set;
+	const int node = node_of_caller();
+	const cpu_set_t *const cpus =
+		node >= 0 && read_cpulist(node, &set) == 0 ? &set : NULL;
+
+	/* pmemblk_set_zero() updates the map only; slice by block count */
+	nthreads = choose_nthreads(nthreads, cpus, (size_t)count, 256);
+
+	struct worker w[MAX_THREADS];
+	for (int t = 0; t < nthreads; ++t) {
+		const long long b = count * t / nthreads;
+		const long long e = count * (t + 1) / nthreads;
+		w[t] = (struct worker){.cpus = cpus, .pbp = pbp,
+			.blockno = blockno + b, .count = e - b};
+	}
+	return run_workers(set_zero_worker, w, sizeof(w[0]), nthreads);
+}
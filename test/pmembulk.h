@@ -0,0 +1,34 @@
+#ifndef PMEMBULK_H
+#define PMEMBULK_H
+
+#include <libpmemblk.h>
+#include <stddef.h>
+
+/*
+ * pmembulk: initializing and zeroing large regions in parallel.
+ *
+ * One thread cannot keep a pmem device busy with stores. These split a
+ * region into contiguous slices, one per thread, pinned to the CPUs of
+ * the NUMA node the region is on. Each thread fills its slice with
+ * non-temporal stores and drains once at the end; a drain orders only
+ * the stores of its own thread, so there is one per thread and none per
+ * slice.
+ *
+ * nthreads 0 means one thread per CPU of the node. Every function
+ * returns 0 on success, or -1 with errno set.
+ */
+
+/* smaller slices are not worth a thread */
+#define PMEMBULK_MIN_SLICE ((size_t)(1 << 20))
+
+/* memset() and persist; the mapping needs not be pmem */
+int pmembulk_memset(void *addr, int c, size_t len, int nthreads);
+
+/* pmemblk_set_zero() of the blocks [blockno, blockno + count) */
+int pmembulk_blk_set_zero(PMEMblkpool *pbp, long long blockno,
+	long long count, int nthreads);
+
+/* the NUMA node of the page at addr, or -1 if unknown */
+int pmembulk_node(const void *addr);
+
+#endif /* PMEMBULK_H */
@@ -0,0 +1,558 @@
+#include "config.h" /* should be included first */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libpmem.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "pmemckpt.h"
+#include "pmemplus.h"
+
+#define CKPT_MAGIC    "PMEMCKP"
+#define CKPT_HDR_SIZE ((size_t)4096)
+#define MAX_THREADS   RUN_MAX_THREADS
+#define MIN_SLICE     ((size_t)(1 << 20)) /* smaller is not worth a thread */
+
+#define PAGEMAP_SOFT_DIRTY (1ULL << 55)
+#define PAGEMAP_CHUNK      512 /* entries read at a time */
+
+/* on-media layout; the slot of generation g is g % 2 */
+struct ckpt_hdr {
+	char magic[8];
+	uint64_t len;
+	uint64_t active;	/* generation; 0 for none */
+};
+
+struct pmemckpt {
+	char *base;
+	size_t mapped_len;
+	int is_pmem;
+	struct ckpt_hdr *hdr;
+	char *addr;
+	size_t len;
+	size_t pagesize;
+	size_t npage;
+	size_t nword;		/* of each bitmap */
+	enum pmemckpt_track track;
+	uint64_t *dirty;	/* since the last checkpoint */
+	uint64_t *copied;	/* by the last checkpoint */
+	uint64_t *copy;		/* by this one */
+	size_t last_copied;
+	PMEMckpt *sd_next;	/* in sd_list_ */
+	int wp_index;		/* in wp_; -1 if none */
+};
+
+/* a run of pages to copy, and what each thread copies */
+struct run {
+	size_t page;
+	size_t npage;
+};
+
+struct worker {
+	PMEMckpt *ckp;
+	char *slot;
+	const struct run *run;
+	size_t nrun;
+};
+
+/* process-wide state of the trackers */
+static pthread_mutex_t track_lock_ = PTHREAD_MUTEX_INITIALIZER;
+static PMEMckpt *sd_list_ = NULL;
+static PMEMckpt *wp_[PMEMCKPT_MAX_WRPROTECT];
+static struct sigaction wp_old_;
+static int wp_installed_ = 0;
+
+/* util functions */
+static void set_bit(uint64_t *map, size_t i)
+{
+	map[i / 64] |= 1ULL << (i % 64);
+}
+
+static int test_bit(const uint64_t *map, size_t i)
+{
+	return (map[i / 64] >> (i % 64)) & 1;
+}
+
+static void set_all(PMEMckpt *ckp, uint64_t *map)
+{
+	memset(map, 0, ckp->nword * sizeof(*map));
+	for (size_t i = 0; i < ckp->npage; ++i)
+		set_bit(map, i);
+}
+
+static void persist(PMEMckpt *ckp, const void *addr, size_t len)
+{
+	if (ckp->is_pmem)
+		pmem_persist(addr, len);
+	else
+		pmem_msync(addr, len);
+}
+
+static char *slot_of(PMEMckpt *ckp, uint64_t gen)
+{
+	return ckp->base + CKPT_HDR_SIZE + (gen % 2) * ckp->len;
+}
+
+/* soft-dirty tracking */
+
+/* a page just written is soft-dirty if the kernel tracks it at all */
+static int softdirty_supported(void)
+{
+	const long ps = sysconf(_SC_PAGESIZE);
+	char *const page = mmap(NULL, (size_t)ps, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (page == MAP_FAILED)
+		return 0;
+	*(volatile char *)page = 1;
+	int ret = 0;
+	const int fd = open("/proc/self/pagemap", O_RDONLY);
+	if (fd != -1) {
+		uint64_t e = 0;
+		const off_t off = (off_t)((uintptr_t)page / (uintptr_t)ps
+			* sizeof(e));
+		ret = pread(fd, &e, sizeof(e), off) == sizeof(e)
+			&& (e & PAGEMAP_SOFT_DIRTY);
+		close(fd);
+	}
+	munmap(page, (size_t)ps);
+	return ret;
+}
+
+/* adds the soft-dirty pages of the region to its dirty map */
+static int sd_scan(PMEMckpt *ckp, int fd)
+{
+	uint64_t e[PAGEMAP_CHUNK];
+	const uintptr_t first = (uintptr_t)ckp->addr / ckp->pagesize;
+	for (size_t i = 0; i < ckp->npage; i += PAGEMAP_CHUNK) {
+		const size_t n = ckp->npage - i < PAGEMAP_CHUNK
+			? ckp->npage - i : PAGEMAP_CHUNK;
+		const ssize_t len = (ssize_t)(n * sizeof(e[0]));
+		if (pread(fd, e, (size_t)len,
+				(off_t)((first + i) * sizeof(e[0]))) != len)
+			return -1;
+		for (size_t j = 0; j < n; ++j)
+			if (e[j] & PAGEMAP_SOFT_DIRTY)
+				set_bit(ckp->dirty, i + j);
+	}
+	return 0;
+}
+
+/* scans every region before the bits of all are cleared; under lock */
+static int sd_clear(void)
+{
+	const int fd = open("/proc/self/pagemap", O_RDONLY);
+	if (fd == -1)
+		return -1;
+	for (PMEMckpt *c = sd_list_; c; c = c->sd_next) {
+		if (sd_scan(c, fd) == -1) {
+			const int oerrno = errno;
+			close(fd);
+			errno = oerrno;
+			return -1;
+		}
+	}
+	close(fd);
+
+	const int cfd = open("/proc/self/clear_refs", O_WRONLY);
+	if (cfd == -1)
+		return -1;
+	const int ret = write(cfd, "4", 1) == 1 ? 0 : -1;
+	const int oerrno = errno;
+	close(cfd);
+	errno = oerrno;
+	return ret;
+}
+
+/* write-protect tracking */
+static void wp_handler(int sig, siginfo_t *si, void *uctx)
+{
+	char *const a = si->si_addr;
+	for (int i = 0; i < PMEMCKPT_MAX_WRPROTECT; ++i) {
+		PMEMckpt *const ckp = __atomic_load_n(&wp_[i],
+			__ATOMIC_ACQUIRE);
+		if (!ckp || a < ckp->addr || a >= ckp->addr + ckp->len)
+			continue;
+		const size_t page = (size_t)(a - ckp->addr) / ckp->pagesize;
+		__atomic_fetch_or(&ckp->dirty[page / 64], 1ULL << (page % 64),
+			__ATOMIC_RELAXED);
+		mprotect(ckp->addr + page * ckp->pagesize, ckp->pagesize,
+			PROT_READ|PROT_WRITE);
+		return;
+	}
+
+	/* not ours; as if there were no handler */
+	if (wp_old_.sa_flags & SA_SIGINFO) {
+		wp_old_.sa_sigaction(sig, si, uctx);
+	} else if (wp_old_.sa_handler != SIG_DFL
+			&& wp_old_.sa_handler != SIG_IGN) {
+		wp_old_.sa_handler(sig);
+	} else {
+		/* the access faults again, and kills the process */
+		signal(sig, SIG_DFL);
+	}
+}
+
+/* under lock */
+static int wp_register(PMEMckpt *ckp)
+{
+	if (!wp_installed_) {
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_sigaction = wp_handler;
+		sa.sa_flags = SA_SIGINFO|SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(SIGSEGV, &sa, &wp_old_) == -1)
+			return -1;
+		wp_installed_ = 1;
+	}
+	for (int i = 0; i < PMEMCKPT_MAX_WRPROTECT; ++i) {
+		if (!wp_[i]) {
+			ckp->wp_index = i;
+			__atomic_store_n(&wp_[i], ckp, __ATOMIC_RELEASE);
+			return 0;
+		}
+	}
+	errno = EBUSY;
+	return -1;
+}
+
+static int wp_arm(PMEMckpt *ckp)
+{
+	return mprotect(ckp->addr, ckp->len, PROT_READ);
+}
+
+/* tracking */
+static int track_start(PMEMckpt *ckp)
+{
+	pthread_mutex_lock(&track_lock_);
+	int ret = 0;
+	switch (ckp->track) {
+	case PMEMCKPT_TRACK_SOFTDIRTY:
+		ckp->sd_next = sd_list_;
+		sd_list_ = ckp;
+		ret = sd_clear();
+		break;
+	case PMEMCKPT_TRACK_WRPROTECT:
+		ret = wp_register(ckp);
+		if (ret == 0)
+			ret = wp_arm(ckp);
+		break;
+	default:
+		break;
+	}
+	pthread_mutex_unlock(&track_lock_);
+	return ret;
+}
+
+static void track_stop(PMEMckpt *ckp)
+{
+	pthread_mutex_lock(&track_lock_);
+	if (ckp->track == PMEMCKPT_TRACK_SOFTDIRTY) {
+		for (PMEMckpt **p = &sd_list_; *p; p = &(*p)->sd_next) {
+			if (*p == ckp) {
+				*p = ckp->sd_next;
+				break;
+			}
+		}
+	} else if (ckp->wp_index >= 0) {
+		mprotect(ckp->addr, ckp->len, PROT_READ|PROT_WRITE);
+		__atomic_store_n(&wp_[ckp->wp_index], NULL, __ATOMIC_RELEASE);
+		ckp->wp_index = -1;
+	}
+	pthread_mutex_unlock(&track_lock_);
+}
+
+/* copying */
+static void *copy_worker(void *arg)
+{
+	struct worker *const w = arg;
+	PMEMckpt *const ckp = w->ckp;
+	for (size_t i = 0; i < w->nrun; ++i) {
+		const size_t off = w->run[i].page * ckp->pagesize;
+		const size_t len = w->run[i].npage * ckp->pagesize;
+		if (ckp->is_pmem) {
+#ifdef PMEM_F_MEM_NODRAIN
+			pmem_memcpy(w->slot + off, ckp->addr + off, len,
+				PMEM_F_MEM_NONTEMPORAL|PMEM_F_MEM_NODRAIN);
+#else
+			pmem_memcpy_nodrain(w->slot + off, ckp->addr + off,
+				len);
+#endif
+		} else {
+			memcpy(w->slot + off, ckp->addr + off, len);
+			if (pmem_msync(w->slot + off, len) != 0)
+				return worker_failed();
+		}
+	}
+	if (ckp->is_pmem)
+		pmem_drain();
+	return NULL;
+}
+
+/*
+ * Copies the pages of the copy map to slot, in runs split evenly
+ * between the threads.
+ */
+static int copy_pages(PMEMckpt *ckp, char *slot, size_t npage, int nthreads)
+{
+	if (nthreads == 0)
+		nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > MAX_THREADS)
+		nthreads = MAX_THREADS;
+	if ((size_t)nthreads > npage * ckp->pagesize / MIN_SLICE)
+		nthreads = (int)(npage * ckp->pagesize / MIN_SLICE);
+	if (nthreads < 1)
+		nthreads = 1;
+
+	/* a run is cut where a thread has its share */
+	struct run *const runs = malloc(npage * sizeof(*runs));
+	if (!runs)
+		return -1;
+	struct worker w[MAX_THREADS];
+	const size_t share = (npage + (size_t)nthreads - 1) / (size_t)nthreads;
+	size_t nrun = 0, filled = 0;
+	int t = 0;
+	w[0] = (struct worker){.ckp = ckp, .slot = slot, .run = runs};
+	for (size_t i = 0; i < ckp->npage; ) {
+		if (ckp->copy[i / 64] == 0) {
+			i = (i / 64 + 1) * 64;
+			continue;
+		}
+		if (!test_bit(ckp->copy, i)) {
+			++i;
+			continue;
+		}
+		size_t n = 1;
+		while (i + n < ckp->npage && test_bit(ckp->copy, i + n)
+				&& filled + n < share)
+			++n;
+		runs[nrun++] = (struct run){i, n};
+		++w[t].nrun;
+		i += n;
+		filled += n;
+		if (filled == share && t + 1 < nthreads) {
+			++t;
+			w[t] = (struct worker){.ckp = ckp, .slot = slot,
+				.run = runs + nrun};
+			filled = 0;
+		}
+	}
+	const int ret = run_workers(copy_worker, w, sizeof(w[0]), t + 1);
+	const int oerrno = errno;
+	free(runs);
+	errno = oerrno;
+	return ret;
+}
+
+/* pool management */
+static PMEMckpt *ckpt_init(char *base, size_t mapped_len, int is_pmem,
+		void *addr, size_t len, enum pmemckpt_track track)
+{
+	if (track == PMEMCKPT_TRACK_AUTO)
+		track = softdirty_supported()
+			? PMEMCKPT_TRACK_SOFTDIRTY : PMEMCKPT_TRACK_FULL;
+	else if (track == PMEMCKPT_TRACK_SOFTDIRTY && !softdirty_supported()) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	PMEMckpt *const ckp = calloc(1, sizeof(*ckp));
+	if (!ckp)
+		return NULL;
+	ckp->base = base;
+	ckp->mapped_len = mapped_len;
+	ckp->is_pmem = is_pmem;
+	ckp->hdr = (struct ckpt_hdr *)base;
+	ckp->addr = addr;
+	ckp->len = len;
+	ckp->pagesize = (size_t)sysconf(_SC_PAGESIZE);
+	ckp->npage = len / ckp->pagesize;
+	ckp->nword = (ckp->npage + 63) / 64;
+	ckp->track = track;
+	ckp->wp_index = -1;
+	ckp->dirty = malloc(ckp->nword * sizeof(uint64_t));
+	ckp->copied = malloc(ckp->nword * sizeof(uint64_t));
+	ckp->copy = malloc(ckp->nword * sizeof(uint64_t));
+	if (!ckp->dirty || !ckp->copied || !ckp->copy)
+		goto err;
+
+	/* neither slot is known to match the region */
+	set_all(ckp, ckp->dirty);
+	set_all(ckp, ckp->copied);
+	if (track_start(ckp) == -1) {
+		const int oerrno = errno;
+		track_stop(ckp);
+		errno = oerrno;
+		goto err;
+	}
+	return ckp;
+
+err:
+	free(ckp->dirty);
+	free(ckp->copied);
+	free(ckp->copy);
+	free(ckp);
+	return NULL;
+}
+
+static int region_valid(const void *addr, size_t len,
+		enum pmemckpt_track track)
+{
+	const uintptr_t ps = (uintptr_t)sysconf(_SC_PAGESIZE);
+	return addr && len > 0 && (uintptr_t)addr % ps == 0 && len % ps == 0
+		&& track <= PMEMCKPT_TRACK_FULL;
+}
+
+PMEMckpt *pmemckpt_create(const char *path, void *addr, size_t len,
+		enum pmemckpt_track track, mode_t mode)
+{
+	if (!region_valid(addr, len, track)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	char *const base = pmem_map_file(path, CKPT_HDR_SIZE + 2 * len,
+		PMEM_FILE_CREATE|PMEM_FILE_EXCL, mode, &mapped_len, &is_pmem);
+	if (!base)
+		return NULL;
+
+	struct ckpt_hdr *const hdr = (struct ckpt_hdr *)base;
+	hdr->len = len;
+	hdr->active = 0;
+	pmem_msync(hdr, sizeof(*hdr));
+	magic_persist(hdr->magic, CKPT_MAGIC);
+
+	PMEMckpt *const ckp = ckpt_init(base, mapped_len, is_pmem, addr, len,
+		track);
+	if (!ckp) {
+		const int oerrno = errno;
+		pmem_unmap(base, mapped_len);
+		unlink(path);
+		errno = oerrno;
+	}
+	return ckp;
+}
+
+PMEMckpt *pmemckpt_open(const char *path, void *addr, size_t len,
+		enum pmemckpt_track track)
+{
+	if (!region_valid(addr, len, track)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	char *const base = pmem_map_file(path, 0, 0, 0,
+		&mapped_len, &is_pmem);
+	if (!base)
+		return NULL;
+
+	const struct ckpt_hdr *const hdr = (struct ckpt_hdr *)base;
+	if (mapped_len != CKPT_HDR_SIZE + 2 * len
+			|| memcmp(hdr->magic, CKPT_MAGIC, sizeof(hdr->magic)) != 0
+			|| hdr->len != len) {
+		pmem_unmap(base, mapped_len);
+		errno = EINVAL;
+		return NULL;
+	}
+	if (hdr->active > 0)
+		memcpy(addr, base + CKPT_HDR_SIZE + (hdr->active % 2) * len,
+			len);
+
+	PMEMckpt *const ckp = ckpt_init(base, mapped_len, is_pmem, addr, len,
+		track);
+	if (!ckp) {
+		const int oerrno = errno;
+		pmem_unmap(base, mapped_len);
+		errno = oerrno;
+	}
+	return ckp;
+}
+
+void pmemckpt_close(PMEMckpt *ckp)
+{
+	track_stop(ckp);
+	pmem_unmap(ckp->base, ckp->mapped_len);
+	free(ckp->dirty);
+	free(ckp->copied);
+	free(ckp->copy);
+	free(ckp);
+}
+
+/* checkpoints */
+int pmemckpt_checkpoint(PMEMckpt *ckp, int nthreads)
+{
+	if (nthreads < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/*
+	 * The scan for any soft-dirty region sets bits in the dirty maps of
+	 * all; the lock keeps one from landing between the copy map being
+	 * taken and the maps being swapped, where it would be lost.
+	 */
+	const int locked = ckp->track == PMEMCKPT_TRACK_SOFTDIRTY;
+	if (locked) {
+		pthread_mutex_lock(&track_lock_);
+		if (sd_clear() == -1) {
+			pthread_mutex_unlock(&track_lock_);
+			return -1;
+		}
+	} else if (ckp->track == PMEMCKPT_TRACK_FULL) {
+		set_all(ckp, ckp->dirty);
+	}
+
+	/* the slot has the checkpoint before the last one */
+	size_t npage = 0;
+	for (size_t i = 0; i < ckp->nword; ++i) {
+		ckp->copy[i] = ckp->dirty[i] | ckp->copied[i];
+		npage += (size_t)__builtin_popcountll(ckp->copy[i]);
+	}
+	const uint64_t gen = ckp->hdr->active + 1;
+	if (npage > 0 && copy_pages(ckp, slot_of(ckp, gen), npage,
+			nthreads) == -1) {
+		if (locked)
+			pthread_mutex_unlock(&track_lock_);
+		return -1;
+	}
+
+	/* the flip */
+	__atomic_store_n(&ckp->hdr->active, gen, __ATOMIC_RELEASE);
+	persist(ckp, &ckp->hdr->active, sizeof(ckp->hdr->active));
+
+	uint64_t *const t = ckp->copied;
+	ckp->copied = ckp->dirty;
+	ckp->dirty = t;
+	memset(ckp->dirty, 0, ckp->nword * sizeof(uint64_t));
+	if (locked)
+		pthread_mutex_unlock(&track_lock_);
+	ckp->last_copied = npage * ckp->pagesize;
+	if (ckp->track == PMEMCKPT_TRACK_WRPROTECT)
+		return wp_arm(ckp);
+	return 0;
+}
+
+uint64_t pmemckpt_generation(PMEMckpt *ckp)
+{
+	return ckp->hdr->active;
+}
+
+enum pmemckpt_track pmemckpt_track(PMEMckpt *ckp)
+{
+	return ckp->track;
+}
+
+size_t pmemckpt_last_copied(PMEMckpt *ckp)
+{
+	return ckp->last_copied;
+}
@@ -0,0 +1,78 @@
+#ifndef PMEMCKPT_H
+#define PMEMCKPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * pmemckpt: incremental checkpoints of a region of DRAM to a file
+ * mapped by pmem_map_file().
+ *
+ * The file has room for two checkpoints of the region. A checkpoint is
+ * written to the slot not in use, and made the active one by a single
+ * 8-byte store of its generation to the header once it is durable, so
+ * that a crash leaves the last complete checkpoint active.
+ *
+ * Only the pages written since the slot was last written are copied:
+ * those dirtied since the last checkpoint and those copied by it. The
+ * pages are found by one of:
+ *
+ *   PMEMCKPT_TRACK_SOFTDIRTY  the soft-dirty bits of the page table,
+ *     read from /proc/self/pagemap and cleared through
+ *     /proc/self/clear_refs (kernels with CONFIG_MEM_SOFT_DIRTY)
+ *   PMEMCKPT_TRACK_WRPROTECT  a write fault on each page after a
+ *     checkpoint, with the region mprotect()ed read-only and a SIGSEGV
+ *     handler that notes the page and makes it writable again
+ *   PMEMCKPT_TRACK_FULL       none; every page is copied
+ *
+ * The dirty pages are split between nthreads threads, which copy them
+ * with non-temporal stores and drain once each; nthreads 0 means one
+ * per CPU.
+ *
+ * The region must be page-aligned, and must not be written while a
+ * checkpoint is taken. Clearing soft-dirty bits is process-wide, so
+ * every region that tracks them is scanned before any is cleared, and
+ * checkpoints of such regions are taken one at a time in a process.
+ */
+
+enum pmemckpt_track {
+	PMEMCKPT_TRACK_AUTO,	/* soft-dirty if the kernel has it, else full */
+	PMEMCKPT_TRACK_SOFTDIRTY,
+	PMEMCKPT_TRACK_WRPROTECT,
+	PMEMCKPT_TRACK_FULL,
+};
+
+/* the regions that may track with PMEMCKPT_TRACK_WRPROTECT at a time */
+#define PMEMCKPT_MAX_WRPROTECT 16
+
+typedef struct pmemckpt PMEMckpt;
+
+/*
+ * Tracks the region [addr, addr + len) for checkpoints to a new file;
+ * EINVAL if the region is not page-aligned, EOPNOTSUPP if track is
+ * PMEMCKPT_TRACK_SOFTDIRTY on a kernel without it, EBUSY if track is
+ * PMEMCKPT_TRACK_WRPROTECT and PMEMCKPT_MAX_WRPROTECT regions already are.
+ */
+PMEMckpt *pmemckpt_create(const char *path, void *addr, size_t len,
+	enum pmemckpt_track track, mode_t mode);
+
+/* copies the active checkpoint of path, if any, to the region first */
+PMEMckpt *pmemckpt_open(const char *path, void *addr, size_t len,
+	enum pmemckpt_track track);
+
+/* stops tracking; the region is left writable */
+void pmemckpt_close(PMEMckpt *ckp);
+
+int pmemckpt_checkpoint(PMEMckpt *ckp, int nthreads);
+
+/* of the active checkpoint; 0 if there is none */
+uint64_t pmemckpt_generation(PMEMckpt *ckp);
+
+/* how the region is tracked; never PMEMCKPT_TRACK_AUTO */
+enum pmemckpt_track pmemckpt_track(PMEMckpt *ckp);
+
+/* the bytes copied by the last checkpoint */
+size_t pmemckpt_last_copied(PMEMckpt *ckp);
+
+#endif /* PMEMCKPT_H */
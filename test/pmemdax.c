@@ -0,0 +1,1079 @@
+#include "config.h" /* should be included first */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libpmem.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef MAJOR_IN_SYSMACROS
+#include <sys/sysmacros.h>
+#endif
+
+#include "pmemdax.h"
+#include "pmemplus.h"
+#include "pmemuring.h"
+
+#define DAXBLK_MAGIC "PMEMDXB"
+#define DAXLOG_MAGIC "PMEMDXL"
+#define SUPER_SIZE   ((size_t)4096)
+#define NOTIFY_OFF   ((size_t)2048)
+#define DEV_ALIGN    ((size_t)(2 << 20)) /* unless sysfs tells */
+
+#define NLANE        64
+#define NSTRIPE      256
+
+/*
+ * A map entry is the internal block holding an external block, plus
+ * two flags. There are always NLANE more internal blocks than external
+ * ones; those not in the map are the free blocks of the lanes.
+ */
+#define MAP_ERROR    ((uint32_t)1 << 31)
+#define MAP_ZERO     ((uint32_t)1 << 30)
+#define MAP_POSTMAP  (MAP_ZERO - 1)
+
+/* on-media layout */
+struct dax_super {
+	char magic[8];
+	uint64_t size; /* mapped length when formatted */
+};
+
+struct daxblk_super {
+	struct dax_super super;
+	uint64_t bsize;
+	uint64_t stride; /* bsize rounded up to a cache line */
+	uint64_t nblock;
+	uint64_t nlane;
+	uint64_t map_off;
+	uint64_t flog_off;
+	uint64_t data_off;
+};
+
+/*
+ * One log entry per lane in use; the one with the newer seq is valid.
+ * Each half is stored and persisted as an 8-byte word, lba and old
+ * first, so that a torn entry keeps the seq of its previous life.
+ */
+struct flog_entry {
+	uint32_t lba;
+	uint32_t old_map;
+	uint32_t new_map;
+	uint32_t seq; /* 1, 2, 3, 1, ...; 0 if never written */
+};
+
+struct flog {
+	struct flog_entry ent[2];
+} __attribute__((aligned(64)));
+
+struct daxlog_super {
+	struct dax_super super;
+	uint64_t data_off;
+	uint64_t nbyte;
+	uint64_t write_offset __attribute__((aligned(64)));
+};
+
+/*
+ * At NOTIFY_OFF in the superblock, and never persisted: what readers in
+ * other processes wait on. The writer bumps seq after each append and
+ * epoch at each rewind, and wakes seq if the count of waiters is not 0.
+ * The count is the low half of waiters; the high half is bumped by
+ * pmemdaxlog_open() when it resets the count.
+ */
+struct daxlog_notify {
+	uint32_t seq;
+	uint32_t epoch;
+	uint64_t waiters;
+} __attribute__((aligned(64)));
+
+/*
+ * A mapping of the device, or of its stand-in file. A file that is not
+ * pmem is mapped privately instead, and what would be persisted is
+ * written back to it through ring; see dax_persist().
+ */
+struct daxdev {
+	char *base;
+	size_t mapped_len;
+	PMEMuring *ring;
+	pthread_mutex_t ring_lock; /* held from dax_begin() to dax_end() */
+};
+
+struct lane {
+	pthread_mutex_t lock;
+	uint32_t free;
+	int cur; /* the valid flog entry */
+} __attribute__((aligned(64)));
+
+struct pmemdaxblk {
+	struct daxdev dev;
+	size_t bsize;
+	size_t stride;
+	size_t nblock;
+	uint32_t *map;
+	struct flog *flog;
+	char *data;
+	struct lane lane[NLANE];
+	unsigned next_lane;
+	/* a read holds its stripe so that its block is not reused */
+	pthread_rwlock_t stripe[NSTRIPE];
+};
+
+struct pmemdaxlog {
+	struct daxdev dev;
+	struct daxlog_super *super;
+	char *data;
+	pthread_rwlock_t lock;
+	/*
+	 * In the device mapping, or, if that is private, in a shared one
+	 * of the superblock, where readers see it.
+	 */
+	struct daxlog_notify *notify;
+	void *notify_map;
+};
+
+struct pmemdaxlog_reader {
+	const char *base;
+	size_t mapped_len;
+	void *ctl; /* a writable mapping with notify; NULL if not allowed */
+	size_t ctl_len;
+	const struct daxlog_super *super;
+	const char *data;
+	struct daxlog_notify *notify; /* in ctl if it is mapped */
+	uint64_t offset;
+	uint32_t epoch;
+};
+
+/* util functions */
+static size_t roundup(size_t n, size_t align)
+{
+	return (n + align - 1) / align * align;
+}
+
+static uint32_t seq_next(uint32_t seq)
+{
+	return seq % 3 + 1;
+}
+
+static unsigned env_uint(const char *name, unsigned dflt)
+{
+	const char *const p = getenv(name);
+	return p && *p ? (unsigned)strtoul(p, NULL, 0) : dflt;
+}
+
+/* an attribute of the Device DAX st is of */
+static int dev_attr(const struct stat *st, const char *name, size_t *val)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/%s",
+		major(st->st_rdev), minor(st->st_rdev), name);
+	FILE *const fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	unsigned long long n = 0;
+	const int r = fscanf(fp, "%llu", &n);
+	fclose(fp);
+	if (r != 1) {
+		errno = EINVAL;
+		return -1;
+	}
+	*val = (size_t)n;
+	return 0;
+}
+
+/* the size of a regular file, or of Device DAX as sysfs tells */
+static int dev_size(int fd, size_t *size)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+		return -1;
+	if (S_ISREG(st.st_mode)) {
+		*size = (size_t)st.st_size;
+		return 0;
+	}
+	if (!S_ISCHR(st.st_mode)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return dev_attr(&st, "size", size);
+}
+
+/* the least a mapping of st can be: a page, or the Device DAX alignment */
+static size_t dev_align(const struct stat *st)
+{
+	size_t align = 0;
+	if (!S_ISCHR(st->st_mode))
+		return SUPER_SIZE;
+	if (dev_attr(st, "align", &align) != 0 || align < SUPER_SIZE)
+		align = DEV_ALIGN;
+	return align;
+}
+
+/* daxdev: the mapping and the superblock */
+static int dax_map_uring(const char *path, struct daxdev *dev)
+{
+	const int fd = open(path, O_RDWR);
+	if (fd < 0)
+		return -1;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+			|| (size_t)st.st_size < PMEMDAX_MIN_POOL) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	dev->mapped_len = (size_t)st.st_size;
+	dev->base = mmap(NULL, dev->mapped_len, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (dev->base == MAP_FAILED)
+		return -1;
+
+	const unsigned flags =
+		env_uint("PMEMDAX_URING_FSYNC", 0) ? PMEMURING_FSYNC : 0;
+	dev->ring = pmemuring_open(path,
+		env_uint("PMEMDAX_URING_DEPTH", PMEMURING_DEPTH), flags);
+	if (!dev->ring) {
+		const int err = errno;
+		munmap(dev->base, dev->mapped_len);
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+static int dax_map(const char *path, struct daxdev *dev)
+{
+	int is_pmem = 0;
+	dev->ring = NULL;
+	dev->base = pmem_map_file(path, 0, 0, 0, &dev->mapped_len, &is_pmem);
+	if (!dev->base)
+		return -1;
+	if (dev->mapped_len < PMEMDAX_MIN_POOL) {
+		pmem_unmap(dev->base, dev->mapped_len);
+		errno = EINVAL;
+		return -1;
+	}
+	if (is_pmem)
+		return 0;
+
+	/* msync() would cost a system call per range; batch them instead */
+	pmem_unmap(dev->base, dev->mapped_len);
+	return dax_map_uring(path, dev);
+}
+
+static void dax_unmap(struct daxdev *dev)
+{
+	if (dev->ring) {
+		pmemuring_close(dev->ring);
+		munmap(dev->base, dev->mapped_len);
+	} else {
+		pmem_unmap(dev->base, dev->mapped_len);
+	}
+}
+
+/*
+ * pmem_persist(), or, on a file that is not pmem, queue a write of the
+ * range that is durable after those queued before it. dax_sync()
+ * submits them all at once and waits. An operation on an open pool
+ * queues between dax_begin() and dax_end(), so that those of other
+ * threads do not join its chain.
+ */
+static void dax_persist(struct daxdev *dev, const void *addr, size_t len)
+{
+	if (!dev->ring) {
+		pmem_persist(addr, len);
+		return;
+	}
+	/* an error is reported by dax_end() */
+	pmemuring_write(dev->ring, addr, len,
+		(off_t)((const char *)addr - dev->base));
+}
+
+static void dax_memcpy_persist(struct daxdev *dev, void *dst,
+		const void *src, size_t len)
+{
+	if (!dev->ring) {
+		pmem_memcpy_persist(dst, src, len);
+		return;
+	}
+	memcpy(dst, src, len);
+	dax_persist(dev, dst, len);
+}
+
+static int dax_sync(struct daxdev *dev)
+{
+	return dev->ring ? pmemuring_sync(dev->ring) : 0;
+}
+
+static void dax_begin(struct daxdev *dev)
+{
+	if (dev->ring)
+		pthread_mutex_lock(&dev->ring_lock);
+}
+
+static int dax_end(struct daxdev *dev)
+{
+	if (!dev->ring)
+		return 0;
+	const int ret = dax_sync(dev);
+	pthread_mutex_unlock(&dev->ring_lock);
+	return ret;
+}
+
+static int dax_check(const struct daxdev *dev, const char *magic)
+{
+	const struct dax_super *const s = (struct dax_super *)dev->base;
+	if (memcmp(s->magic, magic, sizeof(s->magic)) != 0
+			|| s->size != dev->mapped_len) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/* the caller has persisted the rest of the superblock */
+static void dax_commit(struct daxdev *dev, const char *magic)
+{
+	struct dax_super *const s = (struct dax_super *)dev->base;
+	s->size = dev->mapped_len;
+	dax_persist(dev, &s->size, sizeof(s->size));
+	memcpy(s->magic, magic, sizeof(s->magic));
+	dax_persist(dev, s->magic, sizeof(s->magic));
+}
+
+/* pmemdaxblk */
+static void flog_write(struct daxdev *dev, struct flog_entry *e,
+		uint32_t lba, uint32_t old_map, uint32_t new_map, uint32_t seq)
+{
+	uint64_t *const w = (uint64_t *)e;
+	__atomic_store_n(&w[0], (uint64_t)lba | (uint64_t)old_map << 32,
+		__ATOMIC_RELAXED);
+	dax_persist(dev, &w[0], sizeof(w[0]));
+	__atomic_store_n(&w[1], (uint64_t)new_map | (uint64_t)seq << 32,
+		__ATOMIC_RELAXED);
+	dax_persist(dev, &w[1], sizeof(w[1]));
+}
+
+/* returns the valid entry of f, or -1 if there is none */
+static int flog_current(const struct flog *f)
+{
+	const uint32_t s0 = f->ent[0].seq, s1 = f->ent[1].seq;
+	if (s0 == 0 && s1 == 0)
+		return -1;
+	if (s1 == 0 || (s0 != 0 && seq_next(s1) == s0))
+		return 0;
+	return 1;
+}
+
+static int daxblk_layout(size_t size, size_t bsize, struct daxblk_super *s)
+{
+	s->bsize = bsize;
+	s->stride = roundup(bsize, 64);
+	s->nlane = NLANE;
+	s->map_off = SUPER_SIZE;
+
+	/* each external block costs its data and a map entry */
+	const size_t fixed = SUPER_SIZE + 2 * 4096
+		+ NLANE * sizeof(struct flog) + NLANE * s->stride;
+	if (size <= fixed)
+		return -1;
+	size_t nblock = (size - fixed) / (s->stride + sizeof(uint32_t));
+	if (nblock + NLANE > MAP_POSTMAP)
+		nblock = MAP_POSTMAP - NLANE;
+
+	for (; nblock > 0; --nblock) {
+		s->flog_off = roundup(s->map_off + nblock * sizeof(uint32_t),
+			4096);
+		s->data_off = roundup(s->flog_off
+			+ NLANE * sizeof(struct flog), 4096);
+		if (s->data_off + (nblock + NLANE) * s->stride <= size)
+			break;
+	}
+	s->nblock = nblock;
+	return nblock > 0 ? 0 : -1;
+}
+
+static PMEMdaxblkpool *daxblk_init(struct daxdev *dev)
+{
+	PMEMdaxblkpool *const pbp = calloc(1, sizeof(*pbp));
+	if (!pbp)
+		return NULL;
+	const struct daxblk_super *const s = (struct daxblk_super *)dev->base;
+	pbp->dev = *dev;
+	pbp->bsize = s->bsize;
+	pbp->stride = s->stride;
+	pbp->nblock = s->nblock;
+	pbp->map = (uint32_t *)(dev->base + s->map_off);
+	pbp->flog = (struct flog *)(dev->base + s->flog_off);
+	pbp->data = dev->base + s->data_off;
+	for (int i = 0; i < NLANE; ++i)
+		pthread_mutex_init(&pbp->lane[i].lock, NULL);
+	for (int i = 0; i < NSTRIPE; ++i)
+		pthread_rwlock_init(&pbp->stripe[i], NULL);
+	pthread_mutex_init(&pbp->dev.ring_lock, NULL);
+	return pbp;
+}
+
+/* finishes the map update of each lane and finds its free block */
+static int daxblk_recover(PMEMdaxblkpool *pbp)
+{
+	const uint32_t ninternal = (uint32_t)(pbp->nblock + NLANE);
+	for (int i = 0; i < NLANE; ++i) {
+		const int cur = flog_current(&pbp->flog[i]);
+		if (cur < 0)
+			return -1;
+		const struct flog_entry *const e = &pbp->flog[i].ent[cur];
+		if (e->lba >= pbp->nblock || e->old_map >= ninternal
+				|| e->new_map >= ninternal)
+			return -1;
+
+		uint32_t *const m = &pbp->map[e->lba];
+		if ((*m & MAP_POSTMAP) == e->old_map
+				&& e->old_map != e->new_map) {
+			__atomic_store_n(m, e->new_map, __ATOMIC_RELAXED);
+			dax_persist(&pbp->dev, m, sizeof(*m));
+		}
+		pbp->lane[i].free = e->old_map;
+		pbp->lane[i].cur = cur;
+	}
+	return 0;
+}
+
+static struct lane *lane_acquire(PMEMdaxblkpool *pbp)
+{
+	const unsigned start =
+		__atomic_fetch_add(&pbp->next_lane, 1, __ATOMIC_RELAXED);
+	for (unsigned i = 0; i < NLANE; ++i) {
+		struct lane *const l = &pbp->lane[(start + i) % NLANE];
+		if (pthread_mutex_trylock(&l->lock) == 0)
+			return l;
+	}
+	struct lane *const l = &pbp->lane[start % NLANE];
+	pthread_mutex_lock(&l->lock);
+	return l;
+}
+
+static pthread_rwlock_t *stripe_of(PMEMdaxblkpool *pbp, long long blockno)
+{
+	return &pbp->stripe[(unsigned long long)blockno % NSTRIPE];
+}
+
+static int check_blockno(PMEMdaxblkpool *pbp, long long blockno)
+{
+	if (blockno < 0 || (unsigned long long)blockno >= pbp->nblock) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+PMEMdaxblkpool *pmemdaxblk_create(const char *path, size_t bsize)
+{
+	if (bsize == 0 || bsize > UINT32_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct daxdev dev;
+	if (dax_map(path, &dev) != 0)
+		return NULL;
+
+	struct daxblk_super *const s = (struct daxblk_super *)dev.base;
+	struct daxblk_super layout = {{{0}, 0}, 0, 0, 0, 0, 0, 0, 0};
+	if (daxblk_layout(dev.mapped_len, bsize, &layout) != 0) {
+		dax_unmap(&dev);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* invalidate an old superblock before anything else */
+	memset(s->super.magic, 0, sizeof(s->super.magic));
+	dax_persist(&dev, s->super.magic, sizeof(s->super.magic));
+
+	/* every block reads as zeroes until it is written */
+	uint32_t *const map = (uint32_t *)(dev.base + layout.map_off);
+	for (uint32_t i = 0; i < layout.nblock; ++i)
+		map[i] = MAP_ZERO | i;
+	dax_persist(&dev, map, layout.nblock * sizeof(*map));
+
+	/* lane i starts with internal block nblock + i free */
+	struct flog *const flog = (struct flog *)(dev.base + layout.flog_off);
+	memset(flog, 0, NLANE * sizeof(*flog));
+	for (uint32_t i = 0; i < NLANE; ++i) {
+		const uint32_t b = (uint32_t)layout.nblock + i;
+		flog[i].ent[0] = (struct flog_entry){0, b, b, 1};
+	}
+	dax_persist(&dev, flog, NLANE * sizeof(*flog));
+
+	s->bsize = layout.bsize;
+	s->stride = layout.stride;
+	s->nblock = layout.nblock;
+	s->nlane = layout.nlane;
+	s->map_off = layout.map_off;
+	s->flog_off = layout.flog_off;
+	s->data_off = layout.data_off;
+	dax_persist(&dev, s, sizeof(*s));
+	dax_commit(&dev, DAXBLK_MAGIC);
+	if (dax_sync(&dev) != 0) {
+		const int err = errno;
+		dax_unmap(&dev);
+		errno = err;
+		return NULL;
+	}
+
+	PMEMdaxblkpool *const pbp = daxblk_init(&dev);
+	if (!pbp) {
+		dax_unmap(&dev);
+		errno = ENOMEM;
+		return NULL;
+	}
+	daxblk_recover(pbp);
+	if (dax_sync(&pbp->dev) != 0) {
+		const int err = errno;
+		pmemdaxblk_close(pbp);
+		errno = err;
+		return NULL;
+	}
+	return pbp;
+}
+
+PMEMdaxblkpool *pmemdaxblk_open(const char *path, size_t bsize)
+{
+	struct daxdev dev;
+	if (dax_map(path, &dev) != 0)
+		return NULL;
+
+	const struct daxblk_super *const s = (struct daxblk_super *)dev.base;
+	struct daxblk_super layout;
+	if (dax_check(&dev, DAXBLK_MAGIC) != 0
+			|| (bsize != 0 && bsize != s->bsize)
+			|| s->nlane != NLANE
+			|| daxblk_layout(dev.mapped_len, s->bsize, &layout) != 0
+			|| layout.nblock != s->nblock
+			|| layout.flog_off != s->flog_off
+			|| layout.data_off != s->data_off) {
+		dax_unmap(&dev);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	PMEMdaxblkpool *const pbp = daxblk_init(&dev);
+	if (!pbp) {
+		dax_unmap(&dev);
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (daxblk_recover(pbp) != 0) {
+		pmemdaxblk_close(pbp);
+		errno = EINVAL;
+		return NULL;
+	}
+	if (dax_sync(&pbp->dev) != 0) {
+		const int err = errno;
+		pmemdaxblk_close(pbp);
+		errno = err;
+		return NULL;
+	}
+	return pbp;
+}
+
+void pmemdaxblk_close(PMEMdaxblkpool *pbp)
+{
+	for (int i = 0; i < NLANE; ++i)
+		pthread_mutex_destroy(&pbp->lane[i].lock);
+	for (int i = 0; i < NSTRIPE; ++i)
+		pthread_rwlock_destroy(&pbp->stripe[i]);
+	pthread_mutex_destroy(&pbp->dev.ring_lock);
+	dax_unmap(&pbp->dev);
+	free(pbp);
+}
+
+size_t pmemdaxblk_bsize(PMEMdaxblkpool *pbp)
+{
+	return pbp->bsize;
+}
+
+size_t pmemdaxblk_nblock(PMEMdaxblkpool *pbp)
+{
+	return pbp->nblock;
+}
+
+int pmemdaxblk_read(PMEMdaxblkpool *pbp, void *buf, long long blockno)
+{
+	if (check_blockno(pbp, blockno) != 0)
+		return -1;
+
+	int ret = 0;
+	pthread_rwlock_t *const stripe = stripe_of(pbp, blockno);
+	pthread_rwlock_rdlock(stripe);
+	const uint32_t m =
+		__atomic_load_n(&pbp->map[blockno], __ATOMIC_ACQUIRE);
+	if (m & MAP_ERROR) {
+		errno = EIO;
+		ret = -1;
+	} else if (m & MAP_ZERO) {
+		memset(buf, 0, pbp->bsize);
+	} else {
+		memcpy(buf, pbp->data + (m & MAP_POSTMAP) * pbp->stride,
+			pbp->bsize);
+	}
+	pthread_rwlock_unlock(stripe);
+	return ret;
+}
+
+int pmemdaxblk_write(PMEMdaxblkpool *pbp, const void *buf, long long blockno)
+{
+	if (check_blockno(pbp, blockno) != 0)
+		return -1;
+
+	pthread_rwlock_t *const stripe = stripe_of(pbp, blockno);
+	pthread_rwlock_wrlock(stripe);
+	struct lane *const l = lane_acquire(pbp);
+	const int i = (int)(l - pbp->lane);
+	dax_begin(&pbp->dev);
+
+	/* the new data goes to the free block, out of place */
+	const uint32_t new_map = l->free;
+	dax_memcpy_persist(&pbp->dev, pbp->data + new_map * pbp->stride, buf,
+		pbp->bsize);
+
+	uint32_t *const m = &pbp->map[blockno];
+	const uint32_t old_map = *m & MAP_POSTMAP;
+	const int next = !l->cur;
+	flog_write(&pbp->dev, &pbp->flog[i].ent[next], (uint32_t)blockno,
+		old_map, new_map, seq_next(pbp->flog[i].ent[l->cur].seq));
+	l->cur = next;
+
+	/* clears MAP_ZERO and MAP_ERROR as well */
+	__atomic_store_n(m, new_map, __ATOMIC_RELEASE);
+	dax_persist(&pbp->dev, m, sizeof(*m));
+	l->free = old_map;
+	const int ret = dax_end(&pbp->dev);
+
+	pthread_mutex_unlock(&l->lock);
+	pthread_rwlock_unlock(stripe);
+	return ret;
+}
+
+static int daxblk_set_flag(PMEMdaxblkpool *pbp, long long blockno,
+		uint32_t flag)
+{
+	if (check_blockno(pbp, blockno) != 0)
+		return -1;
+
+	pthread_rwlock_t *const stripe = stripe_of(pbp, blockno);
+	pthread_rwlock_wrlock(stripe);
+	dax_begin(&pbp->dev);
+	uint32_t *const m = &pbp->map[blockno];
+	__atomic_store_n(m, (*m & MAP_POSTMAP) | flag, __ATOMIC_RELEASE);
+	dax_persist(&pbp->dev, m, sizeof(*m));
+	const int ret = dax_end(&pbp->dev);
+	pthread_rwlock_unlock(stripe);
+	return ret;
+}
+
+int pmemdaxblk_set_zero(PMEMdaxblkpool *pbp, long long blockno)
+{
+	return daxblk_set_flag(pbp, blockno, MAP_ZERO);
+}
+
+int pmemdaxblk_set_error(PMEMdaxblkpool *pbp, long long blockno)
+{
+	return daxblk_set_flag(pbp, blockno, MAP_ERROR);
+}
+
+/* pmemdaxlog */
+static PMEMdaxlogpool *daxlog_init(struct daxdev *dev, const char *path)
+{
+	PMEMdaxlogpool *const plp = calloc(1, sizeof(*plp));
+	if (!plp) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	plp->dev = *dev;
+	plp->super = (struct daxlog_super *)dev->base;
+	plp->data = dev->base + plp->super->data_off;
+	plp->notify = (struct daxlog_notify *)(dev->base + NOTIFY_OFF);
+	if (dev->ring) {
+		/* only a regular file is mapped privately */
+		const int fd = open(path, O_RDWR);
+		if (fd < 0) {
+			free(plp);
+			return NULL;
+		}
+		plp->notify_map = mmap(NULL, SUPER_SIZE,
+			PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (plp->notify_map == MAP_FAILED) {
+			free(plp);
+			return NULL;
+		}
+		plp->notify = (struct daxlog_notify *)
+			((char *)plp->notify_map + NOTIFY_OFF);
+	}
+	pthread_rwlock_init(&plp->lock, NULL);
+	pthread_mutex_init(&plp->dev.ring_lock, NULL);
+	return plp;
+}
+
+static void daxlog_notify(PMEMdaxlogpool *plp, int rewound)
+{
+	struct daxlog_notify *const n = plp->notify;
+	if (rewound)
+		__atomic_add_fetch(&n->epoch, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&n->seq, 1, __ATOMIC_SEQ_CST);
+	if ((uint32_t)__atomic_load_n(&n->waiters, __ATOMIC_SEQ_CST) > 0)
+		futex(&n->seq, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+PMEMdaxlogpool *pmemdaxlog_create(const char *path)
+{
+	struct daxdev dev;
+	if (dax_map(path, &dev) != 0)
+		return NULL;
+
+	struct daxlog_super *const s = (struct daxlog_super *)dev.base;
+	memset(s->super.magic, 0, sizeof(s->super.magic));
+	dax_persist(&dev, s->super.magic, sizeof(s->super.magic));
+
+	s->data_off = SUPER_SIZE;
+	s->nbyte = dev.mapped_len - SUPER_SIZE;
+	s->write_offset = 0;
+	dax_persist(&dev, s, sizeof(*s));
+	dax_commit(&dev, DAXLOG_MAGIC);
+	if (dax_sync(&dev) != 0) {
+		const int err = errno;
+		dax_unmap(&dev);
+		errno = err;
+		return NULL;
+	}
+
+	PMEMdaxlogpool *const plp = daxlog_init(&dev, path);
+	if (!plp) {
+		const int err = errno;
+		dax_unmap(&dev);
+		errno = err;
+		return NULL;
+	}
+	memset(plp->notify, 0, sizeof(*plp->notify));
+	return plp;
+}
+
+PMEMdaxlogpool *pmemdaxlog_open(const char *path)
+{
+	struct daxdev dev;
+	if (dax_map(path, &dev) != 0)
+		return NULL;
+
+	const struct daxlog_super *const s = (struct daxlog_super *)dev.base;
+	if (dax_check(&dev, DAXLOG_MAGIC) != 0
+			|| s->data_off != SUPER_SIZE
+			|| s->nbyte != dev.mapped_len - SUPER_SIZE
+			|| s->write_offset > s->nbyte) {
+		dax_unmap(&dev);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	PMEMdaxlogpool *const plp = daxlog_init(&dev, path);
+	if (!plp) {
+		const int err = errno;
+		dax_unmap(&dev);
+		errno = err;
+		return NULL;
+	}
+
+	/*
+	 * A reader killed while waiting leaves its count behind, which
+	 * would cost every append a wake. Readers waiting now are woken to
+	 * count themselves again, in the new generation.
+	 */
+	struct daxlog_notify *const n = plp->notify;
+	uint64_t w = __atomic_load_n(&n->waiters, __ATOMIC_SEQ_CST);
+	while (!__atomic_compare_exchange_n(&n->waiters, &w,
+			((w >> 32) + 1) << 32, 1, __ATOMIC_SEQ_CST,
+			__ATOMIC_SEQ_CST))
+		;
+	__atomic_add_fetch(&n->seq, 1, __ATOMIC_SEQ_CST);
+	futex(&n->seq, FUTEX_WAKE, INT_MAX, NULL);
+	return plp;
+}
+
+void pmemdaxlog_close(PMEMdaxlogpool *plp)
+{
+	if (plp->notify_map)
+		munmap(plp->notify_map, SUPER_SIZE);
+	pthread_rwlock_destroy(&plp->lock);
+	pthread_mutex_destroy(&plp->dev.ring_lock);
+	dax_unmap(&plp->dev);
+	free(plp);
+}
+
+size_t pmemdaxlog_nbyte(PMEMdaxlogpool *plp)
+{
+	return plp->super->nbyte;
+}
+
+int pmemdaxlog_append(PMEMdaxlogpool *plp, const void *buf, size_t count)
+{
+	int ret = 0;
+	pthread_rwlock_wrlock(&plp->lock);
+	struct daxlog_super *const s = plp->super;
+	const uint64_t off = s->write_offset;
+	if (count > s->nbyte - off) {
+		errno = ENOSPC;
+		ret = -1;
+	} else {
+		/* the data first, then the offset that makes it visible */
+		dax_begin(&plp->dev);
+		dax_memcpy_persist(&plp->dev, plp->data + off, buf, count);
+		__atomic_store_n(&s->write_offset, off + count,
+			__ATOMIC_RELEASE);
+		dax_persist(&plp->dev, &s->write_offset,
+			sizeof(s->write_offset));
+		ret = dax_end(&plp->dev);
+	}
+	pthread_rwlock_unlock(&plp->lock);
+	if (ret == 0)
+		daxlog_notify(plp, 0);
+	return ret;
+}
+
+long long pmemdaxlog_tell(PMEMdaxlogpool *plp)
+{
+	return (long long)__atomic_load_n(&plp->super->write_offset,
+		__ATOMIC_ACQUIRE);
+}
+
+void pmemdaxlog_rewind(PMEMdaxlogpool *plp)
+{
+	pthread_rwlock_wrlock(&plp->lock);
+	/* readers see the epoch change before the offset does */
+	daxlog_notify(plp, 1);
+	dax_begin(&plp->dev);
+	__atomic_store_n(&plp->super->write_offset, 0, __ATOMIC_RELEASE);
+	dax_persist(&plp->dev, &plp->super->write_offset,
+		sizeof(plp->super->write_offset));
+	dax_end(&plp->dev); /* DO NOT care; it returns void */
+	pthread_rwlock_unlock(&plp->lock);
+}
+
+void pmemdaxlog_walk(PMEMdaxlogpool *plp, size_t chunksize,
+	int (*process_chunk)(const void *buf, size_t len, void *arg),
+	void *arg)
+{
+	pthread_rwlock_rdlock(&plp->lock);
+	const size_t end = plp->super->write_offset;
+
+	/* chunksize 0 means the whole log in one call */
+	if (chunksize == 0) {
+		process_chunk(plp->data, end, arg);
+	} else {
+		for (size_t off = 0; off < end; off += chunksize) {
+			const size_t len = end - off < chunksize
+				? end - off : chunksize;
+			if (!process_chunk(plp->data + off, len, arg))
+				break;
+		}
+	}
+	pthread_rwlock_unlock(&plp->lock);
+}
+
+/* pmemdaxlog_reader */
+PMEMdaxlogreader *pmemdaxlog_reader_open(const char *path)
+{
+	int fd = open(path, O_RDWR);
+	const int writable = fd >= 0;
+	if (fd < 0 && (errno == EACCES || errno == EROFS))
+		fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	size_t size = 0;
+	struct stat st;
+	if (dev_size(fd, &size) != 0 || fstat(fd, &st) != 0) {
+		const int err = errno;
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+	if (size < PMEMDAX_MIN_POOL) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	PMEMdaxlogreader *const plr = calloc(1, sizeof(*plr));
+	if (!plr) {
+		close(fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+	plr->mapped_len = size;
+	plr->base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (plr->base == MAP_FAILED)
+		goto err_base;
+	if (writable) {
+		/* only the superblock is written; the data stays read-only */
+		plr->ctl_len = dev_align(&st);
+		if (plr->ctl_len > size)
+			plr->ctl_len = size;
+		plr->ctl = mmap(NULL, plr->ctl_len, PROT_READ|PROT_WRITE,
+			MAP_SHARED, fd, 0);
+		if (plr->ctl == MAP_FAILED)
+			goto err_ctl;
+	}
+	close(fd);
+
+	plr->super = (const struct daxlog_super *)plr->base;
+	plr->data = plr->base + SUPER_SIZE;
+	plr->notify = (struct daxlog_notify *)((plr->ctl ? plr->ctl
+		: (void *)plr->base) + NOTIFY_OFF);
+	const struct dax_super *const s = &plr->super->super;
+	if (memcmp(s->magic, DAXLOG_MAGIC, sizeof(s->magic)) != 0
+			|| s->size != size
+			|| plr->super->data_off != SUPER_SIZE
+			|| plr->super->nbyte != size - SUPER_SIZE) {
+		pmemdaxlog_reader_close(plr);
+		errno = EINVAL;
+		return NULL;
+	}
+	plr->epoch = __atomic_load_n(&plr->notify->epoch, __ATOMIC_SEQ_CST);
+	return plr;
+
+err_ctl:
+	munmap((void *)plr->base, size);
+err_base:
+	close(fd);
+	free(plr);
+	return NULL;
+}
+
+void pmemdaxlog_reader_close(PMEMdaxlogreader *plr)
+{
+	if (plr->ctl)
+		munmap(plr->ctl, plr->ctl_len);
+	munmap((void *)plr->base, plr->mapped_len);
+	free(plr);
+}
+
+long long pmemdaxlog_reader_tell(PMEMdaxlogreader *plr)
+{
+	return (long long)plr->offset;
+}
+
+long long pmemdaxlog_reader_end(PMEMdaxlogreader *plr)
+{
+	return (long long)__atomic_load_n(&plr->super->write_offset,
+		__ATOMIC_ACQUIRE);
+}
+
+int pmemdaxlog_reader_seek(PMEMdaxlogreader *plr, long long offset)
+{
+	/* the epoch first, so that a rewind after it is noticed */
+	plr->epoch = __atomic_load_n(&plr->notify->epoch, __ATOMIC_SEQ_CST);
+	if (offset < 0 || offset > pmemdaxlog_reader_end(plr)) {
+		errno = EINVAL;
+		return -1;
+	}
+	plr->offset = (uint64_t)offset;
+	return 0;
+}
+
+/* bytes past the offset; -1 with ESTALE if the log was rewound */
+static long long reader_avail(PMEMdaxlogreader *plr)
+{
+	const uint64_t end = __atomic_load_n(&plr->super->write_offset,
+		__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&plr->notify->epoch, __ATOMIC_SEQ_CST)
+			!= plr->epoch || end < plr->offset) {
+		errno = ESTALE;
+		return -1;
+	}
+	return (long long)(end - plr->offset);
+}
+
+/* counts a waiter; returns the generation it is counted in */
+static uint32_t waiter_add(struct daxlog_notify *n)
+{
+	return (uint32_t)(__atomic_add_fetch(&n->waiters, 1,
+		__ATOMIC_SEQ_CST) >> 32);
+}
+
+/* uncounts a waiter, unless the count was reset since it was counted */
+static void waiter_del(struct daxlog_notify *n, uint32_t gen)
+{
+	uint64_t w = __atomic_load_n(&n->waiters, __ATOMIC_SEQ_CST);
+	while ((uint32_t)(w >> 32) == gen && (uint32_t)w > 0
+			&& !__atomic_compare_exchange_n(&n->waiters, &w, w - 1,
+				1, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+		;
+}
+
+/*
+ * Sleeps until seq moves, the deadline passes, or a millisecond does
+ * if the reader cannot count itself as a waiter. The count goes up
+ * before avail is checked again, and an append bumps seq before it
+ * reads the count, so either the check sees the append or the append
+ * sees the waiter.
+ */
+static long long reader_sleep(PMEMdaxlogreader *plr, long long deadline)
+{
+	struct daxlog_notify *const n = plr->notify;
+	uint32_t gen = 0;
+	if (plr->ctl)
+		gen = waiter_add(n);
+	uint32_t seq = __atomic_load_n(&n->seq, __ATOMIC_SEQ_CST);
+	/* a writer opening the pool before seq was read reset the count */
+	while (plr->ctl && (uint32_t)(__atomic_load_n(&n->waiters,
+			__ATOMIC_SEQ_CST) >> 32) != gen) {
+		gen = waiter_add(n);
+		seq = __atomic_load_n(&n->seq, __ATOMIC_SEQ_CST);
+	}
+	long long avail = reader_avail(plr);
+	if (avail == 0) {
+		long long left = deadline < 0 ? -1
+			: deadline - (long long)now_ns();
+		if (!plr->ctl && (left < 0 || left > 1000000))
+			left = 1000000;
+		if (left != 0) {
+			const struct timespec ts = {
+				left / 1000000000LL, left % 1000000000LL};
+			futex(&n->seq, FUTEX_WAIT, seq, left < 0 ? NULL : &ts);
+		}
+		avail = reader_avail(plr);
+	}
+	if (plr->ctl)
+		waiter_del(n, gen);
+	return avail;
+}
+
+ssize_t pmemdaxlog_reader_next(PMEMdaxlogreader *plr, const void **buf,
+		long long timeout_ns)
+{
+	const long long start = (long long)now_ns();
+	const long long deadline = timeout_ns < 0 ? -1 : start + timeout_ns;
+	const long long spin_until = start + (timeout_ns >= 0
+		&& timeout_ns < PMEMDAX_SPIN_NS ? timeout_ns : PMEMDAX_SPIN_NS);
+
+	long long avail;
+	while ((avail = reader_avail(plr)) == 0
+			&& (long long)now_ns() < spin_until)
+		__builtin_ia32_pause();
+	while (avail == 0 && (deadline < 0 || (long long)now_ns() < deadline))
+		avail = reader_sleep(plr, deadline);
+	if (avail <= 0)
+		return avail;
+
+	*buf = plr->data + plr->offset;
+	plr->offset += (uint64_t)avail;
+	return (ssize_t)avail;
+}
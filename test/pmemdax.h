@@ -0,0 +1,97 @@
+#ifndef PMEMDAX_H
+#define PMEMDAX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * pmemdax: block and log engines that run directly on Device DAX
+ * (e.g. /dev/dax1.0), i.e. without a file system under them.
+ *
+ * A character device cannot be created, truncated or unlinked, so
+ * *_create() formats a device or an existing file in place and the
+ * engine keeps its own superblock at offset 0.
+ *
+ * A regular file that pmem_map_file() does not report as persistent
+ * memory is mapped privately instead of falling back to msync(). What
+ * an operation persists is written back to the file in order, with one
+ * io_uring submission per operation (see pmemuring.h). The environment
+ * tunes it:
+ *
+ *   PMEMDAX_URING_DEPTH  requests per submission; 0 for pwrite(2)
+ *   PMEMDAX_URING_FSYNC  1 for fdatasync(2) instead of O_DSYNC
+ *
+ * Writers are then serialized.
+ *
+ * pmemdaxblk writes blocks atomically as pmemblk does. Each write goes
+ * to the free block of a lane and is published by a 4-byte map store;
+ * a per-lane log finishes an interrupted map update on open.
+ * pmemdaxlog appends as pmemlog does and persists the write offset last.
+ */
+
+#define PMEMDAX_MIN_POOL ((size_t)(1 << 21))
+
+typedef struct pmemdaxblk PMEMdaxblkpool;
+typedef struct pmemdaxlog PMEMdaxlogpool;
+
+PMEMdaxblkpool *pmemdaxblk_create(const char *path, size_t bsize);
+PMEMdaxblkpool *pmemdaxblk_open(const char *path, size_t bsize);
+void pmemdaxblk_close(PMEMdaxblkpool *pbp);
+size_t pmemdaxblk_bsize(PMEMdaxblkpool *pbp);
+size_t pmemdaxblk_nblock(PMEMdaxblkpool *pbp);
+int pmemdaxblk_read(PMEMdaxblkpool *pbp, void *buf, long long blockno);
+int pmemdaxblk_write(PMEMdaxblkpool *pbp, const void *buf, long long blockno);
+int pmemdaxblk_set_zero(PMEMdaxblkpool *pbp, long long blockno);
+int pmemdaxblk_set_error(PMEMdaxblkpool *pbp, long long blockno);
+
+PMEMdaxlogpool *pmemdaxlog_create(const char *path);
+PMEMdaxlogpool *pmemdaxlog_open(const char *path);
+void pmemdaxlog_close(PMEMdaxlogpool *plp);
+size_t pmemdaxlog_nbyte(PMEMdaxlogpool *plp);
+int pmemdaxlog_append(PMEMdaxlogpool *plp, const void *buf, size_t count);
+long long pmemdaxlog_tell(PMEMdaxlogpool *plp);
+void pmemdaxlog_rewind(PMEMdaxlogpool *plp);
+void pmemdaxlog_walk(PMEMdaxlogpool *plp, size_t chunksize,
+	int (*process_chunk)(const void *buf, size_t len, void *arg),
+	void *arg);
+
+/*
+ * pmemdaxlog_reader: tails a pmemdaxlog pool from other processes.
+ *
+ * A reader maps the pool shared and read-only and hands out pointers
+ * into the mapping, so records are not copied. pmemdaxlog_reader_next()
+ * returns what has been appended past the reader's offset, up to the
+ * write offset, which an append publishes once its data is persistent.
+ * If there is nothing yet, it spins for PMEMDAX_SPIN_NS and then sleeps
+ * on a futex(2) word of the superblock that every append bumps. To be
+ * woken, a reader counts itself on the superblock, which needs write
+ * access to the pool; only the page holding the superblock, or on
+ * Device DAX the unit of its alignment, is mapped writable. A reader
+ * without write access polls every millisecond.
+ *
+ * After a rewind, next() fails with ESTALE until the reader seeks. The
+ * bytes a reader was handed may change under it if the log is rewound.
+ */
+
+#define PMEMDAX_SPIN_NS 20000LL
+
+typedef struct pmemdaxlog_reader PMEMdaxlogreader;
+
+PMEMdaxlogreader *pmemdaxlog_reader_open(const char *path);
+void pmemdaxlog_reader_close(PMEMdaxlogreader *plr);
+
+/* the reader's offset; pmemdaxlog_tell() of the writer is the end */
+long long pmemdaxlog_reader_tell(PMEMdaxlogreader *plr);
+long long pmemdaxlog_reader_end(PMEMdaxlogreader *plr);
+int pmemdaxlog_reader_seek(PMEMdaxlogreader *plr, long long offset);
+
+/*
+ * Waits up to timeout_ns (-1 for ever) for bytes past the offset, points
+ * *buf at them and moves the offset past them. Returns how many, or 0
+ * on timeout.
+ */
+ssize_t pmemdaxlog_reader_next(PMEMdaxlogreader *plr, const void **buf,
+	long long timeout_ns);
+
+#endif /* PMEMDAX_H */
@@ -0,0 +1,380 @@
+#define _GNU_SOURCE /* RTLD_NEXT */
+#include "config.h" /* should be included first */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <libpmem.h>
+#include <libpmemblk.h>
+#include <libpmemlog.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * libpmememu.so: makes DRAM or tmpfs perform like pmem.
+ *
+ * LD_PRELOAD it into a program linked with libpmem (see run_emu). It
+ * takes over pmem_map_file() so that every mapping is pmem, counts the
+ * cache lines flushed by each thread, and at the next drain waits for
+ * the write latency plus the time to move those lines at the write
+ * bandwidth. Copies out of a mapping by pmem_memcpy() and the like, and
+ * pmemblk_read() and pmemlog_walk(), are charged the read latency and
+ * bandwidth. Plain loads cannot be seen and are not charged. At most
+ * MAX_MAPS files can be mapped at a time; pmem_map_file() fails with
+ * ENOMEM beyond that.
+ *
+ * Each bandwidth is shared by all threads, like that of one device.
+ * The defaults are close to a single Optane DC DIMM:
+ *
+ *   PMEMEMU_WRITE_LATENCY_NS  100
+ *   PMEMEMU_WRITE_BW_MBS      2300  (10^6 bytes/sec)
+ *   PMEMEMU_READ_LATENCY_NS   300
+ *   PMEMEMU_READ_BW_MBS       6600
+ *   PMEMEMU_STATS             1 prints what was charged at exit
+ */
+
+#define CACHELINE  ((uintptr_t)64)
+#define MAX_MAPS   64
+
+struct channel {
+	const char *name;
+	uint64_t latency_ns;
+	uint64_t bw_mbs;
+	uint64_t busy_until; /* ns; when the device is free again */
+	/* statistics */
+	uint64_t nop;
+	uint64_t nbyte;
+	uint64_t wait_ns;
+};
+
+struct range {
+	uintptr_t lo;
+	uintptr_t hi;
+};
+
+static struct channel write_ = {"write", 100, 2300, 0, 0, 0, 0};
+static struct channel read_ = {"read", 300, 6600, 0, 0, 0, 0};
+
+/* bytes flushed by this thread and not drained yet */
+static __thread size_t pending_ = 0;
+
+static pthread_mutex_t maps_lock_ = PTHREAD_MUTEX_INITIALIZER;
+static struct range maps_[MAX_MAPS];
+
+/* the functions taken over */
+static void *(*real_map_file)(const char *, size_t, int, mode_t,
+	size_t *, int *);
+static int (*real_unmap)(void *, size_t);
+static int (*real_is_pmem)(const void *, size_t);
+static void (*real_flush)(const void *, size_t);
+static void (*real_drain)(void);
+static void (*real_persist)(const void *, size_t);
+static void *(*real_memmove_nodrain)(void *, const void *, size_t);
+static void *(*real_memcpy_nodrain)(void *, const void *, size_t);
+static void *(*real_memset_nodrain)(void *, int, size_t);
+#ifdef PMEM_F_MEM_NODRAIN
+static void *(*real_memmove)(void *, const void *, size_t, unsigned);
+static void *(*real_memcpy)(void *, const void *, size_t, unsigned);
+static void *(*real_memset)(void *, int, size_t, unsigned);
+#endif
+static int (*real_blk_read)(PMEMblkpool *, void *, long long);
+static size_t (*real_blk_bsize)(PMEMblkpool *);
+static void (*real_log_walk)(PMEMlogpool *, size_t,
+	int (*)(const void *, size_t, void *), void *);
+
+/* util functions */
+static uint64_t env_u64(const char *name, uint64_t dflt)
+{
+	const char *const p = getenv(name);
+	return p && *p ? strtoull(p, NULL, 0) : dflt;
+}
+
+static uint64_t clock_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec;
+}
+
+/* in cache lines, as the hardware writes them back */
+static size_t line_bytes(const void *addr, size_t len)
+{
+	const uintptr_t lo = (uintptr_t)addr & ~(CACHELINE - 1);
+	const uintptr_t hi = ((uintptr_t)addr + len + CACHELINE - 1)
+		& ~(CACHELINE - 1);
+	return len ? (size_t)(hi - lo) : 0;
+}
+
+/*
+ * Moves len bytes through c after whatever other threads have queued,
+ * then waits for the latency. Sleeping is far too coarse, so this spins.
+ */
+static void charge(struct channel *c, size_t len)
+{
+	const uint64_t xfer = c->bw_mbs ? (uint64_t)len * 1000 / c->bw_mbs : 0;
+	const uint64_t now = clock_ns();
+	uint64_t busy = __atomic_load_n(&c->busy_until, __ATOMIC_RELAXED);
+	uint64_t start;
+	do {
+		start = busy > now ? busy : now;
+	} while (!__atomic_compare_exchange_n(&c->busy_until, &busy,
+		start + xfer, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	const uint64_t done = start + xfer + c->latency_ns;
+	while (clock_ns() < done)
+		__builtin_ia32_pause();
+
+	__atomic_fetch_add(&c->nop, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->nbyte, len, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->wait_ns, done - now, __ATOMIC_RELAXED);
+}
+
+static void emu_drain(void)
+{
+	if (pending_ > 0) {
+		charge(&write_, pending_);
+		pending_ = 0;
+	}
+}
+
+static int in_maps(const void *addr)
+{
+	const uintptr_t a = (uintptr_t)addr;
+	int found = 0;
+	pthread_mutex_lock(&maps_lock_);
+	for (int i = 0; i < MAX_MAPS && !found; ++i)
+		found = maps_[i].lo <= a && a < maps_[i].hi;
+	pthread_mutex_unlock(&maps_lock_);
+	return found;
+}
+
+static void charge_read(const void *src, size_t len)
+{
+	if (len > 0 && in_maps(src))
+		charge(&read_, line_bytes(src, len));
+}
+
+__attribute__((constructor))
+static void emu_init(void)
+{
+	write_.latency_ns = env_u64("PMEMEMU_WRITE_LATENCY_NS",
+		write_.latency_ns);
+	write_.bw_mbs = env_u64("PMEMEMU_WRITE_BW_MBS", write_.bw_mbs);
+	read_.latency_ns = env_u64("PMEMEMU_READ_LATENCY_NS",
+		read_.latency_ns);
+	read_.bw_mbs = env_u64("PMEMEMU_READ_BW_MBS", read_.bw_mbs);
+
+	*(void **)&real_map_file = dlsym(RTLD_NEXT, "pmem_map_file");
+	*(void **)&real_unmap = dlsym(RTLD_NEXT, "pmem_unmap");
+	*(void **)&real_is_pmem = dlsym(RTLD_NEXT, "pmem_is_pmem");
+	*(void **)&real_flush = dlsym(RTLD_NEXT, "pmem_flush");
+	*(void **)&real_drain = dlsym(RTLD_NEXT, "pmem_drain");
+	*(void **)&real_persist = dlsym(RTLD_NEXT, "pmem_persist");
+	*(void **)&real_memmove_nodrain =
+		dlsym(RTLD_NEXT, "pmem_memmove_nodrain");
+	*(void **)&real_memcpy_nodrain =
+		dlsym(RTLD_NEXT, "pmem_memcpy_nodrain");
+	*(void **)&real_memset_nodrain =
+		dlsym(RTLD_NEXT, "pmem_memset_nodrain");
+#ifdef PMEM_F_MEM_NODRAIN
+	*(void **)&real_memmove = dlsym(RTLD_NEXT, "pmem_memmove");
+	*(void **)&real_memcpy = dlsym(RTLD_NEXT, "pmem_memcpy");
+	*(void **)&real_memset = dlsym(RTLD_NEXT, "pmem_memset");
+#endif
+	*(void **)&real_blk_read = dlsym(RTLD_NEXT, "pmemblk_read");
+	*(void **)&real_blk_bsize = dlsym(RTLD_NEXT, "pmemblk_bsize");
+	*(void **)&real_log_walk = dlsym(RTLD_NEXT, "pmemlog_walk");
+}
+
+__attribute__((destructor))
+static void emu_fini(void)
+{
+	if (env_u64("PMEMEMU_STATS", 0) == 0)
+		return;
+	const struct channel *const c[2] = {&write_, &read_};
+	for (int i = 0; i < 2; ++i)
+		fprintf(stderr, "pmememu: %s %lu ops %lu bytes %lu us\n",
+			c[i]->name, (unsigned long)c[i]->nop,
+			(unsigned long)c[i]->nbyte,
+			(unsigned long)(c[i]->wait_ns / 1000));
+}
+
+/* libpmem */
+void *pmem_map_file(const char *path, size_t len, int flags, mode_t mode,
+	size_t *mapped_lenp, int *is_pmemp)
+{
+	size_t mapped_len = 0;
+	void *const addr = real_map_file(path, len, flags, mode,
+		&mapped_len, NULL);
+	if (!addr)
+		return NULL;
+
+	int i;
+	pthread_mutex_lock(&maps_lock_);
+	for (i = 0; i < MAX_MAPS; ++i) {
+		if (maps_[i].hi == 0) {
+			maps_[i].lo = (uintptr_t)addr;
+			maps_[i].hi = (uintptr_t)addr + mapped_len;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&maps_lock_);
+	if (i == MAX_MAPS) {
+		/* it would not be charged for */
+		fprintf(stderr, "pmememu: cannot map %s: more than %d mappings\n",
+			path, MAX_MAPS);
+		real_unmap(addr, mapped_len);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (mapped_lenp)
+		*mapped_lenp = mapped_len;
+	if (is_pmemp)
+		*is_pmemp = 1;
+	return addr;
+}
+
+int pmem_unmap(void *addr, size_t len)
+{
+	pthread_mutex_lock(&maps_lock_);
+	for (int i = 0; i < MAX_MAPS; ++i)
+		if (maps_[i].lo == (uintptr_t)addr)
+			maps_[i].lo = maps_[i].hi = 0;
+	pthread_mutex_unlock(&maps_lock_);
+	return real_unmap(addr, len);
+}
+
+int pmem_is_pmem(const void *addr, size_t len)
+{
+	return in_maps(addr) || real_is_pmem(addr, len);
+}
+
+void pmem_flush(const void *addr, size_t len)
+{
+	real_flush(addr, len);
+	pending_ += line_bytes(addr, len);
+}
+
+void pmem_drain(void)
+{
+	real_drain();
+	emu_drain();
+}
+
+void pmem_persist(const void *addr, size_t len)
+{
+	real_persist(addr, len);
+	pending_ += line_bytes(addr, len);
+	emu_drain();
+}
+
+void *pmem_memmove_nodrain(void *dst, const void *src, size_t len)
+{
+	charge_read(src, len);
+	real_memmove_nodrain(dst, src, len);
+	pending_ += line_bytes(dst, len);
+	return dst;
+}
+
+void *pmem_memcpy_nodrain(void *dst, const void *src, size_t len)
+{
+	charge_read(src, len);
+	real_memcpy_nodrain(dst, src, len);
+	pending_ += line_bytes(dst, len);
+	return dst;
+}
+
+void *pmem_memset_nodrain(void *dst, int c, size_t len)
+{
+	real_memset_nodrain(dst, c, len);
+	pending_ += line_bytes(dst, len);
+	return dst;
+}
+
+void *pmem_memmove_persist(void *dst, const void *src, size_t len)
+{
+	pmem_memmove_nodrain(dst, src, len);
+	pmem_drain();
+	return dst;
+}
+
+void *pmem_memcpy_persist(void *dst, const void *src, size_t len)
+{
+	pmem_memcpy_nodrain(dst, src, len);
+	pmem_drain();
+	return dst;
+}
+
+void *pmem_memset_persist(void *dst, int c, size_t len)
+{
+	pmem_memset_nodrain(dst, c, len);
+	pmem_drain();
+	return dst;
+}
+
+#ifdef PMEM_F_MEM_NODRAIN
+/* PMEM_F_MEM_NOFLUSH leaves the data in the cache; it costs nothing */
+static void account_flags(void *dst, size_t len, unsigned flags)
+{
+	if (flags & PMEM_F_MEM_NOFLUSH)
+		return;
+	pending_ += line_bytes(dst, len);
+	if (!(flags & PMEM_F_MEM_NODRAIN))
+		emu_drain();
+}
+
+void *pmem_memmove(void *dst, const void *src, size_t len, unsigned flags)
+{
+	charge_read(src, len);
+	real_memmove(dst, src, len, flags);
+	account_flags(dst, len, flags);
+	return dst;
+}
+
+void *pmem_memcpy(void *dst, const void *src, size_t len, unsigned flags)
+{
+	charge_read(src, len);
+	real_memcpy(dst, src, len, flags);
+	account_flags(dst, len, flags);
+	return dst;
+}
+
+void *pmem_memset(void *dst, int c, size_t len, unsigned flags)
+{
+	real_memset(dst, c, len, flags);
+	account_flags(dst, len, flags);
+	return dst;
+}
+#endif
+
+/* libpmemblk and libpmemlog read with plain loads */
+int pmemblk_read(PMEMblkpool *pbp, void *buf, long long blockno)
+{
+	const int ret = real_blk_read(pbp, buf, blockno);
+	if (ret == 0)
+		charge(&read_, real_blk_bsize(pbp));
+	return ret;
+}
+
+struct walk_arg {
+	int (*process_chunk)(const void *buf, size_t len, void *arg);
+	void *arg;
+};
+
+static int charged_chunk(const void *buf, size_t len, void *arg)
+{
+	const struct walk_arg *const w = arg;
+	charge(&read_, line_bytes(buf, len));
+	return w->process_chunk(buf, len, w->arg);
+}
+
+void pmemlog_walk(PMEMlogpool *plp, size_t chunksize,
+	int (*process_chunk)(const void *buf, size_t len, void *arg),
+	void *arg)
+{
+	struct walk_arg w = {process_chunk, arg};
+	real_log_walk(plp, chunksize, charged_chunk, &w);
+}
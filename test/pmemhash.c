@@ -0,0 +1,309 @@
+#include "config.h" /* should be included first */
+
+#include <errno.h>
+#include <libpmem.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h> /* SSE2 */
+#endif
+
+#include "pmemhash.h"
+#include "pmemplus.h"
+
+#define HASH_MAGIC    "PMEMHSH"
+#define HASH_HDR_SIZE ((size_t)4096)
+#define NSLOT         4
+
+/*
+ * A slot word is 0 if empty, TOMBSTONE if removed, or otherwise a
+ * 16-bit tag, whose top bit is always set, followed by the blockno.
+ */
+#define TOMBSTONE     ((uint64_t)1)
+#define BLOCKNO_MASK  ((uint64_t)PMEMHASH_MAX_BLOCKNO)
+#define TAG_SHIFT     48
+
+/* on-media layout */
+struct hash_hdr {
+	char magic[8];
+	uint64_t poolsize;
+	uint64_t nbucket; /* power of two */
+};
+
+struct bucket {
+	uint64_t meta[NSLOT];
+	uint64_t key[NSLOT];
+} __attribute__((aligned(64)));
+
+struct pmemhash {
+	char *base;
+	size_t mapped_len;
+	int is_pmem;
+	struct bucket *bucket;
+	uint64_t mask; /* nbucket - 1 */
+	pthread_mutex_t lock; /* serializes modifications */
+};
+
+/* util functions */
+static uint64_t hash64(uint64_t x)
+{
+	/* splitmix64 finalizer */
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	x ^= x >> 31;
+	return x;
+}
+
+static uint16_t tag_of(uint64_t h)
+{
+	return (uint16_t)((h >> TAG_SHIFT) | 0x8000);
+}
+
+static void persist(PMEMhashpool *php, const void *addr, size_t len)
+{
+	if (php->is_pmem)
+		pmem_persist(addr, len);
+	else
+		pmem_msync(addr, len);
+}
+
+/* returns a bitmask of the slots whose tag equals to tag */
+static unsigned bucket_match(const struct bucket *b, uint16_t tag)
+{
+#ifdef __SSE2__
+	const __m128i t = _mm_set1_epi16((short)tag);
+	const __m128i lo = _mm_load_si128((const __m128i *)&b->meta[0]);
+	const __m128i hi = _mm_load_si128((const __m128i *)&b->meta[2]);
+	const unsigned mlo = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(lo, t));
+	const unsigned mhi = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(hi, t));
+	/* the tag of each 8-byte slot is in its bytes 6 and 7 */
+	return ((mlo >> 6) & 1) | ((mlo >> 13) & 2)
+		| (((mhi >> 6) & 1) << 2) | (((mhi >> 14) & 1) << 3);
+#else
+	unsigned m = 0;
+	for (int i = 0; i < NSLOT; ++i) {
+		const uint64_t meta = __atomic_load_n(&b->meta[i], __ATOMIC_RELAXED);
+		if ((uint16_t)(meta >> TAG_SHIFT) == tag)
+			m |= 1U << i;
+	}
+	return m;
+#endif
+}
+
+/*
+ * Finds the slot holding key. The caller either holds php->lock or
+ * re-validates the slot word it reads after the key.
+ */
+static uint64_t *find(PMEMhashpool *php, uint64_t key, uint64_t *metap)
+{
+	const uint64_t h = hash64(key);
+	const uint16_t tag = tag_of(h);
+
+	for (uint64_t i = 0; i <= php->mask; ++i) {
+		struct bucket *const b = &php->bucket[(h + i) & php->mask];
+		unsigned m = bucket_match(b, tag);
+		while (m) {
+			const int s = __builtin_ctz(m);
+			m &= m - 1;
+			const uint64_t meta =
+				__atomic_load_n(&b->meta[s], __ATOMIC_ACQUIRE);
+			if ((uint16_t)(meta >> TAG_SHIFT) != tag)
+				continue;
+			const uint64_t k =
+				__atomic_load_n(&b->key[s], __ATOMIC_ACQUIRE);
+			/* the slot may have been reused in the meantime */
+			if (k == key && meta == __atomic_load_n(&b->meta[s],
+					__ATOMIC_ACQUIRE)) {
+				*metap = meta;
+				return &b->meta[s];
+			}
+		}
+		/* an empty slot terminates the probe sequence */
+		for (int s = 0; s < NSLOT; ++s)
+			if (__atomic_load_n(&b->meta[s], __ATOMIC_ACQUIRE) == 0)
+				return NULL;
+	}
+	return NULL;
+}
+
+/* pool management */
+static PMEMhashpool *hash_init(char *base, size_t mapped_len, int is_pmem)
+{
+	PMEMhashpool *const php = calloc(1, sizeof(*php));
+	if (!php)
+		return NULL;
+	const struct hash_hdr *const hdr = (struct hash_hdr *)base;
+	php->base = base;
+	php->mapped_len = mapped_len;
+	php->is_pmem = is_pmem;
+	php->bucket = (struct bucket *)(base + HASH_HDR_SIZE);
+	php->mask = hdr->nbucket - 1;
+	pthread_mutex_init(&php->lock, NULL);
+	return php;
+}
+
+PMEMhashpool *pmemhash_create(const char *path, size_t poolsize, mode_t mode)
+{
+	if (poolsize < PMEMHASH_MIN_POOL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	char *const base = pmem_map_file(path, poolsize,
+		PMEM_FILE_CREATE|PMEM_FILE_EXCL, mode, &mapped_len, &is_pmem);
+	if (!base)
+		return NULL;
+
+	/* a new file reads as zeroes; i.e. every slot is empty */
+	uint64_t nbucket = 1;
+	while (HASH_HDR_SIZE + nbucket * 2 * sizeof(struct bucket) <= mapped_len)
+		nbucket *= 2;
+
+	struct hash_hdr *const hdr = (struct hash_hdr *)base;
+	hdr->poolsize = mapped_len;
+	hdr->nbucket = nbucket;
+	pmem_msync(hdr, sizeof(*hdr));
+
+	magic_persist(hdr->magic, HASH_MAGIC);
+
+	PMEMhashpool *const php = hash_init(base, mapped_len, is_pmem);
+	if (!php) {
+		pmem_unmap(base, mapped_len);
+		unlink(path);
+		errno = ENOMEM;
+	}
+	return php;
+}
+
+PMEMhashpool *pmemhash_open(const char *path)
+{
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	char *const base = pmem_map_file(path, 0, 0, 0,
+		&mapped_len, &is_pmem);
+	if (!base)
+		return NULL;
+
+	const struct hash_hdr *const hdr = (struct hash_hdr *)base;
+	if (mapped_len < PMEMHASH_MIN_POOL
+			|| memcmp(hdr->magic, HASH_MAGIC, sizeof(hdr->magic)) != 0
+			|| hdr->poolsize != mapped_len
+			|| hdr->nbucket == 0
+			|| (hdr->nbucket & (hdr->nbucket - 1)) != 0
+			|| HASH_HDR_SIZE + hdr->nbucket * sizeof(struct bucket)
+				> mapped_len) {
+		pmem_unmap(base, mapped_len);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	PMEMhashpool *const php = hash_init(base, mapped_len, is_pmem);
+	if (!php) {
+		pmem_unmap(base, mapped_len);
+		errno = ENOMEM;
+	}
+	return php;
+}
+
+void pmemhash_close(PMEMhashpool *php)
+{
+	pthread_mutex_destroy(&php->lock);
+	pmem_unmap(php->base, php->mapped_len);
+	free(php);
+}
+
+size_t pmemhash_nslot(PMEMhashpool *php)
+{
+	return (size_t)(php->mask + 1) * NSLOT;
+}
+
+size_t pmemhash_count(PMEMhashpool *php)
+{
+	size_t n = 0;
+	for (uint64_t i = 0; i <= php->mask; ++i)
+		for (int s = 0; s < NSLOT; ++s)
+			n += (__atomic_load_n(&php->bucket[i].meta[s],
+				__ATOMIC_ACQUIRE) >> 63) != 0;
+	return n;
+}
+
+/* operations */
+int pmemhash_insert(PMEMhashpool *php, uint64_t key, long long blockno)
+{
+	if (blockno < 0 || blockno > PMEMHASH_MAX_BLOCKNO) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	const uint64_t h = hash64(key);
+	const uint64_t meta = ((uint64_t)tag_of(h) << TAG_SHIFT)
+		| (uint64_t)blockno;
+
+	pthread_mutex_lock(&php->lock);
+
+	/* update in place; a single 8-byte store */
+	uint64_t old = 0;
+	uint64_t *const slot = find(php, key, &old);
+	if (slot) {
+		__atomic_store_n(slot, meta, __ATOMIC_RELEASE);
+		persist(php, slot, sizeof(*slot));
+		pthread_mutex_unlock(&php->lock);
+		return 0;
+	}
+
+	/* the first empty or removed slot along the probe sequence */
+	for (uint64_t i = 0; i <= php->mask; ++i) {
+		struct bucket *const b = &php->bucket[(h + i) & php->mask];
+		for (int s = 0; s < NSLOT; ++s) {
+			if (b->meta[s] > TOMBSTONE)
+				continue;
+			/* the key must be persistent before the slot is live */
+			__atomic_store_n(&b->key[s], key, __ATOMIC_RELEASE);
+			persist(php, &b->key[s], sizeof(b->key[s]));
+			__atomic_store_n(&b->meta[s], meta, __ATOMIC_RELEASE);
+			persist(php, &b->meta[s], sizeof(b->meta[s]));
+			pthread_mutex_unlock(&php->lock);
+			return 0;
+		}
+	}
+
+	pthread_mutex_unlock(&php->lock);
+	errno = ENOSPC;
+	return -1;
+}
+
+int pmemhash_lookup(PMEMhashpool *php, uint64_t key, long long *blockno)
+{
+	uint64_t meta = 0;
+	if (!find(php, key, &meta)) {
+		errno = ENOENT;
+		return -1;
+	}
+	*blockno = (long long)(meta & BLOCKNO_MASK);
+	return 0;
+}
+
+int pmemhash_remove(PMEMhashpool *php, uint64_t key)
+{
+	pthread_mutex_lock(&php->lock);
+	uint64_t meta = 0;
+	uint64_t *const slot = find(php, key, &meta);
+	if (slot) {
+		__atomic_store_n(slot, TOMBSTONE, __ATOMIC_RELEASE);
+		persist(php, slot, sizeof(*slot));
+	}
+	pthread_mutex_unlock(&php->lock);
+
+	if (!slot) {
+		errno = ENOENT;
+		return -1;
+	}
+	return 0;
+}
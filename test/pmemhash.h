@@ -0,0 +1,34 @@
+#ifndef PMEMHASH_H
+#define PMEMHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * pmemhash: a persistent hash index from 64-bit keys to pmemblk block
+ * numbers, stored in a pmem_map_file() region.
+ *
+ * Buckets are single cache lines of four slots and are probed linearly.
+ * A slot is published or retired by one 8-byte atomic store of its
+ * tag|blockno word, so pmemhash_open() needs neither a log nor a scan.
+ * Lookups are lock-free; modifications are serialized internally.
+ */
+
+#define PMEMHASH_MIN_POOL    ((size_t)(1 << 18))
+#define PMEMHASH_MAX_BLOCKNO ((1LL << 48) - 1)
+
+typedef struct pmemhash PMEMhashpool;
+
+PMEMhashpool *pmemhash_create(const char *path, size_t poolsize, mode_t mode);
+PMEMhashpool *pmemhash_open(const char *path);
+void pmemhash_close(PMEMhashpool *php);
+
+size_t pmemhash_nslot(PMEMhashpool *php);
+size_t pmemhash_count(PMEMhashpool *php);
+
+int pmemhash_insert(PMEMhashpool *php, uint64_t key, long long blockno);
+int pmemhash_lookup(PMEMhashpool *php, uint64_t key, long long *blockno);
+int pmemhash_remove(PMEMhashpool *php, uint64_t key);
+
+#endif /* PMEMHASH_H */
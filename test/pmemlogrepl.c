@@ -0,0 +1,352 @@
+#include "config.h" /* should be included first */
+
+#include <errno.h>
+#include <libpmemlog.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pmemlogrepl.h"
+#include "pmemplus.h"
+
+#define RING      PMEMLOGREPL_RING
+#define MAX_PIECE (RING / 4)
+#define MAX_IOV   256 /* records per append to the mirror */
+#define SKIP      UINT32_MAX /* the rest of the ring is unused */
+#define KICK      (RING / 2) /* the replicator is woken this full */
+
+/* in the ring, before the bytes of a piece of a record */
+struct rec {
+	uint32_t len;
+	uint32_t last; /* the piece ends its record */
+	uint64_t ns;   /* when it was appended to the primary */
+};
+
+struct pmemlogrepl {
+	PMEMlogpool *primary;
+	PMEMlogpool *mirror;
+	char *ring;
+	pthread_mutex_t lock; /* serializes appenders */
+	pthread_t thread;
+	int closing;
+	int error; /* of the mirror; 0 while replicating */
+	long long acked;
+	struct pmemlogrepl_stats st;
+
+	/* bytes put in the ring, and taken out of it; they only go up */
+	uint64_t head __attribute__((aligned(64)));
+	uint64_t tail __attribute__((aligned(64)));
+
+	/* bumped to wake the replicator, and whenever tail moves */
+	uint32_t hseq __attribute__((aligned(64)));
+	uint32_t sleeping;
+	uint32_t tseq __attribute__((aligned(64)));
+	uint32_t nwaiter;
+};
+
+/* what a walk of the primary appends to the mirror */
+struct catchup {
+	PMEMlogpool *mirror;
+	size_t from;
+	int ret;
+	int error;
+};
+
+/* util functions */
+static size_t rec_size(size_t len)
+{
+	return sizeof(struct rec) + ((len + 15) & ~(size_t)15);
+}
+
+/*
+ * A waiter counts itself before it reads the sequence and checks its
+ * condition again, and a waker bumps the sequence before it reads the
+ * count, so either the check sees the move or the waker sees the
+ * waiter, as in pmemdax.c.
+ */
+static void wake(uint32_t *seq, uint32_t *nwaiter)
+{
+	__atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(nwaiter, __ATOMIC_SEQ_CST))
+		futex(seq, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+static uint32_t waiter_enter(uint32_t *seq, uint32_t *nwaiter)
+{
+	__atomic_add_fetch(nwaiter, 1, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(seq, __ATOMIC_SEQ_CST);
+}
+
+static void waiter_leave(uint32_t *nwaiter)
+{
+	__atomic_sub_fetch(nwaiter, 1, __ATOMIC_SEQ_CST);
+}
+
+static uint64_t load(const uint64_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+/* has the replicator look at the ring now, rather than at its poll */
+static void kick(PMEMlogrepl *prl)
+{
+	wake(&prl->hseq, &prl->sleeping);
+}
+
+/* waits until the replicator has taken everything up to target */
+static void wait_tail(PMEMlogrepl *prl, uint64_t target)
+{
+	if (load(&prl->tail) < target)
+		kick(prl);
+	while (load(&prl->tail) < target) {
+		const uint32_t seq = waiter_enter(&prl->tseq, &prl->nwaiter);
+		if (load(&prl->tail) < target)
+			futex(&prl->tseq, FUTEX_WAIT, seq, NULL);
+		waiter_leave(&prl->nwaiter);
+	}
+}
+
+/* puts a piece of a record in the ring; under the lock */
+static void ring_put(PMEMlogrepl *prl, const void *buf, size_t len,
+		uint64_t ns, int last, int *stalled)
+{
+	uint64_t head = prl->head;
+	const size_t pos = head % RING;
+	const size_t size = rec_size(len);
+	/* a piece does not wrap around; the end is skipped instead */
+	const size_t skip = RING - pos < size ? RING - pos : 0;
+
+	if (RING - (head - load(&prl->tail)) < skip + size) {
+		*stalled = 1;
+		wait_tail(prl, head + skip + size - RING);
+	}
+	if (skip) {
+		((struct rec *)(prl->ring + pos))->len = SKIP;
+		head += skip;
+	}
+	struct rec *const r = (struct rec *)(prl->ring + head % RING);
+	r->len = (uint32_t)len;
+	r->last = (uint32_t)last;
+	r->ns = ns;
+	memcpy(r + 1, buf, len);
+	__atomic_store_n(&prl->head, head + size, __ATOMIC_RELEASE);
+	/* not on every append, not to make a syscall of each */
+	if (head + size - load(&prl->tail) >= KICK)
+		kick(prl);
+}
+
+static void *replicator(void *arg)
+{
+	PMEMlogrepl *const prl = arg;
+	uint64_t tail = prl->tail;
+	for (;;) {
+		const uint64_t head = load(&prl->head);
+		if (head == tail) {
+			if (__atomic_load_n(&prl->closing, __ATOMIC_ACQUIRE))
+				break;
+			static const struct timespec poll = {
+				0, PMEMLOGREPL_POLL_NS};
+			const uint32_t seq = waiter_enter(&prl->hseq,
+				&prl->sleeping);
+			if (load(&prl->head) == tail
+					&& !__atomic_load_n(&prl->closing,
+						__ATOMIC_ACQUIRE))
+				futex(&prl->hseq, FUTEX_WAIT, seq, &poll);
+			waiter_leave(&prl->sleeping);
+			continue;
+		}
+
+		/* what is in the ring, up to MAX_IOV records, as one append */
+		struct iovec iov[MAX_IOV];
+		const struct rec *recs[MAX_IOV];
+		int n = 0;
+		size_t bytes = 0;
+		while (tail != head && n < MAX_IOV) {
+			const size_t pos = tail % RING;
+			const struct rec *const r =
+				(const struct rec *)(prl->ring + pos);
+			if (r->len == SKIP) {
+				tail += RING - pos;
+				continue;
+			}
+			iov[n].iov_base = (void *)(r + 1);
+			iov[n].iov_len = r->len;
+			recs[n++] = r;
+			bytes += r->len;
+			tail += rec_size(r->len);
+		}
+		if (n > 0 && !__atomic_load_n(&prl->error, __ATOMIC_RELAXED)) {
+			if (pmemlog_appendv(prl->mirror, iov, n) == 0) {
+				__atomic_store_n(&prl->acked,
+					pmemlog_tell(prl->mirror),
+					__ATOMIC_RELAXED);
+				__atomic_add_fetch(&prl->st.bytes, bytes,
+					__ATOMIC_RELAXED);
+				__atomic_add_fetch(&prl->st.nbatch, 1,
+					__ATOMIC_RELAXED);
+			} else {
+				__atomic_store_n(&prl->error, errno ? errno : EIO,
+					__ATOMIC_RELAXED);
+			}
+		}
+
+		const uint64_t now = now_ns();
+		uint64_t sum = 0, max = prl->st.lag_ns_max;
+		for (int i = 0; i < n; ++i) {
+			if (!recs[i]->last)
+				continue;
+			const uint64_t lag = now - recs[i]->ns;
+			sum += lag;
+			if (lag > max)
+				max = lag;
+		}
+		__atomic_add_fetch(&prl->st.lag_ns_sum, sum, __ATOMIC_RELAXED);
+		__atomic_store_n(&prl->st.lag_ns_max, max, __ATOMIC_RELAXED);
+
+		/* the records are not read past here */
+		__atomic_store_n(&prl->tail, tail, __ATOMIC_RELEASE);
+		wake(&prl->tseq, &prl->nwaiter);
+	}
+	return NULL;
+}
+
+/* callback function passed to pmemlog_walk() */
+static int catchup_chunk(const void *buf, size_t len, void *arg)
+{
+	struct catchup *const c = arg;
+	if (len > c->from) {
+		c->ret = pmemlog_append(c->mirror, (const char *)buf + c->from,
+			len - c->from);
+		c->error = errno;
+	}
+	return 0;
+}
+
+/* pool management */
+PMEMlogrepl *pmemlogrepl_open(PMEMlogpool *primary, PMEMlogpool *mirror)
+{
+	const long long p = pmemlog_tell(primary);
+	const long long m = pmemlog_tell(mirror);
+	if (m > p) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (m < p) {
+		/* what was in the ring, or everything, for a new mirror */
+		struct catchup c = {mirror, (size_t)m, 0, 0};
+		pmemlog_walk(primary, 0, catchup_chunk, &c);
+		if (c.ret != 0) {
+			errno = c.error;
+			return NULL;
+		}
+	}
+
+	PMEMlogrepl *prl = NULL;
+	if (posix_memalign((void **)&prl, 64, sizeof(*prl)) != 0) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(prl, 0, sizeof(*prl));
+	if (posix_memalign((void **)&prl->ring, 64, RING) != 0) {
+		free(prl);
+		errno = ENOMEM;
+		return NULL;
+	}
+	prl->primary = primary;
+	prl->mirror = mirror;
+	prl->acked = pmemlog_tell(mirror);
+	pthread_mutex_init(&prl->lock, NULL);
+
+	const int r = pthread_create(&prl->thread, NULL, replicator, prl);
+	if (r != 0) {
+		pthread_mutex_destroy(&prl->lock);
+		free(prl->ring);
+		free(prl);
+		errno = r;
+		return NULL;
+	}
+	return prl;
+}
+
+void pmemlogrepl_close(PMEMlogrepl *prl)
+{
+	__atomic_store_n(&prl->closing, 1, __ATOMIC_RELEASE);
+	kick(prl);
+	pthread_join(prl->thread, NULL);
+	pthread_mutex_destroy(&prl->lock);
+	free(prl->ring);
+	free(prl);
+}
+
+/* appending */
+int pmemlogrepl_append(PMEMlogrepl *prl, const void *buf, size_t count)
+{
+	pthread_mutex_lock(&prl->lock);
+	if (pmemlog_append(prl->primary, buf, count) != 0) {
+		const int e = errno;
+		pthread_mutex_unlock(&prl->lock);
+		errno = e;
+		return -1;
+	}
+
+	const uint64_t ns = now_ns();
+	const char *p = buf;
+	int stalled = 0;
+	do {
+		const size_t n = count < MAX_PIECE ? count : MAX_PIECE;
+		ring_put(prl, p, n, ns, n == count, &stalled);
+		p += n;
+		count -= n;
+	} while (count > 0);
+	__atomic_add_fetch(&prl->st.nrec, 1, __ATOMIC_RELAXED);
+	if (stalled)
+		__atomic_add_fetch(&prl->st.nstall, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&prl->lock);
+	return 0;
+}
+
+void pmemlogrepl_rewind(PMEMlogrepl *prl)
+{
+	pthread_mutex_lock(&prl->lock);
+	wait_tail(prl, prl->head);
+	/* a crash in between leaves the mirror behind, not ahead */
+	pmemlog_rewind(prl->mirror);
+	pmemlog_rewind(prl->primary);
+	__atomic_store_n(&prl->acked, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&prl->error, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&prl->lock);
+}
+
+/* replication */
+long long pmemlogrepl_acked(PMEMlogrepl *prl)
+{
+	return __atomic_load_n(&prl->acked, __ATOMIC_RELAXED);
+}
+
+int pmemlogrepl_sync(PMEMlogrepl *prl)
+{
+	wait_tail(prl, load(&prl->head));
+	const int e = __atomic_load_n(&prl->error, __ATOMIC_RELAXED);
+	if (e) {
+		errno = e;
+		return -1;
+	}
+	return 0;
+}
+
+void pmemlogrepl_stats(PMEMlogrepl *prl, struct pmemlogrepl_stats *st)
+{
+	const struct pmemlogrepl_stats *const s = &prl->st;
+	st->bytes = __atomic_load_n(&s->bytes, __ATOMIC_RELAXED);
+	st->nrec = __atomic_load_n(&s->nrec, __ATOMIC_RELAXED);
+	st->nbatch = __atomic_load_n(&s->nbatch, __ATOMIC_RELAXED);
+	st->nstall = __atomic_load_n(&s->nstall, __ATOMIC_RELAXED);
+	st->lag_ns_sum = __atomic_load_n(&s->lag_ns_sum, __ATOMIC_RELAXED);
+	st->lag_ns_max = __atomic_load_n(&s->lag_ns_max, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,70 @@
+#ifndef PMEMLOGREPL_H
+#define PMEMLOGREPL_H
+
+#include <libpmemlog.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * pmemlogrepl: asynchronous replication of a pmemlog pool to a mirror.
+ *
+ * pmemlogrepl_append() appends to the primary pool as pmemlog_append()
+ * does, and then copies the record into a ring in DRAM; it returns
+ * without waiting for the mirror. A replicator thread takes whatever is
+ * in the ring and appends it to the mirror pool with one
+ * pmemlog_appendv(), so the mirror holds the same bytes at the same
+ * offsets, behind the primary by what is in the ring. The replicator
+ * looks at the ring every PMEMLOGREPL_POLL_NS, or as soon as it is half
+ * full, so that appends to the mirror are batched and an append to the
+ * primary seldom has to wake it. Appenders are serialized, as pmemlog
+ * does anyway, so the ring has one producer and one consumer and needs
+ * no locks; an appender that finds it full waits for the replicator.
+ *
+ * The watermark of what the mirror has acknowledged is its own write
+ * offset, which pmemlog keeps durable. pmemlogrepl_open() catches the
+ * mirror up with the primary from there, for what was in the ring at a
+ * crash. The mirror must be empty, or one that was last opened with the
+ * same primary.
+ *
+ * If appending to the mirror fails, e.g. with ENOSPC, replication stops
+ * until the next pmemlogrepl_rewind() or pmemlogrepl_open(), while
+ * appends to the primary go on; pmemlogrepl_sync() reports the error.
+ */
+
+/* of the ring; a record larger than a quarter of it is split */
+#define PMEMLOGREPL_RING ((size_t)(4 << 20))
+#define PMEMLOGREPL_POLL_NS 100000L
+
+struct pmemlogrepl_stats {
+	uint64_t bytes;		/* appended to the mirror */
+	uint64_t nrec;		/* of pmemlogrepl_append() */
+	uint64_t nbatch;	/* of pmemlog_appendv() on the mirror */
+	uint64_t nstall;	/* appends that waited for the ring */
+	uint64_t lag_ns_sum;	/* from append to the mirror, of all nrec */
+	uint64_t lag_ns_max;
+};
+
+typedef struct pmemlogrepl PMEMlogrepl;
+
+/* EINVAL if mirror is ahead of primary */
+PMEMlogrepl *pmemlogrepl_open(PMEMlogpool *primary, PMEMlogpool *mirror);
+/* replicates what is in the ring first; the pools stay open */
+void pmemlogrepl_close(PMEMlogrepl *prl);
+
+int pmemlogrepl_append(PMEMlogrepl *prl, const void *buf, size_t count);
+
+/* rewinds the mirror, then the primary */
+void pmemlogrepl_rewind(PMEMlogrepl *prl);
+
+/* the offset up to which the mirror is durable, as of pmemlog_tell() */
+long long pmemlogrepl_acked(PMEMlogrepl *prl);
+
+/*
+ * Waits until the mirror has everything appended before the call;
+ * -1 with the errno of the mirror if replication has stopped.
+ */
+int pmemlogrepl_sync(PMEMlogrepl *prl);
+
+void pmemlogrepl_stats(PMEMlogrepl *prl, struct pmemlogrepl_stats *st);
+
+#endif /* PMEMLOGREPL_H */
@@ -0,0 +1,396 @@
+#include "config.h" /* should be included first */
+
+#include <errno.h>
+#include <libpmemlog.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "pmemlogz.h"
+
+/*
+ * The codec writes the LZ4 block format: a sequence is a token of the
+ * literal and match lengths, the literals, and a 2-byte offset back into
+ * the output; a length of 15 or more continues in bytes of 255 and a
+ * last byte below it. The last sequence has literals only.
+ */
+#define MINMATCH      4
+#define MAX_OFFSET    65535
+#define LAST_LITERALS 5   /* a match ends this far before the input does */
+#define MFLIMIT       12  /* a match starts this far before it, at least */
+#define HASH_LOG      12
+#define SKIP_TRIGGER  6   /* misses before the search steps over bytes */
+
+/* on-media layout */
+struct frame {
+	uint32_t orig_len;
+	uint32_t comp_len; /* orig_len if stored as it is */
+};
+
+/* a thread's buffer; touched by the thread only, and then by close */
+struct tbuf {
+	PMEMlogz *plz;
+	struct tbuf *prev;
+	struct tbuf *next;
+	size_t len;
+	uint32_t table[1 << HASH_LOG];
+	char in[PMEMLOGZ_FRAME];
+	char out[PMEMLOGZ_FRAME];
+};
+
+struct pmemlogz {
+	PMEMlogpool *plp;
+	unsigned flags;
+	pthread_mutex_t lock; /* guards tbufs */
+	pthread_key_t key;
+	struct tbuf *tbufs;
+};
+
+/* codec */
+static uint32_t read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t hash4(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+/* a length of 15 or more continues after the token */
+static uint8_t *put_len(uint8_t *op, size_t len)
+{
+	for (len -= 15; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+/* returns the end of the output, or NULL if it does not fit */
+static uint8_t *put_seq(uint8_t *op, const uint8_t *oend,
+		const uint8_t *lit, size_t nlit, size_t offset, size_t mlen)
+{
+	/* token, literals, lengths, offset */
+	if ((size_t)(oend - op) < 1 + nlit + nlit / 255 + 1
+			+ (mlen ? 2 + (mlen - MINMATCH) / 255 + 1 : 0))
+		return NULL;
+
+	const size_t ml = mlen ? mlen - MINMATCH : 0;
+	*op++ = (uint8_t)(((nlit < 15 ? nlit : 15) << 4)
+		| (ml < 15 ? ml : 15));
+	if (nlit >= 15)
+		op = put_len(op, nlit);
+	memcpy(op, lit, nlit);
+	op += nlit;
+	if (mlen) {
+		*op++ = (uint8_t)offset;
+		*op++ = (uint8_t)(offset >> 8);
+		if (ml >= 15)
+			op = put_len(op, ml);
+	}
+	return op;
+}
+
+/* returns the compressed length, or 0 if it is not below cap */
+static size_t lz_compress(const void *src, size_t n, void *dst, size_t cap,
+		uint32_t *table)
+{
+	const uint8_t *const base = src;
+	const uint8_t *const end = base + n;
+	const uint8_t *const mflimit = n > MFLIMIT ? end - MFLIMIT : base;
+	const uint8_t *const mlimit = n > MFLIMIT ? end - LAST_LITERALS : base;
+	const uint8_t *ip = base, *anchor = base;
+	uint8_t *op = dst;
+	const uint8_t *const oend = op + cap;
+
+	memset(table, 0, sizeof(*table) << HASH_LOG);
+	unsigned misses = 0;
+	while (ip < mflimit) {
+		const uint32_t v = read32(ip);
+		const uint32_t h = hash4(v);
+		const uint8_t *ref = base + table[h];
+		table[h] = (uint32_t)(ip - base);
+		if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != v) {
+			ip += 1 + (misses++ >> SKIP_TRIGGER);
+			continue;
+		}
+		misses = 0;
+
+		while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+			--ip;
+			--ref;
+		}
+		const uint8_t *p = ip + MINMATCH, *q = ref + MINMATCH;
+		while (p < mlimit && *p == *q) {
+			++p;
+			++q;
+		}
+		op = put_seq(op, oend, anchor, (size_t)(ip - anchor),
+			(size_t)(ip - ref), (size_t)(p - ip));
+		if (!op)
+			return 0;
+		ip = anchor = p;
+	}
+	op = put_seq(op, oend, anchor, (size_t)(end - anchor), 0, 0);
+	if (!op || op == oend)
+		return 0;
+	return (size_t)(op - (uint8_t *)dst);
+}
+
+/* a length of 15 continues in the input; returns -1 if it runs out */
+static int get_len(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+	if (*len < 15)
+		return 0;
+	uint8_t b;
+	do {
+		if (*ip == iend)
+			return -1;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return 0;
+}
+
+/* returns the decompressed length, or -1 if src is not a valid block */
+static long lz_decompress(const void *src, size_t n, void *dst, size_t cap)
+{
+	const uint8_t *ip = src;
+	const uint8_t *const iend = ip + n;
+	uint8_t *const obase = dst;
+	uint8_t *op = obase;
+	const uint8_t *const oend = op + cap;
+
+	while (ip < iend) {
+		const uint8_t token = *ip++;
+		size_t nlit = token >> 4;
+		if (get_len(&ip, iend, &nlit) != 0
+				|| nlit > (size_t)(iend - ip)
+				|| nlit > (size_t)(oend - op))
+			return -1;
+		memcpy(op, ip, nlit);
+		op += nlit;
+		ip += nlit;
+		if (ip == iend)
+			break; /* the last sequence */
+
+		if (iend - ip < 2)
+			return -1;
+		const size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+		ip += 2;
+		size_t mlen = token & 15;
+		if (get_len(&ip, iend, &mlen) != 0)
+			return -1;
+		mlen += MINMATCH;
+		if (offset == 0 || offset > (size_t)(op - obase)
+				|| mlen > (size_t)(oend - op))
+			return -1;
+		const uint8_t *ref = op - offset;
+		if (offset >= mlen) {
+			memcpy(op, ref, mlen);
+			op += mlen;
+		} else {
+			/* the match overlaps what it writes */
+			for (size_t i = 0; i < mlen; ++i)
+				*op++ = *ref++;
+		}
+	}
+	return (long)(op - obase);
+}
+
+/* frames */
+static int frame_append(PMEMlogz *plz, struct tbuf *tb)
+{
+	if (tb->len == 0)
+		return 0;
+
+	struct frame f = {(uint32_t)tb->len, (uint32_t)tb->len};
+	const void *data = tb->in;
+	if (!(plz->flags & PMEMLOGZ_RAW)) {
+		const size_t c = lz_compress(tb->in, tb->len, tb->out,
+			tb->len, tb->table);
+		if (c > 0) {
+			f.comp_len = (uint32_t)c;
+			data = tb->out;
+		}
+	}
+	struct iovec iov[2] = {
+		{&f, sizeof(f)},
+		{(void *)data, f.comp_len},
+	};
+	tb->len = 0; /* dropped even if the append fails */
+	return pmemlog_appendv(plz->plp, iov, 2);
+}
+
+/* thread buffers */
+static void tbuf_destroy(void *arg)
+{
+	struct tbuf *const tb = arg;
+	PMEMlogz *const plz = tb->plz;
+	frame_append(plz, tb); /* DO NOT care; no one to tell */
+
+	pthread_mutex_lock(&plz->lock);
+	if (tb->prev)
+		tb->prev->next = tb->next;
+	else
+		plz->tbufs = tb->next;
+	if (tb->next)
+		tb->next->prev = tb->prev;
+	pthread_mutex_unlock(&plz->lock);
+
+	free(tb);
+}
+
+static struct tbuf *tbuf_get(PMEMlogz *plz)
+{
+	struct tbuf *tb = pthread_getspecific(plz->key);
+	if (tb)
+		return tb;
+
+	tb = malloc(sizeof(*tb));
+	if (!tb)
+		return NULL;
+	tb->plz = plz;
+	tb->len = 0;
+
+	pthread_mutex_lock(&plz->lock);
+	tb->prev = NULL;
+	tb->next = plz->tbufs;
+	if (tb->next)
+		tb->next->prev = tb;
+	plz->tbufs = tb;
+	pthread_mutex_unlock(&plz->lock);
+
+	if (pthread_setspecific(plz->key, tb) != 0) {
+		tbuf_destroy(tb);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return tb;
+}
+
+/* log management */
+PMEMlogz *pmemlogz_open(PMEMlogpool *plp, unsigned flags)
+{
+	PMEMlogz *const plz = calloc(1, sizeof(*plz));
+	if (!plz)
+		return NULL;
+	plz->plp = plp;
+	plz->flags = flags;
+	if (pthread_key_create(&plz->key, tbuf_destroy) != 0) {
+		free(plz);
+		errno = EAGAIN;
+		return NULL;
+	}
+	pthread_mutex_init(&plz->lock, NULL);
+	return plz;
+}
+
+void pmemlogz_close(PMEMlogz *plz)
+{
+	/* buffers of threads still alive are appended for them */
+	pthread_key_delete(plz->key);
+	for (struct tbuf *tb = plz->tbufs, *next; tb; tb = next) {
+		next = tb->next;
+		frame_append(plz, tb); /* DO NOT care */
+		free(tb);
+	}
+	pthread_mutex_destroy(&plz->lock);
+	free(plz);
+}
+
+int pmemlogz_append(PMEMlogz *plz, const void *buf, size_t count)
+{
+	struct tbuf *const tb = tbuf_get(plz);
+	if (!tb)
+		return -1;
+
+	/* a record that fits in a frame is not split */
+	if (tb->len + count > PMEMLOGZ_FRAME && count <= PMEMLOGZ_FRAME
+			&& frame_append(plz, tb) != 0)
+		return -1;
+
+	const char *p = buf;
+	while (count > 0) {
+		const size_t n = count < PMEMLOGZ_FRAME - tb->len
+			? count : PMEMLOGZ_FRAME - tb->len;
+		memcpy(tb->in + tb->len, p, n);
+		tb->len += n;
+		p += n;
+		count -= n;
+		if (tb->len == PMEMLOGZ_FRAME && frame_append(plz, tb) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+int pmemlogz_flush(PMEMlogz *plz)
+{
+	struct tbuf *const tb = pthread_getspecific(plz->key);
+	return tb ? frame_append(plz, tb) : 0;
+}
+
+/* walk */
+struct walk_arg {
+	int (*process_chunk)(const void *, size_t, void *);
+	void *arg;
+	char *buf;
+	int err;
+};
+
+/* callback function passed to pmemlog_walk; gets the whole log */
+static int walk_frames(const void *buf, size_t len, void *arg)
+{
+	struct walk_arg *const wa = arg;
+	const char *p = buf;
+	const char *const end = p + len;
+	while (p < end) {
+		struct frame f;
+		if ((size_t)(end - p) < sizeof(f)) {
+			wa->err = EILSEQ;
+			return 0;
+		}
+		memcpy(&f, p, sizeof(f));
+		p += sizeof(f);
+		if (f.orig_len == 0 || f.orig_len > PMEMLOGZ_FRAME
+				|| f.comp_len > f.orig_len
+				|| f.comp_len > (size_t)(end - p)) {
+			wa->err = EILSEQ;
+			return 0;
+		}
+
+		const void *data = p;
+		if (f.comp_len < f.orig_len) {
+			if (lz_decompress(p, f.comp_len, wa->buf, f.orig_len)
+					!= (long)f.orig_len) {
+				wa->err = EILSEQ;
+				return 0;
+			}
+			data = wa->buf;
+		}
+		p += f.comp_len;
+		if (!wa->process_chunk(data, f.orig_len, wa->arg))
+			break;
+	}
+	return 0;
+}
+
+int pmemlogz_walk(PMEMlogpool *plp,
+		int (*process_chunk)(const void *buf, size_t len, void *arg),
+		void *arg)
+{
+	struct walk_arg wa = {process_chunk, arg, malloc(PMEMLOGZ_FRAME), 0};
+	if (!wa.buf)
+		return -1;
+	pmemlog_walk(plp, 0, walk_frames, &wa);
+	free(wa.buf);
+	if (wa.err) {
+		errno = wa.err;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef PMEMLOGZ_H
+#define PMEMLOGZ_H
+
+#include <libpmemlog.h>
+#include <stddef.h>
+
+/*
+ * pmemlogz: compressed appends to a pmemlog pool.
+ *
+ * pmemlogz_append() copies a record into a buffer of the calling
+ * thread. A full buffer is compressed with an LZ4-style codec and
+ * appended to the pool as one frame, an 8-byte header of the original
+ * and compressed lengths followed by the compressed bytes; a frame that
+ * does not compress is stored as it is. pmemlogz_walk() decompresses
+ * the frames and hands them to process_chunk in the order they were
+ * appended, so the records of a thread come back in order, and the
+ * records of a frame are contiguous.
+ *
+ * The records in a buffer are not in the pool until it is appended, by
+ * pmemlogz_flush() from the thread, or by pmemlogz_close() for all of
+ * the threads. If appending a frame fails, e.g. with ENOSPC, its records
+ * are dropped. A pool written through pmemlogz must not be appended to
+ * with pmemlog_append().
+ */
+
+/* the largest frame, before compression */
+#define PMEMLOGZ_FRAME ((size_t)(1 << 16))
+
+/* store the frames without compressing them; for benchmarks */
+#define PMEMLOGZ_RAW (1U << 0)
+
+typedef struct pmemlogz PMEMlogz;
+
+PMEMlogz *pmemlogz_open(PMEMlogpool *plp, unsigned flags);
+void pmemlogz_close(PMEMlogz *plz);
+
+int pmemlogz_append(PMEMlogz *plz, const void *buf, size_t count);
+int pmemlogz_flush(PMEMlogz *plz);
+
+/*
+ * Calls process_chunk with each decompressed frame until it returns 0.
+ * Returns -1 with EILSEQ if a frame is corrupt.
+ */
+int pmemlogz_walk(PMEMlogpool *plp,
+	int (*process_chunk)(const void *buf, size_t len, void *arg),
+	void *arg);
+
+#endif /* PMEMLOGZ_H */
@@ -0,0 +1,217 @@
+#include "config.h" /* should be included first */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libpmem.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "pmemmap.h"
+
+/* older C libraries lack these */
+#ifndef MAP_SHARED_VALIDATE
+#define MAP_SHARED_VALIDATE 0x03
+#endif
+#ifndef MAP_SYNC
+#define MAP_SYNC 0x80000
+#endif
+
+static const char *const MODE_NAME[] = {
+	[PMEMMAP_PMEM]    = "pmem",
+	[PMEMMAP_ALIGNED] = "aligned",
+	[PMEMMAP_THP]     = "thp",
+	[PMEMMAP_HUGETLB] = "hugetlb",
+};
+
+#define NMODE ((int)(sizeof(MODE_NAME) / sizeof(MODE_NAME[0])))
+
+int pmemmap_mode_parse(const char *name)
+{
+	for (int m = 0; m < NMODE; ++m)
+		if (strcmp(name, MODE_NAME[m]) == 0)
+			return m;
+	return -1;
+}
+
+const char *pmemmap_mode_name(int mode)
+{
+	return mode >= 0 && mode < NMODE ? MODE_NAME[mode] : NULL;
+}
+
+/*
+ * Reserves len bytes of address space at a PMEMMAP_HUGE_SIZE boundary;
+ * mmap() alone only aligns to the base page size.
+ */
+static char *reserve_aligned(size_t len)
+{
+	const size_t slop = PMEMMAP_HUGE_SIZE;
+	char *const p = mmap(NULL, len + slop, PROT_NONE,
+		MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	char *const a = (char *)(((uintptr_t)p + slop - 1) & ~(slop - 1));
+	if (a > p)
+		munmap(p, (size_t)(a - p));
+	if (p + slop > a)
+		munmap(a + len, (size_t)(p + slop - a));
+	return a;
+}
+
+static void *map_aligned(const char *path, size_t len, mode_t perm,
+	int *is_pmemp)
+{
+	const int fd = open(path, O_RDWR|O_CREAT|O_EXCL, perm);
+	if (fd == -1)
+		return NULL;
+
+	/* DAX FS maps a 2 MiB page only over an allocated 2 MiB extent */
+	int err = posix_fallocate(fd, 0, (off_t)len);
+	char *a = NULL;
+	if (err == 0) {
+		a = reserve_aligned(len);
+		if (!a)
+			err = errno;
+	}
+	if (err != 0) {
+		close(fd);
+		unlink(path);
+		errno = err;
+		return NULL;
+	}
+
+	/* MAP_SYNC succeeds on DAX FS only; then the mapping is pmem */
+	int is_pmem = 1;
+	void *p = mmap(a, len, PROT_READ|PROT_WRITE,
+		MAP_SHARED_VALIDATE|MAP_SYNC|MAP_FIXED, fd, 0);
+	if (p == MAP_FAILED) {
+		is_pmem = 0;
+		p = mmap(a, len, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_FIXED, fd, 0);
+	}
+	err = errno;
+	close(fd);
+	if (p == MAP_FAILED) {
+		munmap(a, len);
+		unlink(path);
+		errno = err;
+		return NULL;
+	}
+
+	madvise(p, len, MADV_HUGEPAGE); /* DO NOT care */
+	*is_pmemp = is_pmem || pmem_is_pmem(p, len);
+	return p;
+}
+
+static void *map_thp(size_t len)
+{
+	char *const a = reserve_aligned(len);
+	if (!a)
+		return NULL;
+	void *const p = mmap(a, len, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0);
+	if (p == MAP_FAILED) {
+		const int err = errno;
+		munmap(a, len);
+		errno = err;
+		return NULL;
+	}
+	if (madvise(p, len, MADV_HUGEPAGE) != 0) {
+		const int err = errno;
+		munmap(p, len);
+		errno = err;
+		return NULL;
+	}
+	return p;
+}
+
+static void *map_hugetlb(size_t len)
+{
+	void *const p = mmap(NULL, len, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+void *pmemmap_create(const char *path, size_t len, mode_t perm, int mode,
+	size_t *mapped_lenp, int *is_pmemp)
+{
+	if (mode != PMEMMAP_PMEM && len % PMEMMAP_HUGE_SIZE != 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	int is_pmem = 0;
+	size_t mapped_len = len;
+	void *p = NULL;
+	switch (mode) {
+	case PMEMMAP_PMEM:
+		p = pmem_map_file(path, len, PMEM_FILE_CREATE|PMEM_FILE_EXCL,
+			perm, &mapped_len, &is_pmem);
+		break;
+	case PMEMMAP_ALIGNED:
+		p = map_aligned(path, len, perm, &is_pmem);
+		break;
+	case PMEMMAP_THP:
+	case PMEMMAP_HUGETLB:
+		p = mode == PMEMMAP_THP ? map_thp(len) : map_hugetlb(len);
+		if (p)
+			is_pmem = pmem_is_pmem(p, len);
+		break;
+	default:
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!p)
+		return NULL;
+
+	if (mapped_lenp)
+		*mapped_lenp = mapped_len;
+	if (is_pmemp)
+		*is_pmemp = is_pmem;
+	return p;
+}
+
+int pmemmap_unmap(void *addr, size_t len)
+{
+	/* pmem_unmap() is munmap() as well */
+	return munmap(addr, len);
+}
+
+long long pmemmap_huge_bytes(const void *addr, size_t len)
+{
+	static const char *const FIELDS[] = {
+		"AnonHugePages:", "ShmemPmdMapped:", "FilePmdMapped:",
+		"Shared_Hugetlb:", "Private_Hugetlb:",
+	};
+
+	FILE *const fp = fopen("/proc/self/smaps", "r");
+	if (!fp)
+		return -1;
+
+	const uintptr_t lo = (uintptr_t)addr, hi = lo + len;
+	long long kb = 0;
+	int in_range = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), fp)) {
+		unsigned long start, end;
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			in_range = start < hi && lo < end;
+			continue;
+		}
+		if (!in_range)
+			continue;
+		for (size_t i = 0; i < sizeof(FIELDS) / sizeof(FIELDS[0]); ++i) {
+			const size_t n = strlen(FIELDS[i]);
+			if (strncmp(line, FIELDS[i], n) == 0)
+				kb += atoll(line + n);
+		}
+	}
+	fclose(fp);
+
+	const long long bytes = kb * 1024;
+	return bytes < (long long)len ? bytes : (long long)len;
+}
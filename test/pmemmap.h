@@ -0,0 +1,44 @@
+#ifndef PMEMMAP_H
+#define PMEMMAP_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * pmemmap: pmem_map_file() with a choice of page size.
+ *
+ * PMEMMAP_PMEM     pmem_map_file() as is.
+ * PMEMMAP_ALIGNED  a new file, fully allocated and mapped at a 2 MiB
+ *                  boundary, so that DAX FS can map it with 2 MiB pages.
+ *                  MAP_SYNC is used where the file system supports it.
+ * PMEMMAP_THP      anonymous memory at a 2 MiB boundary, advised to be
+ *                  backed by transparent huge pages.
+ * PMEMMAP_HUGETLB  anonymous memory from the hugetlbfs pool; fails with
+ *                  ENOMEM unless vm.nr_hugepages is large enough.
+ *
+ * The last two ignore path, do not persist anything and are for testing
+ * on machines without pmem; is_pmem follows PMEM_IS_PMEM_FORCE for them.
+ */
+
+#define PMEMMAP_HUGE_SIZE ((size_t)(1 << 21))
+
+enum pmemmap_mode {
+	PMEMMAP_PMEM,
+	PMEMMAP_ALIGNED,
+	PMEMMAP_THP,
+	PMEMMAP_HUGETLB,
+};
+
+/* "pmem", "aligned", "thp" or "hugetlb"; -1 if none of them */
+int pmemmap_mode_parse(const char *name);
+const char *pmemmap_mode_name(int mode);
+
+/* creates path as pmem_map_file() with PMEM_FILE_CREATE|PMEM_FILE_EXCL */
+void *pmemmap_create(const char *path, size_t len, mode_t perm, int mode,
+	size_t *mapped_lenp, int *is_pmemp);
+int pmemmap_unmap(void *addr, size_t len);
+
+/* bytes of [addr, addr + len) mapped by huge pages, or -1 on error */
+long long pmemmap_huge_bytes(const void *addr, size_t len);
+
+#endif /* PMEMMAP_H */
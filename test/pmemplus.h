@@ -0,0 +1,115 @@
+#ifndef PMEMPLUS_H
+#define PMEMPLUS_H
+
+#include <errno.h>
+#include <libpmem.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUN_MAX_THREADS 64
+
+/* Fletcher-64 over 32-bit words; a short tail is padded with zeroes */
+static inline void fletcher64_update(uint64_t sum[2], const void *buf,
+	size_t len)
+{
+	const unsigned char *p = buf;
+	uint64_t lo = sum[0], hi = sum[1];
+	for (; len >= 4; len -= 4, p += 4) {
+		uint32_t w;
+		memcpy(&w, p, 4);
+		lo += w;
+		hi += lo;
+	}
+	if (len > 0) {
+		uint32_t w = 0;
+		memcpy(&w, p, len);
+		lo += w;
+		hi += lo;
+	}
+	sum[0] = lo;
+	sum[1] = hi;
+}
+
+/* zeroes sum to 0; the xor keeps a record never written from being valid */
+static inline uint64_t fletcher64_final(const uint64_t sum[2])
+{
+	return (sum[1] << 32 | (sum[0] & 0xFFFFFFFF)) ^ 0x5A5A5A5A5A5A5A5AULL;
+}
+
+/*
+ * Sets the magic of a new header once the rest of it is persistent, so
+ * that a create torn by a crash is not valid.
+ */
+static inline void magic_persist(char magic[8], const char *value)
+{
+	memcpy(magic, value, 8);
+	pmem_msync(magic, 8);
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec;
+}
+
+/* sleeps until t of now_ns() */
+static inline void sleep_until(uint64_t t)
+{
+	const struct timespec ts = {
+		(time_t)(t / 1000000000ULL), (long)(t % 1000000000ULL)};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+			== EINTR)
+		;
+}
+
+static inline long futex(uint32_t *uaddr, int op, uint32_t val,
+	const struct timespec *timeout)
+{
+	return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+/* what a worker of run_workers() returns when it fails */
+static inline void *worker_failed(void)
+{
+	return (void *)(intptr_t)(errno != 0 ? errno : EIO);
+}
+
+/*
+ * Runs fn on each of n arguments, size bytes apart from args, a thread
+ * each; one that cannot be started runs in the caller. fn returns NULL,
+ * or worker_failed(). On failure, errno is that of the first worker
+ * that failed. n is at most RUN_MAX_THREADS.
+ */
+static inline int run_workers(void *(*fn)(void *), void *args, size_t size,
+	int n)
+{
+	pthread_t th[RUN_MAX_THREADS];
+	int started[RUN_MAX_THREADS] = {0};
+	void *res[RUN_MAX_THREADS];
+	for (int t = 0; t < n; ++t) {
+		void *const arg = (char *)args + (size_t)t * size;
+		started[t] = pthread_create(&th[t], NULL, fn, arg) == 0;
+		if (!started[t])
+			res[t] = fn(arg);
+	}
+	int err = 0;
+	for (int t = 0; t < n; ++t) {
+		if (started[t])
+			pthread_join(th[t], &res[t]);
+		if (res[t] && err == 0)
+			err = (int)(intptr_t)res[t];
+	}
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+#endif /* PMEMPLUS_H */
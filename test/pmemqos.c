@@ -0,0 +1,172 @@
+#include "config.h" /* should be included first */
+
+#include <errno.h>
+#include <libpmem.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pmemplus.h"
+#include "pmemqos.h"
+
+struct qos_class {
+	uint64_t rate;		/* bytes/sec; 0 for no limit */
+	uint64_t burst_ns;	/* the burst, in time at rate */
+	uint64_t tat;		/* when the bucket runs dry; ns */
+	uint64_t bytes;
+	uint64_t nwrite;
+	uint64_t ndrain;
+	uint64_t throttled_ns;
+} __attribute__((aligned(64)));
+
+struct pmemqos {
+	struct qos_class cls[PMEMQOS_NCLASS];
+	uint64_t fg_last __attribute__((aligned(64)));
+	uint64_t start_ns;
+};
+
+/* util functions */
+/* takes len bytes of tokens of cls, sleeping for them if need be */
+static void take(PMEMqos *qos, enum pmemqos_class cls, size_t len)
+{
+	struct qos_class *const c = &qos->cls[cls];
+	uint64_t now = now_ns();
+	/* signed, as another thread may have stored an fg_last after now */
+	if (cls == PMEMQOS_FG) {
+		/* not on every write, not to bounce the line */
+		const uint64_t last = __atomic_load_n(&qos->fg_last,
+			__ATOMIC_RELAXED);
+		if ((int64_t)(now - last) > (int64_t)PMEMQOS_IDLE_NS / 16)
+			__atomic_store_n(&qos->fg_last, now, __ATOMIC_RELAXED);
+	} else if ((int64_t)(now - __atomic_load_n(&qos->fg_last,
+			__ATOMIC_RELAXED)) >= (int64_t)PMEMQOS_IDLE_NS) {
+		return; /* the foreground is idle */
+	}
+
+	const uint64_t rate = __atomic_load_n(&c->rate, __ATOMIC_RELAXED);
+	if (rate == 0)
+		return;
+	const uint64_t burst_ns = __atomic_load_n(&c->burst_ns,
+		__ATOMIC_RELAXED);
+	const uint64_t cost = (uint64_t)((double)len * 1e9 / (double)rate);
+
+	uint64_t tat = __atomic_load_n(&c->tat, __ATOMIC_RELAXED);
+	uint64_t start;
+	do {
+		start = tat > now ? tat : now;
+	} while (!__atomic_compare_exchange_n(&c->tat, &tat, start + cost, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	/* up to the burst may be taken ahead */
+	if (start + cost > now + burst_ns) {
+		sleep_until(start + cost - burst_ns);
+		__atomic_add_fetch(&c->throttled_ns, now_ns() - now,
+			__ATOMIC_RELAXED);
+	}
+}
+
+/* pool management */
+PMEMqos *pmemqos_new(void)
+{
+	PMEMqos *qos = NULL;
+	if (posix_memalign((void **)&qos, 64, sizeof(*qos)) != 0) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(qos, 0, sizeof(*qos));
+	qos->start_ns = now_ns();
+	return qos;
+}
+
+void pmemqos_delete(PMEMqos *qos)
+{
+	free(qos);
+}
+
+int pmemqos_set_limit(PMEMqos *qos, enum pmemqos_class cls,
+		uint64_t bytes_per_sec, uint64_t burst)
+{
+	if ((unsigned)cls >= PMEMQOS_NCLASS
+			|| (bytes_per_sec > 0 && burst < PMEMQOS_CHUNK)) {
+		errno = EINVAL;
+		return -1;
+	}
+	struct qos_class *const c = &qos->cls[cls];
+	const uint64_t burst_ns = bytes_per_sec > 0
+		? (uint64_t)((double)burst * 1e9 / (double)bytes_per_sec) : 0;
+	__atomic_store_n(&c->burst_ns, burst_ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->tat, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->rate, bytes_per_sec, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* writes */
+void *pmemqos_memmove_nodrain(PMEMqos *qos, enum pmemqos_class cls,
+		void *pmemdest, const void *src, size_t len)
+{
+	char *const d = pmemdest;
+	const char *const s = src;
+	/* backwards if the ranges overlap that way */
+	const int back = d > s && d < s + len;
+	for (size_t done = 0; done < len; ) {
+		const size_t n = len - done < PMEMQOS_CHUNK
+			? len - done : PMEMQOS_CHUNK;
+		const size_t off = back ? len - done - n : done;
+		take(qos, cls, n);
+		pmem_memmove_nodrain(d + off, s + off, n);
+		done += n;
+	}
+	struct qos_class *const c = &qos->cls[cls];
+	__atomic_add_fetch(&c->bytes, len, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&c->nwrite, 1, __ATOMIC_RELAXED);
+	return pmemdest;
+}
+
+void *pmemqos_memset_nodrain(PMEMqos *qos, enum pmemqos_class cls,
+		void *pmemdest, int c, size_t len)
+{
+	char *const d = pmemdest;
+	for (size_t done = 0; done < len; ) {
+		const size_t n = len - done < PMEMQOS_CHUNK
+			? len - done : PMEMQOS_CHUNK;
+		take(qos, cls, n);
+		pmem_memset_nodrain(d + done, c, n);
+		done += n;
+	}
+	struct qos_class *const qc = &qos->cls[cls];
+	__atomic_add_fetch(&qc->bytes, len, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&qc->nwrite, 1, __ATOMIC_RELAXED);
+	return pmemdest;
+}
+
+void pmemqos_drain(PMEMqos *qos, enum pmemqos_class cls)
+{
+	pmem_drain();
+	__atomic_add_fetch(&qos->cls[cls].ndrain, 1, __ATOMIC_RELAXED);
+}
+
+/* statistics */
+void pmemqos_stats(PMEMqos *qos, enum pmemqos_class cls,
+		struct pmemqos_stats *st)
+{
+	const struct qos_class *const c = &qos->cls[cls];
+	st->bytes = __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+	st->nwrite = __atomic_load_n(&c->nwrite, __ATOMIC_RELAXED);
+	st->ndrain = __atomic_load_n(&c->ndrain, __ATOMIC_RELAXED);
+	st->throttled_ns = __atomic_load_n(&c->throttled_ns,
+		__ATOMIC_RELAXED);
+	st->elapsed_ns = now_ns() - __atomic_load_n(&qos->start_ns,
+		__ATOMIC_RELAXED);
+}
+
+void pmemqos_reset_stats(PMEMqos *qos)
+{
+	for (int i = 0; i < PMEMQOS_NCLASS; ++i) {
+		struct qos_class *const c = &qos->cls[i];
+		__atomic_store_n(&c->bytes, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&c->nwrite, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&c->ndrain, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&c->throttled_ns, 0, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&qos->start_ns, now_ns(), __ATOMIC_RELAXED);
+}
@@ -0,0 +1,68 @@
+#ifndef PMEMQOS_H
+#define PMEMQOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * pmemqos: sharing the write bandwidth of pmem between a foreground
+ * class, whose latency matters, and a background class, whose
+ * throughput does, such as zeroing, truncation or snapshots.
+ *
+ * Writers go through pmemqos_memmove_nodrain(), pmemqos_memset_nodrain()
+ * and pmemqos_drain() instead of the libpmem calls, naming their class.
+ * Each class has a token bucket, kept as the time at which it runs dry
+ * (GCRA), so taking tokens is a compare-and-swap. A write of more than
+ * PMEMQOS_CHUNK bytes takes them a chunk at a time, so that a large
+ * background copy leaves room between its chunks. A writer that is out
+ * of tokens sleeps until it has them.
+ *
+ * The limit of the background class applies only while the foreground
+ * has written within the last PMEMQOS_IDLE_NS; otherwise background
+ * writes run at full speed. A limit of 0 is no limit, which is where
+ * both classes start.
+ *
+ * Thread-safe; all writes to pmem, as those of libpmem.
+ */
+
+#define PMEMQOS_CHUNK   ((size_t)(64 << 10))
+#define PMEMQOS_IDLE_NS 1000000ULL
+
+enum pmemqos_class {
+	PMEMQOS_FG,
+	PMEMQOS_BG,
+	PMEMQOS_NCLASS
+};
+
+struct pmemqos_stats {
+	uint64_t bytes;		/* written */
+	uint64_t nwrite;	/* calls */
+	uint64_t ndrain;
+	uint64_t throttled_ns;	/* slept for tokens */
+	uint64_t elapsed_ns;	/* since pmemqos_new() or the last reset */
+};
+
+typedef struct pmemqos PMEMqos;
+
+PMEMqos *pmemqos_new(void);
+void pmemqos_delete(PMEMqos *qos);
+
+/*
+ * Allows cls bytes_per_sec on average, and burst bytes at once after
+ * it has been idle; EINVAL if burst is less than PMEMQOS_CHUNK.
+ */
+int pmemqos_set_limit(PMEMqos *qos, enum pmemqos_class cls,
+	uint64_t bytes_per_sec, uint64_t burst);
+
+void *pmemqos_memmove_nodrain(PMEMqos *qos, enum pmemqos_class cls,
+	void *pmemdest, const void *src, size_t len);
+void *pmemqos_memset_nodrain(PMEMqos *qos, enum pmemqos_class cls,
+	void *pmemdest, int c, size_t len);
+void pmemqos_drain(PMEMqos *qos, enum pmemqos_class cls);
+
+/* what cls has done; bytes * 1e9 / elapsed_ns is its bandwidth */
+void pmemqos_stats(PMEMqos *qos, enum pmemqos_class cls,
+	struct pmemqos_stats *st);
+void pmemqos_reset_stats(PMEMqos *qos);
+
+#endif /* PMEMQOS_H */
@@ -0,0 +1,365 @@
+#include "config.h" /* should be included first */
+
+#include <errno.h>
+#include <libpmem.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pmemplus.h"
+#include "pmemqueue.h"
+
+#define QUEUE_MAGIC    "PMEMQUE"
+#define QUEUE_HDR_SIZE ((size_t)4096)
+
+/* on-media layout */
+struct queue_hdr {
+	char magic[8];
+	uint64_t poolsize;
+	uint64_t itemsize;
+	uint64_t stride;
+	uint64_t nslot;
+};
+
+/*
+ * The seq of a slot is the position it is free for, or that position
+ * plus 1 while it holds the item. The checksum covers seq, len, hole
+ * and the item, so a slot torn by a crash is told from a full one.
+ */
+struct slot {
+	uint64_t seq;
+	uint32_t len;
+	uint32_t hole;
+	uint64_t checksum;
+	uint64_t reserved;
+	char data[];
+};
+
+struct pmemqueue {
+	char *base;
+	size_t mapped_len;
+	int is_pmem;
+	size_t itemsize;
+	size_t stride;
+	uint64_t nslot;
+	uint64_t mask;
+	size_t nhole;
+	char *slots;
+	/* each on a cache line of its own */
+	uint64_t tail __attribute__((aligned(64)));
+	uint64_t head __attribute__((aligned(64)));
+};
+
+/* util functions */
+static void flush(PMEMqueue *pqp, const void *addr, size_t len)
+{
+	if (pqp->is_pmem)
+		pmem_flush(addr, len);
+	else
+		pmem_msync(addr, len);
+}
+
+static void drain(PMEMqueue *pqp)
+{
+	if (pqp->is_pmem)
+		pmem_drain();
+}
+
+static uint64_t slot_checksum(uint64_t seq, uint32_t len, uint32_t hole,
+		const void *data)
+{
+	uint64_t sum[2] = {0, 0};
+	const uint64_t head[2] = {seq, (uint64_t)len << 32 | hole};
+	fletcher64_update(sum, head, sizeof(head));
+	fletcher64_update(sum, data, len);
+	return fletcher64_final(sum);
+}
+
+static struct slot *slot_at(PMEMqueue *pqp, uint64_t pos)
+{
+	return (struct slot *)(pqp->slots + (pos & pqp->mask) * pqp->stride);
+}
+
+/*
+ * Fills the slot of pos and publishes it; the caller drains. A consumer
+ * may take the item before it is durable, but then its dequeue, which
+ * is persisted before it returns, overwrites the seq anyway.
+ */
+static void slot_fill(PMEMqueue *pqp, uint64_t pos, const void *buf,
+		size_t len)
+{
+	struct slot *const s = slot_at(pqp, pos);
+	memcpy(s->data, buf, len);
+	s->len = (uint32_t)len;
+	s->hole = 0;
+	s->checksum = slot_checksum(pos + 1, s->len, 0, buf);
+	__atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+	flush(pqp, s, sizeof(*s) + len);
+}
+
+/* the size of a slot of itemsize bytes; 0 if too large */
+static size_t slot_stride(size_t itemsize)
+{
+	if (itemsize == 0 || itemsize > UINT32_MAX)
+		return 0;
+	return (sizeof(struct slot) + itemsize + 63) & ~(size_t)63;
+}
+
+static uint64_t slot_count(size_t poolsize, size_t stride)
+{
+	uint64_t n = 1;
+	while (QUEUE_HDR_SIZE + n * 2 * stride <= poolsize)
+		n *= 2;
+	return n;
+}
+
+/* pool management */
+static PMEMqueue *queue_init(char *base, size_t mapped_len, int is_pmem)
+{
+	PMEMqueue *pqp = NULL;
+	if (posix_memalign((void **)&pqp, 64, sizeof(*pqp)) != 0) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(pqp, 0, sizeof(*pqp));
+	const struct queue_hdr *const hdr = (struct queue_hdr *)base;
+	pqp->base = base;
+	pqp->mapped_len = mapped_len;
+	pqp->is_pmem = is_pmem;
+	pqp->itemsize = hdr->itemsize;
+	pqp->stride = hdr->stride;
+	pqp->nslot = hdr->nslot;
+	pqp->mask = hdr->nslot - 1;
+	pqp->slots = base + QUEUE_HDR_SIZE;
+	return pqp;
+}
+
+/* 1 if the slot holds the item of pos, whole */
+static int slot_valid(PMEMqueue *pqp, const struct slot *s, uint64_t pos)
+{
+	return s->seq == pos + 1 && s->len <= pqp->itemsize
+		&& s->checksum == slot_checksum(s->seq, s->len, s->hole,
+			s->data);
+}
+
+/*
+ * Every slot is either free or full for its position, and the full
+ * ones are at most a ring apart. The valid items give head and tail;
+ * each position between them without one becomes a hole, and every
+ * other slot is made free for its position in the next lap.
+ */
+static void queue_recover(PMEMqueue *pqp)
+{
+	uint64_t head = UINT64_MAX, last = 0, low = UINT64_MAX;
+	int found = 0;
+	for (uint64_t i = 0; i < pqp->nslot; ++i) {
+		const struct slot *const s = slot_at(pqp, i);
+		const uint64_t pos = (s->seq & pqp->mask) == i
+			? s->seq : s->seq - 1;
+		if (pos < low)
+			low = pos;
+		if (pos != s->seq && slot_valid(pqp, s, pos)) {
+			found = 1;
+			if (pos < head)
+				head = pos;
+			if (pos > last)
+				last = pos;
+		}
+	}
+	if (!found)
+		head = last = low;
+	const uint64_t tail = found ? last + 1 : low;
+
+	for (uint64_t i = 0; i < pqp->nslot; ++i) {
+		struct slot *const s = slot_at(pqp, i);
+		const uint64_t pos = head + ((i - head) & pqp->mask);
+		if (pos < tail) {
+			if (slot_valid(pqp, s, pos))
+				continue;
+			s->len = 0;
+			s->hole = 1;
+			s->seq = pos + 1;
+			s->checksum = slot_checksum(s->seq, 0, 1, s->data);
+			++pqp->nhole;
+		} else {
+			if (s->seq == pos)
+				continue;
+			s->seq = pos;
+		}
+		flush(pqp, s, sizeof(*s));
+	}
+	drain(pqp);
+	pqp->head = head;
+	pqp->tail = tail;
+}
+
+PMEMqueue *pmemqueue_create(const char *path, size_t poolsize,
+		size_t itemsize, mode_t mode)
+{
+	const size_t stride = slot_stride(itemsize);
+	if (poolsize < PMEMQUEUE_MIN_POOL || stride == 0
+			|| slot_count(poolsize, stride) < 2) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	char *const base = pmem_map_file(path, poolsize,
+		PMEM_FILE_CREATE|PMEM_FILE_EXCL, mode, &mapped_len, &is_pmem);
+	if (!base)
+		return NULL;
+
+	struct queue_hdr *const hdr = (struct queue_hdr *)base;
+	hdr->poolsize = mapped_len;
+	hdr->itemsize = itemsize;
+	hdr->stride = stride;
+	hdr->nslot = slot_count(mapped_len, stride);
+
+	/* a new file reads as zeroes; slot i is free for position i */
+	for (uint64_t i = 0; i < hdr->nslot; ++i)
+		((struct slot *)(base + QUEUE_HDR_SIZE + i * stride))->seq = i;
+	pmem_msync(base, QUEUE_HDR_SIZE + hdr->nslot * stride);
+
+	magic_persist(hdr->magic, QUEUE_MAGIC);
+
+	PMEMqueue *const pqp = queue_init(base, mapped_len, is_pmem);
+	if (!pqp) {
+		const int oerrno = errno;
+		pmem_unmap(base, mapped_len);
+		unlink(path);
+		errno = oerrno;
+	}
+	return pqp;
+}
+
+PMEMqueue *pmemqueue_open(const char *path)
+{
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	char *const base = pmem_map_file(path, 0, 0, 0,
+		&mapped_len, &is_pmem);
+	if (!base)
+		return NULL;
+
+	const struct queue_hdr *const hdr = (struct queue_hdr *)base;
+	const int valid = mapped_len >= PMEMQUEUE_MIN_POOL
+		&& memcmp(hdr->magic, QUEUE_MAGIC, sizeof(hdr->magic)) == 0
+		&& hdr->poolsize == mapped_len
+		&& hdr->stride == slot_stride(hdr->itemsize)
+		&& hdr->stride != 0
+		&& hdr->nslot == slot_count(mapped_len, hdr->stride);
+	if (!valid) {
+		pmem_unmap(base, mapped_len);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	PMEMqueue *const pqp = queue_init(base, mapped_len, is_pmem);
+	if (!pqp) {
+		const int oerrno = errno;
+		pmem_unmap(base, mapped_len);
+		errno = oerrno;
+		return NULL;
+	}
+	queue_recover(pqp);
+	return pqp;
+}
+
+void pmemqueue_close(PMEMqueue *pqp)
+{
+	pmem_unmap(pqp->base, pqp->mapped_len);
+	free(pqp);
+}
+
+size_t pmemqueue_nslot(PMEMqueue *pqp)
+{
+	return (size_t)pqp->nslot;
+}
+
+size_t pmemqueue_itemsize(PMEMqueue *pqp)
+{
+	return pqp->itemsize;
+}
+
+size_t pmemqueue_nhole(PMEMqueue *pqp)
+{
+	return pqp->nhole;
+}
+
+/* queue operations */
+int pmemqueue_enqueue(PMEMqueue *pqp, const void *buf, size_t len)
+{
+	const struct iovec iov = {(void *)buf, len};
+	return pmemqueue_enqueue_batch(pqp, &iov, 1) == 1 ? 0 : -1;
+}
+
+int pmemqueue_enqueue_batch(PMEMqueue *pqp, const struct iovec *iov,
+		int iovcnt)
+{
+	for (int i = 0; i < iovcnt; ++i) {
+		if (iov[i].iov_len > pqp->itemsize) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	if (iovcnt <= 0)
+		return 0;
+
+	/* claim the longest run of free slots, up to iovcnt */
+	uint64_t pos;
+	int n;
+	for (;;) {
+		pos = __atomic_load_n(&pqp->tail, __ATOMIC_RELAXED);
+		n = 0;
+		while (n < iovcnt && __atomic_load_n(&slot_at(pqp, pos + n)->seq,
+				__ATOMIC_ACQUIRE) == pos + (uint64_t)n)
+			++n;
+		if (n == 0) {
+			const uint64_t seq = __atomic_load_n(
+				&slot_at(pqp, pos)->seq, __ATOMIC_ACQUIRE);
+			if ((int64_t)(seq - pos) < 0) {
+				errno = EAGAIN;
+				return -1;
+			}
+			continue; /* another producer took pos */
+		}
+		if (__atomic_compare_exchange_n(&pqp->tail, &pos,
+				pos + (uint64_t)n, 0, __ATOMIC_RELAXED,
+				__ATOMIC_RELAXED))
+			break;
+	}
+
+	for (int i = 0; i < n; ++i)
+		slot_fill(pqp, pos + (uint64_t)i, iov[i].iov_base,
+			iov[i].iov_len);
+	drain(pqp);
+	return n;
+}
+
+ssize_t pmemqueue_dequeue(PMEMqueue *pqp, void *buf)
+{
+	for (;;) {
+		uint64_t pos = __atomic_load_n(&pqp->head, __ATOMIC_RELAXED);
+		struct slot *const s = slot_at(pqp, pos);
+		const uint64_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		const int64_t dif = (int64_t)(seq - (pos + 1));
+		if (dif < 0) {
+			errno = EAGAIN;
+			return -1;
+		}
+		if (dif > 0 || !__atomic_compare_exchange_n(&pqp->head, &pos,
+				pos + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			continue;
+
+		const int hole = s->hole != 0;
+		const size_t len = s->len;
+		memcpy(buf, s->data, len);
+		__atomic_store_n(&s->seq, pos + pqp->nslot, __ATOMIC_RELEASE);
+		flush(pqp, &s->seq, sizeof(s->seq));
+		drain(pqp);
+		if (!hole)
+			return (ssize_t)len;
+	}
+}
@@ -0,0 +1,59 @@
+#ifndef PMEMQUEUE_H
+#define PMEMQUEUE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * pmemqueue: a bounded, persistent multi-producer multi-consumer queue
+ * in a file mapped by pmem_map_file().
+ *
+ * The queue is a ring of slots with a sequence number each, as in
+ * Vyukov's bounded MPMC queue: a slot whose seq is a position is free
+ * for the enqueue at that position, and one whose seq is the position
+ * plus 1 holds its item. Producers and consumers take positions from
+ * head and tail counters in DRAM with a compare-and-swap. An enqueue
+ * writes the item, its length and a checksum along with the seq, and is
+ * durable when it returns; a batch of items takes one drain. A dequeue
+ * is durable when it returns, so an item is delivered once unless the
+ * process dies inside pmemqueue_dequeue().
+ *
+ * pmemqueue_open() finds head and tail from the seqs. A position
+ * between them whose item did not become durable, i.e. whose slot is
+ * still free or fails its checksum, is marked as a hole, which dequeues
+ * skip; the items around it are kept in order.
+ */
+
+#define PMEMQUEUE_MIN_POOL ((size_t)(1 << 20))
+
+typedef struct pmemqueue PMEMqueue;
+
+/* as many slots of up to itemsize bytes as fit, rounded down to 2^n */
+PMEMqueue *pmemqueue_create(const char *path, size_t poolsize,
+	size_t itemsize, mode_t mode);
+PMEMqueue *pmemqueue_open(const char *path);
+void pmemqueue_close(PMEMqueue *pqp);
+
+size_t pmemqueue_nslot(PMEMqueue *pqp);
+size_t pmemqueue_itemsize(PMEMqueue *pqp);
+/* the holes found by pmemqueue_open() */
+size_t pmemqueue_nhole(PMEMqueue *pqp);
+
+/* EAGAIN if the queue is full, EINVAL if len is over itemsize */
+int pmemqueue_enqueue(PMEMqueue *pqp, const void *buf, size_t len);
+
+/*
+ * Enqueues the first of iovcnt items that fit, in order, and returns
+ * how many; -1 with EAGAIN if none does.
+ */
+int pmemqueue_enqueue_batch(PMEMqueue *pqp, const struct iovec *iov,
+	int iovcnt);
+
+/*
+ * buf holds itemsize bytes. Returns the length of the item, or -1 with
+ * EAGAIN if the queue is empty.
+ */
+ssize_t pmemqueue_dequeue(PMEMqueue *pqp, void *buf);
+
+#endif /* PMEMQUEUE_H */
@@ -0,0 +1,469 @@
+#include "config.h" /* should be included first */
+
+#include <errno.h>
+#include <libpmem.h>
+#include <libpmemblk.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pmembulk.h"
+#include "pmemplus.h"
+#include "pmemsnap.h"
+
+#define SNAP_MAGIC    "PMEMSNP"
+#define SNAP_HDR_SIZE ((size_t)4096)
+
+#define NSTRIPE       1024
+#define MAX_THREADS   RUN_MAX_THREADS
+#define EXPORT_BATCH  64 /* blocks per pwrite(2) */
+
+/* on-media layout */
+struct snap_hdr {
+	char magic[8];
+	uint64_t size;
+	uint64_t bsize;
+	uint64_t nblock;
+	uint64_t nslot;
+	uint64_t epoch;
+	uint64_t active; /* written after epoch */
+};
+
+/*
+ * The header is followed by the bitmap, the slot of each block and the
+ * area of nslot saved blocks. The slot of a block is valid only if its
+ * bit is set.
+ */
+struct pmemsnap {
+	PMEMblkpool *pbp;
+	char *base;
+	size_t mapped_len;
+	int is_pmem;
+	size_t bsize;
+	size_t nblock;
+	size_t nslot;
+	struct snap_hdr *hdr;
+	uint64_t *bitmap;
+	uint64_t *slot;
+	char *area;
+	size_t next_slot;
+	pthread_mutex_t stripe[NSTRIPE];
+};
+
+/* util functions */
+static size_t round_page(size_t n)
+{
+	return (n + 4095) & ~(size_t)4095;
+}
+
+static size_t bitmap_len(size_t nblock)
+{
+	return round_page((nblock + 63) / 64 * sizeof(uint64_t));
+}
+
+static size_t area_offset(size_t nblock)
+{
+	return SNAP_HDR_SIZE + bitmap_len(nblock)
+		+ round_page(nblock * sizeof(uint64_t));
+}
+
+static void persist(PMEMsnap *psp, const void *addr, size_t len)
+{
+	if (psp->is_pmem)
+		pmem_persist(addr, len);
+	else
+		pmem_msync(addr, len);
+}
+
+/* persist() in two steps, to drain several ranges at once */
+static void flush(PMEMsnap *psp, const void *addr, size_t len)
+{
+	if (psp->is_pmem)
+		pmem_flush(addr, len);
+	else
+		pmem_msync(addr, len);
+}
+
+static void drain(PMEMsnap *psp)
+{
+	if (psp->is_pmem)
+		pmem_drain();
+}
+
+static int is_saved(PMEMsnap *psp, size_t b)
+{
+	const uint64_t w = __atomic_load_n(&psp->bitmap[b / 64],
+		__ATOMIC_ACQUIRE);
+	return (w >> (b % 64)) & 1;
+}
+
+static int check_blockno(PMEMsnap *psp, long long blockno)
+{
+	if (blockno < 0 || (size_t)blockno >= psp->nblock) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+static pthread_mutex_t *stripe_of(PMEMsnap *psp, long long blockno)
+{
+	return &psp->stripe[(size_t)blockno % NSTRIPE];
+}
+
+static void stripes_lock_all(PMEMsnap *psp)
+{
+	for (int i = 0; i < NSTRIPE; ++i)
+		pthread_mutex_lock(&psp->stripe[i]);
+}
+
+static void stripes_unlock_all(PMEMsnap *psp)
+{
+	for (int i = NSTRIPE - 1; i >= 0; --i)
+		pthread_mutex_unlock(&psp->stripe[i]);
+}
+
+/*
+ * Copies the block into a free slot unless it is saved already; the
+ * stripe of the block is held. The bit is the commit point: it is set
+ * only after the copy and its slot number are durable.
+ */
+static int save_block(PMEMsnap *psp, size_t b)
+{
+	if (is_saved(psp, b))
+		return 0;
+
+	const size_t s = __atomic_fetch_add(&psp->next_slot, 1,
+		__ATOMIC_RELAXED);
+	if (s >= psp->nslot) {
+		errno = ENOSPC;
+		return -1;
+	}
+	char *const data = psp->area + s * psp->bsize;
+	if (pmemblk_read(psp->pbp, data, (long long)b) != 0)
+		return -1;
+	flush(psp, data, psp->bsize);
+	psp->slot[b] = s;
+	flush(psp, &psp->slot[b], sizeof(psp->slot[b]));
+	drain(psp);
+
+	__atomic_fetch_or(&psp->bitmap[b / 64], (uint64_t)1 << (b % 64),
+		__ATOMIC_RELEASE);
+	persist(psp, &psp->bitmap[b / 64], sizeof(uint64_t));
+	return 0;
+}
+
+/* snapshot file management */
+static PMEMsnap *snap_init(PMEMblkpool *pbp, char *base, size_t mapped_len,
+		int is_pmem)
+{
+	PMEMsnap *const psp = calloc(1, sizeof(*psp));
+	if (!psp)
+		return NULL;
+	psp->pbp = pbp;
+	psp->base = base;
+	psp->mapped_len = mapped_len;
+	psp->is_pmem = is_pmem;
+	psp->hdr = (struct snap_hdr *)base;
+	psp->bsize = psp->hdr->bsize;
+	psp->nblock = psp->hdr->nblock;
+	psp->nslot = psp->hdr->nslot;
+	psp->bitmap = (uint64_t *)(base + SNAP_HDR_SIZE);
+	psp->slot = (uint64_t *)(base + SNAP_HDR_SIZE
+		+ bitmap_len(psp->nblock));
+	psp->area = base + area_offset(psp->nblock);
+	for (int i = 0; i < NSTRIPE; ++i)
+		pthread_mutex_init(&psp->stripe[i], NULL);
+	return psp;
+}
+
+/* the slots in use are those up to the highest one of a saved block */
+static int snap_recover(PMEMsnap *psp)
+{
+	psp->next_slot = 0;
+	if (!psp->hdr->active)
+		return 0;
+	for (size_t b = 0; b < psp->nblock; ++b) {
+		if (!is_saved(psp, b))
+			continue;
+		if (psp->slot[b] >= psp->nslot) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (psp->slot[b] + 1 > psp->next_slot)
+			psp->next_slot = psp->slot[b] + 1;
+	}
+	return 0;
+}
+
+size_t pmemsnap_size(PMEMblkpool *pbp)
+{
+	const size_t nblock = pmemblk_nblock(pbp);
+	const size_t size = area_offset(nblock)
+		+ round_page(nblock * pmemblk_bsize(pbp));
+	return size > PMEMSNAP_MIN_SIZE ? size : PMEMSNAP_MIN_SIZE;
+}
+
+PMEMsnap *pmemsnap_create(PMEMblkpool *pbp, const char *path, size_t size,
+	mode_t mode)
+{
+	const size_t bsize = pmemblk_bsize(pbp);
+	const size_t nblock = pmemblk_nblock(pbp);
+	if (size < PMEMSNAP_MIN_SIZE || size < area_offset(nblock) + bsize) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	char *const base = pmem_map_file(path, size,
+		PMEM_FILE_CREATE|PMEM_FILE_EXCL, mode, &mapped_len, &is_pmem);
+	if (!base)
+		return NULL;
+
+	/* a new file reads as zeroes; i.e. no snapshot is active */
+	struct snap_hdr *const hdr = (struct snap_hdr *)base;
+	hdr->size = mapped_len;
+	hdr->bsize = bsize;
+	hdr->nblock = nblock;
+	hdr->nslot = (mapped_len - area_offset(nblock)) / bsize;
+	pmem_msync(hdr, sizeof(*hdr));
+
+	magic_persist(hdr->magic, SNAP_MAGIC);
+
+	PMEMsnap *const psp = snap_init(pbp, base, mapped_len, is_pmem);
+	if (!psp) {
+		pmem_unmap(base, mapped_len);
+		unlink(path);
+		errno = ENOMEM;
+	}
+	return psp;
+}
+
+PMEMsnap *pmemsnap_open(PMEMblkpool *pbp, const char *path)
+{
+	size_t mapped_len = 0;
+	int is_pmem = 0;
+	char *const base = pmem_map_file(path, 0, 0, 0, &mapped_len, &is_pmem);
+	if (!base)
+		return NULL;
+
+	const struct snap_hdr *const hdr = (struct snap_hdr *)base;
+	if (mapped_len < PMEMSNAP_MIN_SIZE
+			|| memcmp(hdr->magic, SNAP_MAGIC, sizeof(hdr->magic)) != 0
+			|| hdr->size != mapped_len
+			|| hdr->bsize != pmemblk_bsize(pbp)
+			|| hdr->nblock != pmemblk_nblock(pbp)
+			|| hdr->nslot == 0
+			|| area_offset(hdr->nblock) + hdr->nslot * hdr->bsize
+				> mapped_len) {
+		pmem_unmap(base, mapped_len);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	PMEMsnap *const psp = snap_init(pbp, base, mapped_len, is_pmem);
+	if (!psp) {
+		pmem_unmap(base, mapped_len);
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (snap_recover(psp) != 0) {
+		const int err = errno;
+		pmemsnap_close(psp);
+		errno = err;
+		return NULL;
+	}
+	return psp;
+}
+
+void pmemsnap_close(PMEMsnap *psp)
+{
+	for (int i = 0; i < NSTRIPE; ++i)
+		pthread_mutex_destroy(&psp->stripe[i]);
+	pmem_unmap(psp->base, psp->mapped_len);
+	free(psp);
+}
+
+/* snapshot management */
+int pmemsnap_begin(PMEMsnap *psp)
+{
+	stripes_lock_all(psp);
+	if (psp->hdr->active) {
+		stripes_unlock_all(psp);
+		errno = EBUSY;
+		return -1;
+	}
+	if (pmembulk_memset(psp->bitmap, 0, bitmap_len(psp->nblock), 0)
+			!= 0) {
+		const int err = errno;
+		stripes_unlock_all(psp);
+		errno = err;
+		return -1;
+	}
+	psp->next_slot = 0;
+	psp->hdr->epoch++;
+	persist(psp, &psp->hdr->epoch, sizeof(psp->hdr->epoch));
+	psp->hdr->active = 1;
+	persist(psp, &psp->hdr->active, sizeof(psp->hdr->active));
+	stripes_unlock_all(psp);
+	return 0;
+}
+
+int pmemsnap_end(PMEMsnap *psp)
+{
+	stripes_lock_all(psp);
+	if (!psp->hdr->active) {
+		stripes_unlock_all(psp);
+		errno = EINVAL;
+		return -1;
+	}
+	psp->hdr->active = 0;
+	persist(psp, &psp->hdr->active, sizeof(psp->hdr->active));
+	stripes_unlock_all(psp);
+	return 0;
+}
+
+int pmemsnap_active(PMEMsnap *psp)
+{
+	return (int)__atomic_load_n(&psp->hdr->active, __ATOMIC_ACQUIRE);
+}
+
+unsigned long long pmemsnap_epoch(PMEMsnap *psp)
+{
+	return psp->hdr->epoch;
+}
+
+/* the pool */
+int pmemsnap_write(PMEMsnap *psp, const void *buf, long long blockno)
+{
+	if (check_blockno(psp, blockno) != 0)
+		return -1;
+	pthread_mutex_t *const m = stripe_of(psp, blockno);
+	pthread_mutex_lock(m);
+	int ret = 0;
+	if (psp->hdr->active)
+		ret = save_block(psp, (size_t)blockno);
+	if (ret == 0)
+		ret = pmemblk_write(psp->pbp, buf, blockno);
+	pthread_mutex_unlock(m);
+	return ret;
+}
+
+int pmemsnap_set_zero(PMEMsnap *psp, long long blockno)
+{
+	if (check_blockno(psp, blockno) != 0)
+		return -1;
+	pthread_mutex_t *const m = stripe_of(psp, blockno);
+	pthread_mutex_lock(m);
+	int ret = 0;
+	if (psp->hdr->active)
+		ret = save_block(psp, (size_t)blockno);
+	if (ret == 0)
+		ret = pmemblk_set_zero(psp->pbp, blockno);
+	pthread_mutex_unlock(m);
+	return ret;
+}
+
+/* the snapshot */
+int pmemsnap_read(PMEMsnap *psp, void *buf, long long blockno)
+{
+	if (check_blockno(psp, blockno) != 0)
+		return -1;
+	pthread_mutex_t *const m = stripe_of(psp, blockno);
+	pthread_mutex_lock(m);
+	int ret = 0;
+	if (!psp->hdr->active) {
+		errno = EINVAL;
+		ret = -1;
+	} else if (is_saved(psp, (size_t)blockno)) {
+		memcpy(buf, psp->area + psp->slot[blockno] * psp->bsize,
+			psp->bsize);
+	} else {
+		ret = pmemblk_read(psp->pbp, buf, blockno);
+	}
+	pthread_mutex_unlock(m);
+	return ret;
+}
+
+struct export_arg {
+	PMEMsnap *psp;
+	int fd;
+	size_t first;
+	size_t count;
+};
+
+static int pwrite_all(int fd, const char *buf, size_t len, off_t off)
+{
+	while (len > 0) {
+		const ssize_t n = pwrite(fd, buf, len, off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= (size_t)n;
+		off += n;
+	}
+	return 0;
+}
+
+static void *export_worker(void *arg)
+{
+	struct export_arg *const a = arg;
+	PMEMsnap *const psp = a->psp;
+	char *const buf = malloc(EXPORT_BATCH * psp->bsize);
+	if (!buf) {
+		errno = ENOMEM;
+		return worker_failed();
+	}
+	void *ret = NULL;
+	for (size_t b = a->first; b < a->first + a->count; ) {
+		size_t n = a->first + a->count - b;
+		if (n > EXPORT_BATCH)
+			n = EXPORT_BATCH;
+		int r = 0;
+		for (size_t i = 0; i < n && r == 0; ++i)
+			r = pmemsnap_read(psp, buf + i * psp->bsize,
+				(long long)(b + i));
+		if (r == 0)
+			r = pwrite_all(a->fd, buf, n * psp->bsize,
+				(off_t)(b * psp->bsize));
+		if (r != 0) {
+			ret = worker_failed();
+			break;
+		}
+		b += n;
+	}
+	free(buf);
+	return ret;
+}
+
+int pmemsnap_export(PMEMsnap *psp, int fd, int nthreads)
+{
+	if (nthreads < 0 || !pmemsnap_active(psp)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (nthreads == 0)
+		nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > MAX_THREADS)
+		nthreads = MAX_THREADS;
+	if ((size_t)nthreads > (psp->nblock + EXPORT_BATCH - 1) / EXPORT_BATCH)
+		nthreads = (int)((psp->nblock + EXPORT_BATCH - 1)
+			/ EXPORT_BATCH);
+	if (nthreads < 1)
+		nthreads = 1;
+
+	struct export_arg arg[MAX_THREADS];
+	for (int t = 0; t < nthreads; ++t) {
+		const size_t lo = psp->nblock * (size_t)t / (size_t)nthreads;
+		const size_t hi = psp->nblock * (size_t)(t + 1)
+			/ (size_t)nthreads;
+		arg[t] = (struct export_arg){psp, fd, lo, hi - lo};
+	}
+	return run_workers(export_worker, arg, sizeof(arg[0]), nthreads);
+}
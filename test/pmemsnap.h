@@ -0,0 +1,59 @@
+#ifndef PMEMSNAP_H
+#define PMEMSNAP_H
+
+#include <libpmemblk.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * pmemsnap: point-in-time snapshots of a pmemblk pool, taken online.
+ *
+ * A snapshot file beside the pool holds a persistent bitmap with a bit
+ * per block and an area of saved blocks. pmemsnap_begin() clears the
+ * bitmap; from then on the first write to each block copies its old
+ * contents into the area and sets its bit, and later writes go straight
+ * to the pool. pmemsnap_read() and pmemsnap_export() see the pool as it
+ * was at pmemsnap_begin(), while the pool is written to. The snapshot
+ * survives a crash until pmemsnap_end().
+ *
+ * While a PMEMsnap is open, every write to the pool must go through it.
+ */
+
+#define PMEMSNAP_MIN_SIZE ((size_t)(1 << 20))
+
+typedef struct pmemsnap PMEMsnap;
+
+/*
+ * size bounds how many blocks may be written during one snapshot;
+ * pmemsnap_size() for the whole pool never runs out.
+ */
+size_t pmemsnap_size(PMEMblkpool *pbp);
+PMEMsnap *pmemsnap_create(PMEMblkpool *pbp, const char *path, size_t size,
+	mode_t mode);
+PMEMsnap *pmemsnap_open(PMEMblkpool *pbp, const char *path);
+void pmemsnap_close(PMEMsnap *psp);
+
+/* EBUSY if one is active already */
+int pmemsnap_begin(PMEMsnap *psp);
+int pmemsnap_end(PMEMsnap *psp);
+int pmemsnap_active(PMEMsnap *psp);
+/* counts pmemsnap_begin() calls */
+unsigned long long pmemsnap_epoch(PMEMsnap *psp);
+
+/*
+ * pmemblk_write() and pmemblk_set_zero() that save the block first;
+ * ENOSPC if it cannot be saved.
+ */
+int pmemsnap_write(PMEMsnap *psp, const void *buf, long long blockno);
+int pmemsnap_set_zero(PMEMsnap *psp, long long blockno);
+
+/* a block of the snapshot; EINVAL if none is active */
+int pmemsnap_read(PMEMsnap *psp, void *buf, long long blockno);
+
+/*
+ * Writes the snapshot to fd as a flat image of every block, with
+ * nthreads threads (0 for one per CPU) each streaming a range of it.
+ */
+int pmemsnap_export(PMEMsnap *psp, int fd, int nthreads);
+
+#endif /* PMEMSNAP_H */
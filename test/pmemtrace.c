@@ -0,0 +1,136 @@
+#include "config.h" /* should be included first */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pmemtrace.h"
+
+/* util functions */
+static int hdr_valid(const struct pmemtrace_hdr *hdr, size_t len)
+{
+	const size_t nmax = (len - sizeof(*hdr)) / sizeof(struct pmemtrace_rec);
+	return memcmp(hdr->magic, PMEMTRACE_MAGIC, sizeof(hdr->magic)) == 0
+		&& hdr->version == PMEMTRACE_VERSION
+		&& hdr->nthread > 0 && hdr->nthread <= UINT16_MAX + 1U
+		&& hdr->bsize > 0
+		&& hdr->nrec <= nmax
+		&& len == sizeof(*hdr)
+			+ hdr->nrec * sizeof(struct pmemtrace_rec);
+}
+
+static int rec_valid(const struct pmemtrace_hdr *hdr,
+		const struct pmemtrace_rec *rec, uint64_t prev_ts)
+{
+	if (rec->ts < prev_ts || rec->thread >= hdr->nthread)
+		return 0;
+	switch (rec->op) {
+	case PMEMTRACE_BLK_READ:
+	case PMEMTRACE_BLK_WRITE:
+	case PMEMTRACE_BLK_ZERO:
+		return rec->offset < hdr->nblock;
+	case PMEMTRACE_LOG_APPEND:
+		return rec->size > 0 && rec->size <= hdr->logsize;
+	case PMEMTRACE_LOG_WALK:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	while (len > 0) {
+		const ssize_t n = write(fd, p, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+/* trace files */
+int pmemtrace_load(const char *path, struct pmemtrace *tr)
+{
+	const int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		const int oerrno = errno;
+		close(fd);
+		errno = oerrno;
+		return -1;
+	}
+	const size_t len = (size_t)st.st_size;
+	if (len < sizeof(struct pmemtrace_hdr)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	void *const map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	const int oerrno = errno;
+	close(fd);
+	if (map == MAP_FAILED) {
+		errno = oerrno;
+		return -1;
+	}
+
+	const struct pmemtrace_hdr *const hdr = map;
+	const struct pmemtrace_rec *const rec = (const void *)(hdr + 1);
+	int valid = hdr_valid(hdr, len);
+	uint64_t ts = 0;
+	for (uint64_t i = 0; valid && i < hdr->nrec; ++i) {
+		valid = rec_valid(hdr, &rec[i], ts);
+		ts = rec[i].ts;
+	}
+	if (!valid) {
+		munmap(map, len);
+		errno = EINVAL;
+		return -1;
+	}
+
+	tr->hdr = hdr;
+	tr->rec = rec;
+	tr->mapped_len = len;
+	return 0;
+}
+
+void pmemtrace_unload(struct pmemtrace *tr)
+{
+	munmap((void *)tr->hdr, tr->mapped_len);
+	memset(tr, 0, sizeof(*tr));
+}
+
+int pmemtrace_save(const char *path, const struct pmemtrace_hdr *hdr,
+		const struct pmemtrace_rec *rec)
+{
+	const int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd == -1)
+		return -1;
+	if (write_all(fd, hdr, sizeof(*hdr)) == -1
+			|| write_all(fd, rec, hdr->nrec * sizeof(*rec)) == -1) {
+		const int oerrno = errno;
+		close(fd);
+		unlink(path);
+		errno = oerrno;
+		return -1;
+	}
+	return close(fd);
+}
+
+const char *pmemtrace_op_name(unsigned op)
+{
+	static const char *const NAME[PMEMTRACE_NOP] = {
+		"read", "write", "zero", "append", "walk",
+	};
+	return op < PMEMTRACE_NOP ? NAME[op] : "?";
+}
@@ -0,0 +1,70 @@
+#ifndef PMEMTRACE_H
+#define PMEMTRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * pmemtrace: a binary trace of pmemblk and pmemlog operations, written
+ * by tracegen and replayed by perf_replay.
+ *
+ * A trace is a struct pmemtrace_hdr followed by nrec records in the
+ * order of their timestamps, all in host byte order. The header gives
+ * the geometry the pools must have to replay the trace: nblock blocks
+ * of bsize bytes, and a log of logsize bytes.
+ */
+
+#define PMEMTRACE_MAGIC   "PMEMTRC"
+#define PMEMTRACE_VERSION 1
+
+enum pmemtrace_op {
+	PMEMTRACE_BLK_READ,	/* pmemblk_read() of block offset */
+	PMEMTRACE_BLK_WRITE,	/* pmemblk_write() of block offset */
+	PMEMTRACE_BLK_ZERO,	/* pmemblk_set_zero() of block offset */
+	PMEMTRACE_LOG_APPEND,	/* pmemlog_append() of size bytes */
+	PMEMTRACE_LOG_WALK,	/* pmemlog_walk() in chunks of size bytes */
+	PMEMTRACE_NOP		/* the number of ops */
+};
+
+struct pmemtrace_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t nthread;
+	uint64_t nrec;
+	uint64_t nblock;
+	uint32_t bsize;
+	uint32_t reserved;
+	uint64_t logsize;
+	char name[16];		/* of the pattern, for reports */
+};
+
+struct pmemtrace_rec {
+	uint64_t ts;		/* ns since the start of the trace */
+	uint64_t offset;
+	uint32_t size;
+	uint16_t thread;	/* the replay thread that issues it */
+	uint8_t op;
+	uint8_t reserved;
+};
+
+/* a trace mapped read-only */
+struct pmemtrace {
+	const struct pmemtrace_hdr *hdr;
+	const struct pmemtrace_rec *rec;
+	size_t mapped_len;
+};
+
+/*
+ * Maps and checks the trace at path; EINVAL if it is not a trace or a
+ * record does not fit the header.
+ */
+int pmemtrace_load(const char *path, struct pmemtrace *tr);
+void pmemtrace_unload(struct pmemtrace *tr);
+
+/* writes hdr and its hdr->nrec records to a new file */
+int pmemtrace_save(const char *path, const struct pmemtrace_hdr *hdr,
+	const struct pmemtrace_rec *rec);
+
+const char *pmemtrace_op_name(unsigned op);
+
+#endif /* PMEMTRACE_H */
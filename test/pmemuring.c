@@ -0,0 +1,369 @@
+#include "config.h" /* should be included first */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+#include "pmemuring.h"
+
+/* a request's len is 32 bits */
+#define MAX_WRITE ((size_t)1 << 30)
+
+/* a write queued in the chain */
+struct entry {
+	const char *buf;
+	size_t len;
+	off_t off;
+	char copy[PMEMURING_INLINE];
+};
+
+struct pmemuring {
+	int fd;
+	unsigned flags;
+	unsigned depth; /* requests; 0 if io_uring is not used */
+	struct entry *ent; /* the writes of the chain */
+	unsigned nent;
+	unsigned nsqe;
+	int err; /* of a write queued since the last sync */
+#ifdef HAVE_LINUX_IO_URING_H
+	int ring_fd;
+	void *sq_ring;
+	size_t sq_ring_len;
+	void *cq_ring;
+	size_t cq_ring_len;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+#endif
+};
+
+/* util functions */
+static int pwrite_all(int fd, const char *buf, size_t len, off_t off)
+{
+	while (len > 0) {
+		const ssize_t n = pwrite(fd, buf, len, off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= (size_t)n;
+		off += n;
+	}
+	return 0;
+}
+
+static int write_now(PMEMuring *ur, const char *buf, size_t len, off_t off)
+{
+	if (pwrite_all(ur->fd, buf, len, off) != 0)
+		return -1;
+	if ((ur->flags & PMEMURING_FSYNC) && fdatasync(ur->fd) != 0)
+		return -1;
+	return 0;
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+static int ring_setup(PMEMuring *ur)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	ur->ring_fd = (int)syscall(__NR_io_uring_setup, ur->depth, &p);
+	if (ur->ring_fd < 0)
+		return -1;
+
+	ur->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ur->cq_ring_len = p.cq_off.cqes
+		+ p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->cq_ring_len > ur->sq_ring_len)
+			ur->sq_ring_len = ur->cq_ring_len;
+		ur->cq_ring_len = ur->sq_ring_len;
+	}
+	ur->sq_ring = mmap(NULL, ur->sq_ring_len, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, ur->ring_fd, IORING_OFF_SQ_RING);
+	if (ur->sq_ring == MAP_FAILED)
+		goto err_sq;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cq_ring = ur->sq_ring;
+	} else {
+		ur->cq_ring = mmap(NULL, ur->cq_ring_len, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, ur->ring_fd,
+			IORING_OFF_CQ_RING);
+		if (ur->cq_ring == MAP_FAILED)
+			goto err_cq;
+	}
+	ur->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur->sqes = mmap(NULL, ur->sqes_len, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, ur->ring_fd, IORING_OFF_SQES);
+	if (ur->sqes == MAP_FAILED)
+		goto err_sqes;
+
+	char *const sq = ur->sq_ring, *const cq = ur->cq_ring;
+	ur->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ur->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ur->sq_array = (unsigned *)(sq + p.sq_off.array);
+	ur->cq_head = (unsigned *)(cq + p.cq_off.head);
+	ur->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ur->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	ur->depth = p.sq_entries;
+	return 0;
+
+err_sqes:
+	if (ur->cq_ring != ur->sq_ring)
+		munmap(ur->cq_ring, ur->cq_ring_len);
+err_cq:
+	munmap(ur->sq_ring, ur->sq_ring_len);
+err_sq:
+	close(ur->ring_fd);
+	return -1;
+}
+
+static void ring_teardown(PMEMuring *ur)
+{
+	munmap(ur->sqes, ur->sqes_len);
+	if (ur->cq_ring != ur->sq_ring)
+		munmap(ur->cq_ring, ur->cq_ring_len);
+	munmap(ur->sq_ring, ur->sq_ring_len);
+	close(ur->ring_fd);
+}
+
+/* every request is linked to the next; pmemuring_sync() ends the chain */
+static struct io_uring_sqe *sqe_next(PMEMuring *ur)
+{
+	const unsigned tail = *ur->sq_tail + ur->nsqe;
+	const unsigned i = tail & *ur->sq_mask;
+	struct io_uring_sqe *const sqe = &ur->sqes[i];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->flags = IOSQE_IO_LINK;
+	ur->sq_array[i] = i;
+	++ur->nsqe;
+	return sqe;
+}
+
+static void ring_queue(PMEMuring *ur, const struct entry *e)
+{
+	struct io_uring_sqe *sqe = sqe_next(ur);
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = ur->fd;
+	sqe->addr = (uint64_t)(uintptr_t)e->buf;
+	sqe->len = (uint32_t)e->len;
+	sqe->off = (uint64_t)e->off;
+	sqe->user_data = (uint64_t)(e - ur->ent) + 1;
+	if (ur->flags & PMEMURING_FSYNC) {
+		sqe = sqe_next(ur);
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fd = ur->fd;
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+	}
+}
+
+/* reaps the completions there are; sets *failed if one failed or was short */
+static unsigned ring_reap(PMEMuring *ur, int *failed)
+{
+	unsigned head = *ur->cq_head, reaped = 0;
+	const unsigned ctail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != ctail; ++head, ++reaped) {
+		const struct io_uring_cqe *const c =
+			&ur->cqes[head & *ur->cq_mask];
+		/* a short write is no error to io_uring */
+		if (c->res < 0 || (c->user_data > 0 && (size_t)c->res
+				!= ur->ent[c->user_data - 1].len))
+			*failed = 1;
+	}
+	__atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+	return reaped;
+}
+
+static int ring_enter(PMEMuring *ur, unsigned to_submit, unsigned min_complete)
+{
+	return (int)syscall(__NR_io_uring_enter, ur->ring_fd, to_submit,
+		min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+/* errors of io_uring_enter(2) after which it is worth calling again */
+static int ring_retry(int err)
+{
+	return err == EINTR || err == EAGAIN || err == EBUSY;
+}
+
+/*
+ * Submits the chain and reaps a completion per request; a failed or
+ * short one cancels the rest, and then the chain is written again with
+ * pwrite(2), which is harmless for the requests that did complete.
+ *
+ * If io_uring_enter(2) fails otherwise, what was submitted is reaped,
+ * so that no completion is left for a later chain, and the ring is torn
+ * down; the chain, and every write after it, is done with pwrite(2).
+ */
+static int ring_submit(PMEMuring *ur)
+{
+	const unsigned n = ur->nsqe;
+	const unsigned tail = *ur->sq_tail;
+	ur->sqes[(tail + n - 1) & *ur->sq_mask].flags &= ~IOSQE_IO_LINK;
+	__atomic_store_n(ur->sq_tail, tail + n, __ATOMIC_RELEASE);
+	ur->nsqe = 0;
+
+	int failed = 0, dead = 0;
+	unsigned submitted = 0, reaped = 0;
+	while (reaped < n) {
+		const int r = ring_enter(ur, n - submitted, n - reaped);
+		if (r < 0 && !ring_retry(errno)) {
+			dead = 1;
+			break;
+		}
+		if (r > 0)
+			submitted += (unsigned)r;
+		/* on EBUSY too, to make room for more completions */
+		reaped += ring_reap(ur, &failed);
+	}
+
+	if (dead) {
+		while (reaped < submitted) {
+			if (ring_enter(ur, 0, submitted - reaped) < 0
+					&& !ring_retry(errno))
+				break;
+			reaped += ring_reap(ur, &failed);
+		}
+		ring_teardown(ur);
+		ur->depth = 0;
+		failed = 1;
+	}
+
+	if (failed) {
+		for (unsigned j = 0; j < ur->nent; ++j) {
+			const struct entry *const e = &ur->ent[j];
+			if (write_now(ur, e->buf, e->len, e->off) != 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+#endif
+
+PMEMuring *pmemuring_open(const char *path, unsigned depth, unsigned flags)
+{
+	PMEMuring *const ur = calloc(1, sizeof(*ur));
+	if (!ur)
+		return NULL;
+	ur->flags = flags;
+	ur->fd = open(path, (flags & PMEMURING_FSYNC) ? O_RDWR
+		: O_RDWR|O_DSYNC);
+	if (ur->fd < 0) {
+		free(ur);
+		return NULL;
+	}
+
+	/* a write with PMEMURING_FSYNC takes two requests */
+	const unsigned per = (flags & PMEMURING_FSYNC) ? 2 : 1;
+	if (depth > 0 && depth < per)
+		depth = per;
+	ur->depth = depth;
+#ifdef HAVE_LINUX_IO_URING_H
+	if (ur->depth > 0 && ring_setup(ur) != 0)
+		ur->depth = 0;
+#else
+	ur->depth = 0;
+#endif
+	if (ur->depth > 0) {
+		ur->ent = calloc(ur->depth / per, sizeof(*ur->ent));
+		if (!ur->ent) {
+#ifdef HAVE_LINUX_IO_URING_H
+			ring_teardown(ur);
+#endif
+			close(ur->fd);
+			free(ur);
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+	return ur;
+}
+
+void pmemuring_close(PMEMuring *ur)
+{
+	pmemuring_sync(ur); /* DO NOT care */
+#ifdef HAVE_LINUX_IO_URING_H
+	if (ur->depth > 0)
+		ring_teardown(ur);
+#endif
+	free(ur->ent);
+	close(ur->fd);
+	free(ur);
+}
+
+int pmemuring_is_uring(PMEMuring *ur)
+{
+	return ur->depth > 0;
+}
+
+int pmemuring_write(PMEMuring *ur, const void *buf, size_t len, off_t off)
+{
+	const char *p = buf;
+	while (len > MAX_WRITE) {
+		if (pmemuring_write(ur, p, MAX_WRITE, off) != 0)
+			return -1;
+		p += MAX_WRITE;
+		len -= MAX_WRITE;
+		off += (off_t)MAX_WRITE;
+	}
+
+	if (ur->depth == 0) {
+		if (write_now(ur, p, len, off) != 0) {
+			if (ur->err == 0)
+				ur->err = errno;
+			return -1;
+		}
+		return 0;
+	}
+
+#ifdef HAVE_LINUX_IO_URING_H
+	const unsigned per = (ur->flags & PMEMURING_FSYNC) ? 2 : 1;
+	if (ur->nsqe + per > ur->depth && pmemuring_sync(ur) != 0)
+		return -1;
+
+	struct entry *const e = &ur->ent[ur->nent++];
+	if (len <= PMEMURING_INLINE) {
+		memcpy(e->copy, p, len);
+		p = e->copy;
+	}
+	e->buf = p;
+	e->len = len;
+	e->off = off;
+	ring_queue(ur, e);
+#endif
+	return 0;
+}
+
+int pmemuring_sync(PMEMuring *ur)
+{
+	int err = ur->err;
+	ur->err = 0;
+#ifdef HAVE_LINUX_IO_URING_H
+	if (ur->nsqe > 0 && ring_submit(ur) != 0 && err == 0)
+		err = errno;
+	ur->nent = 0;
+	ur->nsqe = 0;
+#endif
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef PMEMURING_H
+#define PMEMURING_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * pmemuring: ordered durable writes to a file, batched into io_uring(7)
+ * submissions.
+ *
+ * pmemuring_write() queues a write that is durable only after every
+ * write queued before it, as a pmem_persist() is. pmemuring_sync()
+ * submits the queue as one chain of linked requests and waits for it,
+ * so a whole operation of an engine costs one system call instead of an
+ * msync() per range. The file is opened with O_DSYNC, which makes every
+ * write durable when it completes, or, with PMEMURING_FSYNC, each write
+ * is followed by an fdatasync(2) in the chain.
+ *
+ * A queue of depth requests is submitted early when it is full. Where
+ * io_uring is not available (old kernels, seccomp), or with depth 0,
+ * writes are done at once with pwrite(2), as they are from a sync at
+ * which io_uring_enter(2) fails on.
+ *
+ * Not thread-safe; the caller serializes the writes and syncs.
+ */
+
+#define PMEMURING_DEPTH 64
+
+/* fdatasync(2) after each write instead of O_DSYNC */
+#define PMEMURING_FSYNC (1U << 0)
+
+typedef struct pmemuring PMEMuring;
+
+PMEMuring *pmemuring_open(const char *path, unsigned depth, unsigned flags);
+void pmemuring_close(PMEMuring *ur);
+
+/* 1 if writes go through io_uring, 0 if through pwrite(2) */
+int pmemuring_is_uring(PMEMuring *ur);
+
+/*
+ * Writes of up to PMEMURING_INLINE bytes are copied when queued; a
+ * larger buf must not change until pmemuring_sync().
+ */
+#define PMEMURING_INLINE 128
+
+int pmemuring_write(PMEMuring *ur, const void *buf, size_t len, off_t off);
+int pmemuring_sync(PMEMuring *ur);
+
+#endif /* PMEMURING_H */
@@ -0,0 +1,269 @@
+#include "config.h" /* should be included first */
+
+#include <check.h>
+#include <errno.h>
+#include <libpmem.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "checkplus.h"
+#include "pmemqos.h"
+
+#ifndef DIR_DAX
+#define DIR_DAX "/mnt/pmem0/tmp"
+#endif
+#ifndef DIR_NONDAX
+#define DIR_NONDAX "/tmp"
+#endif
+#define FILE_A "foo"
+
+#define POOLSIZE ((size_t)(8 << 20))
+#define NTHREAD  4
+
+/* global variables */
+static PMEMqos *qos_ = NULL;
+static char *pmem_ = NULL;
+static size_t mapped_len_ = 0;
+static char *src_ = NULL;
+
+/* util functions */
+static uint64_t now_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec;
+}
+
+/* writes len bytes of src_ as cls; returns how long it took, in ns */
+static uint64_t write_timed(enum pmemqos_class cls, size_t len)
+{
+	const uint64_t t0 = now_ns();
+	pmemqos_memmove_nodrain(qos_, cls, pmem_, src_, len);
+	pmemqos_drain(qos_, cls);
+	return now_ns() - t0;
+}
+
+/* fixtures */
+static void setup_once_daxfs(void)
+{
+	success(chdir(DIR_DAX));
+}
+
+static void setup_once_nondaxfs(void)
+{
+	success(chdir(DIR_NONDAX));
+}
+
+static void setup(void)
+{
+	unlink(FILE_A); /* DO NOT assert */
+	errno = 0;
+	failure(access(FILE_A, F_OK));
+	error(ENOENT);
+
+	int is_pmem = 0;
+	pmem_ = pmem_map_file(FILE_A, POOLSIZE,
+		PMEM_FILE_CREATE|PMEM_FILE_EXCL, 0600, &mapped_len_, &is_pmem);
+	ck_assert_ptr_nonnull(pmem_);
+	src_ = malloc(POOLSIZE);
+	ck_assert_ptr_nonnull(src_);
+	for (size_t i = 0; i < POOLSIZE; ++i)
+		src_[i] = (char)(i * 7 + i / 4096);
+	qos_ = pmemqos_new();
+	ck_assert_ptr_nonnull(qos_);
+}
+
+static void teardown(void)
+{
+	pmemqos_delete(qos_);
+	qos_ = NULL;
+	free(src_);
+	src_ = NULL;
+	pmem_unmap(pmem_, mapped_len_);
+	pmem_ = NULL;
+	unlink(FILE_A);
+}
+
+/* test cases */
+START_TEST(set_limit_EINVAL)
+{
+	errno = 0;
+	failure(pmemqos_set_limit(qos_, PMEMQOS_NCLASS, 1 << 20, 1 << 20));
+	error(EINVAL);
+	errno = 0;
+	failure(pmemqos_set_limit(qos_, PMEMQOS_FG, 1 << 20,
+		PMEMQOS_CHUNK - 1));
+	error(EINVAL);
+	/* no limit needs no burst */
+	success(pmemqos_set_limit(qos_, PMEMQOS_FG, 0, 0));
+}
+END_TEST
+
+START_TEST(unlimited_OK)
+{
+	const size_t len = PMEMQOS_CHUNK * 3 + 100;
+	pmemqos_memmove_nodrain(qos_, PMEMQOS_FG, pmem_, src_, len);
+	pmemqos_memset_nodrain(qos_, PMEMQOS_BG, pmem_ + len, 'z', 1000);
+	pmemqos_drain(qos_, PMEMQOS_FG);
+	ck_assert_mem_eq(src_, pmem_, len);
+	for (size_t i = 0; i < 1000; ++i)
+		ck_assert_int_eq('z', pmem_[len + i]);
+
+	struct pmemqos_stats fg, bg;
+	pmemqos_stats(qos_, PMEMQOS_FG, &fg);
+	pmemqos_stats(qos_, PMEMQOS_BG, &bg);
+	ck_assert_uint_eq(len, fg.bytes);
+	ck_assert_uint_eq(1, fg.nwrite);
+	ck_assert_uint_eq(1, fg.ndrain);
+	ck_assert_uint_eq(0, fg.throttled_ns);
+	ck_assert_uint_eq(1000, bg.bytes);
+	ck_assert_uint_eq(1, bg.nwrite);
+	ck_assert_uint_eq(0, bg.ndrain);
+	ck_assert_uint_gt(fg.elapsed_ns, 0);
+
+	pmemqos_reset_stats(qos_);
+	pmemqos_stats(qos_, PMEMQOS_FG, &fg);
+	ck_assert_uint_eq(0, fg.bytes);
+	ck_assert_uint_eq(0, fg.nwrite);
+}
+END_TEST
+
+START_TEST(memmove_overlap_OK)
+{
+	memcpy(pmem_, src_, 3 * PMEMQOS_CHUNK);
+	/* forwards, then backwards, over chunk boundaries */
+	pmemqos_memmove_nodrain(qos_, PMEMQOS_BG, pmem_ + 1000, pmem_,
+		2 * PMEMQOS_CHUNK);
+	ck_assert_mem_eq(src_, pmem_ + 1000, 2 * PMEMQOS_CHUNK);
+	pmemqos_memmove_nodrain(qos_, PMEMQOS_BG, pmem_, pmem_ + 1000,
+		2 * PMEMQOS_CHUNK);
+	ck_assert_mem_eq(src_, pmem_, 2 * PMEMQOS_CHUNK);
+	pmemqos_drain(qos_, PMEMQOS_BG);
+}
+END_TEST
+
+START_TEST(fg_limit_OK)
+{
+	/* 1 MiB at 10 MB/s is 100 ms, less the burst */
+	success(pmemqos_set_limit(qos_, PMEMQOS_FG, 10000000,
+		PMEMQOS_CHUNK));
+	const uint64_t ns = write_timed(PMEMQOS_FG, 1 << 20);
+	ck_assert_uint_ge(ns, 80000000);
+	ck_assert_mem_eq(src_, pmem_, 1 << 20);
+
+	struct pmemqos_stats st;
+	pmemqos_stats(qos_, PMEMQOS_FG, &st);
+	ck_assert_uint_gt(st.throttled_ns, 50000000);
+	ck_assert_uint_le(st.throttled_ns, ns);
+}
+END_TEST
+
+START_TEST(bg_idle_OK)
+{
+	/* at 1 MB/s this would be a second, but nothing is in the way */
+	success(pmemqos_set_limit(qos_, PMEMQOS_BG, 1000000,
+		PMEMQOS_CHUNK));
+	write_timed(PMEMQOS_BG, 1 << 20);
+	struct pmemqos_stats st;
+	pmemqos_stats(qos_, PMEMQOS_BG, &st);
+	ck_assert_uint_eq(0, st.throttled_ns);
+}
+END_TEST
+
+START_TEST(bg_throttled_OK)
+{
+	success(pmemqos_set_limit(qos_, PMEMQOS_BG, 1000000,
+		PMEMQOS_CHUNK));
+	/*
+	 * Right after a foreground write, the first chunk is the burst and
+	 * the second waits 64 ms for tokens; by the third the foreground
+	 * is idle. The pages are faulted in first, not to take that long.
+	 */
+	memset(pmem_, 0, 3 * PMEMQOS_CHUNK);
+	write_timed(PMEMQOS_FG, 64);
+	const uint64_t ns = write_timed(PMEMQOS_BG, 3 * PMEMQOS_CHUNK);
+	struct pmemqos_stats st;
+	pmemqos_stats(qos_, PMEMQOS_BG, &st);
+	ck_assert_uint_gt(st.throttled_ns, 30000000);
+	ck_assert_uint_lt(st.throttled_ns, 200000000);
+	ck_assert_uint_ge(ns, st.throttled_ns);
+	ck_assert_mem_eq(src_, pmem_, 3 * PMEMQOS_CHUNK);
+}
+END_TEST
+
+static void *thread_write(void *arg)
+{
+	const size_t t = (size_t)(intptr_t)arg;
+	const size_t slice = POOLSIZE / NTHREAD;
+	for (size_t off = 0; off < slice; off += 4096) {
+		pmemqos_memmove_nodrain(qos_, t % 2 ? PMEMQOS_BG : PMEMQOS_FG,
+			pmem_ + t * slice + off, src_ + t * slice + off, 4096);
+		pmemqos_drain(qos_, t % 2 ? PMEMQOS_BG : PMEMQOS_FG);
+	}
+	return NULL;
+}
+
+START_TEST(threads_OK)
+{
+	success(pmemqos_set_limit(qos_, PMEMQOS_FG, 1ULL << 30,
+		PMEMQOS_CHUNK));
+	success(pmemqos_set_limit(qos_, PMEMQOS_BG, 1ULL << 30,
+		PMEMQOS_CHUNK));
+	pthread_t th[NTHREAD];
+	for (int i = 0; i < NTHREAD; ++i)
+		success(pthread_create(&th[i], NULL, thread_write,
+			(void *)(intptr_t)i));
+	for (int i = 0; i < NTHREAD; ++i)
+		success(pthread_join(th[i], NULL));
+	ck_assert_mem_eq(src_, pmem_, POOLSIZE);
+
+	struct pmemqos_stats fg, bg;
+	pmemqos_stats(qos_, PMEMQOS_FG, &fg);
+	pmemqos_stats(qos_, PMEMQOS_BG, &bg);
+	ck_assert_uint_eq(POOLSIZE / 2, fg.bytes);
+	ck_assert_uint_eq(POOLSIZE / 2, bg.bytes);
+	ck_assert_uint_eq(POOLSIZE / 2 / 4096, fg.nwrite);
+	ck_assert_uint_eq(POOLSIZE / 2 / 4096, bg.ndrain);
+}
+END_TEST
+
+int main()
+{
+	TCase *const tcase_dax = tcase_create("DAX");
+	tcase_add_unchecked_fixture(tcase_dax, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax, setup, teardown);
+	tcase_add_test(tcase_dax, set_limit_EINVAL);
+	tcase_add_test(tcase_dax, unlimited_OK);
+	tcase_add_test(tcase_dax, memmove_overlap_OK);
+	tcase_add_test(tcase_dax, fg_limit_OK);
+	tcase_add_test(tcase_dax, bg_idle_OK);
+	tcase_add_test(tcase_dax, bg_throttled_OK);
+	tcase_add_test(tcase_dax, threads_OK);
+
+	TCase *const tcase_nondax = tcase_create("non-DAX");
+	tcase_add_unchecked_fixture(tcase_nondax, setup_once_nondaxfs, NULL);
+	tcase_add_checked_fixture(tcase_nondax, setup, teardown);
+	tcase_add_test(tcase_nondax, set_limit_EINVAL);
+	tcase_add_test(tcase_nondax, unlimited_OK);
+	tcase_add_test(tcase_nondax, memmove_overlap_OK);
+	tcase_add_test(tcase_nondax, fg_limit_OK);
+	tcase_add_test(tcase_nondax, bg_idle_OK);
+	tcase_add_test(tcase_nondax, bg_throttled_OK);
+	tcase_add_test(tcase_nondax, threads_OK);
+
+	Suite *const suite = suite_create("pmemqos");
+	suite_add_tcase(suite, tcase_dax);
+	suite_add_tcase(suite, tcase_nondax);
+
+	SRunner *const srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	const int failed = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+
+	return !!failed;
+}
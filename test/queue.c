@@ -0,0 +1,427 @@
+#include "config.h" /* should be included first */
+
+#include <check.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkplus.h"
+#include "pmemqueue.h"
+
+#ifndef DIR_DAX
+#define DIR_DAX "/mnt/pmem0/tmp"
+#endif
+#ifndef DIR_NONDAX
+#define DIR_NONDAX "/tmp"
+#endif
+#define FILE_A "foo"
+
+#define POOLSIZE PMEMQUEUE_MIN_POOL
+#define ITEMSIZE 64
+#define NTHREAD  4
+#define NITEM    2000 /* per producer of threads_OK */
+
+/* of the on-media layout, for the tests that tamper with it */
+#define HDR_SIZE  4096
+#define SLOT_HDR  32
+#define STRIDE    128
+
+/* global variables */
+static PMEMqueue *pqp_ = NULL;
+
+/* util functions */
+static void fill(char *buf, size_t len, uint64_t tag)
+{
+	for (size_t i = 0; i < len; ++i)
+		buf[i] = (char)(tag * 31 + i);
+}
+
+static void enqueue(uint64_t tag, size_t len)
+{
+	char buf[ITEMSIZE];
+	fill(buf, len, tag);
+	success(pmemqueue_enqueue(pqp_, buf, len));
+}
+
+static void dequeue(uint64_t tag, size_t len)
+{
+	char buf[ITEMSIZE], exp[ITEMSIZE];
+	fill(exp, len, tag);
+	ck_assert_int_eq((ssize_t)len, pmemqueue_dequeue(pqp_, buf));
+	ck_assert_mem_eq(exp, buf, len);
+}
+
+static void dequeue_EAGAIN(void)
+{
+	char buf[ITEMSIZE];
+	errno = 0;
+	ck_assert_int_eq(-1, pmemqueue_dequeue(pqp_, buf));
+	error(EAGAIN);
+}
+
+static void reopen(void)
+{
+	pmemqueue_close(pqp_);
+	pqp_ = pmemqueue_open(FILE_A);
+	ck_assert_ptr_nonnull(pqp_);
+}
+
+/* overwrites the pool behind the closed queue */
+static void poke(uint64_t slot, size_t off, const void *buf, size_t len)
+{
+	const int fd = open(FILE_A, O_RDWR);
+	opened(fd);
+	const off_t pos = (off_t)(HDR_SIZE + slot * STRIDE + off);
+	ck_assert_int_eq((ssize_t)len, pwrite(fd, buf, len, pos));
+	success(close(fd));
+}
+
+/* fixtures */
+static void setup_once_daxfs(void)
+{
+	success(chdir(DIR_DAX));
+}
+
+static void setup_once_nondaxfs(void)
+{
+	success(chdir(DIR_NONDAX));
+}
+
+static void setup(void)
+{
+	unlink(FILE_A); /* DO NOT assert */
+	errno = 0;
+	failure(access(FILE_A, F_OK));
+	error(ENOENT);
+
+	pqp_ = pmemqueue_create(FILE_A, POOLSIZE, ITEMSIZE, 0600);
+	ck_assert_ptr_nonnull(pqp_);
+}
+
+static void teardown(void)
+{
+	if (pqp_) {
+		pmemqueue_close(pqp_);
+		pqp_ = NULL;
+	}
+}
+
+/* test cases */
+START_TEST(create_EINVAL)
+{
+	unlink(FILE_A);
+	errno = 0;
+	ck_assert_ptr_null(pmemqueue_create(FILE_A, POOLSIZE - 1, ITEMSIZE,
+		0600));
+	error(EINVAL);
+	errno = 0;
+	ck_assert_ptr_null(pmemqueue_create(FILE_A, POOLSIZE, 0, 0600));
+	error(EINVAL);
+	/* not two slots */
+	errno = 0;
+	ck_assert_ptr_null(pmemqueue_create(FILE_A, POOLSIZE, POOLSIZE / 2,
+		0600));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(open_EINVAL)
+{
+	pmemqueue_close(pqp_);
+	pqp_ = NULL;
+	const char zero[8] = {0};
+	const int fd = open(FILE_A, O_RDWR);
+	opened(fd);
+	ck_assert_int_eq(8, pwrite(fd, zero, 8, 0));
+	success(close(fd));
+
+	errno = 0;
+	ck_assert_ptr_null(pmemqueue_open(FILE_A));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(geometry_OK)
+{
+	ck_assert_uint_eq(ITEMSIZE, pmemqueue_itemsize(pqp_));
+	/* the most slots that fit, rounded down to a power of 2 */
+	const size_t nslot = pmemqueue_nslot(pqp_);
+	ck_assert_uint_eq(0, nslot & (nslot - 1));
+	ck_assert_uint_le(HDR_SIZE + nslot * STRIDE, POOLSIZE);
+	ck_assert_uint_gt(HDR_SIZE + nslot * 2 * STRIDE, POOLSIZE);
+	ck_assert_uint_eq(0, pmemqueue_nhole(pqp_));
+}
+END_TEST
+
+START_TEST(fifo_OK)
+{
+	dequeue_EAGAIN();
+	for (uint64_t i = 0; i < 1000; ++i)
+		enqueue(i, i % (ITEMSIZE + 1));
+	for (uint64_t i = 0; i < 1000; ++i)
+		dequeue(i, i % (ITEMSIZE + 1));
+	dequeue_EAGAIN();
+}
+END_TEST
+
+START_TEST(enqueue_EINVAL)
+{
+	char buf[ITEMSIZE + 1] = {0};
+	errno = 0;
+	failure(pmemqueue_enqueue(pqp_, buf, sizeof(buf)));
+	error(EINVAL);
+	dequeue_EAGAIN();
+}
+END_TEST
+
+START_TEST(full_EAGAIN)
+{
+	const size_t nslot = pmemqueue_nslot(pqp_);
+	for (uint64_t i = 0; i < nslot; ++i)
+		enqueue(i, ITEMSIZE);
+	char buf[ITEMSIZE] = {0};
+	errno = 0;
+	failure(pmemqueue_enqueue(pqp_, buf, sizeof(buf)));
+	error(EAGAIN);
+
+	dequeue(0, ITEMSIZE);
+	enqueue(nslot, ITEMSIZE);
+	for (uint64_t i = 1; i <= nslot; ++i)
+		dequeue(i, ITEMSIZE);
+	dequeue_EAGAIN();
+}
+END_TEST
+
+START_TEST(batch_OK)
+{
+	const size_t nslot = pmemqueue_nslot(pqp_);
+	for (uint64_t i = 0; i < nslot - 2; ++i)
+		enqueue(i, 8);
+
+	char buf[5][ITEMSIZE];
+	struct iovec iov[5];
+	for (int i = 0; i < 5; ++i) {
+		fill(buf[i], 8, nslot - 2 + (uint64_t)i);
+		iov[i].iov_base = buf[i];
+		iov[i].iov_len = 8;
+	}
+	/* only the first two fit */
+	ck_assert_int_eq(2, pmemqueue_enqueue_batch(pqp_, iov, 5));
+	errno = 0;
+	failure(pmemqueue_enqueue_batch(pqp_, iov + 2, 3));
+	error(EAGAIN);
+
+	/* a batch with an item too large enqueues nothing */
+	iov[1].iov_len = ITEMSIZE + 1;
+	dequeue(0, 8);
+	errno = 0;
+	failure(pmemqueue_enqueue_batch(pqp_, iov, 2));
+	error(EINVAL);
+
+	for (uint64_t i = 1; i < nslot; ++i)
+		dequeue(i, 8);
+	dequeue_EAGAIN();
+}
+END_TEST
+
+static void *producer(void *arg)
+{
+	const uint64_t t = (uint64_t)(intptr_t)arg;
+	for (uint64_t i = 0; i < NITEM; ++i) {
+		const uint64_t item[2] = {t, i};
+		while (pmemqueue_enqueue(pqp_, item, sizeof(item)) != 0) {
+			ck_assert_int_eq(EAGAIN, errno);
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static unsigned char seen_[NTHREAD][NITEM];
+static long ndequeued_ = 0;
+
+static void *consumer(void *arg)
+{
+	(void)arg;
+	uint64_t last[NTHREAD];
+	memset(last, 0xFF, sizeof(last));
+	while (__atomic_load_n(&ndequeued_, __ATOMIC_SEQ_CST)
+			< (long)NTHREAD * NITEM) {
+		uint64_t item[ITEMSIZE / 8];
+		const ssize_t len = pmemqueue_dequeue(pqp_, item);
+		if (len == -1) {
+			ck_assert_int_eq(EAGAIN, errno);
+			sched_yield();
+			continue;
+		}
+		ck_assert_int_eq(16, len);
+		ck_assert_uint_lt(item[0], NTHREAD);
+		ck_assert_uint_lt(item[1], NITEM);
+		/* the items of a producer come in its order */
+		ck_assert(last[item[0]] == UINT64_MAX
+			|| last[item[0]] < item[1]);
+		last[item[0]] = item[1];
+		ck_assert_int_eq(0, __atomic_exchange_n(
+			&seen_[item[0]][item[1]], 1, __ATOMIC_SEQ_CST));
+		__atomic_add_fetch(&ndequeued_, 1, __ATOMIC_SEQ_CST);
+	}
+	return NULL;
+}
+
+START_TEST(threads_OK)
+{
+	memset(seen_, 0, sizeof(seen_));
+	ndequeued_ = 0;
+	pthread_t th[NTHREAD * 2];
+	for (int i = 0; i < NTHREAD; ++i) {
+		success(pthread_create(&th[i], NULL, producer,
+			(void *)(intptr_t)i));
+		success(pthread_create(&th[NTHREAD + i], NULL, consumer,
+			NULL));
+	}
+	for (int i = 0; i < NTHREAD * 2; ++i)
+		success(pthread_join(th[i], NULL));
+
+	for (int t = 0; t < NTHREAD; ++t)
+		for (int i = 0; i < NITEM; ++i)
+			ck_assert_int_eq(1, seen_[t][i]);
+	dequeue_EAGAIN();
+}
+END_TEST
+
+START_TEST(reopen_OK)
+{
+	const size_t nslot = pmemqueue_nslot(pqp_);
+	/* around the ring once and a half, leaving 100 items */
+	uint64_t head = 0, tail = 0;
+	while (tail < nslot * 3 / 2) {
+		enqueue(tail++, 16);
+		if (tail > 100)
+			dequeue(head++, 16);
+	}
+	reopen();
+	ck_assert_uint_eq(0, pmemqueue_nhole(pqp_));
+
+	enqueue(tail++, 16);
+	while (head < tail)
+		dequeue(head++, 16);
+	dequeue_EAGAIN();
+
+	/* and empty */
+	reopen();
+	dequeue_EAGAIN();
+	for (uint64_t i = 0; i < nslot; ++i)
+		enqueue(i, 8);
+	for (uint64_t i = 0; i < nslot; ++i)
+		dequeue(i, 8);
+}
+END_TEST
+
+START_TEST(torn_hole_OK)
+{
+	for (uint64_t i = 0; i < 5; ++i)
+		enqueue(i, 32);
+	pmemqueue_close(pqp_);
+	pqp_ = NULL;
+
+	/* the item of position 2 did not all reach the media */
+	const char junk = 0x7F;
+	poke(2, SLOT_HDR + 7, &junk, 1);
+	pqp_ = pmemqueue_open(FILE_A);
+	ck_assert_ptr_nonnull(pqp_);
+	ck_assert_uint_eq(1, pmemqueue_nhole(pqp_));
+
+	dequeue(0, 32);
+	dequeue(1, 32);
+	dequeue(3, 32);
+	dequeue(4, 32);
+	dequeue_EAGAIN();
+
+	/* the hole is gone for good */
+	reopen();
+	ck_assert_uint_eq(0, pmemqueue_nhole(pqp_));
+	dequeue_EAGAIN();
+}
+END_TEST
+
+START_TEST(unwritten_hole_OK)
+{
+	for (uint64_t i = 0; i < 4; ++i)
+		enqueue(i, 32);
+	pmemqueue_close(pqp_);
+	pqp_ = NULL;
+
+	/* position 1 was taken, but its item not written at all */
+	const uint64_t seq = 1;
+	poke(1, 0, &seq, sizeof(seq));
+	pqp_ = pmemqueue_open(FILE_A);
+	ck_assert_ptr_nonnull(pqp_);
+	ck_assert_uint_eq(1, pmemqueue_nhole(pqp_));
+
+	/* nor were the last ones: they are dropped, not holes */
+	pmemqueue_close(pqp_);
+	pqp_ = NULL;
+	poke(1, 0, &seq, sizeof(seq));
+	const uint64_t seq3 = 3;
+	poke(3, 0, &seq3, sizeof(seq3));
+	pqp_ = pmemqueue_open(FILE_A);
+	ck_assert_ptr_nonnull(pqp_);
+	ck_assert_uint_eq(1, pmemqueue_nhole(pqp_));
+
+	dequeue(0, 32);
+	dequeue(2, 32);
+	dequeue_EAGAIN();
+	enqueue(9, 32);
+	dequeue(9, 32);
+}
+END_TEST
+
+int main()
+{
+	TCase *const tcase_dax = tcase_create("DAX");
+	tcase_add_unchecked_fixture(tcase_dax, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax, setup, teardown);
+	tcase_add_test(tcase_dax, create_EINVAL);
+	tcase_add_test(tcase_dax, open_EINVAL);
+	tcase_add_test(tcase_dax, geometry_OK);
+	tcase_add_test(tcase_dax, fifo_OK);
+	tcase_add_test(tcase_dax, enqueue_EINVAL);
+	tcase_add_test(tcase_dax, full_EAGAIN);
+	tcase_add_test(tcase_dax, batch_OK);
+	tcase_add_test(tcase_dax, threads_OK);
+	tcase_add_test(tcase_dax, reopen_OK);
+	tcase_add_test(tcase_dax, torn_hole_OK);
+	tcase_add_test(tcase_dax, unwritten_hole_OK);
+
+	TCase *const tcase_nondax = tcase_create("non-DAX");
+	tcase_add_unchecked_fixture(tcase_nondax, setup_once_nondaxfs, NULL);
+	tcase_add_checked_fixture(tcase_nondax, setup, teardown);
+	tcase_add_test(tcase_nondax, create_EINVAL);
+	tcase_add_test(tcase_nondax, open_EINVAL);
+	tcase_add_test(tcase_nondax, geometry_OK);
+	tcase_add_test(tcase_nondax, fifo_OK);
+	tcase_add_test(tcase_nondax, enqueue_EINVAL);
+	tcase_add_test(tcase_nondax, full_EAGAIN);
+	tcase_add_test(tcase_nondax, batch_OK);
+	tcase_add_test(tcase_nondax, threads_OK);
+	tcase_add_test(tcase_nondax, reopen_OK);
+	tcase_add_test(tcase_nondax, torn_hole_OK);
+	tcase_add_test(tcase_nondax, unwritten_hole_OK);
+
+	Suite *const suite = suite_create("pmemqueue");
+	suite_add_tcase(suite, tcase_dax);
+	suite_add_tcase(suite, tcase_nondax);
+
+	SRunner *const srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	const int failed = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+
+	return !!failed;
+}
@@ -0,0 +1,360 @@
+#include "config.h" /* should be included first */
+
+#include <check.h>
+#include <errno.h>
+#include <libpmemlog.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkplus.h"
+#include "pmemlogrepl.h"
+
+#ifndef DIR_DAX
+#define DIR_DAX "/mnt/pmem0/tmp"
+#endif
+#ifndef DIR_NONDAX
+#define DIR_NONDAX "/tmp"
+#endif
+#define FILE_A "foo"
+#define FILE_B "bar"
+
+#define POOLSIZE ((size_t)(32 << 20))
+#define RSIZE    100 /* of the records of threads_OK */
+#define NTHREAD  4
+#define NREC     500 /* per thread */
+
+/* global variables */
+static PMEMlogpool *primary_ = NULL;
+static PMEMlogpool *mirror_ = NULL;
+static PMEMlogrepl *prl_ = NULL;
+
+/* what a walk returned */
+struct walked {
+	char *buf;
+	size_t len;
+};
+
+/* util functions */
+static uint64_t rand_next(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static void fill_random(char *buf, size_t len, uint64_t seed)
+{
+	for (size_t i = 0; i < len; ++i)
+		buf[i] = (char)rand_next(&seed);
+}
+
+/* callback function passed to pmemlog_walk() */
+static int collect(const void *buf, size_t len, void *arg)
+{
+	struct walked *const w = arg;
+	w->buf = realloc(w->buf, w->len + len + 1);
+	ck_assert_ptr_nonnull(w->buf);
+	memcpy(w->buf + w->len, buf, len);
+	w->len += len;
+	return 1;
+}
+
+/* the mirror holds exactly what the primary does */
+static void assert_mirrored(void)
+{
+	struct walked p = {NULL, 0}, m = {NULL, 0};
+	pmemlog_walk(primary_, 0, collect, &p);
+	pmemlog_walk(mirror_, 0, collect, &m);
+	ck_assert_uint_eq(p.len, m.len);
+	if (p.len)
+		ck_assert_mem_eq(p.buf, m.buf, p.len);
+	ck_assert_int_eq(pmemlog_tell(primary_), pmemlog_tell(mirror_));
+	free(p.buf);
+	free(m.buf);
+}
+
+static void reopen_repl(void)
+{
+	pmemlogrepl_close(prl_);
+	prl_ = pmemlogrepl_open(primary_, mirror_);
+	ck_assert_ptr_nonnull(prl_);
+}
+
+/* fixtures */
+static void setup_once_daxfs(void)
+{
+	success(chdir(DIR_DAX));
+}
+
+static void setup_once_nondaxfs(void)
+{
+	success(chdir(DIR_NONDAX));
+}
+
+static void setup(void)
+{
+	unlink(FILE_A); /* DO NOT assert */
+	unlink(FILE_B); /* DO NOT assert */
+	errno = 0;
+	failure(access(FILE_A, F_OK));
+	error(ENOENT);
+
+	primary_ = pmemlog_create(FILE_A, POOLSIZE, 0600);
+	ck_assert_ptr_nonnull(primary_);
+	mirror_ = pmemlog_create(FILE_B, POOLSIZE, 0600);
+	ck_assert_ptr_nonnull(mirror_);
+	prl_ = pmemlogrepl_open(primary_, mirror_);
+	ck_assert_ptr_nonnull(prl_);
+}
+
+static void teardown(void)
+{
+	if (prl_) {
+		pmemlogrepl_close(prl_);
+		prl_ = NULL;
+	}
+	if (primary_) {
+		pmemlog_close(primary_);
+		primary_ = NULL;
+	}
+	if (mirror_) {
+		pmemlog_close(mirror_);
+		mirror_ = NULL;
+	}
+	unlink(FILE_A);
+	unlink(FILE_B);
+}
+
+/* test cases */
+START_TEST(empty_OK)
+{
+	success(pmemlogrepl_sync(prl_));
+	ck_assert_int_eq(0, pmemlogrepl_acked(prl_));
+	assert_mirrored();
+}
+END_TEST
+
+START_TEST(append_sync_OK)
+{
+	char buf[1000];
+	fill_random(buf, sizeof(buf), 1);
+	/* records of every length up to 1000 bytes, and of none */
+	size_t total = 0;
+	for (size_t n = 0; n <= sizeof(buf); ++n) {
+		success(pmemlogrepl_append(prl_, buf, n));
+		total += n;
+	}
+	ck_assert_int_eq((long long)total, pmemlog_tell(primary_));
+	success(pmemlogrepl_sync(prl_));
+	ck_assert_int_eq((long long)total, pmemlogrepl_acked(prl_));
+	assert_mirrored();
+
+	struct pmemlogrepl_stats st;
+	pmemlogrepl_stats(prl_, &st);
+	ck_assert_uint_eq(total, st.bytes);
+	ck_assert_uint_eq(sizeof(buf) + 1, st.nrec);
+	ck_assert_uint_ge(st.nbatch, 1);
+	ck_assert_uint_le(st.lag_ns_sum / st.nrec, st.lag_ns_max);
+}
+END_TEST
+
+START_TEST(large_record_OK)
+{
+	/* split into pieces, and around the ring more than once */
+	const size_t len = PMEMLOGREPL_RING + 12345;
+	char *const buf = malloc(len);
+	ck_assert_ptr_nonnull(buf);
+	for (int i = 0; i < 3; ++i) {
+		fill_random(buf, len, (uint64_t)i + 1);
+		success(pmemlogrepl_append(prl_, buf, len));
+	}
+	success(pmemlogrepl_sync(prl_));
+	assert_mirrored();
+
+	struct pmemlogrepl_stats st;
+	pmemlogrepl_stats(prl_, &st);
+	ck_assert_uint_eq(3, st.nrec);
+	ck_assert_uint_eq(3 * len, st.bytes);
+	free(buf);
+}
+END_TEST
+
+START_TEST(catchup_OK)
+{
+	char buf[4096];
+	fill_random(buf, sizeof(buf), 2);
+	success(pmemlogrepl_append(prl_, buf, 1000));
+	success(pmemlogrepl_sync(prl_));
+
+	/* as if these had been in the ring at a crash */
+	pmemlogrepl_close(prl_);
+	prl_ = NULL;
+	success(pmemlog_append(primary_, buf + 1000, 3000));
+	ck_assert_int_eq(1000, pmemlog_tell(mirror_));
+	prl_ = pmemlogrepl_open(primary_, mirror_);
+	ck_assert_ptr_nonnull(prl_);
+	ck_assert_int_eq(4000, pmemlogrepl_acked(prl_));
+	assert_mirrored();
+
+	/* and a new mirror takes everything */
+	pmemlogrepl_close(prl_);
+	prl_ = NULL;
+	pmemlog_close(mirror_);
+	unlink(FILE_B);
+	mirror_ = pmemlog_create(FILE_B, POOLSIZE, 0600);
+	ck_assert_ptr_nonnull(mirror_);
+	prl_ = pmemlogrepl_open(primary_, mirror_);
+	ck_assert_ptr_nonnull(prl_);
+	assert_mirrored();
+	success(pmemlogrepl_append(prl_, buf, sizeof(buf)));
+	success(pmemlogrepl_sync(prl_));
+	assert_mirrored();
+}
+END_TEST
+
+START_TEST(open_EINVAL)
+{
+	pmemlogrepl_close(prl_);
+	prl_ = NULL;
+	success(pmemlog_append(mirror_, "x", 1));
+	errno = 0;
+	ck_assert_ptr_null(pmemlogrepl_open(primary_, mirror_));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(close_OK)
+{
+	char buf[1000];
+	fill_random(buf, sizeof(buf), 3);
+	for (int i = 0; i < 100; ++i)
+		success(pmemlogrepl_append(prl_, buf, sizeof(buf)));
+	/* close replicates what is in the ring */
+	pmemlogrepl_close(prl_);
+	prl_ = NULL;
+	assert_mirrored();
+	prl_ = pmemlogrepl_open(primary_, mirror_);
+	ck_assert_ptr_nonnull(prl_);
+}
+END_TEST
+
+START_TEST(rewind_OK)
+{
+	char buf[1000];
+	fill_random(buf, sizeof(buf), 4);
+	success(pmemlogrepl_append(prl_, buf, sizeof(buf)));
+	pmemlogrepl_rewind(prl_);
+	ck_assert_int_eq(0, pmemlog_tell(primary_));
+	ck_assert_int_eq(0, pmemlog_tell(mirror_));
+	ck_assert_int_eq(0, pmemlogrepl_acked(prl_));
+	success(pmemlogrepl_append(prl_, buf, 10));
+	success(pmemlogrepl_sync(prl_));
+	assert_mirrored();
+	reopen_repl();
+	assert_mirrored();
+}
+END_TEST
+
+START_TEST(mirror_ENOSPC)
+{
+	/* a mirror smaller than the primary */
+	pmemlogrepl_close(prl_);
+	prl_ = NULL;
+	pmemlog_close(mirror_);
+	unlink(FILE_B);
+	mirror_ = pmemlog_create(FILE_B, POOLSIZE / 4, 0600);
+	ck_assert_ptr_nonnull(mirror_);
+	prl_ = pmemlogrepl_open(primary_, mirror_);
+	ck_assert_ptr_nonnull(prl_);
+
+	const size_t len = 1 << 20;
+	char *const buf = malloc(len);
+	ck_assert_ptr_nonnull(buf);
+	fill_random(buf, len, 5);
+	/* the primary goes on */
+	for (size_t n = 0; n < POOLSIZE / 2; n += len)
+		success(pmemlogrepl_append(prl_, buf, len));
+	errno = 0;
+	failure(pmemlogrepl_sync(prl_));
+	error(ENOSPC);
+	ck_assert_int_lt(pmemlogrepl_acked(prl_), pmemlog_tell(primary_));
+	ck_assert_int_eq(pmemlogrepl_acked(prl_), pmemlog_tell(mirror_));
+
+	/* until a rewind */
+	pmemlogrepl_rewind(prl_);
+	success(pmemlogrepl_append(prl_, buf, len));
+	success(pmemlogrepl_sync(prl_));
+	assert_mirrored();
+	free(buf);
+}
+END_TEST
+
+static void *thread_append(void *arg)
+{
+	const uint64_t t = (uint64_t)(intptr_t)arg;
+	char buf[RSIZE];
+	for (int i = 0; i < NREC; ++i) {
+		fill_random(buf, sizeof(buf), t * NREC + (uint64_t)i + 1);
+		success(pmemlogrepl_append(prl_, buf, sizeof(buf)));
+	}
+	return NULL;
+}
+
+START_TEST(threads_OK)
+{
+	pthread_t th[NTHREAD];
+	for (int i = 0; i < NTHREAD; ++i)
+		success(pthread_create(&th[i], NULL, thread_append,
+			(void *)(intptr_t)i));
+	for (int i = 0; i < NTHREAD; ++i)
+		success(pthread_join(th[i], NULL));
+	success(pmemlogrepl_sync(prl_));
+	ck_assert_int_eq(NTHREAD * NREC * RSIZE, pmemlog_tell(primary_));
+	assert_mirrored();
+}
+END_TEST
+
+int main()
+{
+	TCase *const tcase_dax = tcase_create("DAX");
+	tcase_add_unchecked_fixture(tcase_dax, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax, setup, teardown);
+	tcase_add_test(tcase_dax, empty_OK);
+	tcase_add_test(tcase_dax, append_sync_OK);
+	tcase_add_test(tcase_dax, large_record_OK);
+	tcase_add_test(tcase_dax, catchup_OK);
+	tcase_add_test(tcase_dax, open_EINVAL);
+	tcase_add_test(tcase_dax, close_OK);
+	tcase_add_test(tcase_dax, rewind_OK);
+	tcase_add_test(tcase_dax, mirror_ENOSPC);
+	tcase_add_test(tcase_dax, threads_OK);
+
+	TCase *const tcase_nondax = tcase_create("non-DAX");
+	tcase_add_unchecked_fixture(tcase_nondax, setup_once_nondaxfs, NULL);
+	tcase_add_checked_fixture(tcase_nondax, setup, teardown);
+	tcase_add_test(tcase_nondax, empty_OK);
+	tcase_add_test(tcase_nondax, append_sync_OK);
+	tcase_add_test(tcase_nondax, large_record_OK);
+	tcase_add_test(tcase_nondax, catchup_OK);
+	tcase_add_test(tcase_nondax, open_EINVAL);
+	tcase_add_test(tcase_nondax, close_OK);
+	tcase_add_test(tcase_nondax, rewind_OK);
+	tcase_add_test(tcase_nondax, mirror_ENOSPC);
+	tcase_add_test(tcase_nondax, threads_OK);
+
+	Suite *const suite = suite_create("pmemlogrepl");
+	suite_add_tcase(suite, tcase_dax);
+	suite_add_tcase(suite, tcase_nondax);
+
+	SRunner *const srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	const int failed = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+
+	return !!failed;
+}
@@ -0,0 +1,305 @@
+#include "config.h" /* should be included first */
+
+#include <check.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libpmemblk.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "checkplus.h"
+#include "pmemsnap.h"
+
+#ifndef DIR_DAX
+#define DIR_DAX "/mnt/pmem0/tmp"
+#endif
+#ifndef DIR_NONDAX
+#define DIR_NONDAX "/tmp"
+#endif
+#define FILE_A "foo"
+#define FILE_B "foo.snap"
+#define FILE_C "foo.img"
+
+#define BSIZE  ((size_t)512)
+#define NBLOCK 64
+
+/* global variables */
+static PMEMblkpool *pbp_ = NULL;
+static PMEMsnap *psp_ = NULL;
+
+/* util functions */
+static void fill(char *buf, char c)
+{
+	memset(buf, c, BSIZE);
+}
+
+static void write_all(char c)
+{
+	char buf[BSIZE];
+	fill(buf, c);
+	for (long long i = 0; i < NBLOCK; ++i)
+		success(pmemsnap_write(psp_, buf, i));
+}
+
+static void assert_block(int snapshot, long long blockno, char c)
+{
+	char buf[BSIZE], expected[BSIZE];
+	fill(expected, c);
+	if (snapshot)
+		success(pmemsnap_read(psp_, buf, blockno));
+	else
+		success(pmemblk_read(pbp_, buf, blockno));
+	ck_assert_mem_eq(expected, buf, BSIZE);
+}
+
+/* fixtures */
+static void setup_once_daxfs(void)
+{
+	success(chdir(DIR_DAX));
+}
+
+static void setup_once_nondaxfs(void)
+{
+	success(chdir(DIR_NONDAX));
+}
+
+static void setup(void)
+{
+	unlink(FILE_A); /* DO NOT assert */
+	unlink(FILE_B); /* DO NOT assert */
+	unlink(FILE_C); /* DO NOT assert */
+	errno = 0;
+	failure(access(FILE_A, F_OK));
+	error(ENOENT);
+
+	pbp_ = pmemblk_create(FILE_A, BSIZE, PMEMBLK_MIN_POOL, 0600);
+	ck_assert_ptr_nonnull(pbp_);
+	psp_ = pmemsnap_create(pbp_, FILE_B, pmemsnap_size(pbp_), 0600);
+	ck_assert_ptr_nonnull(psp_);
+}
+
+static void teardown(void)
+{
+	if (psp_) {
+		pmemsnap_close(psp_);
+		psp_ = NULL;
+	}
+	if (pbp_) {
+		pmemblk_close(pbp_);
+		pbp_ = NULL;
+	}
+}
+
+/* test cases */
+START_TEST(create_EINVAL)
+{
+	errno = 0;
+	ck_assert_ptr_null(pmemsnap_create(pbp_, FILE_C,
+		PMEMSNAP_MIN_SIZE - 1, 0600));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(open_EINVAL)
+{
+	/* the pool is not a snapshot file */
+	errno = 0;
+	ck_assert_ptr_null(pmemsnap_open(pbp_, FILE_A));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(begin_end_OK)
+{
+	ck_assert_int_eq(0, pmemsnap_active(psp_));
+	ck_assert_uint_eq(0, pmemsnap_epoch(psp_));
+
+	success(pmemsnap_begin(psp_));
+	ck_assert_int_eq(1, pmemsnap_active(psp_));
+	ck_assert_uint_eq(1, pmemsnap_epoch(psp_));
+
+	errno = 0;
+	failure(pmemsnap_begin(psp_));
+	error(EBUSY);
+
+	success(pmemsnap_end(psp_));
+	ck_assert_int_eq(0, pmemsnap_active(psp_));
+
+	errno = 0;
+	failure(pmemsnap_end(psp_));
+	error(EINVAL);
+
+	char buf[BSIZE];
+	errno = 0;
+	failure(pmemsnap_read(psp_, buf, 0));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(copy_on_write_OK)
+{
+	write_all('A');
+	success(pmemsnap_begin(psp_));
+
+	char buf[BSIZE];
+	fill(buf, 'B');
+	for (long long i = 0; i < NBLOCK / 2; ++i)
+		success(pmemsnap_write(psp_, buf, i));
+	/* the second write to a block does not save it again */
+	fill(buf, 'C');
+	success(pmemsnap_write(psp_, buf, 0));
+	success(pmemsnap_set_zero(psp_, NBLOCK - 1));
+
+	for (long long i = 0; i < NBLOCK; ++i)
+		assert_block(1, i, 'A');
+	assert_block(0, 0, 'C');
+	assert_block(0, 1, 'B');
+	assert_block(0, NBLOCK / 2, 'A');
+	assert_block(0, NBLOCK - 1, '\0');
+
+	/* a new snapshot sees the pool as it is now */
+	success(pmemsnap_end(psp_));
+	success(pmemsnap_begin(psp_));
+	ck_assert_uint_eq(2, pmemsnap_epoch(psp_));
+	write_all('D');
+	assert_block(1, 0, 'C');
+	assert_block(1, 1, 'B');
+	assert_block(1, NBLOCK / 2, 'A');
+	assert_block(1, NBLOCK - 1, '\0');
+}
+END_TEST
+
+START_TEST(write_EINVAL)
+{
+	char buf[BSIZE];
+	fill(buf, 'A');
+	errno = 0;
+	failure(pmemsnap_write(psp_, buf, -1));
+	error(EINVAL);
+	errno = 0;
+	failure(pmemsnap_write(psp_, buf, (long long)pmemblk_nblock(pbp_)));
+	error(EINVAL);
+}
+END_TEST
+
+START_TEST(write_ENOSPC)
+{
+	pmemsnap_close(psp_);
+	psp_ = NULL;
+	success(unlink(FILE_B));
+	psp_ = pmemsnap_create(pbp_, FILE_B, PMEMSNAP_MIN_SIZE, 0600);
+	ck_assert_ptr_nonnull(psp_);
+	success(pmemsnap_begin(psp_));
+
+	char buf[BSIZE];
+	fill(buf, 'A');
+	long long i = 0;
+	while (pmemsnap_write(psp_, buf, i) == 0)
+		++i;
+	error(ENOSPC);
+	ck_assert_int_lt(0, i);
+	ck_assert_int_lt(i, (long long)pmemblk_nblock(pbp_));
+
+	/* saved blocks are still writable */
+	success(pmemsnap_write(psp_, buf, 0));
+}
+END_TEST
+
+START_TEST(reopen_OK)
+{
+	write_all('A');
+	success(pmemsnap_begin(psp_));
+	char buf[BSIZE];
+	fill(buf, 'B');
+	success(pmemsnap_write(psp_, buf, 3));
+
+	pmemsnap_close(psp_);
+	psp_ = pmemsnap_open(pbp_, FILE_B);
+	ck_assert_ptr_nonnull(psp_);
+	ck_assert_int_eq(1, pmemsnap_active(psp_));
+	ck_assert_uint_eq(1, pmemsnap_epoch(psp_));
+
+	/* a block saved now does not take the slot of block 3 */
+	success(pmemsnap_write(psp_, buf, 4));
+	for (long long i = 0; i < NBLOCK; ++i)
+		assert_block(1, i, 'A');
+	assert_block(0, 3, 'B');
+	assert_block(0, 4, 'B');
+}
+END_TEST
+
+START_TEST(export_OK)
+{
+	write_all('A');
+	success(pmemsnap_begin(psp_));
+	write_all('B');
+
+	const int fd = open(FILE_C, O_RDWR|O_CREAT|O_EXCL, 0600);
+	opened(fd);
+	success(pmemsnap_export(psp_, fd, 3));
+
+	struct stat st;
+	success(fstat(fd, &st));
+	ck_assert_uint_eq(pmemblk_nblock(pbp_) * BSIZE, (size_t)st.st_size);
+
+	char buf[BSIZE], expected[BSIZE];
+	fill(expected, 'A');
+	for (long long i = 0; i < NBLOCK; ++i) {
+		ck_assert_int_eq(BSIZE, pread(fd, buf, BSIZE,
+			(off_t)(i * (long long)BSIZE)));
+		ck_assert_mem_eq(expected, buf, BSIZE);
+	}
+	success(close(fd));
+}
+END_TEST
+
+START_TEST(export_EINVAL)
+{
+	/* no snapshot */
+	errno = 0;
+	failure(pmemsnap_export(psp_, 1, 1));
+	error(EINVAL);
+}
+END_TEST
+
+int main()
+{
+	TCase *const tcase_dax = tcase_create("DAX");
+	tcase_add_unchecked_fixture(tcase_dax, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax, setup, teardown);
+	tcase_add_test(tcase_dax, create_EINVAL);
+	tcase_add_test(tcase_dax, open_EINVAL);
+	tcase_add_test(tcase_dax, begin_end_OK);
+	tcase_add_test(tcase_dax, copy_on_write_OK);
+	tcase_add_test(tcase_dax, write_EINVAL);
+	tcase_add_test(tcase_dax, write_ENOSPC);
+	tcase_add_test(tcase_dax, reopen_OK);
+	tcase_add_test(tcase_dax, export_OK);
+	tcase_add_test(tcase_dax, export_EINVAL);
+
+	TCase *const tcase_nondax = tcase_create("non-DAX");
+	tcase_add_unchecked_fixture(tcase_nondax, setup_once_nondaxfs, NULL);
+	tcase_add_checked_fixture(tcase_nondax, setup, teardown);
+	tcase_add_test(tcase_nondax, create_EINVAL);
+	tcase_add_test(tcase_nondax, open_EINVAL);
+	tcase_add_test(tcase_nondax, begin_end_OK);
+	tcase_add_test(tcase_nondax, copy_on_write_OK);
+	tcase_add_test(tcase_nondax, write_EINVAL);
+	tcase_add_test(tcase_nondax, write_ENOSPC);
+	tcase_add_test(tcase_nondax, reopen_OK);
+	tcase_add_test(tcase_nondax, export_OK);
+	tcase_add_test(tcase_nondax, export_EINVAL);
+
+	Suite *const suite = suite_create("pmemsnap");
+	suite_add_tcase(suite, tcase_dax);
+	suite_add_tcase(suite, tcase_nondax);
+
+	SRunner *const srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	const int failed = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+
+	return !!failed;
+}
@@ -0,0 +1,288 @@
+#include "config.h" /* should be included first */
+
+#include <check.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkplus.h"
+#include "pmemtrace.h"
+
+#ifndef DIR_DAX
+#define DIR_DAX "/mnt/pmem0/tmp"
+#endif
+#ifndef DIR_NONDAX
+#define DIR_NONDAX "/tmp"
+#endif
+#define FILE_A "foo"
+
+#define NREC 6
+
+/* global variables */
+static struct pmemtrace_hdr hdr_;
+static struct pmemtrace_rec rec_[NREC];
+static struct pmemtrace tr_;
+
+/* util functions */
+
+/* writes hdr_ and n records of rec_, whatever hdr_.nrec says */
+static void write_raw(size_t n)
+{
+	FILE *const fp = fopen(FILE_A, "wb");
+	ck_assert_ptr_nonnull(fp);
+	ck_assert_uint_eq(1, fwrite(&hdr_, sizeof(hdr_), 1, fp));
+	ck_assert_uint_eq(n, fwrite(rec_, sizeof(rec_[0]), n, fp));
+	success(fclose(fp));
+}
+
+static void assert_load_EINVAL(void)
+{
+	errno = 0;
+	failure(pmemtrace_load(FILE_A, &tr_));
+	error(EINVAL);
+	ck_assert_ptr_null(tr_.hdr);
+}
+
+/* fixtures */
+static void setup_once_daxfs(void)
+{
+	success(chdir(DIR_DAX));
+}
+
+static void setup_once_nondaxfs(void)
+{
+	success(chdir(DIR_NONDAX));
+}
+
+static void setup(void)
+{
+	unlink(FILE_A); /* DO NOT assert */
+	memset(&tr_, 0, sizeof(tr_));
+
+	memset(&hdr_, 0, sizeof(hdr_));
+	memcpy(hdr_.magic, PMEMTRACE_MAGIC, sizeof(hdr_.magic));
+	hdr_.version = PMEMTRACE_VERSION;
+	hdr_.nthread = 2;
+	hdr_.nrec = NREC;
+	hdr_.nblock = 16;
+	hdr_.bsize = 512;
+	hdr_.logsize = 1 << 20;
+	strcpy(hdr_.name, "test");
+
+	/* one of each op, and one more at the same time as the last */
+	memset(rec_, 0, sizeof(rec_));
+	for (int i = 0; i < NREC; ++i) {
+		rec_[i].ts = (uint64_t)(i < NREC - 1 ? i : i - 1) * 1000;
+		rec_[i].thread = (uint16_t)(i % 2);
+		rec_[i].op = (uint8_t)(i % PMEMTRACE_NOP);
+		rec_[i].offset = rec_[i].op <= PMEMTRACE_BLK_ZERO
+			? (uint64_t)i * 3 : 0;
+		rec_[i].size = rec_[i].op >= PMEMTRACE_LOG_APPEND ? 4096 : 0;
+	}
+}
+
+static void teardown(void)
+{
+	if (tr_.hdr)
+		pmemtrace_unload(&tr_);
+	unlink(FILE_A); /* DO NOT assert */
+}
+
+/* test cases */
+START_TEST(save_load_OK)
+{
+	success(pmemtrace_save(FILE_A, &hdr_, rec_));
+	success(pmemtrace_load(FILE_A, &tr_));
+	ck_assert_mem_eq(&hdr_, tr_.hdr, sizeof(hdr_));
+	ck_assert_mem_eq(rec_, tr_.rec, sizeof(rec_));
+	ck_assert_uint_eq(sizeof(hdr_) + sizeof(rec_), tr_.mapped_len);
+
+	pmemtrace_unload(&tr_);
+	ck_assert_ptr_null(tr_.hdr);
+	ck_assert_ptr_null(tr_.rec);
+
+	/* no records */
+	hdr_.nrec = 0;
+	success(pmemtrace_save(FILE_A, &hdr_, rec_));
+	success(pmemtrace_load(FILE_A, &tr_));
+	ck_assert_uint_eq(0, tr_.hdr->nrec);
+}
+END_TEST
+
+START_TEST(op_name_OK)
+{
+	ck_assert_str_eq("read", pmemtrace_op_name(PMEMTRACE_BLK_READ));
+	ck_assert_str_eq("walk", pmemtrace_op_name(PMEMTRACE_LOG_WALK));
+	ck_assert_str_eq("?", pmemtrace_op_name(PMEMTRACE_NOP));
+}
+END_TEST
+
+START_TEST(save_ENOENT)
+{
+	errno = 0;
+	failure(pmemtrace_save("nonexistent/" FILE_A, &hdr_, rec_));
+	error(ENOENT);
+}
+END_TEST
+
+START_TEST(load_ENOENT)
+{
+	errno = 0;
+	failure(pmemtrace_load(FILE_A, &tr_));
+	error(ENOENT);
+}
+END_TEST
+
+START_TEST(load_EINVAL_magic)
+{
+	hdr_.magic[0] = 'X';
+	write_raw(NREC);
+	assert_load_EINVAL();
+}
+END_TEST
+
+START_TEST(load_EINVAL_version)
+{
+	hdr_.version = PMEMTRACE_VERSION + 1;
+	write_raw(NREC);
+	assert_load_EINVAL();
+}
+END_TEST
+
+START_TEST(load_EINVAL_truncated)
+{
+	/* a record short */
+	write_raw(NREC);
+	success(truncate(FILE_A, (off_t)(sizeof(hdr_) + sizeof(rec_) - 1)));
+	assert_load_EINVAL();
+
+	/* the header short */
+	success(truncate(FILE_A, (off_t)sizeof(hdr_) - 1));
+	assert_load_EINVAL();
+
+	success(truncate(FILE_A, 0));
+	assert_load_EINVAL();
+}
+END_TEST
+
+START_TEST(load_EINVAL_nrec)
+{
+	/* fewer records than the header says */
+	write_raw(NREC - 1);
+	assert_load_EINVAL();
+
+	/* more */
+	hdr_.nrec = NREC - 1;
+	write_raw(NREC);
+	assert_load_EINVAL();
+
+	hdr_.nrec = UINT64_MAX;
+	write_raw(NREC);
+	assert_load_EINVAL();
+}
+END_TEST
+
+START_TEST(load_EINVAL_thread)
+{
+	rec_[1].thread = (uint16_t)hdr_.nthread;
+	write_raw(NREC);
+	assert_load_EINVAL();
+
+	setup();
+	hdr_.nthread = 0;
+	write_raw(NREC);
+	assert_load_EINVAL();
+}
+END_TEST
+
+START_TEST(load_EINVAL_offset)
+{
+	/* the last block is fine, the one past it is not */
+	rec_[1].offset = hdr_.nblock - 1;
+	write_raw(NREC);
+	success(pmemtrace_load(FILE_A, &tr_));
+	pmemtrace_unload(&tr_);
+
+	rec_[1].offset = hdr_.nblock;
+	write_raw(NREC);
+	assert_load_EINVAL();
+
+	/* appends of nothing, or of more than the log */
+	setup();
+	rec_[PMEMTRACE_LOG_APPEND].size = 0;
+	write_raw(NREC);
+	assert_load_EINVAL();
+
+	setup();
+	rec_[PMEMTRACE_LOG_APPEND].size = (uint32_t)hdr_.logsize + 1;
+	write_raw(NREC);
+	assert_load_EINVAL();
+
+	/* not an op */
+	setup();
+	rec_[1].op = PMEMTRACE_NOP;
+	write_raw(NREC);
+	assert_load_EINVAL();
+}
+END_TEST
+
+START_TEST(load_EINVAL_ts)
+{
+	/* the same time is fine, an earlier one is not */
+	rec_[3].ts = rec_[2].ts;
+	write_raw(NREC);
+	success(pmemtrace_load(FILE_A, &tr_));
+	pmemtrace_unload(&tr_);
+
+	rec_[3].ts = rec_[2].ts - 1;
+	write_raw(NREC);
+	assert_load_EINVAL();
+}
+END_TEST
+
+int main()
+{
+	TCase *const tcase_dax = tcase_create("DAX");
+	tcase_add_unchecked_fixture(tcase_dax, setup_once_daxfs, NULL);
+	tcase_add_checked_fixture(tcase_dax, setup, teardown);
+	tcase_add_test(tcase_dax, save_load_OK);
+	tcase_add_test(tcase_dax, op_name_OK);
+	tcase_add_test(tcase_dax, save_ENOENT);
+	tcase_add_test(tcase_dax, load_ENOENT);
+	tcase_add_test(tcase_dax, load_EINVAL_magic);
+	tcase_add_test(tcase_dax, load_EINVAL_version);
+	tcase_add_test(tcase_dax, load_EINVAL_truncated);
+	tcase_add_test(tcase_dax, load_EINVAL_nrec);
+	tcase_add_test(tcase_dax, load_EINVAL_thread);
+	tcase_add_test(tcase_dax, load_EINVAL_offset);
+	tcase_add_test(tcase_dax, load_EINVAL_ts);
+
+	TCase *const tcase_nondax = tcase_create("non-DAX");
+	tcase_add_unchecked_fixture(tcase_nondax, setup_once_nondaxfs, NULL);
+	tcase_add_checked_fixture(tcase_nondax, setup, teardown);
+	tcase_add_test(tcase_nondax, save_load_OK);
+	tcase_add_test(tcase_nondax, op_name_OK);
+	tcase_add_test(tcase_nondax, save_ENOENT);
+	tcase_add_test(tcase_nondax, load_ENOENT);
+	tcase_add_test(tcase_nondax, load_EINVAL_magic);
+	tcase_add_test(tcase_nondax, load_EINVAL_version);
+	tcase_add_test(tcase_nondax, load_EINVAL_truncated);
+	tcase_add_test(tcase_nondax, load_EINVAL_nrec);
+	tcase_add_test(tcase_nondax, load_EINVAL_thread);
+	tcase_add_test(tcase_nondax, load_EINVAL_offset);
+	tcase_add_test(tcase_nondax, load_EINVAL_ts);
+
+	Suite *const suite = suite_create("pmemtrace");
+	suite_add_tcase(suite, tcase_dax);
+	suite_add_tcase(suite, tcase_nondax);
+
+	SRunner *const srunner = srunner_create(suite);
+	srunner_run_all(srunner, CK_NORMAL);
+	const int failed = srunner_ntests_failed(srunner);
+	srunner_free(srunner);
+
+	return !!failed;
+}
@@ -0,0 +1,244 @@
+#include "config.h" /* should be included first */
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfplus.h"
+#include "pmemtrace.h"
+
+/*
+ * Usage: tracegen [-p seq|zipf|burst] [-n nrec] [-t nthread] [-r ops/s]
+ *                 [-b nblock] [-l log-MiB] [-s theta]
+ *                 [-m read,write,zero,append,walk] file
+ *
+ * Writes a trace of nrec operations for perf_replay to file. The ops are
+ * drawn by the percentages of -m, and arrive at ops/s on average:
+ *
+ *   seq    at a fixed interval; each thread goes through a range of
+ *          blocks of its own in order
+ *   zipf   as a Poisson process; blocks are drawn from a Zipf
+ *          distribution of parameter theta, with the hot blocks spread
+ *          over the pool
+ *   burst  as a Poisson process that brings half of the ops in the first
+ *          BURST_ON of every BURST_PERIOD; blocks are uniform
+ *
+ * Appends are of 64 B to 4 KiB, in powers of 2; a walk goes through the
+ * whole log in chunks of 4 KiB.
+ */
+
+#define BSIZE        4096
+#define BURST_PERIOD 100000000ULL /* ns */
+#define BURST_ON     10000000ULL
+
+enum pattern { SEQ, ZIPF, BURST };
+
+static uint64_t seed_ = 1;
+
+/* util functions */
+static double uniform(void)
+{
+	return (double)(perf_rand(&seed_) >> 11) * 0x1p-53;
+}
+
+/* the time to the next arrival of a Poisson process */
+static uint64_t exponential(double rate)
+{
+	return (uint64_t)(-log(1.0 - uniform()) / rate * 1e9);
+}
+
+/* Zipf over [0, n), after Gray et al., "Quickly generating billion-record
+ * synthetic databases" */
+struct zipf {
+	uint64_t n;
+	double theta, alpha, zetan, eta;
+};
+
+static void zipf_init(struct zipf *z, uint64_t n, double theta)
+{
+	double zeta2 = 0.0;
+	z->zetan = 0.0;
+	for (uint64_t i = 1; i <= n; ++i) {
+		z->zetan += 1.0 / pow((double)i, theta);
+		if (i == 2)
+			zeta2 = z->zetan;
+	}
+	z->n = n;
+	z->theta = theta;
+	z->alpha = 1.0 / (1.0 - theta);
+	z->eta = (1.0 - pow(2.0 / (double)n, 1.0 - theta))
+		/ (1.0 - zeta2 / z->zetan);
+}
+
+static uint64_t zipf_next(const struct zipf *z)
+{
+	const double u = uniform();
+	const double uz = u * z->zetan;
+	uint64_t rank;
+	if (uz < 1.0)
+		rank = 0;
+	else if (uz < 1.0 + pow(0.5, z->theta))
+		rank = 1;
+	else
+		rank = (uint64_t)((double)z->n
+			* pow(z->eta * u - z->eta + 1.0, z->alpha));
+	if (rank >= z->n)
+		rank = z->n - 1;
+	/* spread the hot ranks over the blocks */
+	uint64_t h = rank * 0x9E3779B97F4A7C15ULL;
+	h ^= h >> 29;
+	return h % z->n;
+}
+
+static unsigned draw_op(const double cum[PMEMTRACE_NOP])
+{
+	const double u = uniform() * cum[PMEMTRACE_NOP - 1];
+	unsigned op = 0;
+	while (op < PMEMTRACE_NOP - 1 && u >= cum[op])
+		++op;
+	return op;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-p seq|zipf|burst] [-n nrec] "
+		"[-t nthread] [-r ops/s]\n"
+		"\t[-b nblock] [-l log-MiB] [-s theta] "
+		"[-m read,write,zero,append,walk] file\n", prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	enum pattern pattern = ZIPF;
+	const char *name = "zipf";
+	uint64_t nrec = 1 << 18;
+	unsigned nthread = 4;
+	double rate = 50000.0;
+	uint64_t nblock = 1 << 18;
+	uint64_t log_mib = 256;
+	double theta = 0.99;
+	double mix[PMEMTRACE_NOP] = {50.0, 30.0, 5.0, 14.99, 0.01};
+
+	int c;
+	while ((c = getopt(argc, argv, "p:n:t:r:b:l:s:m:")) != -1) {
+		switch (c) {
+		case 'p':
+			name = optarg;
+			if (strcmp(optarg, "seq") == 0)
+				pattern = SEQ;
+			else if (strcmp(optarg, "zipf") == 0)
+				pattern = ZIPF;
+			else if (strcmp(optarg, "burst") == 0)
+				pattern = BURST;
+			else
+				usage(argv[0]);
+			break;
+		case 'n':
+			nrec = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			nthread = (unsigned)atoi(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'b':
+			nblock = strtoull(optarg, NULL, 0);
+			break;
+		case 'l':
+			log_mib = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			theta = atof(optarg);
+			break;
+		case 'm':
+			if (sscanf(optarg, "%lf,%lf,%lf,%lf,%lf", &mix[0],
+					&mix[1], &mix[2], &mix[3], &mix[4]) != 5)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || nrec == 0 || nthread == 0
+			|| nthread > UINT16_MAX + 1U || rate <= 0.0
+			|| nblock < nthread || log_mib == 0
+			|| theta <= 0.0 || theta == 1.0)
+		usage(argv[0]);
+
+	double cum[PMEMTRACE_NOP];
+	for (unsigned op = 0; op < PMEMTRACE_NOP; ++op) {
+		if (mix[op] < 0.0)
+			usage(argv[0]);
+		cum[op] = mix[op] + (op > 0 ? cum[op - 1] : 0.0);
+	}
+	if (cum[PMEMTRACE_NOP - 1] <= 0.0)
+		usage(argv[0]);
+
+	struct zipf z = {0, 0.0, 0.0, 0.0, 0.0};
+	if (pattern == ZIPF)
+		zipf_init(&z, nblock, theta);
+	uint64_t *const cursor = calloc(nthread, sizeof(*cursor));
+	struct pmemtrace_rec *const rec = calloc(nrec, sizeof(*rec));
+	assert(cursor != NULL && rec != NULL);
+
+	uint64_t ts = 0;
+	for (uint64_t i = 0; i < nrec; ++i) {
+		struct pmemtrace_rec *const r = &rec[i];
+		switch (pattern) {
+		case SEQ:
+			ts = (uint64_t)((double)i / rate * 1e9);
+			r->thread = (uint16_t)(i % nthread);
+			r->offset = r->thread * (nblock / nthread)
+				+ cursor[r->thread]++ % (nblock / nthread);
+			break;
+		case ZIPF:
+			ts += exponential(rate);
+			r->thread = (uint16_t)(perf_rand(&seed_) % nthread);
+			r->offset = zipf_next(&z);
+			break;
+		case BURST: {
+			/* half of the ops in BURST_ON, half in the rest */
+			const int on = ts % BURST_PERIOD < BURST_ON;
+			const double f = (double)BURST_ON / BURST_PERIOD;
+			ts += exponential(on ? rate * 0.5 / f
+				: rate * 0.5 / (1.0 - f));
+			r->thread = (uint16_t)(perf_rand(&seed_) % nthread);
+			r->offset = perf_rand(&seed_) % nblock;
+			break;
+		}
+		}
+		r->ts = ts;
+		r->op = (uint8_t)draw_op(cum);
+		if (r->op == PMEMTRACE_LOG_APPEND)
+			r->size = 64U << (perf_rand(&seed_) % 7);
+		else if (r->op == PMEMTRACE_LOG_WALK)
+			r->size = BSIZE;
+		if (r->op >= PMEMTRACE_LOG_APPEND)
+			r->offset = 0;
+	}
+
+	struct pmemtrace_hdr hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PMEMTRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = PMEMTRACE_VERSION;
+	hdr.nthread = nthread;
+	hdr.nrec = nrec;
+	hdr.nblock = nblock;
+	hdr.bsize = BSIZE;
+	hdr.logsize = log_mib << 20;
+	strncpy(hdr.name, name, sizeof(hdr.name) - 1);
+
+	if (pmemtrace_save(argv[optind], &hdr, rec) == -1) {
+		perror(argv[optind]);
+		return 1;
+	}
+	free(rec);
+	free(cursor);
+	return 0;
+}